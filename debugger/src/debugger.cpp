@@ -23,8 +23,7 @@ class Debugger : public gui::Application {
     std::uint8_t x = 0, y = 0, a = 0, sp = 0;
     std::uint16_t pc = 0;
 
-    llvmes::CPU cpu;
-    std::vector<char> memory;
+    llvmes::BasicCPU<llvmes::Memory> cpu;
 
     BasicLog log;
 
@@ -36,10 +35,10 @@ class Debugger : public gui::Application {
     ClockType start, stop;
 
    public:
-    Debugger() : gui::Application(1000, 700, "LLVMES - Debugger"), memory(0x10000)
+    Debugger() : gui::Application(1000, 700, "LLVMES - Debugger")
     {
-        cpu.Read = [this](std::uint16_t addr) { return memory[addr]; };
-        cpu.Write = [this](std::uint16_t addr, std::uint8_t data) {
+        // Only the page holding the I/O ports goes through a callback
+        cpu.MapDevice(0x20, 1, nullptr, [this](std::uint16_t addr, std::uint8_t data) {
             // Write to '0x2008' and 'A' will be written to stdout as char
             if (addr == 0x2008) {
                 log.AddLog("%c", a);
@@ -58,7 +57,7 @@ class Debugger : public gui::Application {
             }
             // Write status to stdout
             else if (addr == 0x200C) {
-                log.AddLog("%s\n", ToHexString((uint8_t)cpu.reg_status).c_str());
+                log.AddLog("%s\n", ToHexString((uint8_t)cpu.GetStatus()).c_str());
             }
             // Exit program with exit code from reg A
             else if (addr == 0x200F) {
@@ -68,9 +67,9 @@ class Debugger : public gui::Application {
                              GetDuration(TimeFormat::Micro, start, stop));
             }
             else {
-                memory[addr] = data;
+                cpu.GetRAM()[addr] = data;
             }
-        };
+        });
         cpu.Reset();
 
         // Load the recently opened files
@@ -113,7 +112,7 @@ class Debugger : public gui::Application {
         fs::path p(loaded_file_path);
         std::string new_name = fs::path(p.parent_path() / p.stem()).string() + "_mod.bin";
         std::ofstream out(new_name, std::ios::binary | std::ios::out);
-        out.write(memory.data(), memory.size());
+        out.write((char*)cpu.GetRAM(), Memory::PAGE_COUNT * Memory::PAGE_SIZE);
         LLVMES_INFO("{} written!", new_name);
     }
 
@@ -129,6 +128,9 @@ class Debugger : public gui::Application {
 
     void Reset()
     {
+        // Memory goes back to how it was when the program got loaded
+        if (cpu.HasSnapshot())
+            cpu.RestoreSnapshot();
         cpu.Reset();
         log.Clear();
         x = cpu.reg_x;
@@ -165,15 +167,18 @@ class Debugger : public gui::Application {
         if (in.fail())
             throw std::runtime_error("Something went wrong with opening the file!");
 
-        memory.clear();  // Clear memory before loading new program.
+        // Clear memory before loading new program.
+        std::uint8_t* memory = cpu.GetRAM();
+        std::fill(memory, memory + Memory::PAGE_COUNT * Memory::PAGE_SIZE, 0);
         std::copy(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>(),
-                  memory.begin() + 0x8000);
+                  memory + 0x8000);
 
         RecentlyOpened::Write(path);
         loaded_file_path = path;
         LLVMES_INFO("Successfully loaded '{}'", loaded_file_path);
 
         cpu.Reset();                         // Reset CPU and load reset-vector
+        cpu.TakeSnapshot();                  // Restored by Reset()
         cache = RecentlyOpened::GetCache();  // Update cache
     }
 
@@ -289,7 +294,8 @@ class Debugger : public gui::Application {
             log.Draw("Log");
 
         if (show_memory_editor)
-            mem_edit.DrawWindow("Memory Editor", memory.data(), memory.size());
+            mem_edit.DrawWindow("Memory Editor", cpu.GetRAM(),
+                                Memory::PAGE_COUNT * Memory::PAGE_SIZE);
     }
 };
 
@@ -27,8 +27,7 @@ float ToFloatColor(uint8_t b)
 }
 
 class BubbleSort : public Application {
-    std::vector<uint8_t> backup;
-    std::unique_ptr<CPU> cpu;
+    std::unique_ptr<BasicCPU<Memory>> cpu;
     std::unique_ptr<dynarec::Compiler> compiler;
     std::function<int(void)> main;
     bool use_jit = false;
@@ -36,7 +35,7 @@ class BubbleSort : public Application {
     std::thread t;
 
    public:
-    BubbleSort() : Application(800, 600, "BubbleSort"), backup(0x10000)
+    BubbleSort() : Application(800, 600, "BubbleSort")
     {
         std::ifstream in{PROGRAM_NAME, std::ios::binary};
         if (in.fail())
@@ -49,19 +48,23 @@ class BubbleSort : public Application {
         dynarec::ParseResult result;
         result = parser.Parse();
         compiler = std::make_unique<dynarec::Compiler>(result, PROGRAM_NAME);
-        main = compiler->Compile(true);
-        backup = compiler->GetMemory();
+        main = compiler->Compile(JITTIR::OptimizationLevel::O2);
 
-        // Interpreter Setup
-        cpu = std::make_unique<CPU>();
-        cpu->Read = [this](uint16_t addr) { return compiler->GetMemory()[addr]; };
-        cpu->Write = [this](uint16_t addr, uint8_t data) {
+        // Interpreter Setup, shares its RAM with the JIT
+        cpu = std::make_unique<BasicCPU<Memory>>();
+        cpu->MapRAM(0x00, Memory::PAGE_COUNT, compiler->GetMemory().data());
+        cpu->MapDevice(0x20, 1, nullptr, [this](uint16_t addr, uint8_t data) {
             compiler->GetMemory()[addr] = data;
             if (addr == 0x200F)
                 cpu->Halt();
-        };
+        });
 
         cpu->Reset();
+
+        // Both keep track of the pages they write to, resetting only copies
+        // those back instead of the whole memory
+        compiler->TakeSnapshot();
+        cpu->TakeSnapshot();
     }
 
     void OnImGui() override {}
@@ -102,8 +105,8 @@ class BubbleSort : public Application {
             else if (ev.GetKeyCode() == LLVMES_KEY_R) {
                 if (is_running)
                     return;
-                compiler->GetMemory() = backup;
-                cpu->Reset();
+                compiler->RestoreSnapshot();
+                cpu->RestoreSnapshot();
                 LLVMES_TRACE("Reset!");
             }
         }
@@ -25,9 +25,11 @@
 #include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
-#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Passes/PassBuilder.h"
 #include "llvm/Transforms/InstCombine/InstCombine.h"
-#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Scalar/EarlyCSE.h"
+#include "llvm/Transforms/Scalar/SROA.h"
+#include "llvm/Transforms/Scalar/SimplifyCFG.h"
 #include "llvm/Transforms/Utils/Mem2Reg.h"
 #include "llvm/IR/Verifier.h"
 
@@ -135,11 +137,11 @@ Jitter::Jitter()
 
 #ifdef JITTER_LLVM_VERSION_LEGACY
 	compile_layer = std::make_unique<IRCompileLayer<
-		RTDyldObjectLinkingLayer, SimpleCompiler>>(*object_layer, SimpleCompiler(*target_machine));
+		RTDyldObjectLinkingLayer, SimpleCompiler>>(*object_layer, SimpleCompiler(*target_machine, &object_cache));
 #else
 	using IRCompileLayer = LegacyIRCompileLayer<
 		LegacyRTDyldObjectLinkingLayer, SimpleCompiler>;
-	compile_layer = std::unique_ptr<IRCompileLayer>(new IRCompileLayer(*object_layer, SimpleCompiler(*target_machine)));
+	compile_layer = std::unique_ptr<IRCompileLayer>(new IRCompileLayer(*object_layer, SimpleCompiler(*target_machine, &object_cache)));
 #endif
 }
 
@@ -157,22 +159,8 @@ Jitter::ModuleHandle Jitter::add_module(std::unique_ptr<Module> module)
 		}
 	}
 
-	if (optimize_module)
-	{
-		legacy::FunctionPassManager pass_manager(module.get());
-		pass_manager.add(createConstantPropagationPass());
-		pass_manager.add(createInstructionCombiningPass());
-		pass_manager.add(createCFGSimplificationPass());
-		pass_manager.add(createAggressiveDCEPass());
-		pass_manager.add(createLoopSimplifyCFGPass());
-		pass_manager.add(createLICMPass());
-		pass_manager.add(createLoopSinkPass());
-		pass_manager.add(createReassociatePass());
-		pass_manager.add(createNewGVNPass());
-		pass_manager.doInitialization();
-		for (auto &func : *module)
-			pass_manager.run(func);
-	}
+	if (optimization_level != OptimizationLevel::None)
+		optimize(*module);
 
 	if (!ir_dump_dir.empty())
 	{
@@ -195,6 +183,67 @@ Jitter::ModuleHandle Jitter::add_module(std::unique_ptr<Module> module)
 		return K;
 }
 
+Jitter::ModuleHandle Jitter::add_object(std::unique_ptr<MemoryBuffer> object)
+{
+	auto K = execution_session->allocateVModule();
+	auto error = object_layer->addObject(K, std::move(object));
+	if (error)
+	{
+		consumeError(std::move(error));
+		return 0;
+	}
+	else
+		return K;
+}
+
+void Jitter::optimize(Module &module)
+{
+	PassBuilder builder(target_machine.get());
+	LoopAnalysisManager loop_analysis;
+	FunctionAnalysisManager function_analysis;
+	CGSCCAnalysisManager cgscc_analysis;
+	ModuleAnalysisManager module_analysis;
+	builder.registerModuleAnalyses(module_analysis);
+	builder.registerCGSCCAnalyses(cgscc_analysis);
+	builder.registerFunctionAnalyses(function_analysis);
+	builder.registerLoopAnalyses(loop_analysis);
+	builder.crossRegisterProxies(loop_analysis, function_analysis, cgscc_analysis, module_analysis);
+
+	ModulePassManager pass_manager;
+	switch (optimization_level)
+	{
+	case OptimizationLevel::Fast:
+	{
+		FunctionPassManager function_passes;
+		function_passes.addPass(SROA());
+		function_passes.addPass(PromotePass());
+		function_passes.addPass(EarlyCSEPass());
+		function_passes.addPass(InstCombinePass());
+		function_passes.addPass(SimplifyCFGPass());
+		pass_manager.addPass(createModuleToFunctionPassAdaptor(std::move(function_passes)));
+		break;
+	}
+	case OptimizationLevel::O1:
+		pass_manager = builder.buildPerModuleDefaultPipeline(PassBuilder::OptimizationLevel::O1);
+		break;
+	case OptimizationLevel::O2:
+		pass_manager = builder.buildPerModuleDefaultPipeline(PassBuilder::OptimizationLevel::O2);
+		break;
+	case OptimizationLevel::O3:
+		pass_manager = builder.buildPerModuleDefaultPipeline(PassBuilder::OptimizationLevel::O3);
+		break;
+	default:
+		return;
+	}
+	pass_manager.run(module, module_analysis);
+}
+
+void Jitter::set_codegen_opt_level(CodeGenOpt::Level level)
+{
+	// The compile layer's SimpleCompiler refers to the same target machine
+	target_machine->setOptLevel(level);
+}
+
 void Jitter::remove_module(Jitter::ModuleHandle module)
 {
 	auto error = compile_layer->removeModule(module);
@@ -33,11 +33,42 @@
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
 #include <memory>
 #include <unordered_map>
 
 namespace JITTIR
 {
+// IR passes run by add_module(). Fast promotes the allocas to registers and
+// cleans up after that, the rest are the standard pipelines of the new pass
+// manager.
+enum class OptimizationLevel
+{
+	None,
+	Fast,
+	O1,
+	O2,
+	O3
+};
+
+// The compile layer is created with the Jitter, this lets the cache be set later
+class ObjectCacheProxy : public llvm::ObjectCache
+{
+public:
+	void notifyObjectCompiled(const llvm::Module *module, llvm::MemoryBufferRef object) override
+	{
+		if (cache)
+			cache->notifyObjectCompiled(module, object);
+	}
+
+	std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *module) override
+	{
+		return cache ? cache->getObject(module) : nullptr;
+	}
+
+	llvm::ObjectCache *cache = nullptr;
+};
+
 class Jitter
 {
 public:
@@ -49,6 +80,15 @@ public:
 
 	ModuleHandle add_module(std::unique_ptr<llvm::Module> module);
 
+	// Links an object file compiled earlier, e.g. one from the object cache
+	ModuleHandle add_object(std::unique_ptr<llvm::MemoryBuffer> object);
+
+	// Gets every object add_module() compiles, it's not owned
+	void set_object_cache(llvm::ObjectCache *cache)
+	{
+		object_cache.cache = cache;
+	}
+
 	void remove_module(ModuleHandle handle);
 
 	llvm::JITSymbol find_symbol(const std::string &name);
@@ -74,15 +114,25 @@ public:
 
 	void enable_optimize_module(bool enable)
 	{
-		optimize_module = enable;
+		optimization_level = enable ? OptimizationLevel::O2 : OptimizationLevel::None;
 	}
 
+	void set_optimization_level(OptimizationLevel level)
+	{
+		optimization_level = level;
+	}
+
+	// Optimization level of the machine code generator, independent of the IR passes
+	void set_codegen_opt_level(llvm::CodeGenOpt::Level level);
+
 	void enable_validate_module(bool enable)
 	{
 		validate_module = enable;
 	}
 
 private:
+	void optimize(llvm::Module &module);
+
 #ifdef JITTER_LLVM_VERSION_LEGACY
 	llvm::LLVMContext context;
 #else
@@ -102,13 +152,14 @@ private:
 		llvm::orc::SimpleCompiler>> compile_layer;
 #endif
 
+	ObjectCacheProxy object_cache;
 	std::unique_ptr<llvm::TargetMachine> target_machine;
 	std::unique_ptr<llvm::orc::MangleAndInterner> mangler;
 	std::unique_ptr<llvm::DataLayout> data_layout;
 	std::unordered_map<std::string, uint64_t> externals;
 	std::string ir_dump_dir;
 	bool log_module = false;
-	bool optimize_module = false;
+	OptimizationLevel optimization_level = OptimizationLevel::None;
 	bool validate_module = false;
 };
 }
\ No newline at end of file
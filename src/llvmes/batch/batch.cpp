@@ -0,0 +1,227 @@
+#include "llvmes/batch/batch.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "llvmes/batch/thread_pool.h"
+#include "llvmes/common.h"
+#include "llvmes/console.h"
+#include "llvmes/interpreter/cpu.h"
+#include "llvmes/interpreter/lockstep.h"
+
+namespace llvmes {
+
+typedef BasicCPU<Memory> BatchCPU;
+
+typedef LockstepCPU<LOCKSTEP_LANES> BatchLockstepCPU;
+
+// Same device as the interpreter tool, but the console output is kept per job.
+// Returns true if the program asked to exit.
+static bool WriteDevice(BatchResult& result, std::uint16_t addr, std::uint8_t a,
+                        std::uint8_t x, std::uint8_t y, std::uint8_t status)
+{
+    char text[4] = {0, 0, 0, '\n'};
+    switch (addr) {
+        case 0x2008:
+            result.output += static_cast<char>(a);
+            return false;
+        case 0x2009:
+            FormatHex(a, text);
+            break;
+        case 0x200A:
+            FormatHex(x, text);
+            break;
+        case 0x200B:
+            FormatHex(y, text);
+            break;
+        case 0x200C:
+            FormatHex(status, text);
+            break;
+        case 0x200F:
+            result.exit_code = a;
+            result.exited = true;
+            return true;
+        default:
+            return false;
+    }
+    result.output.append(text, sizeof(text));
+    return false;
+}
+
+static std::uint64_t HashMemory(const std::uint8_t* data, std::size_t size)
+{
+    std::uint64_t hash = 0xcbf29ce484222325;
+    for (std::size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+static void Load(std::uint8_t* ram, const std::vector<std::uint8_t>& data,
+                 std::uint16_t address)
+{
+    std::size_t size = std::min<std::size_t>(data.size(), 0x10000 - address);
+    std::copy(data.begin(), data.begin() + size, &ram[address]);
+}
+
+BatchResult RunJob(const BatchJob& job, bool decoded)
+{
+    BatchResult result;
+    result.name = job.name;
+
+    // Too big for the worker's stack
+    auto cpu = std::make_unique<BatchCPU>();
+    Load(cpu->GetRAM(), job.program, job.program_address);
+    Load(cpu->GetRAM(), job.input, job.input_address);
+
+    BatchCPU* cpu_ptr = cpu.get();
+    cpu->MapDevice(0x20, 1, nullptr,
+                   [cpu_ptr, &result](std::uint16_t addr, std::uint8_t data) {
+                       BatchCPU& cpu = *cpu_ptr;
+                       if (WriteDevice(result, addr, cpu.reg_a, cpu.reg_x, cpu.reg_y,
+                                       cpu.GetStatus()))
+                           cpu.Halt();
+                       else
+                           cpu.GetRAM()[addr] = data;
+                   });
+    cpu->Reset();
+
+    if (job.cycle_limit) {
+        // RunDecoded() has no cycle budget, the event stops it instead
+        cpu->ScheduleEvent(job.cycle_limit, [&result, cpu_ptr](std::uint64_t) {
+            result.timed_out = true;
+            cpu_ptr->Halt();
+        });
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    if (decoded)
+        cpu->RunDecoded();
+    else
+        cpu->Run();
+    auto stop = std::chrono::high_resolution_clock::now();
+
+    result.seconds = std::chrono::duration<double>(stop - start).count();
+    result.instructions = cpu->GetInstructionCount();
+    result.cycles = cpu->GetCycles();
+    result.memory_hash =
+        HashMemory(cpu->GetRAM(), Memory::PAGE_COUNT * Memory::PAGE_SIZE);
+    return result;
+}
+
+std::vector<BatchResult> RunLockstepJobs(const std::vector<const BatchJob*>& jobs)
+{
+    std::vector<BatchResult> results(jobs.size());
+    auto cpu = std::make_unique<BatchLockstepCPU>();
+
+    for (std::size_t lane = 0; lane < jobs.size(); lane++) {
+        results[lane].name = jobs[lane]->name;
+        const BatchJob& job = *jobs[lane];
+        cpu->LoadRAM(lane, job.program_address, job.program.data(), job.program.size());
+        cpu->LoadRAM(lane, job.input_address, job.input.data(), job.input.size());
+    }
+
+    BatchLockstepCPU* cpu_ptr = cpu.get();
+    cpu->MapDevice(
+        0x20, 1, nullptr,
+        [cpu_ptr, &results](unsigned int lane, std::uint16_t addr, std::uint8_t data) {
+            BatchLockstepCPU& cpu = *cpu_ptr;
+            // Lanes without a job run the same code, but nobody looks at them
+            BatchResult dummy;
+            BatchResult& result = lane < results.size() ? results[lane] : dummy;
+            if (WriteDevice(result, addr, cpu.reg_a[lane], cpu.reg_x[lane],
+                            cpu.reg_y[lane], cpu.GetStatus(lane)))
+                cpu.Halt(lane);
+            else
+                cpu.RAM(lane, addr) = data;
+        });
+    cpu->SetCycleLimit(jobs.front()->cycle_limit);
+    cpu->Reset();
+    for (std::size_t lane = jobs.size(); lane < LOCKSTEP_LANES; lane++)
+        cpu->Halt(lane);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    cpu->Run();
+    auto stop = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration<double>(stop - start).count();
+
+    std::vector<std::uint8_t> memory(Memory::PAGE_COUNT * Memory::PAGE_SIZE);
+    for (std::size_t lane = 0; lane < jobs.size(); lane++) {
+        BatchResult& result = results[lane];
+        result.timed_out = !result.exited && !cpu->HitIllegalOpcode(lane);
+        result.seconds = seconds / jobs.size();
+        result.instructions = cpu->GetInstructionCount(lane);
+        result.cycles = cpu->GetCycles(lane);
+        cpu->SaveRAM(lane, memory.data());
+        result.memory_hash = HashMemory(memory.data(), memory.size());
+    }
+    return results;
+}
+
+// Jobs that can share a LockstepCPU
+static bool SameGroup(const BatchJob& a, const BatchJob& b)
+{
+    return a.program == b.program && a.program_address == b.program_address &&
+           a.input_address == b.input_address && a.cycle_limit == b.cycle_limit;
+}
+
+static void SubmitLockstep(ThreadPool& pool, const std::vector<BatchJob>& jobs,
+                           std::vector<BatchResult>& results,
+                           const BatchSettings& settings)
+{
+    std::vector<bool> assigned(jobs.size());
+    for (std::size_t i = 0; i < jobs.size(); i++) {
+        if (assigned[i])
+            continue;
+
+        std::vector<std::size_t> group;
+        for (std::size_t j = i; j < jobs.size() && group.size() < LOCKSTEP_LANES; j++) {
+            if (!assigned[j] && SameGroup(jobs[i], jobs[j])) {
+                assigned[j] = true;
+                group.push_back(j);
+            }
+        }
+
+        if (group.size() < LOCKSTEP_MIN_JOBS) {
+            for (std::size_t index : group) {
+                pool.Submit([&jobs, &results, &settings, index] {
+                    results[index] = RunJob(jobs[index], settings.decoded);
+                });
+            }
+            continue;
+        }
+
+        pool.Submit([&jobs, &results, group] {
+            std::vector<const BatchJob*> group_jobs;
+            for (std::size_t index : group)
+                group_jobs.push_back(&jobs[index]);
+            std::vector<BatchResult> group_results = RunLockstepJobs(group_jobs);
+            for (std::size_t k = 0; k < group.size(); k++)
+                results[group[k]] = std::move(group_results[k]);
+        });
+    }
+}
+
+std::vector<BatchResult> RunBatch(const std::vector<BatchJob>& jobs,
+                                  const BatchSettings& settings)
+{
+    std::vector<BatchResult> results(jobs.size());
+    ThreadPool pool(settings.threads);
+
+    if (settings.lockstep) {
+        SubmitLockstep(pool, jobs, results, settings);
+        pool.Wait();
+        return results;
+    }
+
+    for (std::size_t i = 0; i < jobs.size(); i++) {
+        pool.Submit([&jobs, &results, &settings, i] {
+            results[i] = RunJob(jobs[i], settings.decoded);
+        });
+    }
+    pool.Wait();
+    return results;
+}
+
+}  // namespace llvmes
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace llvmes {
+
+/// A program run by RunBatch(). Every job gets its own CPU and memory.
+struct BatchJob {
+    std::string name;
+    std::vector<std::uint8_t> program;
+    std::uint16_t program_address = 0x8000;
+    /// Copied to 'input_address' before the CPU is reset
+    std::vector<std::uint8_t> input;
+    std::uint16_t input_address = 0x4000;
+    /// The job is stopped after this many cycles, 0 means no limit
+    std::uint64_t cycle_limit = 0;
+};
+
+struct BatchResult {
+    std::string name;
+    /// Register A when the program wrote to the exit port (0x200F)
+    std::uint8_t exit_code = 0;
+    /// False if the job hit an illegal opcode or the cycle limit
+    bool exited = false;
+    bool timed_out = false;
+    /// FNV-1a hash of the 64KB address space after the run
+    std::uint64_t memory_hash = 0;
+    /// What the program wrote to the console ports (0x2008-0x200C)
+    std::string output;
+    std::uint64_t instructions = 0;
+    std::uint64_t cycles = 0;
+    /// With BatchSettings::lockstep, the time of the whole group divided by
+    /// the number of jobs in it
+    double seconds = 0;
+};
+
+struct BatchSettings {
+    /// 0 means one per hardware thread
+    unsigned int threads = 0;
+    /// Use BasicCPU::RunDecoded()
+    bool decoded = false;
+    /// Jobs with the same program run together on a LockstepCPU, in groups of
+    /// LOCKSTEP_LANES. Groups smaller than LOCKSTEP_MIN_JOBS run one job per
+    /// CPU like without it.
+    bool lockstep = false;
+};
+
+constexpr unsigned int LOCKSTEP_LANES = 32;
+/// Every step costs about the same for any number of lanes, with fewer jobs
+/// than this BasicCPU is faster even on one thread
+constexpr unsigned int LOCKSTEP_MIN_JOBS = 16;
+
+/// Runs all jobs on a work-stealing pool. The results are in the same order as
+/// the jobs.
+std::vector<BatchResult> RunBatch(const std::vector<BatchJob>& jobs,
+                                  const BatchSettings& settings = BatchSettings());
+
+/// Runs a single job on the calling thread
+BatchResult RunJob(const BatchJob& job, bool decoded = false);
+
+/// Runs up to LOCKSTEP_LANES jobs with the same program (and addresses and
+/// cycle limit) in lock-step on the calling thread
+std::vector<BatchResult> RunLockstepJobs(const std::vector<const BatchJob*>& jobs);
+
+}  // namespace llvmes
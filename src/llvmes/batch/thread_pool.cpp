@@ -0,0 +1,116 @@
+#include "llvmes/batch/thread_pool.h"
+
+#include <algorithm>
+
+namespace llvmes {
+
+// Index of the worker running on the current thread, if any
+static thread_local int t_worker_index = -1;
+static thread_local const ThreadPool* t_worker_pool = nullptr;
+
+ThreadPool::ThreadPool(unsigned int threads)
+    : m_queued(0), m_pending(0), m_next_queue(0), m_stop(false)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned int i = 0; i < threads; i++)
+        m_queues.push_back(std::make_unique<Queue>());
+    for (unsigned int i = 0; i < threads; i++)
+        m_workers.emplace_back(&ThreadPool::WorkerMain, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    Wait();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_work_available.notify_all();
+    for (auto& worker : m_workers)
+        worker.join();
+}
+
+void ThreadPool::Submit(Task task)
+{
+    // Tasks spawned by a worker stay local, everything else is spread out
+    unsigned int index;
+    if (t_worker_pool == this)
+        index = t_worker_index;
+    else
+        index = m_next_queue++ % m_queues.size();
+
+    // Counted before it's in a queue, a worker may take it and count it down
+    // right after the push
+    m_pending++;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queued++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+        m_queues[index]->tasks.push_back(std::move(task));
+    }
+    m_work_available.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_all_done.wait(lock, [this] { return m_pending == 0; });
+}
+
+bool ThreadPool::PopOwn(unsigned int index, Task& task)
+{
+    Queue& queue = *m_queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool ThreadPool::Steal(unsigned int thief, Task& task)
+{
+    for (unsigned int i = 1; i < m_queues.size(); i++) {
+        Queue& queue = *m_queues[(thief + i) % m_queues.size()];
+        std::unique_lock<std::mutex> lock(queue.mutex, std::try_to_lock);
+        if (!lock.owns_lock() || queue.tasks.empty())
+            continue;
+        // The oldest task, the owner works on the other end
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::WorkerMain(unsigned int index)
+{
+    t_worker_index = index;
+    t_worker_pool = this;
+
+    while (true) {
+        Task task;
+        if (PopOwn(index, task) || Steal(index, task)) {
+            m_queued--;
+            task();
+            if (--m_pending == 0) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_all_done.notify_all();
+            }
+            continue;
+        }
+
+        // A failed try_lock in Steal() can miss a task, so only sleep if
+        // nothing is queued anywhere
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_work_available.wait(lock, [this] { return m_stop || m_queued > 0; });
+        if (m_stop && m_queued == 0)
+            return;
+    }
+}
+
+}  // namespace llvmes
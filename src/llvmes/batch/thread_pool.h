@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace llvmes {
+
+/// Fixed set of worker threads with a task queue each. A worker takes its own
+/// tasks from the back of its queue and, once that's empty, steals from the
+/// front of the other queues, so long and short tasks even out across the
+/// workers without a single shared queue everybody contends on.
+class ThreadPool {
+   public:
+    typedef std::function<void()> Task;
+
+    /// 0 threads means one per hardware thread
+    explicit ThreadPool(unsigned int threads = 0);
+    /// Waits for the queued tasks to finish
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /// Can be called from any thread, including the tasks themselves
+    void Submit(Task task);
+    /// Blocks until every submitted task has finished
+    void Wait();
+
+    unsigned int GetThreadCount() const { return m_workers.size(); }
+
+   private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void WorkerMain(unsigned int index);
+    bool PopOwn(unsigned int index, Task& task);
+    bool Steal(unsigned int thief, Task& task);
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_workers;
+
+    // Guards the sleeping of idle workers and of Wait()
+    std::mutex m_mutex;
+    std::condition_variable m_work_available;
+    std::condition_variable m_all_done;
+    // Submitted but not yet started, idle workers sleep while this is 0
+    std::atomic<unsigned int> m_queued;
+    // Submitted but not yet finished
+    std::atomic<unsigned int> m_pending;
+    std::atomic<unsigned int> m_next_queue;
+    bool m_stop;
+};
+
+}  // namespace llvmes
@@ -0,0 +1,67 @@
+#include "llvmes/console.h"
+
+#include <cstring>
+
+namespace llvmes {
+
+Console::Console(std::ostream* out) : m_out(out), m_buffer(BUFFER_SIZE), m_size(0) {}
+
+Console::~Console()
+{
+    Flush();
+}
+
+void Console::SetOutput(std::ostream* out)
+{
+    Flush();
+    m_out = out;
+}
+
+void Console::PutHex(std::uint8_t value)
+{
+    char text[4];
+    *FormatHex(value, text) = '\n';
+    PutString(text, sizeof(text));
+}
+
+void Console::PutStatus(std::uint8_t status)
+{
+    // "[N: 1 V: 0 U: 1 B: 1 D: 0 I: 1 Z: 0 C: 0] ($B4)"
+    char text[] = "[N: 0 V: 0 U: 0 B: 0 D: 0 I: 0 Z: 0 C: 0] ($00)\n";
+    for (unsigned int i = 0; i < 8; i++)
+        text[4 + i * 5] = '0' + ((status >> (7 - i)) & 1);
+    FormatHex(status, &text[43]);
+    PutString(text, sizeof(text) - 1);
+}
+
+void Console::Flush()
+{
+    Drain();
+    if (m_out)
+        m_out->flush();
+}
+
+const std::string& Console::GetOutput()
+{
+    Drain();
+    return m_output;
+}
+
+void Console::Drain()
+{
+    if (m_out)
+        m_out->write(m_buffer.data(), m_size);
+    else
+        m_output.append(m_buffer.data(), m_size);
+    m_size = 0;
+}
+
+void Console::PutString(const char* string, std::size_t size)
+{
+    if (m_size + size > BUFFER_SIZE)
+        Drain();
+    std::memcpy(&m_buffer[m_size], string, size);
+    m_size += size;
+}
+
+}  // namespace llvmes
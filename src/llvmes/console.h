@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace llvmes {
+
+/// Writes 'value' as "$XX" to 'out', the format of ToHexString() without the
+/// stringstream
+inline char* FormatHex(std::uint8_t value, char* out)
+{
+    constexpr char digits[] = "0123456789ABCDEF";
+    out[0] = '$';
+    out[1] = digits[value >> 4];
+    out[2] = digits[value & 0xF];
+    return out + 3;
+}
+
+/// The console device behind 0x2008-0x200C, shared by the interpreter tools
+/// and the JIT. Output is collected in a buffer and only written out when it's
+/// full or on Flush(), which the engines call when the program exits or halts.
+/// Numbers are formatted by hand rather than through a stringstream per call.
+class Console {
+   public:
+    constexpr static std::size_t BUFFER_SIZE = 64 * 1024;
+
+    /// Writes to 'out', or keeps everything in memory if it's null (see
+    /// GetOutput()), which takes the terminal out of benchmarks
+    explicit Console(std::ostream* out = &std::cout);
+    /// Flushes
+    ~Console();
+    Console(const Console&) = delete;
+    Console& operator=(const Console&) = delete;
+
+    /// Flushes what was written so far to the previous output
+    void SetOutput(std::ostream* out);
+
+    void PutChar(char c)
+    {
+        if (m_size == BUFFER_SIZE)
+            Drain();
+        m_buffer[m_size++] = c;
+    }
+    /// A register as "$XX" and a newline, the format of ToHexString()
+    void PutHex(std::uint8_t value);
+    /// Every flag of the status register followed by its value in hex
+    void PutStatus(std::uint8_t status);
+    void Flush();
+
+    /// Everything written so far, if there's no output stream
+    const std::string& GetOutput();
+
+   private:
+    // Empties the buffer without flushing the stream
+    void Drain();
+    void PutString(const char* string, std::size_t size);
+
+    std::ostream* m_out;
+    std::vector<char> m_buffer;
+    std::size_t m_size;
+    std::string m_output;
+};
+
+}  // namespace llvmes
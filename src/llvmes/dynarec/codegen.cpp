@@ -5,13 +5,9 @@
 namespace llvmes {
 namespace dynarec {
 
-static std::unordered_map<uint16_t, uint16_t> return_map;
-
-Instruction* i = nullptr;
-
 void Compiler::CodeGen(Instruction& instr)
 {
-    i = &instr;
+    current_instruction = &instr;
     switch (instr.opcode) {
         case 0xD0: {  // BNE Immediate
             OP_BNE(nullptr);
@@ -78,48 +74,48 @@ void Compiler::CodeGen(Instruction& instr)
             break;
         }
         case 0xE6: {  // INC Zeropage
-            llvm::Value* zpg_value = ReadMemory(i->arg);
+            llvm::Value* zpg_value = ReadMemory(current_instruction->arg);
             llvm::Value* inc = c->builder.CreateAdd(zpg_value, GetConstant8(1));
-            WriteMemory(i->arg, inc);
+            WriteMemory(current_instruction->arg, inc);
             DynamicTestZ(inc);
             DynamicTestN(inc);
             break;
         }
         case 0xF6: {  // INC ZeropageX
-            llvm::Value* zpg_addr = GetConstant8(i->arg);
+            llvm::Value* zpg_addr = GetConstant8(current_instruction->arg);
             llvm::Value* load_x = c->builder.CreateLoad(c->reg_x);
             llvm::Value* zpg_x_addr = c->builder.CreateAdd(zpg_addr, load_x);
             llvm::Value* zpg_x_addr_16 = c->builder.CreateZExt(zpg_x_addr, int16);
-            llvm::Value* zpg_x_value = c->builder.CreateCall(c->read_fn, {zpg_x_addr_16});
+            llvm::Value* zpg_x_value = CreateRead(zpg_x_addr_16);
             llvm::Value* incx = c->builder.CreateAdd(zpg_x_value, GetConstant8(1));
-            c->builder.CreateCall(c->write_fn, {zpg_x_addr_16, incx});
+            CreateWrite(zpg_x_addr_16, incx);
             DynamicTestZ(incx);
             DynamicTestN(incx);
             break;
         }
         case 0xEE: {  // INC Absolute
-            llvm::Value* value = ReadMemory(i->arg);
+            llvm::Value* value = ReadMemory(current_instruction->arg);
             llvm::Value* inca = c->builder.CreateAdd(value, GetConstant8(1));
-            WriteMemory(i->arg, inca);
+            WriteMemory(current_instruction->arg, inca);
             DynamicTestZ(inca);
             DynamicTestN(inca);
             break;
         }
         case 0xFE: {  // INC AbsoluteX
-            llvm::Value* addr = AddressModeAbsoluteX(i->arg);
-            llvm::Value* addr_x_value = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeAbsoluteX(current_instruction->arg);
+            llvm::Value* addr_x_value = CreateRead(addr);
             llvm::Value* incax = c->builder.CreateAdd(addr_x_value, GetConstant8(1));
-            c->builder.CreateCall(c->write_fn, {addr, incax});
+            CreateWrite(addr, incax);
             DynamicTestZ(incax);
             DynamicTestN(incax);
             break;
         }
         case 0x4C: {  // JMP Absolute
-            c->builder.CreateBr(c->basicblocks[i->target_label]);
+            c->builder.CreateBr(c->basicblocks[current_instruction->target_label]);
             break;
         }
         case 0x6C: {  // JMP Indirect
-            c->builder.CreateStore(ReadMemory16(i->arg), c->reg_idr);
+            c->builder.CreateStore(ReadMemory16(current_instruction->arg), c->reg_idr);
             c->builder.CreateBr(c->dynJumpBlock);
             break;
         }
@@ -128,13 +124,13 @@ void Compiler::CodeGen(Instruction& instr)
             break;
         }
         case 0x24: {  // BIT Zeropage
-            llvm::Value* addr = AddressModeZeropage(i->arg);
+            llvm::Value* addr = AddressModeZeropage(current_instruction->arg);
             llvm::Value* operand = c->builder.CreateLoad(addr);
             OP_BIT(operand);
             break;
         }
         case 0x2C: {  // BIT Absolute
-            llvm::Value* addr = AddressModeAbsolute(i->arg);
+            llvm::Value* addr = AddressModeAbsolute(current_instruction->arg);
             llvm::Value* operand = c->builder.CreateLoad(addr);
             OP_BIT(operand);
             break;
@@ -143,265 +139,265 @@ void Compiler::CodeGen(Instruction& instr)
             break;
         }
         case 0xC9: {  // CMP Immediate
-            llvm::Value* operand = AddressModeImmediate(i->arg);
+            llvm::Value* operand = AddressModeImmediate(current_instruction->arg);
             OP_CMP(operand);
             break;
         }
         case 0xC5: {  // CMP Zeropage
-            llvm::Value* operand = ReadMemory(i->arg);
+            llvm::Value* operand = ReadMemory(current_instruction->arg);
             OP_CMP(operand);
             break;
         }
         case 0xD5: {  // CMP ZeropageX
-            llvm::Value* addr = AddressModeZeropageX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeZeropageX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_CMP(operand);
             break;
         }
         case 0xCD: {  // CMP Absolute
-            llvm::Value* operand = ReadMemory(i->arg);
+            llvm::Value* operand = ReadMemory(current_instruction->arg);
             OP_CMP(operand);
             break;
         }
         case 0xDD: {  // CMP AbsoluteX
-            llvm::Value* addr = AddressModeAbsoluteX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeAbsoluteX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_CMP(operand);
             break;
         }
         case 0xD9: {  // CMP AbsoluteY
-            llvm::Value* addr = AddressModeAbsoluteY(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeAbsoluteY(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_CMP(operand);
             break;
         }
         case 0xC1: {  // CMP IndirectX
-            llvm::Value* addr = AddressModeIndirectX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeIndirectX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_CMP(operand);
             break;
         }
         case 0xD1: {  // CMP IndirectY
-            llvm::Value* addr = AddressModeIndirectY(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeIndirectY(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_CMP(operand);
             break;
         }
         case 0xE0: {  // CPX Immediate
-            llvm::Value* operand = AddressModeImmediate(i->arg);
+            llvm::Value* operand = AddressModeImmediate(current_instruction->arg);
             OP_CPX(operand);
             break;
         }
         case 0xE4: {  // CPX Zeropage
-            llvm::Value* operand = ReadMemory(i->arg);
+            llvm::Value* operand = ReadMemory(current_instruction->arg);
             OP_CPX(operand);
             break;
         }
         case 0xEC: {  // CPX Absolute
-            llvm::Value* operand = ReadMemory(i->arg);
+            llvm::Value* operand = ReadMemory(current_instruction->arg);
             OP_CPX(operand);
             break;
         }
         case 0xC0: {  // CPY Immediate
-            llvm::Value* operand = llvm::ConstantInt::get(int8, i->arg);
+            llvm::Value* operand = llvm::ConstantInt::get(int8, current_instruction->arg);
             OP_CPY(operand);
             break;
         }
         case 0xC4: {  // CPY Zeropage
-            llvm::Value* operand = ReadMemory(i->arg);
+            llvm::Value* operand = ReadMemory(current_instruction->arg);
             OP_CPY(operand);
             break;
         }
         case 0xCC: {  // CPY Absolute
-            llvm::Value* operand = ReadMemory(i->arg);
+            llvm::Value* operand = ReadMemory(current_instruction->arg);
             OP_CPY(operand);
             break;
         }
         case 0xC6: {  // DEC Zeropage
-            llvm::Value* operand = ReadMemory(i->arg);
+            llvm::Value* operand = ReadMemory(current_instruction->arg);
             operand = c->builder.CreateSub(operand, GetConstant8(1));
-            WriteMemory(i->arg, operand);
+            WriteMemory(current_instruction->arg, operand);
             DynamicTestZ(operand);
             DynamicTestN(operand);
             break;
         }
         case 0xD6: {  // DEC ZeropageX
-            llvm::Value* addr = AddressModeZeropageX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeZeropageX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             operand = c->builder.CreateSub(operand, GetConstant8(1));
-            c->builder.CreateCall(c->write_fn, {addr, operand});
+            CreateWrite(addr, operand);
             DynamicTestZ(operand);
             DynamicTestN(operand);
             break;
         }
         case 0xCE: {  // DEC Absolute
-            llvm::Value* operand = ReadMemory(i->arg);
+            llvm::Value* operand = ReadMemory(current_instruction->arg);
             operand = c->builder.CreateSub(operand, GetConstant8(1));
-            WriteMemory(i->arg, operand);
+            WriteMemory(current_instruction->arg, operand);
             DynamicTestZ(operand);
             DynamicTestN(operand);
             break;
         }
         case 0xDE: {  // DEC AbsoluteX
-            llvm::Value* addr = AddressModeAbsoluteX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeAbsoluteX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             operand = c->builder.CreateSub(operand, GetConstant8(1));
-            c->builder.CreateCall(c->write_fn, {addr, operand});
+            CreateWrite(addr, operand);
             DynamicTestZ(operand);
             DynamicTestN(operand);
             break;
         }
         case 0x49: {  // EOR Immediate
             // In data
-            llvm::Value* operand = AddressModeImmediate(i->arg);
+            llvm::Value* operand = AddressModeImmediate(current_instruction->arg);
             OP_EOR(operand);
             break;
         }
         case 0x45: {  // EOR Zeropage
-            llvm::Value* addr = AddressModeZeropage(i->arg);
+            llvm::Value* addr = AddressModeZeropage(current_instruction->arg);
             llvm::Value* operand = c->builder.CreateLoad(addr);
             OP_EOR(operand);
             break;
         }
         case 0x55: {  // EOR ZeropageX
             // In data
-            llvm::Value* addr = AddressModeZeropageX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, addr);
+            llvm::Value* addr = AddressModeZeropageX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_EOR(operand);
             break;
         }
         case 0x4D: {  // EOR Absolute
-            llvm::Value* addr = AddressModeAbsolute(i->arg);
+            llvm::Value* addr = AddressModeAbsolute(current_instruction->arg);
             llvm::Value* operand = c->builder.CreateLoad(addr);
             OP_EOR(operand);
             break;
         }
         case 0x5D: {  // EOR AbsoluteX
-            llvm::Value* addr = AddressModeAbsoluteX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, addr);
+            llvm::Value* addr = AddressModeAbsoluteX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_EOR(operand);
             break;
         }
         case 0x59: {  // EOR AbsoluteY
-            llvm::Value* addr = AddressModeAbsoluteY(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, addr);
+            llvm::Value* addr = AddressModeAbsoluteY(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_EOR(operand);
             break;
         }
         case 0x41: {  // EOR IndirectX
-            llvm::Value* addr = AddressModeIndirectX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, addr);
+            llvm::Value* addr = AddressModeIndirectX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_EOR(operand);
             break;
         }
         case 0x51: {  // EOR IndirectY
-            llvm::Value* addr = AddressModeIndirectY(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, addr);
+            llvm::Value* addr = AddressModeIndirectY(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_EOR(operand);
             break;
         }
         case 0xA9: {  // LDA Immediate
-            llvm::Value* load_value = AddressModeImmediate(i->arg);
+            llvm::Value* load_value = AddressModeImmediate(current_instruction->arg);
             OP_LDA(load_value);
             break;
         }
         case 0xA5: {  // LDA Zeropage
-            llvm::Value* ram_pointer = AddressModeZeropage(i->arg);
+            llvm::Value* ram_pointer = AddressModeZeropage(current_instruction->arg);
             llvm::Value* load_value = c->builder.CreateLoad(ram_pointer);
             OP_LDA(load_value);
             break;
         }
         case 0xB5: {  // LDA ZeropageX
-            llvm::Value* ram_pointer = AddressModeZeropageX(i->arg);
-            llvm::Value* load_value = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeZeropageX(current_instruction->arg);
+            llvm::Value* load_value = CreateRead(ram_pointer);
             OP_LDA(load_value);
             break;
         }
         case 0xA1: {  // LDA IndirectX
-            llvm::Value* ram_pointer = AddressModeIndirectX(i->arg);
-            llvm::Value* load_value = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeIndirectX(current_instruction->arg);
+            llvm::Value* load_value = CreateRead(ram_pointer);
             OP_LDA(load_value);
             break;
         }
         case 0xB1: {  // LDA IndirectY
-            llvm::Value* ram_pointer = AddressModeIndirectY(i->arg);
-            llvm::Value* load_value = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeIndirectY(current_instruction->arg);
+            llvm::Value* load_value = CreateRead(ram_pointer);
             OP_LDA(load_value);
             break;
         }
         case 0xAD: {  // LDA Absolute
-            llvm::Value* ram_pointer = AddressModeAbsolute(i->arg);
+            llvm::Value* ram_pointer = AddressModeAbsolute(current_instruction->arg);
             llvm::Value* load_value = c->builder.CreateLoad(ram_pointer);
             OP_LDA(load_value);
             break;
         }
         case 0xBD: {  // LDA AbsoluteX
-            llvm::Value* ram_pointer = AddressModeAbsoluteX(i->arg);
-            llvm::Value* load_value = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeAbsoluteX(current_instruction->arg);
+            llvm::Value* load_value = CreateRead(ram_pointer);
             OP_LDA(load_value);
             break;
         }
         case 0xB9: {  // LDA AbsoluteY
-            llvm::Value* ram_pointer = AddressModeAbsoluteY(i->arg);
-            llvm::Value* load_value = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeAbsoluteY(current_instruction->arg);
+            llvm::Value* load_value = CreateRead(ram_pointer);
             OP_LDA(load_value);
             break;
         }
         case 0xA2: {  // LDX Immediate
-            llvm::Value* load_value = AddressModeImmediate(i->arg);
+            llvm::Value* load_value = AddressModeImmediate(current_instruction->arg);
             OP_LDX(load_value);
             break;
         }
         case 0xA6: {  // LDX Zeropage
-            llvm::Value* ram_pointer = AddressModeZeropage(i->arg);
+            llvm::Value* ram_pointer = AddressModeZeropage(current_instruction->arg);
             llvm::Value* load_value = c->builder.CreateLoad(ram_pointer);
             OP_LDX(load_value);
             break;
         }
         case 0xB6: {  // LDX ZeropageY
-            llvm::Value* ram_pointer = AddressModeZeropageY(i->arg);
-            llvm::Value* load_value = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeZeropageY(current_instruction->arg);
+            llvm::Value* load_value = CreateRead(ram_pointer);
             OP_LDX(load_value);
             break;
         }
         case 0xAE: {  // LDX Absolute
-            llvm::Value* ram_pointer = AddressModeAbsolute(i->arg);
+            llvm::Value* ram_pointer = AddressModeAbsolute(current_instruction->arg);
             llvm::Value* load_value = c->builder.CreateLoad(ram_pointer);
             OP_LDX(load_value);
             break;
         }
         case 0xBE: {  // LDX AbsoluteY
-            llvm::Value* ram_pointer = AddressModeAbsoluteY(i->arg);
-            llvm::Value* load_value = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeAbsoluteY(current_instruction->arg);
+            llvm::Value* load_value = CreateRead(ram_pointer);
             OP_LDX(load_value);
             break;
         }
         case 0xA0: {  // LDY Immediate
-            llvm::Value* load_value = AddressModeImmediate(i->arg);
+            llvm::Value* load_value = AddressModeImmediate(current_instruction->arg);
             OP_LDY(load_value);
             break;
         }
         case 0xA4: {  // LDY Zeropage
-            llvm::Value* ram_pointer = AddressModeZeropage(i->arg);
+            llvm::Value* ram_pointer = AddressModeZeropage(current_instruction->arg);
             llvm::Value* load_value = c->builder.CreateLoad(ram_pointer);
             OP_LDY(load_value);
             break;
         }
         case 0xB4: {  // LDY ZeropageX
-            llvm::Value* ram_pointer = AddressModeZeropageX(i->arg);
-            llvm::Value* load_value = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeZeropageX(current_instruction->arg);
+            llvm::Value* load_value = CreateRead(ram_pointer);
             OP_LDY(load_value);
             break;
         }
         case 0xAC: {  // LDY Absolute
-            llvm::Value* ram_pointer = AddressModeAbsolute(i->arg);
+            llvm::Value* ram_pointer = AddressModeAbsolute(current_instruction->arg);
             llvm::Value* load_value = c->builder.CreateLoad(ram_pointer);
             OP_LDY(load_value);
             break;
         }
         case 0xBC: {  // LDY AbsoluteX
-            llvm::Value* ram_pointer = AddressModeAbsoluteX(i->arg);
-            llvm::Value* load_value = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeAbsoluteX(current_instruction->arg);
+            llvm::Value* load_value = CreateRead(ram_pointer);
             OP_LDY(load_value);
             break;
         }
@@ -410,74 +406,74 @@ void Compiler::CodeGen(Instruction& instr)
             break;
         }
         case 0x46: {  // LSR Zeropage
-            llvm::Value* addr = AddressModeZeropage(i->arg);
+            llvm::Value* addr = AddressModeZeropage(current_instruction->arg);
             OP_LSR(addr, true);
             break;
         }
         case 0x56: {  // LSR ZeropageX
-            llvm::Value* addr = AddressModeZeropageX(i->arg);
+            llvm::Value* addr = AddressModeZeropageX(current_instruction->arg);
             OP_LSR(addr, false);
             break;
         }
         case 0x4E: {  // LSR Absolute
-            llvm::Value* addr = AddressModeAbsolute(i->arg);
+            llvm::Value* addr = AddressModeAbsolute(current_instruction->arg);
             OP_LSR(addr, true);
             break;
         }
         case 0x5E: {  // LSR AbsoluteX
-            llvm::Value* addr = AddressModeAbsoluteX(i->arg);
+            llvm::Value* addr = AddressModeAbsoluteX(current_instruction->arg);
             OP_LSR(addr, false);
             break;
         }
         case 0x09: {  // ORA Immediate
             // Fetch operands
-            llvm::Value* operand = AddressModeImmediate(i->arg);
+            llvm::Value* operand = AddressModeImmediate(current_instruction->arg);
             OP_ORA(operand);
             break;
         }
         case 0x05: {  // ORA Zeropage
             // Fetch operands
-            llvm::Value* target_addr = AddressModeZeropage(i->arg);
+            llvm::Value* target_addr = AddressModeZeropage(current_instruction->arg);
             llvm::Value* operand = c->builder.CreateLoad(target_addr);
             OP_ORA(operand);
             break;
         }
         case 0x15: {  // ORA ZeropageX
             // Fetch operands
-            llvm::Value* addr = AddressModeZeropageX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeZeropageX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_ORA(operand);
             break;
         }
         case 0x0D: {  // ORA Absolute
-            llvm::Value* operand = ReadMemory(i->arg);
+            llvm::Value* operand = ReadMemory(current_instruction->arg);
             OP_ORA(operand);
             break;
         }
         case 0x1D: {  // ORA AbsoluteX
-            llvm::Value* addr = AddressModeAbsoluteX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeAbsoluteX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_ORA(operand);
             break;
         }
         case 0x19: {  // ORA AbsoluteY
             // Fetch operands
-            llvm::Value* addr = AddressModeAbsoluteY(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeAbsoluteY(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_ORA(operand);
             break;
         }
         case 0x01: {  // ORA IndirectX
             // Fetch operands
-            llvm::Value* addr = AddressModeIndirectX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeIndirectX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_ORA(operand);
             break;
         }
         case 0x11: {  // ORA IndirectY
             // Fetch operands
-            llvm::Value* addr = AddressModeIndirectY(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeIndirectY(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_ORA(operand);
             break;
         }
@@ -504,22 +500,22 @@ void Compiler::CodeGen(Instruction& instr)
             break;
         }
         case 0x26: {  // ROL Zeropage
-            llvm::Value* addr = AddressModeZeropage(i->arg);
+            llvm::Value* addr = AddressModeZeropage(current_instruction->arg);
             OP_ROL(addr, true);
             break;
         }
         case 0x36: {  // ROL ZeropageX
-            llvm::Value* addr = AddressModeZeropageX(i->arg);
+            llvm::Value* addr = AddressModeZeropageX(current_instruction->arg);
             OP_ROL(addr, false);
             break;
         }
         case 0x2E: {  // ROL Absolute
-            llvm::Value* addr = AddressModeAbsolute(i->arg);
+            llvm::Value* addr = AddressModeAbsolute(current_instruction->arg);
             OP_ROL(addr, true);
             break;
         }
         case 0x3E: {  // ROL AbsoluteX
-            llvm::Value* addr = AddressModeAbsoluteX(i->arg);
+            llvm::Value* addr = AddressModeAbsoluteX(current_instruction->arg);
             OP_ROL(addr, false);
             break;
         }
@@ -528,22 +524,22 @@ void Compiler::CodeGen(Instruction& instr)
             break;
         }
         case 0x66: {  // ROR Zeropage
-            llvm::Value* addr = AddressModeZeropage(i->arg);
+            llvm::Value* addr = AddressModeZeropage(current_instruction->arg);
             OP_ROR(addr, true);
             break;
         }
         case 0x76: {  // ROR ZeropageX
-            llvm::Value* addr = AddressModeZeropageX(i->arg);
+            llvm::Value* addr = AddressModeZeropageX(current_instruction->arg);
             OP_ROR(addr, false);
             break;
         }
         case 0x6E: {  // ROR Absolute
-            llvm::Value* addr = AddressModeAbsolute(i->arg);
+            llvm::Value* addr = AddressModeAbsolute(current_instruction->arg);
             OP_ROR(addr, true);
             break;
         }
         case 0x7E: {  // ROR AbsoluteX
-            llvm::Value* addr = AddressModeAbsoluteX(i->arg);
+            llvm::Value* addr = AddressModeAbsoluteX(current_instruction->arg);
             OP_ROR(addr, false);
             break;
         }
@@ -551,62 +547,60 @@ void Compiler::CodeGen(Instruction& instr)
             break;
         }
         case 0x60: {  // RTS Implied
-            // TODO: use this llvm::value to dynamically jump to a return address
-            llvm::Value* return_addr = StackPull();
-            uint16_t return_addr_s = return_map[current_block_address];
-            c->builder.CreateBr(c->basicblocks[return_addr_s]);
+            OP_RTS(nullptr);
             break;
         }
         case 0xE9: {  // SBC Immediate
-            llvm::Value* operand = AddressModeImmediate(i->arg);
+            llvm::Value* operand = AddressModeImmediate(current_instruction->arg);
             OP_SBC(operand);
             break;
         }
         case 0xE5: {  // SBC Zeropage
-            llvm::Value* ram_pointer = AddressModeZeropage(i->arg);
+            llvm::Value* ram_pointer = AddressModeZeropage(current_instruction->arg);
             llvm::Value* operand = c->builder.CreateLoad(ram_pointer);
             OP_SBC(operand);
             break;
         }
         case 0xF5: {  // SBC ZeropageX
-            llvm::Value* ram_pointer = AddressModeZeropageX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeZeropageX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(ram_pointer);
             OP_SBC(operand);
             break;
         }
         case 0xED: {  // SBC Absolute
-            llvm::Value* ram_pointer = AddressModeAbsolute(i->arg);
+            llvm::Value* ram_pointer = AddressModeAbsolute(current_instruction->arg);
             llvm::Value* operand = c->builder.CreateLoad(ram_pointer);
             OP_SBC(operand);
             break;
         }
         case 0xFD: {  // SBC AbsoluteX
-            llvm::Value* ram_pointer = AddressModeAbsoluteX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeAbsoluteX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(ram_pointer);
             OP_SBC(operand);
             break;
         }
         case 0xF9: {  // SBC AbsoluteY
-            llvm::Value* ram_pointer = AddressModeAbsoluteY(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeAbsoluteY(current_instruction->arg);
+            llvm::Value* operand = CreateRead(ram_pointer);
             OP_SBC(operand);
             break;
         }
         case 0xE1: {  // SBC IndirectX
-            llvm::Value* ram_pointer = AddressModeIndirectX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeIndirectX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(ram_pointer);
             OP_SBC(operand);
             break;
         }
         case 0xF1: {  // SBC IndirectY
-            llvm::Value* ram_pointer = AddressModeIndirectY(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeIndirectY(current_instruction->arg);
+            llvm::Value* operand = CreateRead(ram_pointer);
             OP_SBC(operand);
             break;
         }
         case 0x38: {  // SEC Implied
             llvm::Constant* carry = llvm::ConstantInt::get(int1, 0x1);
-            c->builder.CreateStore(carry, c->status_c);
+            if (IsFlagLive(FLAG_C))
+                c->builder.CreateStore(carry, c->status_c);
             break;
         }
         case 0xF8: {  // SED Implied
@@ -619,7 +613,8 @@ void Compiler::CodeGen(Instruction& instr)
         }
         case 0x18: {  // CLC Implied
             llvm::Constant* carry = llvm::ConstantInt::get(int1, 0x0);
-            c->builder.CreateStore(carry, c->status_c);
+            if (IsFlagLive(FLAG_C))
+                c->builder.CreateStore(carry, c->status_c);
             break;
         }
         case 0xD8: {  // CLD Implied
@@ -631,18 +626,19 @@ void Compiler::CodeGen(Instruction& instr)
             break;
         }
         case 0xB8: {  // CLV Implied
-            c->builder.CreateStore(GetConstant1(0), c->status_v);
+            if (IsFlagLive(FLAG_V))
+                c->builder.CreateStore(GetConstant1(0), c->status_v);
             break;
         }
         case 0x85: {  // STA Zeropage
             llvm::Value* load_a = c->builder.CreateLoad(c->reg_a);
-            WriteMemory(i->arg, load_a);
+            WriteMemory(current_instruction->arg, load_a);
             break;
         }
         case 0x95: {  // STA ZeropageX
             llvm::Value* load_a = c->builder.CreateLoad(c->reg_a);
-            llvm::Value* target_addr = AddressModeZeropageX(i->arg);
-            c->builder.CreateCall(c->write_fn, {target_addr, load_a});
+            llvm::Value* target_addr = AddressModeZeropageX(current_instruction->arg);
+            CreateWrite(target_addr, load_a);
             break;
         }
         case 0x8D: {  // STA Absolute
@@ -651,58 +647,58 @@ void Compiler::CodeGen(Instruction& instr)
         }
         case 0x9D: {  // STA AbsoluteX
             llvm::Value* load_a = c->builder.CreateLoad(c->reg_a);
-            llvm::Value* addr_base = AddressModeAbsoluteX(i->arg);
-            c->builder.CreateCall(c->write_fn, {addr_base, load_a});
+            llvm::Value* addr_base = AddressModeAbsoluteX(current_instruction->arg);
+            CreateWrite(addr_base, load_a);
             break;
         }
         case 0x99: {  // STA AbsoluteY
             llvm::Value* load_a = c->builder.CreateLoad(c->reg_a);
-            llvm::Value* addr_base = AddressModeAbsoluteY(i->arg);
-            c->builder.CreateCall(c->write_fn, {addr_base, load_a});
+            llvm::Value* addr_base = AddressModeAbsoluteY(current_instruction->arg);
+            CreateWrite(addr_base, load_a);
             break;
         }
         case 0x81: {  // STA IndirectX
             llvm::Value* load_a = c->builder.CreateLoad(c->reg_a);
-            llvm::Value* addr_hl_or = AddressModeIndirectX(i->arg);
-            c->builder.CreateCall(c->write_fn, {addr_hl_or, load_a});
+            llvm::Value* addr_hl_or = AddressModeIndirectX(current_instruction->arg);
+            CreateWrite(addr_hl_or, load_a);
             break;
         }
         case 0x91: {  // STA IndirectY
             llvm::Value* load_a = c->builder.CreateLoad(c->reg_a);
-            llvm::Value* addr_hl_or = AddressModeIndirectY(i->arg);
-            c->builder.CreateCall(c->write_fn, {addr_hl_or, load_a});
+            llvm::Value* addr_hl_or = AddressModeIndirectY(current_instruction->arg);
+            CreateWrite(addr_hl_or, load_a);
             break;
         }
         case 0x86: {  // STX Zeropage
             llvm::Value* load_x = c->builder.CreateLoad(c->reg_x);
-            WriteMemory(i->arg, load_x);
+            WriteMemory(current_instruction->arg, load_x);
             break;
         }
         case 0x96: {  // STX ZeropageY
             llvm::Value* load_x = c->builder.CreateLoad(c->reg_x);
-            llvm::Value* target_addr = AddressModeZeropageY(i->arg);
-            c->builder.CreateCall(c->write_fn, {target_addr, load_x});
+            llvm::Value* target_addr = AddressModeZeropageY(current_instruction->arg);
+            CreateWrite(target_addr, load_x);
             break;
         }
         case 0x8E: {  // STX Absolute
             llvm::Value* load_x = c->builder.CreateLoad(c->reg_x);
-            WriteMemory(i->arg, load_x);
+            WriteMemory(current_instruction->arg, load_x);
             break;
         }
         case 0x84: {  // STY Zeropage
             llvm::Value* load_y = c->builder.CreateLoad(c->reg_y);
-            WriteMemory(i->arg, load_y);
+            WriteMemory(current_instruction->arg, load_y);
             break;
         }
         case 0x94: {  // STY ZeropageX
             llvm::Value* load_y = c->builder.CreateLoad(c->reg_y);
-            llvm::Value* target_addr = AddressModeZeropageX(i->arg);
-            c->builder.CreateCall(c->write_fn, {target_addr, load_y});
+            llvm::Value* target_addr = AddressModeZeropageX(current_instruction->arg);
+            CreateWrite(target_addr, load_y);
             break;
         }
         case 0x8C: {  // STY Absolute
             llvm::Value* load_y = c->builder.CreateLoad(c->reg_y);
-            WriteMemory(i->arg, load_y);
+            WriteMemory(current_instruction->arg, load_y);
             break;
         }
         case 0xAA: {  // TAX Implied
@@ -748,48 +744,48 @@ void Compiler::CodeGen(Instruction& instr)
             break;
         }
         case 0x29: {  // AND Immediate
-            llvm::Value* operand = AddressModeImmediate(i->arg);
+            llvm::Value* operand = AddressModeImmediate(current_instruction->arg);
             OP_AND(operand);
             break;
         }
         case 0x25: {  // AND Zeropage
-            llvm::Value* addr = AddressModeZeropage(i->arg);
+            llvm::Value* addr = AddressModeZeropage(current_instruction->arg);
             llvm::Value* operand = c->builder.CreateLoad(addr);
             OP_AND(operand);
             break;
         }
         case 0x35: {  // AND ZeropageX
-            llvm::Value* addr = AddressModeZeropageX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeZeropageX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_AND(operand);
             break;
         }
         case 0x2D: {  // AND Absolute
-            llvm::Value* operand = ReadMemory(i->arg);
+            llvm::Value* operand = ReadMemory(current_instruction->arg);
             OP_AND(operand);
             break;
         }
         case 0x3D: {  // AND AbsoluteX
-            llvm::Value* addr = AddressModeAbsoluteX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeAbsoluteX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_AND(operand);
             break;
         }
         case 0x39: {  // AND AbsoluteY
-            llvm::Value* addr = AddressModeAbsoluteY(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeAbsoluteY(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_AND(operand);
             break;
         }
         case 0x21: {  // AND IndirectX
-            llvm::Value* addr = AddressModeIndirectX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeIndirectX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_AND(operand);
             break;
         }
         case 0x31: {  // AND IndirectY
-            llvm::Value* addr = AddressModeIndirectY(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, {addr});
+            llvm::Value* addr = AddressModeIndirectY(current_instruction->arg);
+            llvm::Value* operand = CreateRead(addr);
             OP_AND(operand);
             break;
         }
@@ -798,69 +794,69 @@ void Compiler::CodeGen(Instruction& instr)
             break;
         }
         case 0x06: {  // ASL Zeropage
-            llvm::Value* addr = AddressModeZeropage(i->arg);
+            llvm::Value* addr = AddressModeZeropage(current_instruction->arg);
             OP_ASL(addr, true);
             break;
         }
         case 0x16: {  // ASL ZeropageX
-            llvm::Value* addr = AddressModeZeropageX(i->arg);
+            llvm::Value* addr = AddressModeZeropageX(current_instruction->arg);
             OP_ASL(addr, false);
             break;
         }
         case 0x0E: {  // ASL Absolute
-            llvm::Value* addr = AddressModeAbsolute(i->arg);
+            llvm::Value* addr = AddressModeAbsolute(current_instruction->arg);
             OP_ASL(addr, true);
             break;
         }
         case 0x1E: {  // ASL AbsoluteX
-            llvm::Value* addr = AddressModeAbsoluteX(i->arg);
+            llvm::Value* addr = AddressModeAbsoluteX(current_instruction->arg);
             OP_ASL(addr, false);
             break;
         }
         case 0x69: {  // ADC Immediate
-            llvm::Value* operand = AddressModeImmediate(i->arg);
+            llvm::Value* operand = AddressModeImmediate(current_instruction->arg);
             OP_ADC(operand);
             break;
         }
         case 0x61: {  // ADC IndirectX
-            llvm::Value* ram_pointer = AddressModeIndirectX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeIndirectX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(ram_pointer);
             OP_ADC(operand);
             break;
         }
         case 0x71: {  // ADC IndirectY
-            llvm::Value* ram_pointer = AddressModeIndirectY(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeIndirectY(current_instruction->arg);
+            llvm::Value* operand = CreateRead(ram_pointer);
             OP_ADC(operand);
             break;
         }
         case 0x65: {  // ADC Zeropage
-            llvm::Value* ram_pointer = AddressModeZeropage(i->arg);
+            llvm::Value* ram_pointer = AddressModeZeropage(current_instruction->arg);
             llvm::Value* operand = c->builder.CreateLoad(ram_pointer);
             OP_ADC(operand);
             break;
         }
         case 0x75: {  // ADC ZeropageX
-            llvm::Value* ram_pointer = AddressModeZeropageX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeZeropageX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(ram_pointer);
             OP_ADC(operand);
             break;
         }
         case 0x6D: {  // ADC Absolute
-            llvm::Value* ram_pointer = AddressModeAbsolute(i->arg);
+            llvm::Value* ram_pointer = AddressModeAbsolute(current_instruction->arg);
             llvm::Value* operand = c->builder.CreateLoad(ram_pointer);
             OP_ADC(operand);
             break;
         }
         case 0x7D: {  // ADC AbsoluteX
-            llvm::Value* ram_pointer = AddressModeAbsoluteX(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeAbsoluteX(current_instruction->arg);
+            llvm::Value* operand = CreateRead(ram_pointer);
             OP_ADC(operand);
             break;
         }
         case 0x79: {  // ADC AbsoluteY
-            llvm::Value* ram_pointer = AddressModeAbsoluteY(i->arg);
-            llvm::Value* operand = c->builder.CreateCall(c->read_fn, ram_pointer);
+            llvm::Value* ram_pointer = AddressModeAbsoluteY(current_instruction->arg);
+            llvm::Value* operand = CreateRead(ram_pointer);
             OP_ADC(operand);
             break;
         }
@@ -887,34 +883,41 @@ void Compiler::OP_ADC(llvm::Value* operand)
     llvm::Value* result = c->builder.CreateAdd(result_a_ram, load_c);
 
     // Handling overflow
+    if (IsFlagLive(FLAG_V)) {
+        llvm::Constant* c_0x80 = llvm::ConstantInt::get(int16, 0x80);
 
-    llvm::Constant* c_0x80 = llvm::ConstantInt::get(int16, 0x80);
+        llvm::Value* xor_result = c->builder.CreateXor(load_a, result);
+        llvm::Value* xor_operand = c->builder.CreateXor(load_a, operand);
 
-    llvm::Value* xor_result = c->builder.CreateXor(load_a, result);
-    llvm::Value* xor_operand = c->builder.CreateXor(load_a, operand);
+        llvm::Value* and_result = c->builder.CreateAnd(xor_result, c_0x80);
+        llvm::Value* and_operand = c->builder.CreateAnd(xor_operand, c_0x80);
 
-    llvm::Value* and_result = c->builder.CreateAnd(xor_result, c_0x80);
-    llvm::Value* and_operand = c->builder.CreateAnd(xor_operand, c_0x80);
+        llvm::Value* NE = c->builder.CreateICmpNE(and_result, GetConstant16(0));
+        llvm::Value* EQ = c->builder.CreateICmpEQ(and_operand, GetConstant16(0));
 
-    llvm::Value* NE = c->builder.CreateICmpNE(and_result, GetConstant16(0));
-    llvm::Value* EQ = c->builder.CreateICmpEQ(and_operand, GetConstant16(0));
+        llvm::Value* overflow = c->builder.CreateAnd(EQ, NE);
 
-    llvm::Value* overflow = c->builder.CreateAnd(EQ, NE);
-
-    c->builder.CreateStore(overflow, c->status_v);
+        c->builder.CreateStore(overflow, c->status_v);
+    }
 
     // Test Z
-    llvm::Value* Z = c->builder.CreateICmpEQ(result, GetConstant16(0));
-    c->builder.CreateStore(Z, c->status_z);
+    if (IsFlagLive(FLAG_Z)) {
+        llvm::Value* Z = c->builder.CreateICmpEQ(result, GetConstant16(0));
+        c->builder.CreateStore(Z, c->status_z);
+    }
 
     // Test N
-    llvm::Value* N = c->builder.CreateAnd(result, GetConstant16(0x80));
-    N = c->builder.CreateICmpEQ(N, GetConstant16(0x80));
-    c->builder.CreateStore(N, c->status_n);
+    if (IsFlagLive(FLAG_N)) {
+        llvm::Value* N = c->builder.CreateAnd(result, GetConstant16(0x80));
+        N = c->builder.CreateICmpEQ(N, GetConstant16(0x80));
+        c->builder.CreateStore(N, c->status_n);
+    }
 
     // Test C
-    llvm::Value* C = c->builder.CreateICmpUGT(result, GetConstant16(0xFF));
-    c->builder.CreateStore(C, c->status_c);
+    if (IsFlagLive(FLAG_C)) {
+        llvm::Value* C = c->builder.CreateICmpUGT(result, GetConstant16(0xFF));
+        c->builder.CreateStore(C, c->status_c);
+    }
 
     // Truncate result and store in A
     result = c->builder.CreateZExtOrTrunc(result, int8);
@@ -939,34 +942,41 @@ void Compiler::OP_SBC(llvm::Value* operand)
     llvm::Value* result = c->builder.CreateSub(result_a_ram, load_c);
 
     // Handling overflow
+    if (IsFlagLive(FLAG_V)) {
+        llvm::Constant* c_0x80 = llvm::ConstantInt::get(int16, 0x80);
 
-    llvm::Constant* c_0x80 = llvm::ConstantInt::get(int16, 0x80);
-
-    llvm::Value* xor_1 = c->builder.CreateXor(load_a, result);
-    llvm::Value* xor_2 = c->builder.CreateXor(load_a, operand);
+        llvm::Value* xor_1 = c->builder.CreateXor(load_a, result);
+        llvm::Value* xor_2 = c->builder.CreateXor(load_a, operand);
 
-    llvm::Value* and_1 = c->builder.CreateAnd(xor_1, c_0x80);
-    llvm::Value* and_2 = c->builder.CreateAnd(xor_2, c_0x80);
+        llvm::Value* and_1 = c->builder.CreateAnd(xor_1, c_0x80);
+        llvm::Value* and_2 = c->builder.CreateAnd(xor_2, c_0x80);
 
-    llvm::Value* SGT_1 = c->builder.CreateICmpNE(and_1, GetConstant16(0));
-    llvm::Value* SGT_2 = c->builder.CreateICmpNE(and_2, GetConstant16(0));
+        llvm::Value* SGT_1 = c->builder.CreateICmpNE(and_1, GetConstant16(0));
+        llvm::Value* SGT_2 = c->builder.CreateICmpNE(and_2, GetConstant16(0));
 
-    llvm::Value* overflow = c->builder.CreateAnd(SGT_2, SGT_1);
+        llvm::Value* overflow = c->builder.CreateAnd(SGT_2, SGT_1);
 
-    c->builder.CreateStore(overflow, c->status_v);
+        c->builder.CreateStore(overflow, c->status_v);
+    }
 
     // TEST Z
-    llvm::Value* Z = c->builder.CreateICmpEQ(result, GetConstant16(0));
-    c->builder.CreateStore(Z, c->status_z);
+    if (IsFlagLive(FLAG_Z)) {
+        llvm::Value* Z = c->builder.CreateICmpEQ(result, GetConstant16(0));
+        c->builder.CreateStore(Z, c->status_z);
+    }
 
     // Test N
-    llvm::Value* N = c->builder.CreateAnd(result, GetConstant16(0x80));
-    N = c->builder.CreateICmpEQ(N, GetConstant16(0x80));
-    c->builder.CreateStore(N, c->status_n);
+    if (IsFlagLive(FLAG_N)) {
+        llvm::Value* N = c->builder.CreateAnd(result, GetConstant16(0x80));
+        N = c->builder.CreateICmpEQ(N, GetConstant16(0x80));
+        c->builder.CreateStore(N, c->status_n);
+    }
 
     // Test C
-    llvm::Value* C = c->builder.CreateICmpULT(result, GetConstant16(0x0100));
-    c->builder.CreateStore(C, c->status_c);
+    if (IsFlagLive(FLAG_C)) {
+        llvm::Value* C = c->builder.CreateICmpULT(result, GetConstant16(0x0100));
+        c->builder.CreateStore(C, c->status_c);
+    }
 
     // Truncate result and store in A
     result = c->builder.CreateZExtOrTrunc(result, int8);
@@ -1006,10 +1016,12 @@ void Compiler::OP_BIT(llvm::Value* operand)
     // Set V to Bit 6 of Memory value - I'm not sure if this way of
     // calculating the V-flag is unique for BIT or if it should be
     // abstracted into a function
-    llvm::Constant* c_0x40 = llvm::ConstantInt::get(int8, 0x40);
-    llvm::Value* do_and_v = c->builder.CreateAnd(operand, c_0x40);
-    llvm::Value* is_overflow = c->builder.CreateICmpEQ(do_and_v, c_0x40);
-    c->builder.CreateStore(is_overflow, c->status_v);
+    if (IsFlagLive(FLAG_V)) {
+        llvm::Constant* c_0x40 = llvm::ConstantInt::get(int8, 0x40);
+        llvm::Value* do_and_v = c->builder.CreateAnd(operand, c_0x40);
+        llvm::Value* is_overflow = c->builder.CreateICmpEQ(do_and_v, c_0x40);
+        c->builder.CreateStore(is_overflow, c->status_v);
+    }
     // Set N to Bit 7 of Memory value
     DynamicTestN(operand);
 }
@@ -1056,27 +1068,31 @@ void Compiler::OP_LSR(llvm::Value* addr, bool static_address)
     if (static_address)
         operand = c->builder.CreateLoad(addr);
     else
-        operand = c->builder.CreateCall(c->read_fn, {addr});
+        operand = CreateRead(addr);
 
-    llvm::Value* and_1 = c->builder.CreateAnd(operand, GetConstant8(1));
-    llvm::Value* status_c = c->builder.CreateICmpEQ(and_1, GetConstant8(1));
-    c->builder.CreateStore(status_c, c->status_c);
+    if (IsFlagLive(FLAG_C)) {
+        llvm::Value* and_1 = c->builder.CreateAnd(operand, GetConstant8(1));
+        llvm::Value* status_c = c->builder.CreateICmpEQ(and_1, GetConstant8(1));
+        c->builder.CreateStore(status_c, c->status_c);
+    }
     operand = c->builder.CreateLShr(operand, 1);
     DynamicTestZ(operand);
     DynamicTestN(operand);
 
     if (static_address)
-        c->builder.CreateStore(operand, addr);
+        StoreStatic(operand);
     else
-        c->builder.CreateCall(c->write_fn, {addr, operand});
+        CreateWrite(addr, operand);
 }
 
 void Compiler::OP_LSR_A()
 {
     llvm::Value* reg_a = c->builder.CreateLoad(c->reg_a);
-    llvm::Value* and_1 = c->builder.CreateAnd(reg_a, GetConstant8(1));
-    llvm::Value* status_c = c->builder.CreateICmpEQ(and_1, GetConstant8(1));
-    c->builder.CreateStore(status_c, c->status_c);
+    if (IsFlagLive(FLAG_C)) {
+        llvm::Value* and_1 = c->builder.CreateAnd(reg_a, GetConstant8(1));
+        llvm::Value* status_c = c->builder.CreateICmpEQ(and_1, GetConstant8(1));
+        c->builder.CreateStore(status_c, c->status_c);
+    }
     reg_a = c->builder.CreateLShr(reg_a, 1);
     DynamicTestZ(reg_a);
     DynamicTestN(reg_a);
@@ -1090,12 +1106,14 @@ void Compiler::OP_ASL(llvm::Value* addr, bool static_address)
     if (static_address)
         operand = c->builder.CreateLoad(addr);
     else
-        operand = c->builder.CreateCall(c->read_fn, {addr});
+        operand = CreateRead(addr);
 
     // Test C
-    llvm::Value* C = c->builder.CreateAnd(operand, GetConstant8(0x80));
-    llvm::Value* status_c = c->builder.CreateICmpEQ(C, GetConstant8(0x80));
-    c->builder.CreateStore(status_c, c->status_c);
+    if (IsFlagLive(FLAG_C)) {
+        llvm::Value* C = c->builder.CreateAnd(operand, GetConstant8(0x80));
+        llvm::Value* status_c = c->builder.CreateICmpEQ(C, GetConstant8(0x80));
+        c->builder.CreateStore(status_c, c->status_c);
+    }
 
     operand = c->builder.CreateShl(operand, 1);
 
@@ -1103,9 +1121,9 @@ void Compiler::OP_ASL(llvm::Value* addr, bool static_address)
     DynamicTestN(operand);
 
     if (static_address)
-        c->builder.CreateStore(operand, addr);
+        StoreStatic(operand);
     else
-        c->builder.CreateCall(c->write_fn, {addr, operand});
+        CreateWrite(addr, operand);
 }
 
 void Compiler::OP_ASL_A()
@@ -1113,9 +1131,11 @@ void Compiler::OP_ASL_A()
     llvm::Value* reg_a = c->builder.CreateLoad(c->reg_a);
 
     // Test C
-    llvm::Value* C = c->builder.CreateAnd(reg_a, GetConstant8(0x80));
-    C = c->builder.CreateICmpEQ(C, GetConstant8(0x80));
-    c->builder.CreateStore(C, c->status_c);
+    if (IsFlagLive(FLAG_C)) {
+        llvm::Value* C = c->builder.CreateAnd(reg_a, GetConstant8(0x80));
+        C = c->builder.CreateICmpEQ(C, GetConstant8(0x80));
+        c->builder.CreateStore(C, c->status_c);
+    }
 
     reg_a = c->builder.CreateShl(reg_a, 1);
 
@@ -1126,13 +1146,67 @@ void Compiler::OP_ASL_A()
 
 void Compiler::OP_JSR(llvm::Value* v)
 {
-    uint16_t return_addr = i->offset + i->size;
-    return_map[i->target_label.address] = return_addr;
-    StackPush(GetConstant8(return_addr));
-    c->builder.CreateBr(c->basicblocks[i->target_label]);
-    llvm::BasicBlock* continue_block = CreateAutoLabel();
-    c->builder.SetInsertPoint(continue_block);
-    c->basicblocks[return_addr] = continue_block;
+    // Pushes the address of its last byte, high byte first
+    uint16_t return_addr = current_instruction->offset + current_instruction->size;
+    uint16_t pushed_addr = return_addr - 1;
+    StackPush(GetConstant8(pushed_addr >> 8));
+    StackPush(GetConstant8(pushed_addr & 0xFF));
+    if (lazy) {
+        CreateSubroutineCall(current_instruction->target_label.address, return_addr);
+        return;
+    }
+
+    // The return site goes on the shadow stack for OP_RTS()
+    auto it = c->basicblocks.find(return_addr);
+    if (it != c->basicblocks.end()) {
+        llvm::Value* top = c->builder.CreateLoad(c->shadow_top);
+        c->builder.CreateStore(GetConstant32(return_addr),
+                               GetShadowPtr(c->shadow_addresses, top));
+        c->builder.CreateStore(llvm::BlockAddress::get(it->second),
+                               GetShadowPtr(c->shadow_blocks, top));
+        c->builder.CreateStore(c->builder.CreateAdd(top, GetConstant8(1)),
+                               c->shadow_top);
+    }
+    c->builder.CreateBr(c->basicblocks[current_instruction->target_label]);
+}
+void Compiler::OP_RTS(llvm::Value* v)
+{
+    // Pulls what OP_JSR() pushed, the next instruction is after that address
+    llvm::Value* low = c->builder.CreateZExt(StackPull(), int16);
+    llvm::Value* high = c->builder.CreateZExt(StackPull(), int16);
+    llvm::Value* return_addr = c->builder.CreateOr(c->builder.CreateShl(high, 8), low);
+    return_addr = c->builder.CreateAdd(return_addr, GetConstant16(1));
+    if (lazy) {
+        CreateSubroutineReturn(return_addr);
+        return;
+    }
+
+    if (!c->return_blocks.empty()) {
+        // Unless the program changed the stack itself, the top of the shadow
+        // stack is where it returns to. Anything else goes through the jump
+        // table.
+        llvm::Value* top =
+            c->builder.CreateSub(c->builder.CreateLoad(c->shadow_top), GetConstant8(1));
+        c->builder.CreateStore(top, c->shadow_top);
+        llvm::Value* predicted =
+            c->builder.CreateLoad(GetShadowPtr(c->shadow_addresses, top));
+        llvm::Value* is_predicted =
+            c->builder.CreateICmpEQ(predicted, c->builder.CreateZExt(return_addr, int32));
+        llvm::BasicBlock* hit_block = CreateAutoLabel();
+        llvm::BasicBlock* miss_block = CreateAutoLabel();
+        c->builder.CreateCondBr(is_predicted, hit_block, miss_block);
+
+        c->builder.SetInsertPoint(hit_block);
+        llvm::Value* block = c->builder.CreateLoad(GetShadowPtr(c->shadow_blocks, top));
+        llvm::IndirectBrInst* br =
+            c->builder.CreateIndirectBr(block, c->return_blocks.size());
+        for (llvm::BasicBlock* return_block : c->return_blocks)
+            br->addDestination(return_block);
+
+        c->builder.SetInsertPoint(miss_block);
+    }
+    c->builder.CreateStore(return_addr, c->reg_idr);
+    c->builder.CreateBr(c->dynJumpBlock);
 }
 void Compiler::OP_JMP(llvm::Value* v)
 {
@@ -1141,114 +1215,92 @@ void Compiler::OP_BNE(llvm::Value* v)
 {
     llvm::Value* load_z = c->builder.CreateLoad(c->status_z);
     llvm::Value* is_nonzero = c->builder.CreateICmpNE(load_z, GetConstant1(1), "ne");
-    CreateCondBranch(is_nonzero, c->basicblocks[i->target_label]);
+    CreateCondBranch(is_nonzero, c->basicblocks[current_instruction->target_label]);
 }
 void Compiler::OP_BEQ(llvm::Value* v)
 {
     llvm::Value* load_z = c->builder.CreateLoad(c->status_z);
     llvm::Value* is_zero = c->builder.CreateICmpEQ(load_z, GetConstant1(1), "eq");
-    CreateCondBranch(is_zero, c->basicblocks[i->target_label]);
+    CreateCondBranch(is_zero, c->basicblocks[current_instruction->target_label]);
 }
 void Compiler::OP_BMI(llvm::Value* v)
 {
     llvm::Value* load_n = c->builder.CreateLoad(c->status_n);
     llvm::Value* is_negative = c->builder.CreateICmpEQ(load_n, GetConstant1(1), "eq");
-    CreateCondBranch(is_negative, c->basicblocks[i->target_label]);
+    CreateCondBranch(is_negative, c->basicblocks[current_instruction->target_label]);
 }
 void Compiler::OP_BCC(llvm::Value* v)
 {
     llvm::Value* load_c = c->builder.CreateLoad(c->status_c);
     llvm::Value* is_carry_clear = c->builder.CreateICmpEQ(load_c, GetConstant1(0), "eq");
-    CreateCondBranch(is_carry_clear, c->basicblocks[i->target_label]);
+    CreateCondBranch(is_carry_clear, c->basicblocks[current_instruction->target_label]);
 }
 void Compiler::OP_BCS(llvm::Value* v)
 {
     llvm::Value* load_c = c->builder.CreateLoad(c->status_c);
     llvm::Value* is_carry_set = c->builder.CreateICmpEQ(load_c, GetConstant1(1), "eq");
-    CreateCondBranch(is_carry_set, c->basicblocks[i->target_label]);
+    CreateCondBranch(is_carry_set, c->basicblocks[current_instruction->target_label]);
 }
 void Compiler::OP_BPL(llvm::Value* v)
 {
     llvm::Value* load_n = c->builder.CreateLoad(c->status_n);
     llvm::Value* is_positive = c->builder.CreateICmpEQ(load_n, GetConstant1(0), "eq");
-    CreateCondBranch(is_positive, c->basicblocks[i->target_label]);
+    CreateCondBranch(is_positive, c->basicblocks[current_instruction->target_label]);
 }
 void Compiler::OP_BVC(llvm::Value* v)
 {
     llvm::Value* load_v = c->builder.CreateLoad(c->status_v);
     llvm::Value* is_overflow_clear =
         c->builder.CreateICmpEQ(load_v, GetConstant1(0), "eq");
-    CreateCondBranch(is_overflow_clear, c->basicblocks[i->target_label]);
+    CreateCondBranch(is_overflow_clear,
+                     c->basicblocks[current_instruction->target_label]);
 }
 void Compiler::OP_BVS(llvm::Value* v)
 {
     llvm::Value* load_v = c->builder.CreateLoad(c->status_v);
     llvm::Value* is_overflow_set = c->builder.CreateICmpEQ(load_v, GetConstant1(1), "eq");
-    CreateCondBranch(is_overflow_set, c->basicblocks[i->target_label]);
+    CreateCondBranch(is_overflow_set, c->basicblocks[current_instruction->target_label]);
 }
 
 void Compiler::OP_STA_ABS(llvm::Value* v)
 {
-    uint16_t addr = i->arg;
+    uint16_t addr = current_instruction->arg;
+    if (checkpoint_callback && ((addr >= 0x2008 && addr <= 0x200C) || addr == 0x200F))
+        CreateCheckpoint(addr);
+
     // Write to '0x2008' and 'A' will be written to stdout as
     // char
     if (addr == 0x2008) {
         llvm::Value* load_a = c->builder.CreateLoad(c->reg_a);
-        c->builder.CreateCall(c->putchar_fn, {load_a});
+        c->builder.CreateCall(c->putchar_fn, {c->state_arg, load_a});
     }
     // Write A to stdout
     else if (addr == 0x2009) {
         llvm::Value* load_a = c->builder.CreateLoad(c->reg_a);
-        c->builder.CreateCall(c->putreg_fn, {load_a});
+        c->builder.CreateCall(c->putreg_fn, {c->state_arg, load_a});
     }
     // Write X to stdout
     else if (addr == 0x200A) {
         llvm::Value* load_x = c->builder.CreateLoad(c->reg_x);
-        c->builder.CreateCall(c->putreg_fn, {load_x});
+        c->builder.CreateCall(c->putreg_fn, {c->state_arg, load_x});
     }
     // Write Y to stdout
     else if (addr == 0x200B) {
         llvm::Value* load_y = c->builder.CreateLoad(c->reg_y);
-        c->builder.CreateCall(c->putreg_fn, {load_y});
+        c->builder.CreateCall(c->putreg_fn, {c->state_arg, load_y});
     }
     // Write flags to stdout
     else if (addr == 0x200C) {
-        llvm::Value* status_c = c->builder.CreateLoad(c->status_c);
-        status_c = c->builder.CreateZExt(status_c, int8);
-        llvm::Value* status_z = c->builder.CreateLoad(c->status_z);
-        status_z = c->builder.CreateZExt(status_z, int8);
-        status_z = c->builder.CreateShl(status_z, 1);
-        llvm::Value* status_i = c->builder.CreateLoad(c->status_i);
-        status_i = c->builder.CreateZExt(status_i, int8);
-        status_i = c->builder.CreateShl(status_i, 2);
-        llvm::Value* status_d = c->builder.CreateLoad(c->status_d);
-        status_d = c->builder.CreateZExt(status_d, int8);
-        status_d = c->builder.CreateShl(status_d, 3);
-        llvm::Value* status_b = c->builder.CreateLoad(c->status_b);
-        status_b = c->builder.CreateZExt(status_b, int8);
-        status_b = c->builder.CreateShl(status_b, 4);
-        llvm::Value* status_u = c->builder.CreateLoad(c->status_u);
-        status_u = c->builder.CreateZExt(status_u, int8);
-        status_u = c->builder.CreateShl(status_u, 5);
-        llvm::Value* status_v = c->builder.CreateLoad(c->status_v);
-        status_v = c->builder.CreateZExt(status_v, int8);
-        status_v = c->builder.CreateShl(status_v, 6);
-        llvm::Value* status_n = c->builder.CreateLoad(c->status_n);
-        status_n = c->builder.CreateZExt(status_n, int8);
-        status_n = c->builder.CreateShl(status_n, 7);
-        llvm::Value* status = c->builder.CreateOr(status_z, status_c);
-        status = c->builder.CreateOr(status, status_i);
-        status = c->builder.CreateOr(status, status_d);
-        status = c->builder.CreateOr(status, status_b);
-        status = c->builder.CreateOr(status, status_u);
-        status = c->builder.CreateOr(status, status_v);
-        status = c->builder.CreateOr(status, status_n);
-        c->builder.CreateCall(c->putstatus_fn, {status});
+        llvm::Value* status = CreateStatus();
+        c->builder.CreateCall(c->putstatus_fn, {c->state_arg, status});
     }
     else if (addr == 0x200F) {  // Exit
+        StoreRegisters(GetConstant16(current_instruction->offset));
         llvm::Value* load_a = c->builder.CreateLoad(c->reg_a);
         llvm::Value* a_32 = c->builder.CreateZExt(load_a, int32);
         c->builder.CreateRet(a_32);
+        // Whatever follows the exit is unreachable from here
+        c->builder.SetInsertPoint(CreateAutoLabel());
     }
     // Store normally
     else {
@@ -1263,7 +1315,7 @@ void Compiler::OP_ROR(llvm::Value* addr, bool static_address)
     if (static_address)
         operand = c->builder.CreateLoad(addr);
     else
-        operand = c->builder.CreateCall(c->read_fn, {addr});
+        operand = CreateRead(addr);
 
     // Get status_c
     llvm::Value* carry_in = c->builder.CreateLoad(c->status_c);
@@ -1276,17 +1328,20 @@ void Compiler::OP_ROR(llvm::Value* addr, bool static_address)
     llvm::Value* carry_in_shl = c->builder.CreateShl(carry_in_8, 7);
     llvm::Value* result = c->builder.CreateOr(operand_Shr, carry_in_shl);
     // Set status_c
-    llvm::Value* carry_out_1 = c->builder.CreateICmpEQ(carry_out, GetConstant8(0x01));
-    c->builder.CreateStore(carry_out_1, c->status_c);
+    if (IsFlagLive(FLAG_C)) {
+        llvm::Value* carry_out_1 =
+            c->builder.CreateICmpEQ(carry_out, GetConstant8(0x01));
+        c->builder.CreateStore(carry_out_1, c->status_c);
+    }
     // Flag test
     DynamicTestZ(result);
     DynamicTestN(result);
 
     // Store in memory
     if (static_address)
-        c->builder.CreateStore(result, addr);
+        StoreStatic(result);
     else
-        c->builder.CreateCall(c->write_fn, {addr, result});
+        CreateWrite(addr, result);
 }
 
 void Compiler::OP_ROR_A()
@@ -1305,8 +1360,11 @@ void Compiler::OP_ROR_A()
     // Stor reg_a
     c->builder.CreateStore(result, c->reg_a);
     // Set status_c
-    llvm::Value* carry_out_1 = c->builder.CreateICmpEQ(carry_out, GetConstant8(0x01));
-    c->builder.CreateStore(carry_out_1, c->status_c);
+    if (IsFlagLive(FLAG_C)) {
+        llvm::Value* carry_out_1 =
+            c->builder.CreateICmpEQ(carry_out, GetConstant8(0x01));
+        c->builder.CreateStore(carry_out_1, c->status_c);
+    }
     // Flag test
     DynamicTestZ(result);
     DynamicTestN(result);
@@ -1319,7 +1377,7 @@ void Compiler::OP_ROL(llvm::Value* addr, bool static_address)
     if (static_address)
         operand = c->builder.CreateLoad(addr);
     else
-        operand = c->builder.CreateCall(c->read_fn, {addr});
+        operand = CreateRead(addr);
 
     // Get status_c
     llvm::Value* carry_in = c->builder.CreateLoad(c->status_c);
@@ -1331,16 +1389,19 @@ void Compiler::OP_ROL(llvm::Value* addr, bool static_address)
     llvm::Value* carry_in_8 = c->builder.CreateZExt(carry_in, int8);
     llvm::Value* result = c->builder.CreateOr(reg_a_Shr, carry_in_8);
     // Set status_c
-    llvm::Value* carry_out_1 = c->builder.CreateICmpEQ(carry_out, GetConstant8(0x80));
-    c->builder.CreateStore(carry_out_1, c->status_c);
+    if (IsFlagLive(FLAG_C)) {
+        llvm::Value* carry_out_1 =
+            c->builder.CreateICmpEQ(carry_out, GetConstant8(0x80));
+        c->builder.CreateStore(carry_out_1, c->status_c);
+    }
     // Flag test
     DynamicTestZ(result);
     DynamicTestN(result);
 
     if (static_address)
-        c->builder.CreateStore(result, addr);
+        StoreStatic(result);
     else
-        c->builder.CreateCall(c->write_fn, {addr, result});
+        CreateWrite(addr, result);
 }
 
 void Compiler::OP_ROL_A()
@@ -1358,8 +1419,11 @@ void Compiler::OP_ROL_A()
     // Stor reg_a
     c->builder.CreateStore(result, c->reg_a);
     // Set status_c
-    llvm::Value* carry_out_1 = c->builder.CreateICmpEQ(carry_out, GetConstant8(0x80));
-    c->builder.CreateStore(carry_out_1, c->status_c);
+    if (IsFlagLive(FLAG_C)) {
+        llvm::Value* carry_out_1 =
+            c->builder.CreateICmpEQ(carry_out, GetConstant8(0x80));
+        c->builder.CreateStore(carry_out_1, c->status_c);
+    }
     // Flag test
     DynamicTestZ(result);
     DynamicTestN(result);
@@ -1369,30 +1433,7 @@ void Compiler::OP_PLP(llvm::Value* v)
 {
     // PLP ignore bits 4 and 5 from the stack
     llvm::Value* status = StackPull();
-    llvm::Value* and_c = c->builder.CreateAnd(status, GetConstant8(0x01));
-    llvm::Value* status_c = c->builder.CreateICmpEQ(and_c, GetConstant8(0x01));
-    c->builder.CreateStore(status_c, c->status_c);
-    llvm::Value* and_z = c->builder.CreateAnd(status, GetConstant8(0x02));
-    llvm::Value* status_z = c->builder.CreateICmpEQ(and_z, GetConstant8(0x02));
-    c->builder.CreateStore(status_z, c->status_z);
-    llvm::Value* and_i = c->builder.CreateAnd(status, GetConstant8(0x04));
-    llvm::Value* status_i = c->builder.CreateICmpEQ(and_i, GetConstant8(0x04));
-    c->builder.CreateStore(status_i, c->status_i);
-    llvm::Value* and_d = c->builder.CreateAnd(status, GetConstant8(0x08));
-    llvm::Value* status_d = c->builder.CreateICmpEQ(and_d, GetConstant8(0x08));
-    c->builder.CreateStore(status_d, c->status_d);
-    llvm::Value* and_b = c->builder.CreateAnd(status, GetConstant8(0x10));
-    llvm::Value* status_b = c->builder.CreateICmpEQ(and_b, GetConstant8(0x10));
-    c->builder.CreateStore(status_b, c->status_b);
-    llvm::Value* and_u = c->builder.CreateAnd(status, GetConstant8(0x20));
-    llvm::Value* status_u = c->builder.CreateICmpEQ(and_u, GetConstant8(0x20));
-    c->builder.CreateStore(status_u, c->status_u);
-    llvm::Value* and_v = c->builder.CreateAnd(status, GetConstant8(0x40));
-    llvm::Value* status_v = c->builder.CreateICmpEQ(and_v, GetConstant8(0x40));
-    c->builder.CreateStore(status_v, c->status_v);
-    llvm::Value* and_n = c->builder.CreateAnd(status, GetConstant8(0x80));
-    llvm::Value* status_n = c->builder.CreateICmpEQ(and_n, GetConstant8(0x80));
-    c->builder.CreateStore(status_n, c->status_n);
+    StoreStatus(status);
 }
 
 void Compiler::OP_PHP(llvm::Value* v)
@@ -3,48 +3,75 @@
 namespace llvmes {
 namespace dynarec {
 
-static Compiler* s_compiler = nullptr;
+// Called by the compiled code, which passes on the GuestState it was given
 
-void write_memory(int16_t addr, int8_t val)
+// Returns whether the code that wrote has to leave, see Compiler::CodeWritten()
+int8_t write_memory(GuestState* state, int16_t addr, int8_t val, int32_t unit)
 {
-    s_compiler->Write(addr, val);
+    uint16_t address = addr;
+    // Writing the value that's there already doesn't change the code
+    bool modifies_code = state->code[address] && state->ram[address] != (uint8_t)val;
+    state->memory->Write(address, val);
+    return modifies_code && state->compiler->CodeWritten(address, unit);
 }
 
-int8_t read_memory(int16_t addr)
+static int8_t read_memory(GuestState* state, int16_t addr)
 {
-    return s_compiler->Read(addr);
+    return state->memory->Read(addr);
 }
 
-void putreg(int8_t r)
+static void checkpoint(GuestState* state, int16_t addr, int8_t a, int8_t x, int8_t y,
+                       int8_t sp, int8_t status)
 {
-    printf("%s\n", ToHexString(r).c_str());
+    (*state->checkpoint)({(uint16_t)addr, (uint8_t)a, (uint8_t)x, (uint8_t)y,
+                          (uint8_t)sp, (uint8_t)status});
 }
 
-void putchar(int8_t c)
+static void putreg(GuestState* state, int8_t r)
 {
-    std::cout << c;
+    state->console->PutHex(r);
 }
 
-void putstatus(int8_t s)
+static void putchar(GuestState* state, int8_t c)
 {
-    printf("[N: %d V: %d U: %d B: %d D: %d I: %d Z: %d C: %d] (%s)\n",
-           (bool)(s & 0x80),                  // Negative Flag
-           (bool)(s & 0x40),                  // Overflow flag
-           (bool)(s & 0x20),                  // U flag
-           (bool)(s & 0x10),                  // BRK flag
-           (bool)(s & 0x08),                  // Decimal flag
-           (bool)(s & 0x04),                  // Interrupt flag
-           (bool)(s & 0x02),                  // Zero flag
-           (bool)(s & 0x01),                  // Carry flag
-           ToHexString((uint8_t)s).c_str());  // Complete status register
+    state->console->PutChar(c);
+}
+
+static void putstatus(GuestState* state, int8_t s)
+{
+    state->console->PutStatus(s);
+}
+
+// What the subroutine table starts out with, patches the entry with the
+// compiled subroutine and calls it. Returns -1 if it doesn't compile.
+int compile_subroutine(GuestState* state, int index)
+{
+    CompiledSubroutine subroutine =
+        state->compiler->CompileSubroutine(index, state->ram);
+    if (!subroutine)
+        return -1;
+    return subroutine(state, index);
+}
+
+// Called when the jump table has no case for the PC in the GuestState, returns
+// the code that continues from there
+CompiledFunction translate(GuestState* state)
+{
+    return state->compiler->CompileTarget(state->registers.pc, state->ram);
 }
 
 Compiler::Compiler(ParseResult parse_result, const std::string& program_name)
     : parse_result(parse_result),
-      c(std::make_unique<Compilation>(program_name, std::move(parse_result.memory)))
+      c(std::make_unique<Compilation>(program_name, std::move(parse_result.memory))),
+      code_bytes(Memory::PAGE_COUNT * Memory::PAGE_SIZE),
+      code_pages(Memory::PAGE_COUNT)
 {
-    assert(s_compiler == nullptr);  // Only one compiler can exist in a program
-    s_compiler = this;
+    c->state.checkpoint = &checkpoint_callback;
+    c->state.compiler = this;
+    c->state.code = code_bytes.data();
+    c->state.code_pages = code_pages.data();
+    MarkCode(this->parse_result.instructions);
+    reset_address = c->ram[0xFFFC] | (c->ram[0xFFFD] << 8);
 
     int64 = llvm::Type::getInt64Ty(c->m->getContext());
     int32 = llvm::Type::getInt32Ty(c->m->getContext());
@@ -53,32 +80,96 @@ Compiler::Compiler(ParseResult parse_result, const std::string& program_name)
     int1 = llvm::Type::getInt1Ty(c->m->getContext());
     void_ty = llvm::Type::getVoidTy(c->m->getContext());
 
-    // Create functions
-    auto putreg_fn = RegisterFunction({int8}, void_ty, "putreg", (void*)putreg);
+    // Same layout as EntryState and GuestState, the pointers the compiled code
+    // doesn't use are just pointers
+    llvm::Type* ptr_ty = int8->getPointerTo();
+    c->registers_ty = llvm::StructType::create(
+        c->m->getContext(), {int16, int8, int8, int8, int8, int8}, "EntryState");
+    c->state_ty = llvm::StructType::create(c->m->getContext(),
+                                           {ptr_ty, ptr_ty->getPointerTo(), int8,
+                                            c->registers_ty, ptr_ty, ptr_ty, ptr_ty,
+                                            ptr_ty, ptr_ty->getPointerTo(), ptr_ty,
+                                            ptr_ty},
+                                           "GuestState");
+    c->subroutine_ty =
+        llvm::FunctionType::get(int32, {c->state_ty->getPointerTo(), int32}, false);
+
+    DeclareRuntimeFunctions();
+
+    auto main_fn =
+        RegisterFunction({c->state_ty->getPointerTo()}, int32, "main", nullptr);
+    c->main_fn = main_fn;
+    CreateFunctionEntry(main_fn);
+
+    // Initiate all variables to 0
+    c->builder.CreateStore(GetConstant8(0), c->reg_x);
+    c->builder.CreateStore(GetConstant8(0), c->reg_y);
+    c->builder.CreateStore(GetConstant8(0), c->reg_a);
+    // Same as the interpreter after a reset
+    c->builder.CreateStore(GetConstant8(0xFD), c->reg_sp);
+
+    c->builder.CreateStore(GetConstant1(0), c->status_c);
+    c->builder.CreateStore(GetConstant1(0), c->status_v);
+    c->builder.CreateStore(GetConstant1(0), c->status_n);
+    c->builder.CreateStore(GetConstant1(1), c->status_b);
+    c->builder.CreateStore(GetConstant1(1), c->status_u);
+    c->builder.CreateStore(GetConstant1(0), c->status_z);
+    c->builder.CreateStore(GetConstant1(1), c->status_i);
+    c->builder.CreateStore(GetConstant1(0), c->status_d);
+
+    // Starting from an entry state goes through the jump table, which is only
+    // added later (see AddResumeBlock())
+    c->resumeBlock =
+        llvm::BasicBlock::Create(c->m->getContext(), "ResumeBlock", main_fn);
+    llvm::BasicBlock* start =
+        llvm::BasicBlock::Create(c->m->getContext(), "Start", main_fn);
+    llvm::Value* resume = c->builder.CreateLoad(GetStatePtr(2));
+    llvm::Value* is_resuming = c->builder.CreateICmpNE(resume, GetConstant8(0));
+    c->builder.CreateCondBr(is_resuming, c->resumeBlock, start);
+    c->builder.SetInsertPoint(start);
+}
+
+void Compiler::DeclareRuntimeFunctions()
+{
+    // The runtime functions get the GuestState first
+    llvm::Type* state_ptr_ty = c->state_ty->getPointerTo();
+
+    auto putreg_fn =
+        RegisterFunction({state_ptr_ty, int8}, void_ty, "putreg", (void*)putreg);
     c->putreg_fn = putreg_fn;
 
-    auto putchar_fn = RegisterFunction({int8}, void_ty, "putchar", (void*)putchar);
+    auto putchar_fn =
+        RegisterFunction({state_ptr_ty, int8}, void_ty, "putchar", (void*)putchar);
     c->putchar_fn = putchar_fn;
 
-    auto putstatus_fn = RegisterFunction({int8}, void_ty, "putstatus", (void*)putstatus);
+    auto putstatus_fn =
+        RegisterFunction({state_ptr_ty, int8}, void_ty, "putstatus", (void*)putstatus);
     c->putstatus_fn = putstatus_fn;
 
-    auto write_fn =
-        RegisterFunction({int16, int8}, void_ty, "write", (void*)write_memory);
+    auto checkpoint_fn =
+        RegisterFunction({state_ptr_ty, int16, int8, int8, int8, int8, int8}, void_ty,
+                         "checkpoint", (void*)checkpoint);
+    c->checkpoint_fn = checkpoint_fn;
+
+    auto write_fn = RegisterFunction({state_ptr_ty, int16, int8, int32}, int8, "write",
+                                     (void*)write_memory);
     c->write_fn = write_fn;
 
-    auto read_fn = RegisterFunction({int16}, int8, "read", (void*)read_memory);
+    auto read_fn =
+        RegisterFunction({state_ptr_ty, int16}, int8, "read", (void*)read_memory);
     c->read_fn = read_fn;
 
-    auto main_fn = RegisterFunction({}, int32, "main", nullptr);
-    c->main_fn = main_fn;
+    auto translate_fn = RegisterFunction({state_ptr_ty}, int8->getPointerTo(),
+                                         "translate", (void*)translate);
+    c->translate_fn = translate_fn;
+}
 
+void Compiler::CreateFunctionEntry(llvm::Function* fn)
+{
     // Create initial basicblock
-    llvm::BasicBlock* entry =
-        llvm::BasicBlock::Create(c->m->getContext(), "entry", main_fn);
+    llvm::BasicBlock* entry = llvm::BasicBlock::Create(c->m->getContext(), "entry", fn);
     c->builder.SetInsertPoint(entry);
 
-    // Initiate all variables to 0
     c->reg_sp = c->builder.CreateAlloca(int8, 0, "SP");
     c->reg_x = c->builder.CreateAlloca(int8, 0, "X");
     c->reg_y = c->builder.CreateAlloca(int8, 0, "Y");
@@ -93,18 +184,11 @@ Compiler::Compiler(ParseResult parse_result, const std::string& program_name)
     c->status_u = c->builder.CreateAlloca(int1, 0, "U");
     c->status_d = c->builder.CreateAlloca(int1, 0, "D");
 
-    c->builder.CreateStore(GetConstant8(0), c->reg_x);
-    c->builder.CreateStore(GetConstant8(0), c->reg_y);
-    c->builder.CreateStore(GetConstant8(0), c->reg_a);
-
-    c->builder.CreateStore(GetConstant1(0), c->status_c);
-    c->builder.CreateStore(GetConstant1(0), c->status_v);
-    c->builder.CreateStore(GetConstant1(0), c->status_n);
-    c->builder.CreateStore(GetConstant1(1), c->status_b);
-    c->builder.CreateStore(GetConstant1(1), c->status_u);
-    c->builder.CreateStore(GetConstant1(0), c->status_z);
-    c->builder.CreateStore(GetConstant1(1), c->status_i);
-    c->builder.CreateStore(GetConstant1(0), c->status_d);
+    // Loaded once, every access to memory is relative to them
+    c->state_arg = fn->arg_begin();
+    c->ram_base = c->builder.CreateLoad(GetStatePtr(0), "RAM");
+    c->write_pages_base = c->builder.CreateLoad(GetStatePtr(1), "WritePages");
+    c->code_pages_base = c->builder.CreateLoad(GetStatePtr(10), "CodePages");
 }
 
 Compiler::~Compiler()
@@ -113,11 +197,84 @@ Compiler::~Compiler()
         delete i.second;
 }
 
+void Compiler::SetCheckpointCallback(CheckpointCallback callback)
+{
+    checkpoint_callback = std::move(callback);
+}
+
+bool Compiler::CanEnterAt(uint16_t pc) const
+{
+    // The jump table has a case for every label and every return site
+    if (lazy)
+        return false;
+    if (parse_result.labels.count(pc))
+        return true;
+    auto it = parse_result.instructions.find(pc - 3);
+    return it != parse_result.instructions.end() &&
+           it->second->op_type == MOS6502::Op::JSR;
+}
+
+bool Compiler::CompiledFrom(const uint8_t* ram) const
+{
+    for (size_t address = 0; address < code_bytes.size(); address++) {
+        if (code_bytes[address] && c->ram[address] != ram[address])
+            return false;
+    }
+    return true;
+}
+
+void Compiler::SetLazy(bool enable)
+{
+    lazy = enable;
+}
+
+void Compiler::SetFlagElimination(bool enable)
+{
+    flag_elimination = enable;
+}
+
+void Compiler::SetObjectCache(ObjectCache* cache)
+{
+    object_cache = cache;
+}
+
+void Compiler::SetEntryState(const EntryState& state)
+{
+    assert(CanEnterAt(state.pc));
+    c->state.registers = state;
+    c->state.resume = 1;
+}
+
+GuestState& Compiler::GetGuestState()
+{
+    return c->state;
+}
+
+Console& Compiler::GetConsole()
+{
+    return c->console;
+}
+
 std::vector<uint8_t>& Compiler::GetMemory()
 {
     return c->ram;
 }
 
+Memory& Compiler::GetMemoryMap()
+{
+    return c->memory;
+}
+
+void Compiler::TakeSnapshot()
+{
+    c->memory.TakeSnapshot();
+}
+
+void Compiler::RestoreSnapshot()
+{
+    c->memory.RestoreSnapshot();
+}
+
 void Compiler::SetDumpDir(const std::string& path)
 {
     c->jitter.set_external_ir_dump_directory(path);
@@ -125,28 +282,38 @@ void Compiler::SetDumpDir(const std::string& path)
 
 void Compiler::StaticTestZ(int v)
 {
+    if (!IsFlagLive(FLAG_Z))
+        return;
     llvm::Constant* z = llvm::ConstantInt::get(int1, v == 0);
     c->builder.CreateStore(z, c->status_z);
 }
 
 void Compiler::StaticTestN(int v)
 {
+    if (!IsFlagLive(FLAG_N))
+        return;
     llvm::Constant* n = llvm::ConstantInt::get(int1, v & 0x80);
     c->builder.CreateStore(n, c->status_n);
 }
 
 void Compiler::DynamicTestZ(llvm::Value* v)
 {
+    if (!IsFlagLive(FLAG_Z))
+        return;
     llvm::Value* is_zero = c->builder.CreateICmpEQ(v, GetConstant8(0), "eq");
     c->builder.CreateStore(is_zero, c->status_z);
 }
 void Compiler::DynamicTestZ16(llvm::Value* v)
 {
+    if (!IsFlagLive(FLAG_Z))
+        return;
     llvm::Value* is_zero = c->builder.CreateICmpEQ(v, GetConstant16(0), "eq");
     c->builder.CreateStore(is_zero, c->status_z);
 }
 void Compiler::DynamicTestN(llvm::Value* v)
 {
+    if (!IsFlagLive(FLAG_N))
+        return;
     llvm::Constant* c_0x80 = llvm::ConstantInt::get(int8, 0x80);
     llvm::Value* do_and = c->builder.CreateAnd(v, c_0x80);
     llvm::Value* is_negative = c->builder.CreateICmpEQ(do_and, c_0x80);
@@ -154,6 +321,8 @@ void Compiler::DynamicTestN(llvm::Value* v)
 }
 void Compiler::DynamicTestN16(llvm::Value* v)
 {
+    if (!IsFlagLive(FLAG_N))
+        return;
     llvm::Constant* c_0x8000 = llvm::ConstantInt::get(int16, 0x8000);
     llvm::Value* do_and = c->builder.CreateAnd(v, c_0x8000);
     llvm::Value* is_negative = c->builder.CreateICmpEQ(do_and, c_0x8000);
@@ -161,37 +330,108 @@ void Compiler::DynamicTestN16(llvm::Value* v)
 }
 void Compiler::DynamicTestCCmp(llvm::Value* v)
 {
+    if (!IsFlagLive(FLAG_C))
+        return;
     llvm::Constant* c_0x0100 = llvm::ConstantInt::get(int16, 0x0100);
     llvm::Value* lessThan = c->builder.CreateICmpULT(v, c_0x0100);
     c->builder.CreateStore(lessThan, c->status_c);
 }
-// Calculates the ram-address as a constant-expr
+// Pointer into the guest's RAM, an offset from the base loaded on entry
 llvm::Value* Compiler::GetRAMPtr(uint16_t addr)
 {
-    llvm::Constant* ram_ptr_value =
-        llvm::ConstantInt::get(llvm::Type::getInt64Ty(c->m->getContext()),
-                               (int64_t)c->ram.data() + (int64_t)addr);
-
-    return llvm::ConstantExpr::getIntToPtr(
-        ram_ptr_value,
-        llvm::PointerType::getUnqual(llvm::Type::getInt8Ty(c->m->getContext())));
+    return c->builder.CreateConstInBoundsGEP1_32(int8, c->ram_base, addr);
 }
 
 llvm::Value* Compiler::GetRAMPtr16(uint16_t addr)
 {
-    llvm::Constant* ram_ptr_value =
-        llvm::ConstantInt::get(llvm::Type::getInt64Ty(c->m->getContext()),
-                               (int64_t)c->ram.data() + (int64_t)addr);
+    return c->builder.CreateBitCast(GetRAMPtr(addr), llvm::PointerType::getUnqual(int16));
+}
+
+llvm::Value* Compiler::GetStatePtr(unsigned field)
+{
+    return c->builder.CreateStructGEP(c->state_ty, c->state_arg, field);
+}
+
+llvm::Value* Compiler::GetRegisterPtr(unsigned field)
+{
+    return c->builder.CreateStructGEP(c->registers_ty, GetStatePtr(3), field);
+}
+
+void Compiler::LoadRegisters()
+{
+    c->builder.CreateStore(c->builder.CreateLoad(GetRegisterPtr(1)), c->reg_a);
+    c->builder.CreateStore(c->builder.CreateLoad(GetRegisterPtr(2)), c->reg_x);
+    c->builder.CreateStore(c->builder.CreateLoad(GetRegisterPtr(3)), c->reg_y);
+    c->builder.CreateStore(c->builder.CreateLoad(GetRegisterPtr(4)), c->reg_sp);
+    StoreStatus(c->builder.CreateLoad(GetRegisterPtr(5)));
+}
+
+void Compiler::StoreRegisters(llvm::Value* pc)
+{
+    c->builder.CreateStore(pc, GetRegisterPtr(0));
+    c->builder.CreateStore(c->builder.CreateLoad(c->reg_a), GetRegisterPtr(1));
+    c->builder.CreateStore(c->builder.CreateLoad(c->reg_x), GetRegisterPtr(2));
+    c->builder.CreateStore(c->builder.CreateLoad(c->reg_y), GetRegisterPtr(3));
+    c->builder.CreateStore(c->builder.CreateLoad(c->reg_sp), GetRegisterPtr(4));
+    c->builder.CreateStore(CreateStatus(), GetRegisterPtr(5));
+}
 
-    return llvm::ConstantExpr::getIntToPtr(
-        ram_ptr_value,
-        llvm::PointerType::getUnqual(llvm::Type::getInt16Ty(c->m->getContext())));
+llvm::Value* Compiler::CreateRead(llvm::Value* addr)
+{
+    return c->builder.CreateCall(c->read_fn, {c->state_arg, addr});
+}
+
+void Compiler::CreateWrite(llvm::Value* addr, llvm::Value* v)
+{
+    llvm::Value* modified = CallWrite(addr, v);
+    code_modified =
+        code_modified ? c->builder.CreateOr(code_modified, modified) : modified;
+}
+llvm::Value* Compiler::CallWrite(llvm::Value* addr, llvm::Value* v)
+{
+    return c->builder.CreateCall(
+        c->write_fn, {c->state_arg, addr, v, GetConstant32(current_code_unit)});
 }
 
 void Compiler::WriteMemory(uint16_t addr, llvm::Value* v)
 {
-    llvm::Value* ram_ptr = GetRAMPtr(addr);
-    c->builder.CreateStore(v, ram_ptr);
+    // Stores to code pages are checked by the runtime
+    if (code_pages[addr >> 8]) {
+        CreateWrite(GetConstant16(addr), v);
+        return;
+    }
+
+    // Pages without a write pointer (e.g. protected by a snapshot) take the
+    // slow path through the memory map, and so do the pages code was compiled
+    // from since. Anything else is stored directly.
+    llvm::Value* page_entry = c->builder.CreateConstInBoundsGEP1_32(
+        int8->getPointerTo(), c->write_pages_base, addr >> 8);
+    llvm::Value* page = c->builder.CreateLoad(page_entry);
+    llvm::Value* is_protected = c->builder.CreateIsNull(page);
+    llvm::Value* code_page = c->builder.CreateLoad(
+        c->builder.CreateConstInBoundsGEP1_32(int8, c->code_pages_base, addr >> 8));
+    llvm::Value* is_code = c->builder.CreateICmpNE(code_page, GetConstant8(0));
+
+    llvm::BasicBlock* slow_block = CreateAutoLabel();
+    llvm::BasicBlock* store_block = CreateAutoLabel();
+    llvm::BasicBlock* continue_block = CreateAutoLabel();
+    c->builder.CreateCondBr(c->builder.CreateOr(is_protected, is_code), slow_block,
+                            store_block);
+
+    c->builder.SetInsertPoint(slow_block);
+    llvm::Value* modified = CallWrite(GetConstant16(addr), v);
+    c->builder.CreateBr(continue_block);
+
+    c->builder.SetInsertPoint(store_block);
+    c->builder.CreateStore(v, GetRAMPtr(addr));
+    c->builder.CreateBr(continue_block);
+
+    // Checked like the writes of CreateWrite()
+    c->builder.SetInsertPoint(continue_block);
+    llvm::PHINode* phi = c->builder.CreatePHI(int8, 2);
+    phi->addIncoming(modified, slow_block);
+    phi->addIncoming(GetConstant8(0), store_block);
+    code_modified = code_modified ? c->builder.CreateOr(code_modified, phi) : phi;
 }
 
 llvm::Value* Compiler::ReadMemory(uint16_t addr)
@@ -206,6 +446,79 @@ llvm::Value* Compiler::ReadMemory16(uint16_t addr)
     return c->builder.CreateLoad(ram_ptr);
 }
 
+llvm::Value* Compiler::CreateStatus()
+{
+    llvm::Value* status_c = c->builder.CreateLoad(c->status_c);
+    status_c = c->builder.CreateZExt(status_c, int8);
+    llvm::Value* status_z = c->builder.CreateLoad(c->status_z);
+    status_z = c->builder.CreateZExt(status_z, int8);
+    status_z = c->builder.CreateShl(status_z, 1);
+    llvm::Value* status_i = c->builder.CreateLoad(c->status_i);
+    status_i = c->builder.CreateZExt(status_i, int8);
+    status_i = c->builder.CreateShl(status_i, 2);
+    llvm::Value* status_d = c->builder.CreateLoad(c->status_d);
+    status_d = c->builder.CreateZExt(status_d, int8);
+    status_d = c->builder.CreateShl(status_d, 3);
+    llvm::Value* status_b = c->builder.CreateLoad(c->status_b);
+    status_b = c->builder.CreateZExt(status_b, int8);
+    status_b = c->builder.CreateShl(status_b, 4);
+    llvm::Value* status_u = c->builder.CreateLoad(c->status_u);
+    status_u = c->builder.CreateZExt(status_u, int8);
+    status_u = c->builder.CreateShl(status_u, 5);
+    llvm::Value* status_v = c->builder.CreateLoad(c->status_v);
+    status_v = c->builder.CreateZExt(status_v, int8);
+    status_v = c->builder.CreateShl(status_v, 6);
+    llvm::Value* status_n = c->builder.CreateLoad(c->status_n);
+    status_n = c->builder.CreateZExt(status_n, int8);
+    status_n = c->builder.CreateShl(status_n, 7);
+    llvm::Value* status = c->builder.CreateOr(status_z, status_c);
+    status = c->builder.CreateOr(status, status_i);
+    status = c->builder.CreateOr(status, status_d);
+    status = c->builder.CreateOr(status, status_b);
+    status = c->builder.CreateOr(status, status_u);
+    status = c->builder.CreateOr(status, status_v);
+    status = c->builder.CreateOr(status, status_n);
+    return status;
+}
+
+void Compiler::StoreStatus(llvm::Value* status)
+{
+    llvm::Value* and_c = c->builder.CreateAnd(status, GetConstant8(0x01));
+    llvm::Value* status_c = c->builder.CreateICmpEQ(and_c, GetConstant8(0x01));
+    c->builder.CreateStore(status_c, c->status_c);
+    llvm::Value* and_z = c->builder.CreateAnd(status, GetConstant8(0x02));
+    llvm::Value* status_z = c->builder.CreateICmpEQ(and_z, GetConstant8(0x02));
+    c->builder.CreateStore(status_z, c->status_z);
+    llvm::Value* and_i = c->builder.CreateAnd(status, GetConstant8(0x04));
+    llvm::Value* status_i = c->builder.CreateICmpEQ(and_i, GetConstant8(0x04));
+    c->builder.CreateStore(status_i, c->status_i);
+    llvm::Value* and_d = c->builder.CreateAnd(status, GetConstant8(0x08));
+    llvm::Value* status_d = c->builder.CreateICmpEQ(and_d, GetConstant8(0x08));
+    c->builder.CreateStore(status_d, c->status_d);
+    llvm::Value* and_b = c->builder.CreateAnd(status, GetConstant8(0x10));
+    llvm::Value* status_b = c->builder.CreateICmpEQ(and_b, GetConstant8(0x10));
+    c->builder.CreateStore(status_b, c->status_b);
+    llvm::Value* and_u = c->builder.CreateAnd(status, GetConstant8(0x20));
+    llvm::Value* status_u = c->builder.CreateICmpEQ(and_u, GetConstant8(0x20));
+    c->builder.CreateStore(status_u, c->status_u);
+    llvm::Value* and_v = c->builder.CreateAnd(status, GetConstant8(0x40));
+    llvm::Value* status_v = c->builder.CreateICmpEQ(and_v, GetConstant8(0x40));
+    c->builder.CreateStore(status_v, c->status_v);
+    llvm::Value* and_n = c->builder.CreateAnd(status, GetConstant8(0x80));
+    llvm::Value* status_n = c->builder.CreateICmpEQ(and_n, GetConstant8(0x80));
+    c->builder.CreateStore(status_n, c->status_n);
+}
+
+void Compiler::CreateCheckpoint(uint16_t addr)
+{
+    llvm::Value* load_a = c->builder.CreateLoad(c->reg_a);
+    llvm::Value* load_x = c->builder.CreateLoad(c->reg_x);
+    llvm::Value* load_y = c->builder.CreateLoad(c->reg_y);
+    llvm::Value* load_sp = c->builder.CreateLoad(c->reg_sp);
+    c->builder.CreateCall(c->checkpoint_fn, {c->state_arg, GetConstant16(addr), load_a,
+                                             load_x, load_y, load_sp, CreateStatus()});
+}
+
 llvm::Value* Compiler::GetStackAddress(llvm::Value* sp)
 {
     llvm::Value* sp_16 = c->builder.CreateZExt(sp, int16);
@@ -223,8 +536,9 @@ void Compiler::StackPush(llvm::Value* v)
     llvm::Constant* c1_8 = llvm::ConstantInt::get(int8, 1);
     load_sp = c->builder.CreateSub(load_sp, c1_8);  // load_sp <- load_sp - 1
 
-    c->builder.CreateStore(load_sp, c->reg_sp);        // reg_sp <- load_sp
-    c->builder.CreateCall(c->write_fn, {sp_addr, v});  // [addr] <- v
+    c->builder.CreateStore(load_sp, c->reg_sp);  // reg_sp <- load_sp
+    // Code on the stack page isn't checked for, JSR couldn't leave half done
+    CallWrite(sp_addr, v);  // [addr] <- v
 }
 
 llvm::Value* Compiler::StackPull()
@@ -238,8 +552,8 @@ llvm::Value* Compiler::StackPull()
 
     llvm::Value* sp_addr = GetStackAddress(load_sp);
 
-    c->builder.CreateStore(load_sp, c->reg_sp);           // reg_sp <- load_sp
-    return c->builder.CreateCall(c->read_fn, {sp_addr});  // [addr] <- v
+    c->builder.CreateStore(load_sp, c->reg_sp);  // reg_sp <- load_sp
+    return CreateRead(sp_addr);                  // [addr] <- v
 }
 
 void Compiler::CreateCondBranch(llvm::Value* pred, llvm::BasicBlock* target)
@@ -318,13 +632,13 @@ llvm::Value* Compiler::AddressModeIndirectX(uint16_t addr)
 
     // low
     llvm::Value* addr_base_16 = c->builder.CreateZExt(addr_base, int16);
-    llvm::Value* addr_low = c->builder.CreateCall(c->read_fn, addr_base_16);
+    llvm::Value* addr_low = CreateRead(addr_base_16);
     llvm::Value* addr_low_16 = c->builder.CreateZExt(addr_low, int16);
 
     // high
     llvm::Value* addr_get_high = c->builder.CreateAdd(addr_base, GetConstant8(1));
     llvm::Value* addr_get_high_16 = c->builder.CreateZExt(addr_get_high, int16);
-    llvm::Value* addr_high = c->builder.CreateCall(c->read_fn, addr_get_high_16);
+    llvm::Value* addr_high = CreateRead(addr_get_high_16);
     llvm::Value* high_addr_16 = c->builder.CreateZExt(addr_high, int16);
     llvm::Value* addr_high_shl = c->builder.CreateShl(high_addr_16, 8);
 
@@ -339,13 +653,13 @@ llvm::Value* Compiler::AddressModeIndirectY(uint16_t addr)
     llvm::Value* load_y_16 = c->builder.CreateZExt(load_y, int16);
 
     // low
-    llvm::Value* addr_low = c->builder.CreateCall(c->read_fn, GetConstant16(addr));
+    llvm::Value* addr_low = CreateRead(GetConstant16(addr));
     llvm::Value* addr_low_16 = c->builder.CreateZExt(addr_low, int16);
 
     // high
     llvm::Value* addr_get_high_16 =
         c->builder.CreateAdd(GetConstant16(addr), GetConstant16(1));
-    llvm::Value* addr_high = c->builder.CreateCall(c->read_fn, addr_get_high_16);
+    llvm::Value* addr_high = CreateRead(addr_get_high_16);
     llvm::Value* addr_high_16 = c->builder.CreateZExt(addr_high, int16);
     llvm::Value* addr_high_shl = c->builder.CreateShl(addr_high_16, 8);
 
@@ -368,80 +682,397 @@ llvm::Function* Compiler::RegisterFunction(llvm::ArrayRef<llvm::Type*> arg_types
     return fn;
 }
 
-std::function<int()> Compiler::Compile(bool optimize)
+JITTIR::OptimizationLevel ParseOptimizationLevel(const std::string& name)
 {
-    PassOne();
-    AddDynJumpTable();
-    PassTwo();
+    if (name == "0")
+        return JITTIR::OptimizationLevel::None;
+    if (name == "fast")
+        return JITTIR::OptimizationLevel::Fast;
+    if (name == "1")
+        return JITTIR::OptimizationLevel::O1;
+    if (name == "2")
+        return JITTIR::OptimizationLevel::O2;
+    if (name == "3")
+        return JITTIR::OptimizationLevel::O3;
+    throw std::runtime_error("Unknown optimization level: " + name);
+}
+
+llvm::CodeGenOpt::Level ParseCodeGenOptLevel(const std::string& name)
+{
+    if (name == "0")
+        return llvm::CodeGenOpt::None;
+    if (name == "1")
+        return llvm::CodeGenOpt::Less;
+    if (name == "2")
+        return llvm::CodeGenOpt::Default;
+    if (name == "3")
+        return llvm::CodeGenOpt::Aggressive;
+    throw std::runtime_error("Unknown code generator optimization level: " + name);
+}
+
+std::string Compiler::GetCacheOptions(JITTIR::OptimizationLevel level,
+                                      llvm::CodeGenOpt::Level codegen_level) const
+{
+    // Checkpoint calls are only generated with a callback
+    return "opt=" + std::to_string((int)level) +
+           " codegen=" + std::to_string((int)codegen_level) +
+           " checkpoints=" + std::to_string((bool)checkpoint_callback) +
+           " flags=" + std::to_string(flag_elimination);
+}
 
-    if (optimize)
-        c->jitter.enable_optimize_module(true);
+std::function<int()> Compiler::Compile(JITTIR::OptimizationLevel level,
+                                       llvm::CodeGenOpt::Level codegen_level)
+{
+    c->jitter.set_optimization_level(level);
+    c->jitter.set_codegen_opt_level(codegen_level);
     c->jitter.enable_validate_module(true);
 
-    auto ok = c->jitter.add_module(std::move(c->m));
+    // A program that was compiled before with the same options only has to be
+    // linked, the functions it calls are registered already
+    std::string key;
+    JITTIR::Jitter::ModuleHandle ok = 0;
+    if (object_cache && !lazy) {
+        key = ObjectCache::GetKey(c->ram, GetCacheOptions(level, codegen_level));
+        if (auto object = object_cache->Load(key))
+            ok = c->jitter.add_object(std::move(object));
+        cache_hit = ok != 0;
+    }
+
+    // Lazily, main is only the code that runs until the first call
+    std::map<uint16_t, Instruction*> instructions = parse_result.instructions;
+    if (lazy) {
+        FindSubroutines();
+        instructions = CollectSubroutine(reset_address, parse_result.instructions);
+    }
+    current_code_unit = AddCodeUnit(CodeUnitKind::Main, 0, instructions);
+    int main_unit = current_code_unit;
+
+    if (!cache_hit) {
+        if (!lazy)
+            CreateShadowStack();
+        PassOne(instructions, parse_result.labels);
+        AddDynJumpTable();
+        AddResumeBlock();
+        c->builder.CreateBr(c->basicblocks[reset_address]);
+        PassTwo(instructions);
+
+        // The object cache stores the object under the module's name
+        if (object_cache && !lazy) {
+            c->m->setModuleIdentifier(key);
+            c->jitter.set_object_cache(object_cache);
+        }
+        ok = c->jitter.add_module(std::move(c->m));
+    }
 
     if (!ok)
         printf("Compilation failed!\n");
-    auto fn_ptr = (int (*)())c->jitter.get_symbol_address("main");
-    return std::function<int()>(fn_ptr);
+    code_units[main_unit].module = ok;
+    compiled_function = (CompiledFunction)c->jitter.get_symbol_address("main");
+    // Main is compiled by now, what's compiled at runtime isn't cached
+    if (object_cache)
+        c->jitter.set_object_cache(nullptr);
+    // The output is only written out once the program is done
+    CompiledFunction fn_ptr = compiled_function;
+    GuestState* state = &c->state;
+    Console* console = &c->console;
+    return [this, fn_ptr, state, console] {
+        int exit_code = fn_ptr(state);
+        console->Flush();
+        RemoveStaleCode();
+        return exit_code;
+    };
 }
 
-void Compiler::PassOne()
+void Compiler::PassOne(const std::map<uint16_t, Instruction*>& instructions,
+                       const std::map<uint16_t, Label>& labels)
 {
-    for (auto& pair : parse_result.labels) {
+    for (auto& pair : labels) {
+        if (!instructions.count(pair.first))
+            continue;
         llvm::BasicBlock* bb = llvm::BasicBlock::Create(
             c->m->getContext(), pair.second.name, (llvm::Function*)c->main_fn);
         c->basicblocks[pair.second.address] = bb;
     }
+
+    // A JSR ends its block, its return site starts one
+    for (auto& pair : instructions) {
+        if (pair.second->op_type != MOS6502::Op::JSR)
+            continue;
+        uint16_t return_addr = pair.first + pair.second->size;
+        if (!instructions.count(return_addr))
+            continue;
+        llvm::BasicBlock*& bb = c->basicblocks[return_addr];
+        if (!bb) {
+            std::stringstream name;
+            name << "Return " << ToHexString(return_addr);
+            bb = llvm::BasicBlock::Create(c->m->getContext(), name.str(),
+                                          (llvm::Function*)c->main_fn);
+        }
+        c->return_blocks.push_back(bb);
+    }
 }
 
-void Compiler::PassTwo()
+void Compiler::PassTwo(const std::map<uint16_t, Instruction*>& instructions)
 {
-    std::pair<uint16_t, Instruction*> prev = *parse_result.instructions.begin();
+    // The first block is entered through a branch to the entry point, which
+    // isn't necessarily the lowest address
+    std::pair<uint16_t, Instruction*> prev = *instructions.begin();
+    bool first = true;
+    FindLiveFlags(instructions);
 
-    for (auto& instr : parse_result.instructions) {
+    for (auto& instr : instructions) {
         uint16_t index = instr.first;
-        bool label_exists = parse_result.labels.count(index);
-
-        if (label_exists && prev.second->op_type != MOS6502::Op::JMP &&
-            prev.second->op_type != MOS6502::Op::RTS) {
+        bool block_exists = c->basicblocks.count(index);
+
+        // Only a lazily compiled JSR comes back to the next instruction by
+        // itself, otherwise RTS jumps there
+        MOS6502::Op prev_op = prev.second->op_type;
+        bool falls_through = prev_op != MOS6502::Op::JMP &&
+                             prev_op != MOS6502::Op::RTS &&
+                             (lazy || prev_op != MOS6502::Op::JSR);
+        if (block_exists && !first && falls_through) {
             c->builder.CreateBr(c->basicblocks[index]);
         }
 
-        if (label_exists) {
+        if (block_exists) {
             c->builder.SetInsertPoint(c->basicblocks[index]);
-            current_block_address = parse_result.labels[index].address;
         }
 
+        current_live_flags = live_flags[index];
         CodeGen(*instr.second);
+        // Writes to code leave once the instruction is done
+        if (code_modified && !c->builder.GetInsertBlock()->getTerminator())
+            CreateCodeModifiedCheck(index + instr.second->size);
+        code_modified = nullptr;
         prev = instr;
+        first = false;
     }
+    current_live_flags = ALL_FLAGS;
+    // Nothing runs past the last instruction, e.g. after an exit
+    if (!c->builder.GetInsertBlock()->getTerminator())
+        c->builder.CreateUnreachable();
 
     // c->builder.CreateRet(GetConstant32(0));
 }
 
+void Compiler::FindLiveFlags(const std::map<uint16_t, Instruction*>& instructions)
+{
+    // The flags read before they're written from the start of each instruction
+    // on, worked out backwards until nothing changes. They only grow, so it
+    // ends after a few rounds.
+    std::unordered_map<uint16_t, uint8_t> live_in;
+    auto live_at = [&](uint16_t pc) -> uint8_t {
+        return instructions.count(pc) ? live_in[pc] : ALL_FLAGS;
+    };
+
+    live_flags.clear();
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto it = instructions.rbegin(); it != instructions.rend(); ++it) {
+            uint16_t pc = it->first;
+            const Instruction& instr = *it->second;
+            MOS6502::Op op = instr.op_type;
+
+            // Same successors as in PassTwo()
+            uint8_t live_out = 0;
+            if (MayLeaveAfter(instr))
+                live_out = ALL_FLAGS;
+            else if (op == MOS6502::Op::JMP)
+                live_out = live_at(instr.target_label.address);
+            else if (op == MOS6502::Op::JSR && !lazy)
+                live_out = live_at(instr.target_label.address);
+            else
+                live_out = live_at(pc + instr.size);
+            if (MOS6502::IsBranch(op) && op != MOS6502::Op::JSR)
+                live_out |= live_at(instr.target_label.address);
+
+            uint8_t uses, defines;
+            GetFlagEffects(instr, uses, defines);
+            uint8_t in = uses | (live_out & ~defines);
+            if (live_in[pc] != in) {
+                live_in[pc] = in;
+                changed = true;
+            }
+            live_flags[pc] = live_out;
+        }
+    }
+
+    for (auto& pair : instructions) {
+        uint8_t uses, defines;
+        GetFlagEffects(*pair.second, uses, defines);
+        if (!flag_elimination)
+            live_flags[pair.first] = ALL_FLAGS;
+        flag_stores += std::bitset<8>(defines).count();
+        dead_flag_stores += std::bitset<8>(defines & ~live_flags[pair.first]).count();
+    }
+}
+
+void Compiler::GetFlagEffects(const Instruction& instr, uint8_t& uses,
+                              uint8_t& defines) const
+{
+    uses = 0;
+    defines = 0;
+    switch (instr.op_type) {
+        case MOS6502::Op::BNE:
+        case MOS6502::Op::BEQ:
+            uses = FLAG_Z;
+            break;
+        case MOS6502::Op::BMI:
+        case MOS6502::Op::BPL:
+            uses = FLAG_N;
+            break;
+        case MOS6502::Op::BCC:
+        case MOS6502::Op::BCS:
+            uses = FLAG_C;
+            break;
+        case MOS6502::Op::BVC:
+        case MOS6502::Op::BVS:
+            uses = FLAG_V;
+            break;
+        case MOS6502::Op::ADC:
+        case MOS6502::Op::SBC:
+            uses = FLAG_C;
+            defines = ALL_FLAGS;
+            break;
+        case MOS6502::Op::ROL:
+        case MOS6502::Op::ROL_ACC:
+        case MOS6502::Op::ROR:
+        case MOS6502::Op::ROR_ACC:
+            uses = FLAG_C;
+            defines = FLAG_N | FLAG_Z | FLAG_C;
+            break;
+        case MOS6502::Op::ASL:
+        case MOS6502::Op::ASL_ACC:
+        case MOS6502::Op::LSR:
+        case MOS6502::Op::LSR_ACC:
+        case MOS6502::Op::CMP:
+        case MOS6502::Op::CPX:
+        case MOS6502::Op::CPY:
+            defines = FLAG_N | FLAG_Z | FLAG_C;
+            break;
+        case MOS6502::Op::BIT:
+            defines = FLAG_N | FLAG_Z | FLAG_V;
+            break;
+        // PLA doesn't set any flags in CodeGen()
+        case MOS6502::Op::AND:
+        case MOS6502::Op::EOR:
+        case MOS6502::Op::ORA:
+        case MOS6502::Op::LDA:
+        case MOS6502::Op::LDX:
+        case MOS6502::Op::LDY:
+        case MOS6502::Op::INC:
+        case MOS6502::Op::INX:
+        case MOS6502::Op::INY:
+        case MOS6502::Op::DEC:
+        case MOS6502::Op::DEX:
+        case MOS6502::Op::DEY:
+        case MOS6502::Op::TAX:
+        case MOS6502::Op::TAY:
+        case MOS6502::Op::TSX:
+        case MOS6502::Op::TXA:
+        case MOS6502::Op::TYA:
+            defines = FLAG_N | FLAG_Z;
+            break;
+        case MOS6502::Op::SEC:
+        case MOS6502::Op::CLC:
+            defines = FLAG_C;
+            break;
+        case MOS6502::Op::CLV:
+            defines = FLAG_V;
+            break;
+        case MOS6502::Op::PHP:
+            uses = ALL_FLAGS;
+            break;
+        case MOS6502::Op::PLP:
+            defines = ALL_FLAGS;
+            break;
+        case MOS6502::Op::JSR:
+            // Lazily, the registers go through the GuestState and come back
+            // with what the subroutine left
+            if (lazy) {
+                uses = ALL_FLAGS;
+                defines = ALL_FLAGS;
+            }
+            break;
+        case MOS6502::Op::STA:
+            // Checkpoints, putstatus and the exit take the status register
+            if (instr.opcode == 0x8D && instr.arg >= 0x2008 && instr.arg <= 0x200F)
+                uses = ALL_FLAGS;
+            break;
+        default:
+            break;
+    }
+}
+
+bool Compiler::MayLeaveAfter(const Instruction& instr) const
+{
+    switch (instr.op_type) {
+        case MOS6502::Op::RTS:
+            return true;
+        case MOS6502::Op::JMP:
+            return instr.opcode == 0x6C;
+        // Any write leaves if it hits code, pages become code pages at runtime
+        case MOS6502::Op::STA:
+        case MOS6502::Op::STX:
+        case MOS6502::Op::STY:
+        case MOS6502::Op::INC:
+        case MOS6502::Op::DEC:
+        case MOS6502::Op::ASL:
+        case MOS6502::Op::LSR:
+        case MOS6502::Op::ROL:
+        case MOS6502::Op::ROR:
+            return true;
+        default:
+            return false;
+    }
+}
+
 void Compiler::AddDynJumpTable()
 {
     // Since we modify the insert point while inserting panic block and
     // jump table, we need to restore the insert point before returning
     llvm::BasicBlock* originalInsertPoint = c->builder.GetInsertBlock();
 
-    // Panic Block. Returns -1 for now.
+    // Panic Block. The code for an address that isn't in the table is
+    // compiled at runtime and takes over from here, with the PC being that
+    // address.
     c->panicBlock = llvm::BasicBlock::Create(c->m->getContext(), "PanicBlock",
                                              (llvm::Function*)c->main_fn);
+    c->translateBlock = llvm::BasicBlock::Create(c->m->getContext(), "Translate",
+                                                 (llvm::Function*)c->main_fn);
+    c->codeModifiedBlock = nullptr;
     c->builder.SetInsertPoint(c->panicBlock);
-    c->builder.CreateRet(
-        GetConstant32(-1));  // This block should instead handle the case where the adress
-                             // being jumped to by JMP Indirect does not exist, ie we need
-                             // to create it, add it to the module and to the jumptable,
-                             // and try again. Not it just returns -1.
+    StoreRegisters(c->builder.CreateLoad(c->reg_idr));
+    c->builder.CreateBr(c->translateBlock);
+
+    // Returns -1 if there's no code for the PC
+    c->builder.SetInsertPoint(c->translateBlock);
+    llvm::Value* target = c->builder.CreateCall(c->translate_fn, {c->state_arg});
+    llvm::BasicBlock* fail_block = CreateAutoLabel();
+    llvm::BasicBlock* target_block = CreateAutoLabel();
+    c->builder.CreateCondBr(c->builder.CreateIsNull(target), fail_block, target_block);
+
+    c->builder.SetInsertPoint(fail_block);
+    c->builder.CreateRet(GetConstant32(-1));
+
+    // It returns the exit code of the program. Main and the other targets
+    // have its type, so they don't stay on the stack while it runs.
+    c->builder.SetInsertPoint(target_block);
+    llvm::FunctionType* target_ty =
+        llvm::FunctionType::get(int32, {c->state_ty->getPointerTo()}, false);
+    llvm::Value* target_fn = c->builder.CreateBitCast(target, target_ty->getPointerTo());
+    llvm::CallInst* result = c->builder.CreateCall(target_ty, target_fn, {c->state_arg});
+    if (!generating_subroutine)
+        result->setTailCallKind(llvm::CallInst::TCK_MustTail);
+    c->builder.CreateRet(result);
 
     // Create Dynamic Jump Table
     c->dynJumpBlock = llvm::BasicBlock::Create(c->m->getContext(), "DynJumpTable",
                                                (llvm::Function*)c->main_fn);
     c->builder.SetInsertPoint(c->dynJumpBlock);
     llvm::LoadInst* reg_idr = c->builder.CreateLoad(c->reg_idr, "");
-    // Here, panic block causes a runtime error and crashes.
+    // Addresses without a case are compiled by the panic block
     llvm::SwitchInst* sw =
         c->builder.CreateSwitch(reg_idr, c->panicBlock, c->basicblocks.size());
     for (std::pair<uint16_t, llvm::BasicBlock*> addr : c->basicblocks) {
@@ -451,6 +1082,370 @@ void Compiler::AddDynJumpTable()
     }
     c->builder.SetInsertPoint(originalInsertPoint);
 };
+
+void Compiler::CreateShadowStack()
+{
+    // In the entry block, ahead of its branch
+    llvm::BasicBlock* originalInsertPoint = c->builder.GetInsertBlock();
+    llvm::Function* fn = (llvm::Function*)c->main_fn;
+    c->builder.SetInsertPoint(fn->getEntryBlock().getTerminator());
+
+    c->shadow_addresses = c->builder.CreateAlloca(
+        llvm::ArrayType::get(int32, SHADOW_STACK_SIZE), 0, "ShadowAddresses");
+    c->shadow_blocks = c->builder.CreateAlloca(
+        llvm::ArrayType::get(int8->getPointerTo(), SHADOW_STACK_SIZE), 0,
+        "ShadowBlocks");
+    c->shadow_top = c->builder.CreateAlloca(int8, 0, "ShadowTop");
+    // All ones isn't a 16-bit address, entries that were never pushed don't
+    // match any return
+    c->builder.CreateMemSet(c->shadow_addresses, GetConstant8(0xFF),
+                            SHADOW_STACK_SIZE * sizeof(uint32_t), 4);
+    c->builder.CreateStore(GetConstant8(0), c->shadow_top);
+
+    c->builder.SetInsertPoint(originalInsertPoint);
+}
+
+llvm::Value* Compiler::GetShadowPtr(llvm::AllocaInst* entries, llvm::Value* index)
+{
+    // Indices are signed, the top of the stack isn't
+    llvm::Value* index_32 = c->builder.CreateZExt(index, int32);
+    return c->builder.CreateInBoundsGEP(entries->getAllocatedType(), entries,
+                                        {GetConstant32(0), index_32});
+}
+
+void Compiler::AddResumeBlock()
+{
+    llvm::BasicBlock* originalInsertPoint = c->builder.GetInsertBlock();
+    c->builder.SetInsertPoint(c->resumeBlock);
+
+    LoadRegisters();
+    c->builder.CreateStore(c->builder.CreateLoad(GetRegisterPtr(0)), c->reg_idr);
+    c->builder.CreateBr(c->dynJumpBlock);
+
+    c->builder.SetInsertPoint(originalInsertPoint);
+}
+
+void Compiler::FindSubroutines()
+{
+    for (auto& instr : parse_result.instructions) {
+        if (instr.second->op_type != MOS6502::Op::JSR)
+            continue;
+        uint16_t address = instr.second->target_label.address;
+        if (subroutine_indices.count(address))
+            continue;
+        subroutine_indices[address] = subroutine_addresses.size();
+        subroutine_addresses.push_back(address);
+    }
+    subroutines.assign(subroutine_addresses.size(), compile_subroutine);
+    c->state.subroutines = subroutines.data();
+}
+
+std::map<uint16_t, Instruction*> Compiler::CollectSubroutine(
+    uint16_t address, const std::map<uint16_t, Instruction*>& from) const
+{
+    std::map<uint16_t, Instruction*> instructions;
+    std::vector<uint16_t> pending = {address};
+    while (!pending.empty()) {
+        uint16_t pc = pending.back();
+        pending.pop_back();
+        auto it = from.find(pc);
+        if (it == from.end() || instructions.count(pc))
+            continue;
+        Instruction* instr = it->second;
+        instructions[pc] = instr;
+
+        // Same as the parser, a JSR returns to the next instruction and the
+        // code following an indirect JMP is its target
+        bool is_jump = instr->op_type == MOS6502::Op::JMP;
+        if (is_jump || (MOS6502::IsBranch(instr->op_type) &&
+                        instr->op_type != MOS6502::Op::JSR))
+            pending.push_back(instr->target_label.address);
+
+        bool is_exit = instr->opcode == 0x8D && instr->arg == 0x200F;
+        if (!is_jump && !is_exit && instr->op_type != MOS6502::Op::RTS)
+            pending.push_back(pc + instr->size);
+    }
+    return instructions;
+}
+
+CompiledSubroutine Compiler::CompileSubroutine(int index, const uint8_t* ram)
+{
+    std::lock_guard<std::mutex> lock(compile_mutex);
+    if (subroutines[index] != compile_subroutine)
+        return subroutines[index];
+
+    uint16_t address = subroutine_addresses[index];
+    ParseResult reparsed;
+    const ParseResult* source = &parse_result;
+    if (code_written && ParseAt(address, ram, reparsed))
+        source = &reparsed;
+    std::map<uint16_t, Instruction*> instructions =
+        CollectSubroutine(address, source->instructions);
+    current_code_unit = AddCodeUnit(CodeUnitKind::Subroutine, index, instructions);
+
+    // Named after the unit too, the stale ones are still there
+    std::stringstream name;
+    name << "sub_" << std::hex << address << "_" << std::dec << current_code_unit;
+
+    c->m = c->jitter.create_module(name.str());
+    DeclareRuntimeFunctions();
+    auto fn = llvm::Function::Create(c->subroutine_ty, llvm::Function::ExternalLinkage,
+                                     name.str(), *c->m);
+    c->main_fn = fn;
+    generating_subroutine = true;
+    CreateFunctionEntry(fn);
+    LoadRegisters();
+
+    c->basicblocks.clear();
+    c->return_blocks.clear();
+    PassOne(instructions, source->labels);
+    AddDynJumpTable();
+    c->builder.CreateBr(c->basicblocks[address]);
+    PassTwo(instructions);
+    for (auto& i : reparsed.instructions)
+        delete i.second;
+
+    JITTIR::Jitter::ModuleHandle module = c->jitter.add_module(std::move(c->m));
+    if (!module)
+        printf("Compilation of %s failed!\n", name.str().c_str());
+    code_units[current_code_unit].module = module;
+    CompiledSubroutine fn_ptr =
+        (CompiledSubroutine)c->jitter.get_symbol_address(name.str());
+    // The table keeps pointing here, like translate() a failed compilation ends
+    // the program
+    if (!fn_ptr)
+        return nullptr;
+    subroutines[index] = fn_ptr;
+    compiled_subroutines++;
+    return fn_ptr;
+}
+
+void Compiler::CreateSubroutineCall(uint16_t address, uint16_t return_address)
+{
+    StoreRegisters(GetConstant16(address));
+    // Code that was parsed again may call something that wasn't a subroutine,
+    // it's compiled like the target of an indirect jump
+    auto it = subroutine_indices.find(address);
+    if (it == subroutine_indices.end()) {
+        c->builder.CreateBr(c->translateBlock);
+        c->builder.SetInsertPoint(CreateAutoLabel());
+        return;
+    }
+    int index = it->second;
+
+    llvm::Value* table = c->builder.CreateLoad(GetStatePtr(8));
+    llvm::Value* entry =
+        c->builder.CreateConstInBoundsGEP1_32(int8->getPointerTo(), table, index);
+    llvm::Value* subroutine = c->builder.CreateBitCast(c->builder.CreateLoad(entry),
+                                                       c->subroutine_ty->getPointerTo());
+    llvm::Value* result = c->builder.CreateCall(c->subroutine_ty, subroutine,
+                                                {c->state_arg, GetConstant32(index)});
+
+    // The program may have exited in the subroutine
+    llvm::BasicBlock* exit_block = CreateAutoLabel();
+    llvm::BasicBlock* continue_block = CreateAutoLabel();
+    llvm::Value* returned =
+        c->builder.CreateICmpEQ(result, GetConstant32(SUBROUTINE_RETURNED));
+    c->builder.CreateCondBr(returned, continue_block, exit_block);
+
+    c->builder.SetInsertPoint(exit_block);
+    c->builder.CreateRet(result);
+
+    c->builder.SetInsertPoint(continue_block);
+    LoadRegisters();
+
+    // A subroutine that changed the address on the stack comes back elsewhere
+    llvm::Value* pc = c->builder.CreateLoad(GetRegisterPtr(0));
+    llvm::BasicBlock* return_block = CreateAutoLabel();
+    llvm::BasicBlock* elsewhere_block = CreateAutoLabel();
+    llvm::Value* is_return =
+        c->builder.CreateICmpEQ(pc, GetConstant16(return_address));
+    c->builder.CreateCondBr(is_return, return_block, elsewhere_block);
+
+    c->builder.SetInsertPoint(elsewhere_block);
+    c->builder.CreateStore(pc, c->reg_idr);
+    c->builder.CreateBr(c->dynJumpBlock);
+
+    c->builder.SetInsertPoint(return_block);
+}
+
+void Compiler::CreateSubroutineReturn(llvm::Value* pc)
+{
+    // Main wasn't called by a JSR, it only gets here through an address the
+    // program pushed itself
+    if (!generating_subroutine) {
+        c->builder.CreateStore(pc, c->reg_idr);
+        c->builder.CreateBr(c->dynJumpBlock);
+        return;
+    }
+    StoreRegisters(pc);
+    c->builder.CreateRet(GetConstant32(SUBROUTINE_RETURNED));
+}
+
+CompiledFunction Compiler::CompileTarget(uint16_t pc, const uint8_t* ram)
+{
+    std::lock_guard<std::mutex> lock(compile_mutex);
+    auto it = target_functions.find(pc);
+    if (it != target_functions.end())
+        return it->second;
+
+    // Most likely a jump into data
+    if (MOS6502::DecodeInstruction(ram[pc]).op == MOS6502::Op::IllegalOP)
+        return nullptr;
+
+    ParseResult target;
+    if (!ParseAt(pc, ram, target))
+        return nullptr;
+    current_code_unit = AddCodeUnit(CodeUnitKind::Target, pc, target.instructions);
+
+    std::stringstream name;
+    name << "target_" << std::hex << pc << "_" << std::dec << current_code_unit;
+
+    c->m = c->jitter.create_module(name.str());
+    DeclareRuntimeFunctions();
+    llvm::FunctionType* fn_ty =
+        llvm::FunctionType::get(int32, {c->state_ty->getPointerTo()}, false);
+    auto fn = llvm::Function::Create(fn_ty, llvm::Function::ExternalLinkage,
+                                     name.str(), *c->m);
+    c->main_fn = fn;
+    CreateFunctionEntry(fn);
+    LoadRegisters();
+
+    // A target is compiled like main without SetLazy(), its subroutines are
+    // part of it even if the program is compiled lazily
+    bool was_lazy = lazy;
+    lazy = false;
+    generating_subroutine = false;
+    c->basicblocks.clear();
+    c->return_blocks.clear();
+    PassOne(target.instructions, target.labels);
+    AddDynJumpTable();
+    c->builder.CreateBr(c->basicblocks[pc]);
+    CreateShadowStack();
+    PassTwo(target.instructions);
+    lazy = was_lazy;
+    for (auto& i : target.instructions)
+        delete i.second;
+
+    JITTIR::Jitter::ModuleHandle module = c->jitter.add_module(std::move(c->m));
+    if (!module)
+        printf("Compilation of %s failed!\n", name.str().c_str());
+    code_units[current_code_unit].module = module;
+    CompiledFunction fn_ptr = (CompiledFunction)c->jitter.get_symbol_address(name.str());
+    target_functions[pc] = fn_ptr;
+    compiled_targets++;
+    return fn_ptr;
+}
+
+bool Compiler::ParseAt(uint16_t address, const uint8_t* ram, ParseResult& result)
+{
+    // From the memory as it is now, the program may have written the code
+    try {
+        std::vector<uint8_t> memory(ram, ram + Memory::PAGE_COUNT * Memory::PAGE_SIZE);
+        result = Parser(std::move(memory), 0x0000).ParseFrom(address);
+    }
+    catch (ParseException&) {
+        return false;
+    }
+    // Only the instructions are needed
+    result.memory = std::vector<uint8_t>();
+    return true;
+}
+
+bool Compiler::CodeUnit::Covers(uint16_t address) const
+{
+    auto it = instructions.upper_bound(address);
+    if (it == instructions.begin())
+        return false;
+    --it;
+    return address < it->first + it->second;
+}
+
+int Compiler::AddCodeUnit(CodeUnitKind kind, int key,
+                          const std::map<uint16_t, Instruction*>& instructions)
+{
+    CodeUnit unit = {kind, key, 0, {}};
+    for (auto& pair : instructions)
+        unit.instructions[pair.first] = pair.second->size;
+    MarkCode(instructions);
+    int id = next_code_unit++;
+    code_units[id] = std::move(unit);
+    return id;
+}
+
+void Compiler::MarkCode(const std::map<uint16_t, Instruction*>& instructions)
+{
+    for (auto& pair : instructions) {
+        for (int i = 0; i < pair.second->size; i++) {
+            uint16_t address = pair.first + i;
+            code_bytes[address] = 1;
+            code_pages[address >> 8] = 1;
+        }
+    }
+}
+
+bool Compiler::CodeWritten(uint16_t address, int unit)
+{
+    std::lock_guard<std::mutex> lock(compile_mutex);
+    code_written = true;
+    code_modifications++;
+
+    bool invalidated = false;
+    for (auto it = code_units.begin(); it != code_units.end();) {
+        const CodeUnit& stale = it->second;
+        if (!stale.Covers(address)) {
+            ++it;
+            continue;
+        }
+        // The next call compiles it again
+        if (stale.kind == CodeUnitKind::Subroutine)
+            subroutines[stale.key] = compile_subroutine;
+        else if (stale.kind == CodeUnitKind::Target)
+            target_functions.erase(stale.key);
+        if (stale.kind != CodeUnitKind::Main)
+            stale_modules.push_back(stale.module);
+        it = code_units.erase(it);
+        invalidated = true;
+    }
+    // Lazily, what called 'unit' may be stale too. It leaves and doesn't return
+    // there, the code it continues in is compiled like the target of an
+    // indirect jump.
+    return (lazy && invalidated) || !code_units.count(unit);
+}
+
+void Compiler::RemoveStaleCode()
+{
+    std::lock_guard<std::mutex> lock(compile_mutex);
+    for (JITTIR::Jitter::ModuleHandle module : stale_modules)
+        c->jitter.remove_module(module);
+    stale_modules.clear();
+}
+
+void Compiler::CreateCodeModifiedCheck(uint16_t next_pc)
+{
+    // One block per function, the PC comes from where it's branched from
+    llvm::BasicBlock* insert_block = c->builder.GetInsertBlock();
+    if (!c->codeModifiedBlock) {
+        c->codeModifiedBlock = llvm::BasicBlock::Create(
+            c->m->getContext(), "CodeModified", (llvm::Function*)c->main_fn);
+        c->builder.SetInsertPoint(c->codeModifiedBlock);
+        c->code_modified_pc = c->builder.CreatePHI(int16, 0);
+        StoreRegisters(c->code_modified_pc);
+        c->builder.CreateBr(c->translateBlock);
+        c->builder.SetInsertPoint(insert_block);
+    }
+
+    llvm::Value* modified = c->builder.CreateICmpNE(code_modified, GetConstant8(0));
+    llvm::BasicBlock* continue_block = CreateAutoLabel();
+    c->builder.CreateCondBr(modified, c->codeModifiedBlock, continue_block);
+    c->code_modified_pc->addIncoming(GetConstant16(next_pc), insert_block);
+    c->builder.SetInsertPoint(continue_block);
+}
+
+void Compiler::StoreStatic(llvm::Value* v)
+{
+    WriteMemory(current_instruction->arg, v);
+}
 }  // namespace dynarec
 
 }  // namespace llvmes
@@ -1,15 +1,92 @@
 #pragma once
 
+#include <bitset>
+#include <map>
+#include <mutex>
+
 #include "jitter/jitter.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvmes/console.h"
+#include "llvmes/dynarec/object_cache.h"
 #include "llvmes/dynarec/parser.h"
+#include "llvmes/memory.h"
 
 namespace llvmes {
 namespace dynarec {
 
+/// Registers of the compiled program when it writes to one of the console ports
+/// (0x2008-0x200C) or exits through 0x200F
+struct CheckpointState {
+    uint16_t address;
+    uint8_t reg_a;
+    uint8_t reg_x;
+    uint8_t reg_y;
+    uint8_t reg_sp;
+    uint8_t status;
+};
+
+typedef std::function<void(const CheckpointState&)> CheckpointCallback;
+
+/// Registers to start the compiled program from instead of a reset, e.g. to take
+/// over from the interpreter (see Compiler::SetEntryState())
+struct EntryState {
+    uint16_t pc;
+    uint8_t reg_a;
+    uint8_t reg_x;
+    uint8_t reg_y;
+    uint8_t reg_sp;
+    uint8_t status;
+};
+
+class Compiler;
+struct GuestState;
+
+/// A subroutine compiled on its own (see Compiler::SetLazy()), 'index' is its
+/// entry in GuestState::subroutines. Returns SUBROUTINE_RETURNED after an RTS,
+/// anything else is the exit code of the whole program.
+typedef int (*CompiledSubroutine)(GuestState* state, int index);
+constexpr int SUBROUTINE_RETURNED = -2;
+
+/// What the compiled function runs on, it gets a pointer to it and addresses
+/// memory relative to it. The runtime functions it calls get the pointer as
+/// well. Nothing in the code depends on where an instance is, so the same
+/// function can be run on several instances, also at the same time.
+struct GuestState {
+    // The 64KB address space
+    uint8_t* ram;
+    // Memory::GetWritePages() of 'memory'
+    uint8_t* const* write_pages;
+    // The function starts from 'registers' if 'resume' is set, otherwise from
+    // the reset vector with the registers cleared. When the program exits
+    // through 0x200F, it leaves its registers here.
+    uint8_t resume;
+    EntryState registers;
+    // Only used by the runtime functions. 'memory' maps 'ram', 'checkpoint'
+    // may be null if the code was compiled without checkpoints.
+    Memory* memory;
+    Console* console;
+    const CheckpointCallback* checkpoint;
+    // Compiles code at runtime, the targets of indirect jumps that weren't
+    // known before and, in lazily compiled programs, the subroutines. A
+    // subroutine is called through its entry in 'subroutines', which starts
+    // out as a stub that compiles it.
+    Compiler* compiler;
+    CompiledSubroutine* subroutines;
+    // Non-zero for every byte of the address space code was generated from,
+    // the runtime checks the writes to them (see Compiler::CodeWritten())
+    const uint8_t* code;
+    // Non-zero for every page with any of those bytes. Stores to addresses
+    // known at compile-time look it up when they run, the code compiled
+    // later may be on a page that had none.
+    const uint8_t* code_pages;
+};
+
+/// The compiled program, returns the exit code
+typedef int (*CompiledFunction)(GuestState* state);
+
 struct Compilation {
     JITTIR::Jitter jitter;
     std::unique_ptr<llvm::Module> m;
@@ -29,16 +106,47 @@ struct Compilation {
     llvm::Value* status_b = nullptr;
     llvm::Value* status_u = nullptr;
     llvm::Value* status_d = nullptr;
+    // The function code is generated into, main or a subroutine
     llvm::Value* main_fn = nullptr;
     llvm::Value* putreg_fn = nullptr;
     llvm::Value* putchar_fn = nullptr;
     llvm::Value* putstatus_fn = nullptr;
+    llvm::Value* checkpoint_fn = nullptr;
     llvm::Value* write_fn = nullptr;
     llvm::Value* read_fn = nullptr;
+    llvm::Value* translate_fn = nullptr;
     llvm::BasicBlock* dynJumpBlock = nullptr;
     llvm::BasicBlock* panicBlock = nullptr;
+    llvm::BasicBlock* resumeBlock = nullptr;
+    // Continues in the code the runtime compiles for the PC in the GuestState
+    llvm::BasicBlock* translateBlock = nullptr;
+    // Where an instruction that wrote to its own code leaves the function,
+    // the PC is the next instruction
+    llvm::BasicBlock* codeModifiedBlock = nullptr;
+    llvm::PHINode* code_modified_pc = nullptr;
+    // The shadow return stack of main, what each JSR returns to, see
+    // Compiler::OP_RTS()
+    llvm::AllocaInst* shadow_addresses = nullptr;
+    llvm::AllocaInst* shadow_blocks = nullptr;
+    llvm::Value* shadow_top = nullptr;
+    // The blocks following a JSR, where an RTS can jump directly
+    std::vector<llvm::BasicBlock*> return_blocks;
+    // The argument of main, and what's loaded from it on entry
+    llvm::StructType* state_ty = nullptr;
+    llvm::StructType* registers_ty = nullptr;
+    llvm::FunctionType* subroutine_ty = nullptr;
+    llvm::Value* state_arg = nullptr;
+    llvm::Value* ram_base = nullptr;
+    llvm::Value* write_pages_base = nullptr;
+    llvm::Value* code_pages_base = nullptr;
 
     std::vector<uint8_t> ram;
+    // Memory map over 'ram', used by accesses that aren't resolved at compile-time
+    Memory memory;
+    // Where the program's output goes, written to by putchar, putreg and putstatus
+    Console console;
+    // The instance Compile()'s function runs on
+    GuestState state = {};
 
     std::unordered_map<uint16_t, llvm::BasicBlock*> basicblocks;
 
@@ -48,9 +156,20 @@ struct Compilation {
           builder(m->getContext()),
           ram(mem)
     {
+        ram.resize(Memory::PAGE_COUNT * Memory::PAGE_SIZE);
+        memory.MapRAM(0x00, Memory::PAGE_COUNT, ram.data());
+        state.ram = ram.data();
+        state.write_pages = memory.GetWritePages();
+        state.memory = &memory;
+        state.console = &console;
     }
 };
 
+/// "0", "fast", "1", "2" or "3", throws std::runtime_error for anything else
+JITTIR::OptimizationLevel ParseOptimizationLevel(const std::string& name);
+/// "0" to "3"
+llvm::CodeGenOpt::Level ParseCodeGenOptLevel(const std::string& name);
+
 class Compiler {
     ParseResult parse_result;
     std::unique_ptr<Compilation> c;
@@ -64,21 +183,233 @@ class Compiler {
     llvm::Type* void_ty = nullptr;
 
     int auto_labels = 0;
-    uint16_t current_block_address = 0;
+    // The instruction CodeGen() is generating code for
+    Instruction* current_instruction = nullptr;
+    // Flags N, Z, C and V as bits of the status register, see FindLiveFlags()
+    static constexpr uint8_t FLAG_C = 0x01;
+    static constexpr uint8_t FLAG_Z = 0x02;
+    static constexpr uint8_t FLAG_V = 0x40;
+    static constexpr uint8_t FLAG_N = 0x80;
+    static constexpr uint8_t ALL_FLAGS = FLAG_C | FLAG_Z | FLAG_V | FLAG_N;
+    bool flag_elimination = true;
+    // The flags read after each instruction of the function PassTwo() generates,
+    // and those of the current instruction. A flag that isn't live isn't
+    // stored, it's overwritten before anything reads it.
+    std::unordered_map<uint16_t, uint8_t> live_flags;
+    uint8_t current_live_flags = ALL_FLAGS;
+    int flag_stores = 0;
+    int dead_flag_stores = 0;
+    // Entries of the shadow return stack, the index is an int8 so it wraps
+    // around by itself
+    static constexpr int SHADOW_STACK_SIZE = 256;
+    uint16_t reset_address = 0;
+
+    // Lazy compilation, see SetLazy()
+    bool lazy = false;
+    // Whether code is generated for a subroutine rather than for main
+    bool generating_subroutine = false;
+    std::vector<uint16_t> subroutine_addresses;
+    std::unordered_map<uint16_t, int> subroutine_indices;
+    std::vector<CompiledSubroutine> subroutines;
+    int compiled_subroutines = 0;
+    // Code found at runtime, see CompileTarget(). The functions are the
+    // dispatch table of the runtime.
+    std::unordered_map<uint16_t, CompiledFunction> target_functions;
+    int compiled_targets = 0;
+
+    // Self-modifying code. A code unit is a function with the instructions
+    // it was generated from. Writes to them make it stale (see
+    // CodeWritten()), its module is removed by RemoveStaleCode().
+    enum class CodeUnitKind { Main, Subroutine, Target };
+    struct CodeUnit {
+        CodeUnitKind kind;
+        // The subroutine index or the address of the target
+        int key;
+        JITTIR::Jitter::ModuleHandle module;
+        // Offset and size of every instruction
+        std::map<uint16_t, int> instructions;
+
+        bool Covers(uint16_t address) const;
+    };
+    std::map<int, CodeUnit> code_units;
+    int next_code_unit = 0;
+    // The unit code is generated for, the runtime gets it with every write
+    int current_code_unit = 0;
+    std::vector<JITTIR::Jitter::ModuleHandle> stale_modules;
+    // Set once the program wrote to its code, anything compiled after that is
+    // parsed again from the memory as it is then
+    bool code_written = false;
+    int code_modifications = 0;
+    // Every byte anything was or will be compiled from, and the pages with
+    // any of them. Stores known at compile-time to a page that's a code page
+    // by then always go to the runtime, the others check the page when they
+    // run.
+    std::vector<uint8_t> code_bytes;
+    std::vector<uint8_t> code_pages;
+    // Whether the instruction CodeGen() generates wrote to code, the results
+    // of the write calls or'ed together. Null for no calls.
+    llvm::Value* code_modified = nullptr;
+    // Taken while compiling at runtime, the same code may be needed on
+    // several threads
+    std::mutex compile_mutex;
+
+    CheckpointCallback checkpoint_callback;
+    ObjectCache* object_cache = nullptr;
+    bool cache_hit = false;
+    CompiledFunction compiled_function = nullptr;
 
    public:
     Compiler(ParseResult ast, const std::string& program_name);
     ~Compiler();
 
-    std::function<int()> Compile(bool optimize);
+    /// The function flushes the console when the program returns. 'level'
+    /// picks the IR passes (see JITTIR::OptimizationLevel), 'codegen_level'
+    /// the effort of the machine code generator. Compile time grows with both,
+    /// so short programs are often done sooner at a lower level.
+    std::function<int()> Compile(
+        JITTIR::OptimizationLevel level = JITTIR::OptimizationLevel::None,
+        llvm::CodeGenOpt::Level codegen_level = llvm::CodeGenOpt::Default);
+    /// The function Compile() returned, without the instance bound to it. It
+    /// can run on other instances, e.g. one per thread, as long as the
+    /// compiler is alive. Their 'compiler', 'subroutines', 'code' and
+    /// 'code_pages' have to be the ones of GetGuestState().
+    CompiledFunction GetCompiledFunction() const { return compiled_function; }
+    /// The instance the function Compile() returned runs on
+    GuestState& GetGuestState();
+    /// Output of the program, stdout unless changed with Console::SetOutput()
+    Console& GetConsole();
     std::vector<uint8_t>& GetMemory();
+    /// Memory map used by the runtime read/write helpers. Devices mapped here
+    /// are seen by accesses whose address is only known when running.
+    Memory& GetMemoryMap();
+    /// Snapshot of the memory, see Memory::TakeSnapshot(). The registers live
+    /// in the compiled function, which starts from scratch every time it's run,
+    /// so the memory is all there is to save. Writes the compiled code does to
+    /// addresses known at compile-time check for the protected pages as well.
+    void TakeSnapshot();
+    void RestoreSnapshot();
     void SetDumpDir(const std::string& path);
+    /// Makes the compiled code call 'callback' right before every write to a
+    /// console port and before exiting, e.g. to compare it with the
+    /// interpreter. Has to be set before Compile(), without it no calls are
+    /// generated.
+    void SetCheckpointCallback(CheckpointCallback callback);
+    /// Whether the compiled code can be entered at 'pc', which has to be the
+    /// start of a block
+    bool CanEnterAt(uint16_t pc) const;
+    /// Whether 'ram' holds the bytes the code was compiled from, i.e. the
+    /// program didn't change its code in the copy of memory it's taken from
+    bool CompiledFrom(const uint8_t* ram) const;
+    /// Makes the compiled function start from 'state' rather than from the
+    /// reset vector with the registers cleared. 'state.pc' has to pass
+    /// CanEnterAt().
+    void SetEntryState(const EntryState& state);
+    /// Makes Compile() generate only the code reachable from the reset vector
+    /// without calling a subroutine. Every JSR target is compiled into a
+    /// function of its own when it's first called, so the startup time
+    /// depends on the code that runs rather than on the size of the
+    /// program. Calls and returns cost more, the registers go through the
+    /// GuestState. Has to be set before Compile(), the object cache isn't used
+    /// and the compiled code can't be entered with SetEntryState().
+    void SetLazy(bool enable);
+    /// Number of subroutines compiled so far in lazy mode, and of all the
+    /// subroutines that were found
+    int GetCompiledSubroutineCount() const { return compiled_subroutines; }
+    int GetSubroutineCount() const { return subroutine_addresses.size(); }
+    /// Number of indirect jump targets that weren't known to Compile() and
+    /// were compiled when the program first jumped there
+    int GetRuntimeTargetCount() const { return compiled_targets; }
+    /// Removes the code that was invalidated because the program wrote to the
+    /// instructions it was compiled from. No compiled code may be running,
+    /// Compile()'s function calls it when the program returns. Main is never
+    /// removed, the function pointer has to stay valid.
+    void RemoveStaleCode();
+    /// Number of times the program wrote to code that was compiled
+    int GetCodeModificationCount() const { return code_modifications; }
+    /// Makes the generated code store only the flags that are read before the
+    /// next instruction writing them, on by default. Has to be set before
+    /// Compile().
+    void SetFlagElimination(bool enable);
+    /// Number of flags the instructions compiled so far write, and how many
+    /// of them weren't stored
+    int GetFlagStoreCount() const { return flag_stores; }
+    int GetDeadFlagStoreCount() const { return dead_flag_stores; }
+    /// Makes Compile() look for the program in 'cache' first and store it
+    /// there once it's compiled. The cache isn't owned and has to outlive the
+    /// compiler.
+    void SetObjectCache(ObjectCache* cache);
+    /// Whether Compile() found the program in the object cache
+    bool IsCacheHit() const { return cache_hit; }
 
    private:
     void CodeGen(Instruction& i);
-    void PassOne();
-    void PassTwo();
+    // Blocks for the labels and the return sites within 'instructions', then
+    // their code
+    void PassOne(const std::map<uint16_t, Instruction*>& instructions,
+                 const std::map<uint16_t, Label>& labels);
+    void PassTwo(const std::map<uint16_t, Instruction*>& instructions);
+    // Fills 'live_flags' for 'instructions', all flags are live wherever the
+    // code may leave the function or continue outside of them
+    void FindLiveFlags(const std::map<uint16_t, Instruction*>& instructions);
+    // The flags 'instr' reads and the ones it always writes, as CodeGen()
+    // generates it
+    void GetFlagEffects(const Instruction& instr, uint8_t& uses, uint8_t& defines) const;
+    // Whether the function may be left right after 'instr', because it
+    // continues at an address only known when running or wrote to code
+    bool MayLeaveAfter(const Instruction& instr) const;
     void AddDynJumpTable();
+    void AddResumeBlock();
+    // Allocates the shadow return stack in the entry block of main
+    void CreateShadowStack();
+    llvm::Value* GetShadowPtr(llvm::AllocaInst* entries, llvm::Value* index);
+    // Declares the runtime functions in the current module
+    void DeclareRuntimeFunctions();
+    // The entry block of 'fn' with the registers and the bases of the
+    // GuestState, leaves the insert point at the end of it
+    void CreateFunctionEntry(llvm::Function* fn);
+
+    // Lazy compilation
+    void FindSubroutines();
+    // Everything in 'from' reachable from 'address' without following JSR
+    std::map<uint16_t, Instruction*> CollectSubroutine(
+        uint16_t address, const std::map<uint16_t, Instruction*>& from) const;
+    // Compiles subroutine 'index' into a module of its own and puts it in the
+    // table, unless that happened already. 'ram' is parsed again if the
+    // program wrote to its code. Null if it doesn't compile.
+    CompiledSubroutine CompileSubroutine(int index, const uint8_t* ram);
+    // Calls the subroutine at 'address' through the table, returns if the
+    // program exited in it, otherwise continues with the registers it left.
+    // That's at 'return_address' unless the subroutine returned elsewhere.
+    void CreateSubroutineCall(uint16_t address, uint16_t return_address);
+    // Returns to the caller, which continues at 'pc'
+    void CreateSubroutineReturn(llvm::Value* pc);
+    friend int compile_subroutine(GuestState* state, int index);
+
+    // The code from 'pc' on in 'ram' as a function of its own, which starts
+    // from the registers in the GuestState. Null if it can't be parsed.
+    CompiledFunction CompileTarget(uint16_t pc, const uint8_t* ram);
+    friend CompiledFunction translate(GuestState* state);
+    // Everything reachable from 'address' in 'ram', false if it can't be
+    // parsed. The instructions are the caller's to delete.
+    bool ParseAt(uint16_t address, const uint8_t* ram, ParseResult& result);
+
+    // Self-modifying code
+    // Registers the unit code is about to be generated for, the module is
+    // set once it's compiled. Returns its key in 'code_units'.
+    int AddCodeUnit(CodeUnitKind kind, int key,
+                    const std::map<uint16_t, Instruction*>& instructions);
+    void MarkCode(const std::map<uint16_t, Instruction*>& instructions);
+    // Called by the runtime when the program changed a byte in 'code'. The
+    // units with that byte are stale from now on, they aren't called anymore.
+    // Returns whether 'unit', the one that wrote, is stale.
+    bool CodeWritten(uint16_t address, int unit);
+    friend int8_t write_memory(GuestState* state, int16_t addr, int8_t val, int32_t unit);
+    // Leaves the function if the instruction just generated wrote to code,
+    // the code for 'next_pc' is compiled again and continues from there
+    void CreateCodeModifiedCheck(uint16_t next_pc);
+    // Everything besides the program that changes the generated code
+    std::string GetCacheOptions(JITTIR::OptimizationLevel level,
+                                llvm::CodeGenOpt::Level codegen_level) const;
 
     llvm::Constant* GetConstant1(bool v) { return llvm::ConstantInt::get(int1, v); }
     llvm::Constant* GetConstant8(uint8_t v) { return llvm::ConstantInt::get(int8, v); }
@@ -97,23 +428,42 @@ class Compiler {
     void DynamicTestN(llvm::Value* v);
     void DynamicTestN16(llvm::Value* v);
     void DynamicTestCCmp(llvm::Value* v);
-    // Calculates the ram-address as a constant-expr
+    // Whether the current instruction has to store 'flag'
+    bool IsFlagLive(uint8_t flag) const { return current_live_flags & flag; }
+    // Pointer into the guest's RAM, an offset from the base loaded on entry
     llvm::Value* GetRAMPtr(uint16_t addr);
     llvm::Value* GetRAMPtr16(uint16_t addr);
 
-    // Can be called by LLVM on runtime
-    void Write(uint16_t addr, uint8_t val) { c->ram[addr] = val; }
-    uint16_t Read(uint16_t addr) { return c->ram[addr]; }
-
-    friend void write_memory(int16_t addr, int8_t data);
-    friend int8_t read_memory(int16_t addr);
+    // Calls to the runtime functions, for addresses only known when running.
+    // CreateWrite() leaves the function after the instruction if it wrote to
+    // code (see CreateCodeModifiedCheck()), CallWrite() doesn't.
+    llvm::Value* CreateRead(llvm::Value* addr);
+    void CreateWrite(llvm::Value* addr, llvm::Value* v);
+    llvm::Value* CallWrite(llvm::Value* addr, llvm::Value* v);
 
     // These two functions are used to write/read -
     // to addresses that are known on compile-time
     void WriteMemory(uint16_t addr, llvm::Value* v);
+    // Stores to the current instruction's address, the one its addressing
+    // mode gave at compile-time, through WriteMemory()
+    void StoreStatic(llvm::Value* v);
     llvm::Value* ReadMemory(uint16_t addr);
     llvm::Value* ReadMemory16(uint16_t addr);
 
+    // The status register put together from the flags
+    llvm::Value* CreateStatus();
+    // Sets all flags from a status register
+    void StoreStatus(llvm::Value* status);
+    // Pointers to the fields of the GuestState and of its registers, in the
+    // order they're declared in
+    llvm::Value* GetStatePtr(unsigned field);
+    llvm::Value* GetRegisterPtr(unsigned field);
+    // Leaves the registers in the GuestState for whoever called the function
+    void StoreRegisters(llvm::Value* pc);
+    // Takes the registers from the GuestState, except for the PC
+    void LoadRegisters();
+    void CreateCheckpoint(uint16_t addr);
+
     llvm::Value* GetStackAddress(llvm::Value* sp);
     void StackPush(llvm::Value* v);
     llvm::Value* StackPull();
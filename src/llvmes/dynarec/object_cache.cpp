@@ -0,0 +1,170 @@
+#include "llvmes/dynarec/object_cache.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Host.h"
+#include "llvmes/hash.h"
+
+namespace fs = std::filesystem;
+
+namespace llvmes {
+namespace dynarec {
+
+// Part of the key, changes whenever the compiler generates different code for
+// the same options
+static constexpr int CACHE_VERSION = 6;
+
+static const char* OBJECT_EXTENSION = ".o";
+
+ObjectCache::ObjectCache(const std::string& directory, std::uint64_t max_size)
+    : m_directory(directory), m_max_size(max_size)
+{
+    std::error_code error;
+    fs::create_directories(m_directory, error);
+    if (error)
+        throw std::runtime_error("Can't create the cache directory " + m_directory +
+                                 ": " + error.message());
+}
+
+std::string ObjectCache::GetKey(const std::vector<std::uint8_t>& memory,
+                                const std::string& options)
+{
+    std::string host = std::to_string(CACHE_VERSION) + " " + LLVM_VERSION_STRING + " " +
+                       llvm::sys::getHostCPUName().str() + " " + options;
+
+    // Sorted, the order of a StringMap isn't fixed
+    llvm::StringMap<bool> feature_map;
+    std::vector<std::string> features;
+    if (llvm::sys::getHostCPUFeatures(feature_map)) {
+        for (const auto& feature : feature_map)
+            features.push_back((feature.second ? "+" : "-") + feature.first().str());
+        std::sort(features.begin(), features.end());
+    }
+    for (const auto& feature : features)
+        host += " " + feature;
+
+    std::uint64_t hash = Hash64(host.data(), host.size());
+    hash = Hash64(memory.data(), memory.size(), hash);
+    std::stringstream key;
+    key << std::hex << std::setfill('0') << std::setw(16) << hash;
+    return key.str();
+}
+
+std::string ObjectCache::GetPath(const std::string& key) const
+{
+    return (fs::path(m_directory) / (key + OBJECT_EXTENSION)).string();
+}
+
+std::unique_ptr<llvm::MemoryBuffer> ObjectCache::Load(const std::string& key)
+{
+    std::string path = GetPath(key);
+    auto buffer = llvm::MemoryBuffer::getFile(path, -1, false);
+    if (!buffer)
+        return nullptr;
+
+    // Keeps it from being evicted for a while
+    std::error_code error;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+    return std::move(*buffer);
+}
+
+void ObjectCache::Store(const std::string& key, llvm::MemoryBufferRef object)
+{
+    // Written next to the object and renamed over it, so other processes
+    // never load half of it
+    std::string path = GetPath(key);
+    std::string temporary_path = path + ".tmp" + std::to_string(std::random_device()());
+    {
+        std::ofstream file(temporary_path, std::ios::binary);
+        file.write(object.getBufferStart(), object.getBufferSize());
+        if (!file) {
+            std::error_code error;
+            fs::remove(temporary_path, error);
+            return;
+        }
+    }
+
+    std::error_code error;
+    fs::rename(temporary_path, path, error);
+    if (error) {
+        fs::remove(temporary_path, error);
+        return;
+    }
+    Evict();
+}
+
+std::uint64_t ObjectCache::GetSize() const
+{
+    std::uint64_t size = 0;
+    std::error_code error;
+    for (const auto& entry : fs::directory_iterator(m_directory, error)) {
+        if (entry.path().extension() == OBJECT_EXTENSION)
+            size += entry.file_size(error);
+    }
+    return size;
+}
+
+void ObjectCache::Clear()
+{
+    std::error_code error;
+    for (const auto& entry : fs::directory_iterator(m_directory, error)) {
+        if (entry.path().extension() == OBJECT_EXTENSION)
+            fs::remove(entry.path(), error);
+    }
+}
+
+void ObjectCache::Evict()
+{
+    struct Entry {
+        fs::path path;
+        fs::file_time_type time;
+        std::uint64_t size;
+    };
+
+    std::vector<Entry> entries;
+    std::uint64_t size = 0;
+    std::error_code error;
+    for (const auto& entry : fs::directory_iterator(m_directory, error)) {
+        if (entry.path().extension() != OBJECT_EXTENSION)
+            continue;
+        entries.push_back({entry.path(), entry.last_write_time(error),
+                           entry.file_size(error)});
+        size += entries.back().size;
+    }
+    if (size <= m_max_size)
+        return;
+
+    // Least recently used first. The newest object stays even if it's too big
+    // on its own, it was just stored to be used.
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry& a, const Entry& b) { return a.time < b.time; });
+    for (std::size_t i = 0; i + 1 < entries.size() && size > m_max_size; i++) {
+        if (fs::remove(entries[i].path, error))
+            size -= entries[i].size;
+    }
+}
+
+void ObjectCache::notifyObjectCompiled(const llvm::Module* module,
+                                       llvm::MemoryBufferRef object)
+{
+    Store(module->getModuleIdentifier(), object);
+}
+
+std::unique_ptr<llvm::MemoryBuffer> ObjectCache::getObject(const llvm::Module*)
+{
+    // Compiler::Compile() looks the program up before it generates any IR, a
+    // module only gets here when there was nothing to load
+    return nullptr;
+}
+
+}  // namespace dynarec
+}  // namespace llvmes
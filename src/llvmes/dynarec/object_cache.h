@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace llvmes {
+namespace dynarec {
+
+/// Object files of compiled programs, kept in a directory so they survive the
+/// process. An object is stored under a key (see GetKey()) that covers
+/// everything the machine code depends on, so a program run again with the
+/// same options only has to be linked. The compiled code reaches memory only
+/// through the GuestState it's given, and the runtime functions through
+/// symbols the compiler registers, so nothing in an object is specific to the
+/// process that compiled it.
+///
+/// The directory is kept below a size limit by removing the objects that were
+/// used least recently, objects are touched every time they're loaded.
+class ObjectCache : public llvm::ObjectCache {
+   public:
+    constexpr static std::uint64_t DEFAULT_MAX_SIZE = 64 * 1024 * 1024;
+
+    /// Creates 'directory' if it doesn't exist, throws std::runtime_error if it
+    /// can't be created
+    explicit ObjectCache(const std::string& directory,
+                         std::uint64_t max_size = DEFAULT_MAX_SIZE);
+
+    /// Hash of the 64KB the program was parsed from, 'options' and the host:
+    /// the LLVM version, the CPU and its features
+    static std::string GetKey(const std::vector<std::uint8_t>& memory,
+                              const std::string& options);
+
+    /// Null if there's no object for 'key'
+    std::unique_ptr<llvm::MemoryBuffer> Load(const std::string& key);
+    /// Replaces the object for 'key', then evicts objects if the cache is full
+    void Store(const std::string& key, llvm::MemoryBufferRef object);
+
+    /// Total size of the objects in the directory
+    std::uint64_t GetSize() const;
+    /// Removes everything in the cache
+    void Clear();
+
+    // llvm::ObjectCache, called by the JIT with the module named after the key
+    void notifyObjectCompiled(const llvm::Module* module,
+                              llvm::MemoryBufferRef object) override;
+    std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module* module) override;
+
+   private:
+    std::string GetPath(const std::string& key) const;
+    void Evict();
+
+    std::string m_directory;
+    std::uint64_t m_max_size;
+};
+
+}  // namespace dynarec
+}  // namespace llvmes
@@ -9,7 +9,7 @@ Parser::Parser(std::vector<uint8_t>&& data_in, uint16_t start_location)
     : data(0x10000), program_size(data_in.size()), start_location(start_location)
 {
     auto temp = std::move(data_in);
-    if (start_location + program_size >= 0xFFFF)
+    if (start_location + program_size > data.size())
         throw ParseException("Program doesn't fit in that space");
     std::copy(temp.begin(), temp.end(), data.begin() + start_location);
 }
@@ -156,7 +156,17 @@ ParseResult Parser::Parse()
     uint16_t reset = data[0xFFFC] | (data[0xFFFD] << 8);
     reset_address = reset;
     labels[reset_address] = {reset_address, "Reset"};
-    index = reset_address;
+    return ParseFrom(reset_address);
+}
+
+ParseResult Parser::ParseFrom(uint16_t address)
+{
+    if (!labels.count(address)) {
+        std::stringstream ss;
+        ss << "Entry " << ToHexString(address);
+        labels[address] = {address, ss.str()};
+    }
+    index = address;
     branches.push(index);
 
     do {
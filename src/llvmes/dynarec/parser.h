@@ -73,7 +73,11 @@ class Parser {
 
    public:
     Parser(std::vector<uint8_t>&& data_in, uint16_t start_location);
+    /// Everything reachable from the reset vector
     ParseResult Parse();
+    /// Everything reachable from 'address', e.g. the target of an indirect
+    /// jump only known at runtime
+    ParseResult ParseFrom(uint16_t address);
 };
 }  // namespace dynarec
 }  // namespace llvmes
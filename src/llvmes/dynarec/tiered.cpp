@@ -0,0 +1,158 @@
+#include "llvmes/dynarec/tiered.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "llvmes/dynarec/parser.h"
+
+namespace llvmes {
+namespace dynarec {
+
+TieredEngine::TieredEngine(const std::vector<std::uint8_t>& program,
+                           const std::string& program_name)
+    : m_program(program),
+      m_program_name(program_name),
+      m_cpu(std::make_unique<BasicCPU<Memory>>()),
+      m_out(&std::cout),
+      m_exited(false),
+      m_exit_code(-1),
+      m_hot_threshold(DEFAULT_HOT_THRESHOLD),
+      m_level(JITTIR::OptimizationLevel::Fast),
+      m_compile_ms(0),
+      m_compiled(false),
+      m_switched(false)
+{
+    std::size_t size = std::min<std::size_t>(program.size(), 0x8000);
+    std::copy(program.begin(), program.begin() + size, &m_cpu->GetRAM()[0x8000]);
+    m_cpu->MapDevice(0x20, 1, nullptr, [this](std::uint16_t addr, std::uint8_t data) {
+        WriteDevice(addr, data);
+    });
+}
+
+TieredEngine::~TieredEngine()
+{
+    if (m_compile_thread.joinable())
+        m_compile_thread.join();
+}
+
+void TieredEngine::SetOutput(std::ostream* out)
+{
+    m_out = out;
+    m_console.SetOutput(out);
+}
+
+// Same ports as the interpreter tool
+void TieredEngine::WriteDevice(std::uint16_t addr, std::uint8_t data)
+{
+    switch (addr) {
+        case 0x2008:
+            m_console.PutChar(m_cpu->reg_a);
+            break;
+        case 0x2009:
+            m_console.PutHex(m_cpu->reg_a);
+            break;
+        case 0x200A:
+            m_console.PutHex(m_cpu->reg_x);
+            break;
+        case 0x200B:
+            m_console.PutHex(m_cpu->reg_y);
+            break;
+        case 0x200C:
+            m_console.PutHex(m_cpu->GetStatus());
+            break;
+        case 0x200F:
+            m_exited = true;
+            m_exit_code = m_cpu->reg_a;
+            m_cpu->Halt();
+            break;
+        default:
+            m_cpu->GetRAM()[addr] = data;
+    }
+}
+
+int TieredEngine::Run()
+{
+    m_cpu->Reset();
+    while (!m_exited) {
+        // Halted by something other than 0x200F
+        if (m_cpu->RunFor(SLICE_CYCLES) < SLICE_CYCLES && !m_exited)
+            break;
+        if (m_exited)
+            break;
+
+        if (!m_compile_thread.joinable() &&
+            m_cpu->GetInstructionCount() >= m_hot_threshold)
+            StartCompiling();
+        if (m_compiled.load(std::memory_order_acquire) && m_native && SwitchToNative())
+            return m_exit_code;
+    }
+    m_console.Flush();
+    return m_exit_code;
+}
+
+void TieredEngine::StartCompiling()
+{
+    m_compile_thread = std::thread([this] {
+        auto start = std::chrono::steady_clock::now();
+        try {
+            Parser parser(std::vector<std::uint8_t>(m_program), 0x8000);
+            m_compiler = std::make_unique<Compiler>(parser.Parse(), m_program_name);
+            m_native = m_compiler->Compile(m_level);
+        }
+        catch (std::exception&) {
+            // The interpreter just keeps going
+            m_compiler.reset();
+            m_native = nullptr;
+        }
+        auto stop = std::chrono::steady_clock::now();
+        m_compile_ms = std::chrono::duration<double, std::milli>(stop - start).count();
+        m_compiled.store(true, std::memory_order_release);
+    });
+}
+
+bool TieredEngine::SwitchToNative()
+{
+    // The compiled code can only be entered at the start of a block. Inside a
+    // subroutine is fine, its return address is on the stack and the return
+    // goes through the jump table as the shadow stack has no entry for it.
+    unsigned int steps = 0;
+    while (!m_compiler->CanEnterAt(m_cpu->reg_pc)) {
+        if (++steps > MAX_SWITCH_STEPS)
+            return false;
+        m_cpu->Step();
+        if (m_exited)
+            return false;
+    }
+
+    // The program was parsed as it was loaded, if it has changed its code since
+    // then the interpreter runs it to the end
+    if (!m_compiler->CompiledFrom(m_cpu->GetRAM())) {
+        m_native = nullptr;
+        return false;
+    }
+
+    // The interpreter's output comes first
+    m_console.Flush();
+    m_compiler->GetConsole().SetOutput(m_out);
+
+    std::vector<std::uint8_t>& memory = m_compiler->GetMemory();
+    std::copy(m_cpu->GetRAM(), m_cpu->GetRAM() + memory.size(), memory.begin());
+    std::uint8_t status = m_cpu->GetStatus();
+    m_compiler->SetEntryState({m_cpu->reg_pc, m_cpu->reg_a, m_cpu->reg_x, m_cpu->reg_y,
+                               m_cpu->reg_sp, status});
+
+    m_switched = true;
+    m_exited = true;
+    m_exit_code = m_native();
+    return true;
+}
+
+const std::uint8_t* TieredEngine::GetMemory()
+{
+    if (m_switched)
+        return m_compiler->GetMemory().data();
+    return m_cpu->GetRAM();
+}
+
+}  // namespace dynarec
+}  // namespace llvmes
@@ -0,0 +1,88 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "llvmes/console.h"
+#include "llvmes/dynarec/compiler.h"
+#include "llvmes/interpreter/cpu.h"
+
+namespace llvmes {
+namespace dynarec {
+
+/// Runs a program on the interpreter right away and only compiles it once it
+/// has been running for a while, so short programs never pay for the JIT.
+/// Compilation happens on a background thread while the interpreter keeps
+/// going. Once it's done, the interpreter steps to the start of a block the
+/// compiled code has an entry for and hands its registers and memory over (see
+/// Compiler::SetEntryState()); the rest of the program runs natively. A
+/// program that changed its code by then stays on the interpreter.
+class TieredEngine {
+   public:
+    /// Instructions interpreted before compilation starts
+    constexpr static std::uint64_t DEFAULT_HOT_THRESHOLD = 1000000;
+
+    /// 'program' is loaded at 0x8000, like in the other tools
+    TieredEngine(const std::vector<std::uint8_t>& program,
+                 const std::string& program_name);
+    /// Waits for a compilation that's still running
+    ~TieredEngine();
+    TieredEngine(const TieredEngine&) = delete;
+    TieredEngine& operator=(const TieredEngine&) = delete;
+
+    void SetHotThreshold(std::uint64_t instructions) { m_hot_threshold = instructions; }
+    void SetOptimizationLevel(JITTIR::OptimizationLevel level) { m_level = level; }
+    /// Output of both tiers, see Console
+    void SetOutput(std::ostream* out);
+
+    /// Runs the program until it exits through 0x200F and returns its exit
+    /// code, or -1 if the interpreter stopped for another reason
+    int Run();
+
+    /// Instructions executed by the interpreter before the switch
+    std::uint64_t GetInterpretedInstructions() const
+    {
+        return m_cpu->GetInstructionCount();
+    }
+    bool RanNatively() const { return m_switched; }
+    /// Time the background thread spent parsing and compiling, 0 if it didn't
+    double GetCompileMilliseconds() const { return m_compile_ms; }
+    /// The memory of whichever tier ran last
+    const std::uint8_t* GetMemory();
+
+   private:
+    // The interpreter runs in slices of this many cycles, in between it checks
+    // whether the program got hot or the compiled code is ready
+    constexpr static std::uint64_t SLICE_CYCLES = 10000;
+    // Instructions to step looking for a block to enter the compiled code at
+    constexpr static unsigned int MAX_SWITCH_STEPS = 1000;
+
+    void WriteDevice(std::uint16_t addr, std::uint8_t data);
+    void StartCompiling();
+    // Returns true if the program ran to the end natively
+    bool SwitchToNative();
+
+    std::vector<std::uint8_t> m_program;
+    std::string m_program_name;
+    std::unique_ptr<BasicCPU<Memory>> m_cpu;
+    Console m_console;
+    std::ostream* m_out;
+    bool m_exited;
+    int m_exit_code;
+
+    std::uint64_t m_hot_threshold;
+    JITTIR::OptimizationLevel m_level;
+    // Written by the compile thread, which publishes them through m_compiled
+    std::unique_ptr<Compiler> m_compiler;
+    std::function<int()> m_native;
+    double m_compile_ms;
+    std::atomic<bool> m_compiled;
+    std::thread m_compile_thread;
+    bool m_switched;
+};
+
+}  // namespace dynarec
+}  // namespace llvmes
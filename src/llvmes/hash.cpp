@@ -0,0 +1,123 @@
+#include "llvmes/hash.h"
+
+#include <cstring>
+
+namespace llvmes {
+
+static constexpr std::uint64_t PRIME_1 = 0x9E3779B185EBCA87;
+static constexpr std::uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4F;
+static constexpr std::uint64_t PRIME_3 = 0x165667B19E3779F9;
+static constexpr std::uint64_t PRIME_4 = 0x85EBCA77C2B2AE63;
+static constexpr std::uint64_t PRIME_5 = 0x27D4EB2F165667C5;
+
+static inline std::uint64_t RotateLeft(std::uint64_t value, unsigned int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Little endian, like the hosts the JIT runs on
+static inline std::uint64_t Load64(const std::uint8_t* data)
+{
+    std::uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline std::uint32_t Load32(const std::uint8_t* data)
+{
+    std::uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline std::uint64_t Round(std::uint64_t accumulator, std::uint64_t input)
+{
+    accumulator += input * PRIME_2;
+    return RotateLeft(accumulator, 31) * PRIME_1;
+}
+
+static inline std::uint64_t MergeRound(std::uint64_t hash, std::uint64_t accumulator)
+{
+    hash ^= Round(0, accumulator);
+    return hash * PRIME_1 + PRIME_4;
+}
+
+std::uint64_t Hash64(const void* data, std::size_t size, std::uint64_t seed)
+{
+    const std::uint8_t* p = static_cast<const std::uint8_t*>(data);
+    const std::uint8_t* end = p + size;
+    std::uint64_t hash;
+
+    if (size >= 32) {
+        std::uint64_t v1 = seed + PRIME_1 + PRIME_2;
+        std::uint64_t v2 = seed + PRIME_2;
+        std::uint64_t v3 = seed;
+        std::uint64_t v4 = seed - PRIME_1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = Round(v1, Load64(p));
+            v2 = Round(v2, Load64(p + 8));
+            v3 = Round(v3, Load64(p + 16));
+            v4 = Round(v4, Load64(p + 24));
+        }
+        hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) +
+               RotateLeft(v4, 18);
+        hash = MergeRound(hash, v1);
+        hash = MergeRound(hash, v2);
+        hash = MergeRound(hash, v3);
+        hash = MergeRound(hash, v4);
+    }
+    else {
+        hash = seed + PRIME_5;
+    }
+
+    hash += size;
+    for (; p + 8 <= end; p += 8) {
+        hash ^= Round(0, Load64(p));
+        hash = RotateLeft(hash, 27) * PRIME_1 + PRIME_4;
+    }
+    if (p + 4 <= end) {
+        hash ^= Load32(p) * PRIME_1;
+        hash = RotateLeft(hash, 23) * PRIME_2 + PRIME_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        hash ^= *p * PRIME_5;
+        hash = RotateLeft(hash, 11) * PRIME_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME_2;
+    hash ^= hash >> 29;
+    hash *= PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+MemoryHasher::MemoryHasher()
+    : m_memory(PAGE_COUNT * PAGE_SIZE), m_page_hashes(), m_ignored(), m_valid(false)
+{
+}
+
+std::uint64_t MemoryHasher::Update(const std::uint8_t* memory)
+{
+    for (unsigned int page = 0; page < PAGE_COUNT; page++) {
+        if (m_ignored[page])
+            continue;
+        const std::uint8_t* current = &memory[page * PAGE_SIZE];
+        std::uint8_t* copy = &m_memory[page * PAGE_SIZE];
+        if (m_valid && std::memcmp(current, copy, PAGE_SIZE) == 0)
+            continue;
+        std::memcpy(copy, current, PAGE_SIZE);
+        m_page_hashes[page] = Hash64(copy, PAGE_SIZE, page);
+    }
+    m_valid = true;
+    return Hash64(m_page_hashes.data(), sizeof(m_page_hashes));
+}
+
+void MemoryHasher::IgnorePage(std::uint8_t page)
+{
+    m_ignored[page] = true;
+    m_page_hashes[page] = 0;
+}
+
+}  // namespace llvmes
@@ -0,0 +1,37 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace llvmes {
+
+/// XXH64 of 'size' bytes, works through 32 bytes at a time in four independent
+/// lanes
+std::uint64_t Hash64(const void* data, std::size_t size, std::uint64_t seed = 0);
+
+/// Hashes the 64KB address space over and over, e.g. at every checkpoint of a
+/// co-simulation. Every page keeps its hash and the contents it was computed
+/// from, and only pages that differ from those are hashed again. Comparing a
+/// page is a memcmp(), which is a lot cheaper than hashing it.
+class MemoryHasher {
+   public:
+    constexpr static unsigned int PAGE_SIZE = 0x100;
+    constexpr static unsigned int PAGE_COUNT = 0x100;
+
+    MemoryHasher();
+    /// Hash of the 64KB at 'memory', which is indexed by the full 16 bit address
+    std::uint64_t Update(const std::uint8_t* memory);
+    /// Leaves the page out of the hash
+    void IgnorePage(std::uint8_t page);
+    bool IsIgnored(std::uint8_t page) const { return m_ignored[page]; }
+
+   private:
+    std::vector<std::uint8_t> m_memory;
+    std::array<std::uint64_t, PAGE_COUNT> m_page_hashes;
+    std::array<bool, PAGE_COUNT> m_ignored;
+    // Before the first Update() the copy doesn't mean anything
+    bool m_valid;
+};
+
+}  // namespace llvmes
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace llvmes {
+
+typedef std::function<std::uint8_t(std::uint16_t)> BusRead;
+typedef std::function<void(std::uint16_t, std::uint8_t)> BusWrite;
+
+// The CPU is parameterized on a bus policy which it inherits from. A policy has
+// to provide a Read(addr) and a Write(addr, data) that can be called like
+// functions. Since the policy is known at compile-time, accesses through the
+// non-callback policies are inlined straight into the opcode handlers. The
+// paged memory map in llvmes/memory.h is a policy as well.
+
+/// Every access is forwarded to user supplied callbacks. This is the original
+/// interface of the CPU: assign 'Read' and 'Write' before calling Reset().
+struct CallbackBus {
+    BusRead Read;
+    BusWrite Write;
+};
+
+/// 64KB of plain RAM and nothing else. Useful when the program doesn't talk to
+/// any devices, e.g. for pure computations driven by the test harness.
+struct FlatRAMBus {
+    std::vector<std::uint8_t> ram;
+
+    FlatRAMBus() : ram(0x10000) {}
+
+    std::uint8_t Read(std::uint16_t addr) const { return ram[addr]; }
+    void Write(std::uint16_t addr, std::uint8_t data) { ram[addr] = data; }
+};
+
+/// 64KB of RAM with a single window of device addresses. Accesses inside the
+/// window go to the device callbacks, everything else hits RAM directly, which
+/// costs a single compare on the fast path.
+struct MMIOBus {
+    std::vector<std::uint8_t> ram;
+    // Device window is [mmio_begin, mmio_begin + mmio_size)
+    std::uint16_t mmio_begin;
+    std::uint16_t mmio_size;
+    BusRead ReadDevice;
+    BusWrite WriteDevice;
+
+    MMIOBus() : ram(0x10000), mmio_begin(0), mmio_size(0) {}
+
+    void MapDevice(std::uint16_t begin, std::uint16_t size, BusRead read, BusWrite write)
+    {
+        mmio_begin = begin;
+        mmio_size = size;
+        ReadDevice = std::move(read);
+        WriteDevice = std::move(write);
+    }
+
+    std::uint8_t Read(std::uint16_t addr) const
+    {
+        if (static_cast<std::uint16_t>(addr - mmio_begin) < mmio_size)
+            return ReadDevice ? ReadDevice(addr) : ram[addr];
+        return ram[addr];
+    }
+
+    void Write(std::uint16_t addr, std::uint8_t data)
+    {
+        if (static_cast<std::uint16_t>(addr - mmio_begin) < mmio_size) {
+            if (WriteDevice)
+                WriteDevice(addr, data);
+            return;
+        }
+        ram[addr] = data;
+    }
+};
+
+}  // namespace llvmes
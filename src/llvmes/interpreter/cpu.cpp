@@ -1,200 +1,283 @@
 #include "llvmes/interpreter/cpu.h"
 
+#include <algorithm>
 #include <bitset>
 #include <iostream>
 #include <map>
+#include <type_traits>
 
 namespace llvmes {
-CPU::CPU()
+template <typename Bus, typename Flags, typename Trace>
+BasicCPU<Bus, Flags, Trace>::BasicCPU()
     : reg_x(0),
       reg_y(0),
       reg_a(0),
       reg_sp(0xFD),
       reg_pc(0),
       reg_status(0x34),
-      m_instruction_table(0x100),
+      m_code_pages(),
+      m_fusion(true),
+      m_fusion_counts(),
+      m_instruction_count(0),
+      m_cycles(0),
+      m_deadline(0),
+      m_run_end(0),
+      m_flags(),
       m_irq(false),
       m_nmi(false),
+      m_trace(),
+      m_trace_record(),
+      m_snapshot(),
       m_illegal_opcode(false),
-      m_address(0),
       m_should_run(false)
 {
-    for (auto& it : m_instruction_table)
-        it = {&CPU::AddressModeImplied, &CPU::IllegalOP, "Illegal OP"};
-
-    m_instruction_table[0xD0] = {&CPU::AddressModeImmediate, &CPU::OP_BNE, "BNE"};
-    m_instruction_table[0xF0] = {&CPU::AddressModeImmediate, &CPU::OP_BEQ, "BEQ"};
-    m_instruction_table[0x30] = {&CPU::AddressModeImmediate, &CPU::OP_BMI, "BMI"};
-    m_instruction_table[0x90] = {&CPU::AddressModeImmediate, &CPU::OP_BCC, "BCC"};
-    m_instruction_table[0xB0] = {&CPU::AddressModeImmediate, &CPU::OP_BCS, "BCS"};
-    m_instruction_table[0x10] = {&CPU::AddressModeImmediate, &CPU::OP_BPL, "BPL"};
-    m_instruction_table[0x50] = {&CPU::AddressModeImmediate, &CPU::OP_BVC, "BVC"};
-    m_instruction_table[0x70] = {&CPU::AddressModeImmediate, &CPU::OP_BVS, "BVS"};
-    m_instruction_table[0xE8] = {&CPU::AddressModeImplied, &CPU::OP_INX, "INX"};
-    m_instruction_table[0xC8] = {&CPU::AddressModeImplied, &CPU::OP_INY, "INY"};
-    m_instruction_table[0x88] = {&CPU::AddressModeImplied, &CPU::OP_DEY, "DEY"};
-    m_instruction_table[0xCA] = {&CPU::AddressModeImplied, &CPU::OP_DEX, "DEX"};
-    m_instruction_table[0xE6] = {&CPU::AddressModeZeropage, &CPU::OP_INC, "INC"};
-    m_instruction_table[0xF6] = {&CPU::AddressModeZeropageX, &CPU::OP_INC, "INC"};
-    m_instruction_table[0xEE] = {&CPU::AddressModeAbsolute, &CPU::OP_INC, "INC"};
-    m_instruction_table[0xFE] = {&CPU::AddressModeAbsoluteX, &CPU::OP_INC, "INC"};
-    m_instruction_table[0x4C] = {&CPU::AddressModeAbsolute, &CPU::OP_JMP, "JMP"};
-    m_instruction_table[0x6C] = {&CPU::AddressModeIndirect, &CPU::OP_JMP, "JMP"};
-    m_instruction_table[0x20] = {&CPU::AddressModeAbsolute, &CPU::OP_JSR, "JSR"};
-    m_instruction_table[0x24] = {&CPU::AddressModeZeropage, &CPU::OP_BIT, "BIT"};
-    m_instruction_table[0x2C] = {&CPU::AddressModeAbsolute, &CPU::OP_BIT, "BIT"};
-    m_instruction_table[0x00] = {&CPU::AddressModeImplied, &CPU::OP_BRK, "BRK"};
-    m_instruction_table[0x69] = {&CPU::AddressModeImmediate, &CPU::OP_ADC, "ADC"};
-    m_instruction_table[0xC9] = {&CPU::AddressModeImmediate, &CPU::OP_CMP, "CMP"};
-    m_instruction_table[0xC5] = {&CPU::AddressModeZeropage, &CPU::OP_CMP, "CMP"};
-    m_instruction_table[0xD5] = {&CPU::AddressModeZeropageX, &CPU::OP_CMP, "CMP"};
-    m_instruction_table[0xCD] = {&CPU::AddressModeAbsolute, &CPU::OP_CMP, "CMP"};
-    m_instruction_table[0xDD] = {&CPU::AddressModeAbsoluteX, &CPU::OP_CMP, "CMP"};
-    m_instruction_table[0xD9] = {&CPU::AddressModeAbsoluteY, &CPU::OP_CMP, "CMP"};
-    m_instruction_table[0xC1] = {&CPU::AddressModeIndirectX, &CPU::OP_CMP, "CMP"};
-    m_instruction_table[0xD1] = {&CPU::AddressModeIndirectY, &CPU::OP_CMP, "CMP"};
-    m_instruction_table[0xE0] = {&CPU::AddressModeImmediate, &CPU::OP_CPX, "CPX"};
-    m_instruction_table[0xE4] = {&CPU::AddressModeZeropage, &CPU::OP_CPX, "CPX"};
-    m_instruction_table[0xEC] = {&CPU::AddressModeAbsolute, &CPU::OP_CPX, "CPX"};
-    m_instruction_table[0xC0] = {&CPU::AddressModeImmediate, &CPU::OP_CPY, "CPY"};
-    m_instruction_table[0xC4] = {&CPU::AddressModeZeropage, &CPU::OP_CPY, "CPY"};
-    m_instruction_table[0xCC] = {&CPU::AddressModeAbsolute, &CPU::OP_CPY, "CPY"};
-    m_instruction_table[0xC6] = {&CPU::AddressModeZeropage, &CPU::OP_DEC, "DEC"};
-    m_instruction_table[0xD6] = {&CPU::AddressModeZeropageX, &CPU::OP_DEC, "DEC"};
-    m_instruction_table[0xCE] = {&CPU::AddressModeAbsolute, &CPU::OP_DEC, "DEC"};
-    m_instruction_table[0xDE] = {&CPU::AddressModeAbsoluteX, &CPU::OP_DEC, "DEC"};
-    m_instruction_table[0x49] = {&CPU::AddressModeImmediate, &CPU::OP_EOR, "EOR"};
-    m_instruction_table[0x45] = {&CPU::AddressModeZeropage, &CPU::OP_EOR, "EOR"};
-    m_instruction_table[0x55] = {&CPU::AddressModeZeropageX, &CPU::OP_EOR, "EOR"};
-    m_instruction_table[0x4D] = {&CPU::AddressModeAbsolute, &CPU::OP_EOR, "EOR"};
-    m_instruction_table[0x5D] = {&CPU::AddressModeAbsoluteX, &CPU::OP_EOR, "EOR"};
-    m_instruction_table[0x59] = {&CPU::AddressModeAbsoluteY, &CPU::OP_EOR, "EOR"};
-    m_instruction_table[0x41] = {&CPU::AddressModeIndirectX, &CPU::OP_EOR, "EOR"};
-    m_instruction_table[0x51] = {&CPU::AddressModeIndirectY, &CPU::OP_EOR, "EOR"};
-    m_instruction_table[0xA9] = {&CPU::AddressModeImmediate, &CPU::OP_LDA, "LDA"};
-    m_instruction_table[0xA5] = {&CPU::AddressModeZeropage, &CPU::OP_LDA, "LDA"};
-    m_instruction_table[0xB5] = {&CPU::AddressModeZeropageX, &CPU::OP_LDA, "LDA"};
-    m_instruction_table[0xA1] = {&CPU::AddressModeIndirectX, &CPU::OP_LDA, "LDA"};
-    m_instruction_table[0xB1] = {&CPU::AddressModeIndirectY, &CPU::OP_LDA, "LDA"};
-    m_instruction_table[0xAD] = {&CPU::AddressModeAbsolute, &CPU::OP_LDA, "LDA"};
-    m_instruction_table[0xBD] = {&CPU::AddressModeAbsoluteX, &CPU::OP_LDA, "LDA"};
-    m_instruction_table[0xB9] = {&CPU::AddressModeAbsoluteY, &CPU::OP_LDA, "LDA"};
-    m_instruction_table[0xA2] = {&CPU::AddressModeImmediate, &CPU::OP_LDX, "LDX"};
-    m_instruction_table[0xA6] = {&CPU::AddressModeZeropage, &CPU::OP_LDX, "LDX"};
-    m_instruction_table[0xB6] = {&CPU::AddressModeZeropageY, &CPU::OP_LDX, "LDX"};
-    m_instruction_table[0xAE] = {&CPU::AddressModeAbsolute, &CPU::OP_LDX, "LDX"};
-    m_instruction_table[0xBE] = {&CPU::AddressModeAbsoluteY, &CPU::OP_LDX, "LDX"};
-    m_instruction_table[0xA0] = {&CPU::AddressModeImmediate, &CPU::OP_LDY, "LDY"};
-    m_instruction_table[0xA4] = {&CPU::AddressModeZeropage, &CPU::OP_LDY, "LDY"};
-    m_instruction_table[0xB4] = {&CPU::AddressModeZeropageX, &CPU::OP_LDY, "LDY"};
-    m_instruction_table[0xAC] = {&CPU::AddressModeAbsolute, &CPU::OP_LDY, "LDY"};
-    m_instruction_table[0xBC] = {&CPU::AddressModeAbsoluteX, &CPU::OP_LDY, "LDY"};
-    m_instruction_table[0x4A] = {&CPU::AddressModeAccumulator, &CPU::OP_LSR_ACC, "LSR"};
-    m_instruction_table[0x46] = {&CPU::AddressModeZeropage, &CPU::OP_LSR, "LSR"};
-    m_instruction_table[0x56] = {&CPU::AddressModeZeropageX, &CPU::OP_LSR, "LSR"};
-    m_instruction_table[0x4E] = {&CPU::AddressModeAbsolute, &CPU::OP_LSR, "LSR"};
-    m_instruction_table[0x5E] = {&CPU::AddressModeAbsoluteX, &CPU::OP_LSR, "LSR"};
-    m_instruction_table[0x09] = {&CPU::AddressModeImmediate, &CPU::OP_ORA, "ORA"};
-    m_instruction_table[0x05] = {&CPU::AddressModeZeropage, &CPU::OP_ORA, "ORA"};
-    m_instruction_table[0x15] = {&CPU::AddressModeZeropageX, &CPU::OP_ORA, "ORA"};
-    m_instruction_table[0x0D] = {&CPU::AddressModeAbsolute, &CPU::OP_ORA, "ORA"};
-    m_instruction_table[0x1D] = {&CPU::AddressModeAbsoluteX, &CPU::OP_ORA, "ORA"};
-    m_instruction_table[0x19] = {&CPU::AddressModeAbsoluteY, &CPU::OP_ORA, "ORA"};
-    m_instruction_table[0x01] = {&CPU::AddressModeIndirectX, &CPU::OP_ORA, "ORA"};
-    m_instruction_table[0x11] = {&CPU::AddressModeIndirectY, &CPU::OP_ORA, "ORA"};
-    m_instruction_table[0x48] = {&CPU::AddressModeImplied, &CPU::OP_PHA, "PHA"};
-    m_instruction_table[0x08] = {&CPU::AddressModeImplied, &CPU::OP_PHP, "PHP"};
-    m_instruction_table[0x68] = {&CPU::AddressModeImplied, &CPU::OP_PLA, "PLA"};
-    m_instruction_table[0x28] = {&CPU::AddressModeImplied, &CPU::OP_PLP, "PLP"};
-    m_instruction_table[0x2A] = {&CPU::AddressModeAccumulator, &CPU::OP_ROL_ACC, "ROL"};
-    m_instruction_table[0x26] = {&CPU::AddressModeZeropage, &CPU::OP_ROL, "ROL"};
-    m_instruction_table[0x36] = {&CPU::AddressModeZeropageX, &CPU::OP_ROL, "ROL"};
-    m_instruction_table[0x2E] = {&CPU::AddressModeAbsolute, &CPU::OP_ROL, "ROL"};
-    m_instruction_table[0x3E] = {&CPU::AddressModeAbsoluteX, &CPU::OP_ROL, "ROL"};
-    m_instruction_table[0x6A] = {&CPU::AddressModeAccumulator, &CPU::OP_ROR_ACC, "ROR"};
-    m_instruction_table[0x66] = {&CPU::AddressModeZeropage, &CPU::OP_ROR, "ROR"};
-    m_instruction_table[0x76] = {&CPU::AddressModeZeropageX, &CPU::OP_ROR, "ROR"};
-    m_instruction_table[0x6E] = {&CPU::AddressModeAbsolute, &CPU::OP_ROR, "ROR"};
-    m_instruction_table[0x7E] = {&CPU::AddressModeAbsoluteX, &CPU::OP_ROR, "ROR"};
-    m_instruction_table[0x40] = {&CPU::AddressModeImplied, &CPU::OP_RTI, "RTI"};
-    m_instruction_table[0x60] = {&CPU::AddressModeImplied, &CPU::OP_RTS, "RTS"};
-    m_instruction_table[0xE9] = {&CPU::AddressModeImmediate, &CPU::OP_SBC, "SBC"};
-    m_instruction_table[0xE5] = {&CPU::AddressModeZeropage, &CPU::OP_SBC, "SBC"};
-    m_instruction_table[0xF5] = {&CPU::AddressModeZeropageX, &CPU::OP_SBC, "SBC"};
-    m_instruction_table[0xED] = {&CPU::AddressModeAbsolute, &CPU::OP_SBC, "SBC"};
-    m_instruction_table[0xFD] = {&CPU::AddressModeAbsoluteX, &CPU::OP_SBC, "SBC"};
-    m_instruction_table[0xF9] = {&CPU::AddressModeAbsoluteY, &CPU::OP_SBC, "SBC"};
-    m_instruction_table[0xE1] = {&CPU::AddressModeIndirectX, &CPU::OP_SBC, "SBC"};
-    m_instruction_table[0xF1] = {&CPU::AddressModeIndirectY, &CPU::OP_SBC, "SBC"};
-    m_instruction_table[0x38] = {&CPU::AddressModeImplied, &CPU::OP_SEC, "SEC"};
-    m_instruction_table[0xF8] = {&CPU::AddressModeImplied, &CPU::OP_SED, "SED"};
-    m_instruction_table[0x78] = {&CPU::AddressModeImplied, &CPU::OP_SEI, "SEI"};
-    m_instruction_table[0x18] = {&CPU::AddressModeImplied, &CPU::OP_CLC, "CLC"};
-    m_instruction_table[0xD8] = {&CPU::AddressModeImplied, &CPU::OP_CLD, "CLD"};
-    m_instruction_table[0x58] = {&CPU::AddressModeImplied, &CPU::OP_CLI, "CLI"};
-    m_instruction_table[0xB8] = {&CPU::AddressModeImplied, &CPU::OP_CLV, "CLV"};
-    m_instruction_table[0x85] = {&CPU::AddressModeZeropage, &CPU::OP_STA, "STA"};
-    m_instruction_table[0x95] = {&CPU::AddressModeZeropageX, &CPU::OP_STA, "STA"};
-    m_instruction_table[0x8D] = {&CPU::AddressModeAbsolute, &CPU::OP_STA, "STA"};
-    m_instruction_table[0x9D] = {&CPU::AddressModeAbsoluteX, &CPU::OP_STA, "STA"};
-    m_instruction_table[0x99] = {&CPU::AddressModeAbsoluteY, &CPU::OP_STA, "STA"};
-    m_instruction_table[0x81] = {&CPU::AddressModeIndirectX, &CPU::OP_STA, "STA"};
-    m_instruction_table[0x91] = {&CPU::AddressModeIndirectY, &CPU::OP_STA, "STA"};
-    m_instruction_table[0x86] = {&CPU::AddressModeZeropage, &CPU::OP_STX, "STX"};
-    m_instruction_table[0x96] = {&CPU::AddressModeZeropageY, &CPU::OP_STX, "STX"};
-    m_instruction_table[0x8E] = {&CPU::AddressModeAbsolute, &CPU::OP_STX, "STX"};
-    m_instruction_table[0x84] = {&CPU::AddressModeZeropage, &CPU::OP_STY, "STY"};
-    m_instruction_table[0x94] = {&CPU::AddressModeZeropageX, &CPU::OP_STY, "STY"};
-    m_instruction_table[0x8C] = {&CPU::AddressModeAbsolute, &CPU::OP_STY, "STY"};
-    m_instruction_table[0xAA] = {&CPU::AddressModeImplied, &CPU::OP_TAX, "TAX"};
-    m_instruction_table[0xA8] = {&CPU::AddressModeImplied, &CPU::OP_TAY, "TAY"};
-    m_instruction_table[0xBA] = {&CPU::AddressModeImplied, &CPU::OP_TSX, "TSX"};
-    m_instruction_table[0x8A] = {&CPU::AddressModeImplied, &CPU::OP_TXA, "TXA"};
-    m_instruction_table[0x9A] = {&CPU::AddressModeImplied, &CPU::OP_TXS, "TXS"};
-    m_instruction_table[0x98] = {&CPU::AddressModeImplied, &CPU::OP_TYA, "TYA"};
-    m_instruction_table[0x29] = {&CPU::AddressModeImmediate, &CPU::OP_AND, "AND"};
-    m_instruction_table[0x25] = {&CPU::AddressModeZeropage, &CPU::OP_AND, "AND"};
-    m_instruction_table[0x35] = {&CPU::AddressModeZeropageX, &CPU::OP_AND, "AND"};
-    m_instruction_table[0x2D] = {&CPU::AddressModeAbsolute, &CPU::OP_AND, "AND"};
-    m_instruction_table[0x3D] = {&CPU::AddressModeAbsoluteX, &CPU::OP_AND, "AND"};
-    m_instruction_table[0x39] = {&CPU::AddressModeAbsoluteY, &CPU::OP_AND, "AND"};
-    m_instruction_table[0x21] = {&CPU::AddressModeIndirectX, &CPU::OP_AND, "AND"};
-    m_instruction_table[0x31] = {&CPU::AddressModeIndirectY, &CPU::OP_AND, "AND"};
-    m_instruction_table[0x0A] = {&CPU::AddressModeAccumulator, &CPU::OP_ASL_ACC, "ASL"};
-    m_instruction_table[0x06] = {&CPU::AddressModeZeropage, &CPU::OP_ASL, "ASL"};
-    m_instruction_table[0x16] = {&CPU::AddressModeZeropageX, &CPU::OP_ASL, "ASL"};
-    m_instruction_table[0x0E] = {&CPU::AddressModeAbsolute, &CPU::OP_ASL, "ASL"};
-    m_instruction_table[0x1E] = {&CPU::AddressModeAbsoluteX, &CPU::OP_ASL, "ASL"};
-    m_instruction_table[0x61] = {&CPU::AddressModeIndirectX, &CPU::OP_ADC, "ADC"};
-    m_instruction_table[0x71] = {&CPU::AddressModeIndirectY, &CPU::OP_ADC, "ADC"};
-    m_instruction_table[0x65] = {&CPU::AddressModeZeropage, &CPU::OP_ADC, "ADC"};
-    m_instruction_table[0x75] = {&CPU::AddressModeZeropageX, &CPU::OP_ADC, "ADC"};
-    m_instruction_table[0x6D] = {&CPU::AddressModeAbsolute, &CPU::OP_ADC, "ADC"};
-    m_instruction_table[0x7D] = {&CPU::AddressModeAbsoluteX, &CPU::OP_ADC, "ADC"};
-    m_instruction_table[0x79] = {&CPU::AddressModeAbsoluteY, &CPU::OP_ADC, "ADC"};
-    m_instruction_table[0xEA] = {&CPU::AddressModeImplied, &CPU::OP_NOP, "NOP"};
-}
-
-void CPU::InvokeIRQ()
+}
+
+template <typename Bus, typename Flags, typename Trace>
+constexpr typename BasicCPU<Bus, Flags, Trace>::HandlerTable BasicCPU<Bus, Flags, Trace>::MakeHandlerTable()
+{
+    HandlerTable table{};
+    for (auto& it : table)
+        it = &Execute<AddressMode::Implied, &BasicCPU::IllegalOP, 0, false>;
+
+#define LLVMES_INSTRUCTION_HANDLER(opcode, name, mode, op, cycles, page_penalty) \
+    table[opcode] = &Execute<AddressMode::mode, &BasicCPU::OP_##op, cycles, page_penalty>;
+    LLVMES_INSTRUCTION_LIST(LLVMES_INSTRUCTION_HANDLER)
+#undef LLVMES_INSTRUCTION_HANDLER
+
+    return table;
+}
+
+template <typename Bus, typename Flags, typename Trace>
+const typename BasicCPU<Bus, Flags, Trace>::HandlerTable BasicCPU<Bus, Flags, Trace>::s_handlers =
+    BasicCPU<Bus, Flags, Trace>::MakeHandlerTable();
+
+template <typename Bus, typename Flags, typename Trace>
+constexpr typename BasicCPU<Bus, Flags, Trace>::DecodedHandlerTable BasicCPU<Bus, Flags, Trace>::MakeDecodedHandlerTable()
+{
+    DecodedHandlerTable table{};
+    for (auto& it : table)
+        it = &ExecuteDecoded<AddressMode::Implied, &BasicCPU::IllegalOP, 0, false>;
+
+#define LLVMES_DECODED_HANDLER(opcode, name, mode, op, cycles, page_penalty) \
+    table[opcode] =                                                          \
+        &ExecuteDecoded<AddressMode::mode, &BasicCPU::OP_##op, cycles, page_penalty>;
+    LLVMES_INSTRUCTION_LIST(LLVMES_DECODED_HANDLER)
+#undef LLVMES_DECODED_HANDLER
+
+    return table;
+}
+
+template <typename Bus, typename Flags, typename Trace>
+const typename BasicCPU<Bus, Flags, Trace>::DecodedHandlerTable BasicCPU<Bus, Flags, Trace>::s_decoded_handlers =
+    BasicCPU<Bus, Flags, Trace>::MakeDecodedHandlerTable();
+
+template <typename Bus, typename Flags, typename Trace>
+constexpr typename BasicCPU<Bus, Flags, Trace>::FusedHandlerTable BasicCPU<Bus, Flags, Trace>::MakeFusedHandlerTable()
+{
+    FusedHandlerTable table{};
+    auto set = [&table](Fusion fusion, DecodedHandler handler) {
+        table[static_cast<unsigned int>(fusion)] = handler;
+    };
+
+    set(Fusion::DEX_BNE, &FusedStepBranch<Fusion::DEX_BNE, &BasicCPU::reg_x, 0xFF>);
+    set(Fusion::DEY_BNE, &FusedStepBranch<Fusion::DEY_BNE, &BasicCPU::reg_y, 0xFF>);
+    set(Fusion::INX_BNE, &FusedStepBranch<Fusion::INX_BNE, &BasicCPU::reg_x, 1>);
+    set(Fusion::INY_BNE, &FusedStepBranch<Fusion::INY_BNE, &BasicCPU::reg_y, 1>);
+    set(Fusion::INC_ZP_BNE, &FusedMemoryStepBranch<Fusion::INC_ZP_BNE, 1>);
+    set(Fusion::DEC_ZP_BNE, &FusedMemoryStepBranch<Fusion::DEC_ZP_BNE, 0xFF>);
+    set(Fusion::CLC_ADC_IMM,
+        &FusedCarryArithmetic<Fusion::CLC_ADC_IMM, false, AddressMode::Immediate, 2>);
+    set(Fusion::CLC_ADC_ZP,
+        &FusedCarryArithmetic<Fusion::CLC_ADC_ZP, false, AddressMode::Zeropage, 3>);
+    set(Fusion::CLC_ADC_ABS,
+        &FusedCarryArithmetic<Fusion::CLC_ADC_ABS, false, AddressMode::Absolute, 4>);
+    set(Fusion::SEC_SBC_IMM,
+        &FusedCarryArithmetic<Fusion::SEC_SBC_IMM, true, AddressMode::Immediate, 2>);
+    set(Fusion::SEC_SBC_ZP,
+        &FusedCarryArithmetic<Fusion::SEC_SBC_ZP, true, AddressMode::Zeropage, 3>);
+    set(Fusion::SEC_SBC_ABS,
+        &FusedCarryArithmetic<Fusion::SEC_SBC_ABS, true, AddressMode::Absolute, 4>);
+    set(Fusion::LDA_ABSX_STA_ABSY,
+        &FusedLoadStore<Fusion::LDA_ABSX_STA_ABSY, AddressMode::AbsoluteX,
+                        AddressMode::AbsoluteY>);
+    set(Fusion::LDA_ABSY_STA_ABSX,
+        &FusedLoadStore<Fusion::LDA_ABSY_STA_ABSX, AddressMode::AbsoluteY,
+                        AddressMode::AbsoluteX>);
+    set(Fusion::LDA_ABSX_STA_ABSX,
+        &FusedLoadStore<Fusion::LDA_ABSX_STA_ABSX, AddressMode::AbsoluteX,
+                        AddressMode::AbsoluteX>);
+    set(Fusion::LDA_ABSY_STA_ABSY,
+        &FusedLoadStore<Fusion::LDA_ABSY_STA_ABSY, AddressMode::AbsoluteY,
+                        AddressMode::AbsoluteY>);
+    set(Fusion::CMP_IMM_BEQ, &FusedCompareBranch<Fusion::CMP_IMM_BEQ, true>);
+    set(Fusion::CMP_IMM_BNE, &FusedCompareBranch<Fusion::CMP_IMM_BNE, false>);
+    set(Fusion::INX_CPX_IMM_BNE,
+        &FusedStepCompareBranch<Fusion::INX_CPX_IMM_BNE, &BasicCPU::reg_x,
+                                AddressMode::Immediate, 2, &BasicCPU::OP_BNE>);
+    set(Fusion::INY_CPY_IMM_BNE,
+        &FusedStepCompareBranch<Fusion::INY_CPY_IMM_BNE, &BasicCPU::reg_y,
+                                AddressMode::Immediate, 2, &BasicCPU::OP_BNE>);
+    set(Fusion::INX_CPX_ZP_BPL,
+        &FusedStepCompareBranch<Fusion::INX_CPX_ZP_BPL, &BasicCPU::reg_x,
+                                AddressMode::Zeropage, 3, &BasicCPU::OP_BPL>);
+
+    return table;
+}
+
+template <typename Bus, typename Flags, typename Trace>
+const typename BasicCPU<Bus, Flags, Trace>::FusedHandlerTable BasicCPU<Bus, Flags, Trace>::s_fused_handlers =
+    BasicCPU<Bus, Flags, Trace>::MakeFusedHandlerTable();
+
+template <typename Bus, typename Flags, typename Trace>
+template <Fusion fusion, std::uint8_t BasicCPU<Bus, Flags, Trace>::*reg,
+          std::uint8_t delta>
+void BasicCPU<Bus, Flags, Trace>::FusedStepBranch(BasicCPU& cpu, std::uint16_t operand)
+{
+    cpu.m_fusion_counts[static_cast<unsigned int>(fusion)]++;
+    std::uint16_t start = cpu.reg_pc;
+    cpu.StartDecoded<AddressMode::Implied, 2, false>(operand);
+    std::uint8_t value = cpu.*reg += delta;
+    cpu.SetNZ(value);
+    if (!cpu.ContinueFused(start))
+        return;
+
+    // The offset is already decoded, the address of it isn't needed
+    cpu.StartDecoded<AddressMode::Immediate, 2, false>(0);
+    std::int8_t offset = cpu.m_decoded[start].fused_operands[0];
+    // Z is only needed for the branch, which can look at the value itself
+    if (value != 0)
+        cpu.TakeBranch(offset);
+}
+
+template <typename Bus, typename Flags, typename Trace>
+template <Fusion fusion, std::uint8_t delta>
+void BasicCPU<Bus, Flags, Trace>::FusedMemoryStepBranch(BasicCPU& cpu,
+                                                        std::uint16_t operand)
+{
+    cpu.m_fusion_counts[static_cast<unsigned int>(fusion)]++;
+    std::uint16_t start = cpu.reg_pc;
+    std::uint16_t address = cpu.StartDecoded<AddressMode::Zeropage, 5, false>(operand);
+    std::uint8_t value = cpu.Read(address) + delta;
+    cpu.WriteMemory(address, value);
+    cpu.SetNZ(value);
+    if (!cpu.ContinueFused(start))
+        return;
+
+    // The offset is already decoded, the address of it isn't needed
+    cpu.StartDecoded<AddressMode::Immediate, 2, false>(0);
+    std::int8_t offset = cpu.m_decoded[start].fused_operands[0];
+    if (value != 0)
+        cpu.TakeBranch(offset);
+}
+
+template <typename Bus, typename Flags, typename Trace>
+template <Fusion fusion, bool subtract, AddressMode mode, unsigned int cycles>
+void BasicCPU<Bus, Flags, Trace>::FusedCarryArithmetic(BasicCPU& cpu,
+                                                       std::uint16_t operand)
+{
+    cpu.m_fusion_counts[static_cast<unsigned int>(fusion)]++;
+    std::uint16_t start = cpu.reg_pc;
+    cpu.StartDecoded<AddressMode::Implied, 2, false>(operand);
+    if (!cpu.ContinueFused(start)) {
+        cpu.SetC(subtract);
+        return;
+    }
+
+    // The carry set by CLC or SEC goes straight into the addition, which
+    // overwrites it anyway
+    std::uint16_t address =
+        cpu.StartDecoded<mode, cycles, false>(cpu.m_decoded[start].fused_operands[0]);
+    std::uint8_t value = cpu.Read(address);
+    cpu.AddWithCarry(subtract ? ~value : value, subtract);
+}
+
+template <typename Bus, typename Flags, typename Trace>
+template <Fusion fusion, AddressMode load_mode, AddressMode store_mode>
+void BasicCPU<Bus, Flags, Trace>::FusedLoadStore(BasicCPU& cpu, std::uint16_t operand)
+{
+    cpu.m_fusion_counts[static_cast<unsigned int>(fusion)]++;
+    std::uint16_t start = cpu.reg_pc;
+    cpu.OP_LDA(cpu.StartDecoded<load_mode, 4, true>(operand));
+    if (!cpu.ContinueFused(start))
+        return;
+
+    std::uint16_t store_operand = cpu.m_decoded[start].fused_operands[0];
+    cpu.OP_STA(cpu.StartDecoded<store_mode, 5, false>(store_operand));
+}
+
+template <typename Bus, typename Flags, typename Trace>
+template <Fusion fusion, bool equal>
+void BasicCPU<Bus, Flags, Trace>::FusedCompareBranch(BasicCPU& cpu, std::uint16_t operand)
+{
+    cpu.m_fusion_counts[static_cast<unsigned int>(fusion)]++;
+    std::uint16_t start = cpu.reg_pc;
+    std::uint8_t value =
+        cpu.Read(cpu.StartDecoded<AddressMode::Immediate, 2, false>(operand));
+    cpu.Compare(cpu.reg_a, value);
+    if (!cpu.ContinueFused(start))
+        return;
+
+    // The offset is already decoded, the address of it isn't needed
+    cpu.StartDecoded<AddressMode::Immediate, 2, false>(0);
+    std::int8_t offset = cpu.m_decoded[start].fused_operands[0];
+    if ((cpu.reg_a == value) == equal)
+        cpu.TakeBranch(offset);
+}
+
+template <typename Bus, typename Flags, typename Trace>
+template <Fusion fusion, std::uint8_t BasicCPU<Bus, Flags, Trace>::*reg,
+          AddressMode compare_mode, unsigned int compare_cycles,
+          typename BasicCPU<Bus, Flags, Trace>::OperationFn branch>
+void BasicCPU<Bus, Flags, Trace>::FusedStepCompareBranch(BasicCPU& cpu,
+                                                         std::uint16_t operand)
+{
+    cpu.m_fusion_counts[static_cast<unsigned int>(fusion)]++;
+    std::uint16_t start = cpu.reg_pc;
+    cpu.StartDecoded<AddressMode::Implied, 2, false>(operand);
+    std::uint8_t value = cpu.*reg += 1;
+    if (!cpu.ContinueFused(start)) {
+        cpu.SetNZ(value);
+        return;
+    }
+
+    // The compare overwrites N and Z, so the increment doesn't set them
+    const DecodedInstruction& decoded = cpu.m_decoded[start];
+    std::uint16_t address =
+        cpu.StartDecoded<compare_mode, compare_cycles, false>(decoded.fused_operands[0]);
+    cpu.Compare(value, cpu.Read(address));
+    if (!cpu.ContinueFused(start))
+        return;
+
+    (cpu.*branch)(
+        cpu.StartDecoded<AddressMode::Immediate, 2, false>(decoded.fused_operands[1]));
+}
+
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::InvokeIRQ()
 {
     StackPush(reg_pc >> 8);
     StackPush(reg_pc & 0xFF);
-    StackPush(reg_status & ~FLAG_B);
-    reg_status.I = 1;
+    StackPush(GetStatus() & ~FLAG_B);
+    reg_status.I() = 1;
     reg_pc = Read16(IRQ_VECTOR);
+    m_cycles += INTERRUPT_CYCLES;
 }
 
-void CPU::InvokeNMI()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::InvokeNMI()
 {
     StackPush(reg_pc >> 8);
     StackPush(reg_pc & 0xFF);
-    StackPush(reg_status & ~FLAG_B);
-    reg_status.I = 1;
+    StackPush(GetStatus() & ~FLAG_B);
+    reg_status.I() = 1;
     reg_pc = Read16(NMI_VECTOR);
     m_nmi = false;
+    m_cycles += INTERRUPT_CYCLES;
 }
 
-std::uint16_t CPU::Read16(std::uint16_t addr)
+template <typename Bus, typename Flags, typename Trace>
+std::uint16_t BasicCPU<Bus, Flags, Trace>::Read16(std::uint16_t addr)
 {
     std::uint16_t lowByte = Read(addr);
     std::uint16_t highByte = Read(addr + 1);
@@ -202,59 +285,69 @@ std::uint16_t CPU::Read16(std::uint16_t addr)
 }
 
 /// The operand immediately following the opcode
-void CPU::AddressModeImmediate()
+template <typename Bus, typename Flags, typename Trace>
+std::uint16_t BasicCPU<Bus, Flags, Trace>::AddressModeImmediate()
 {
-    m_address = reg_pc++;
+    return reg_pc++;
 }
 
 /// The address to the operand is the 2 bytes succeeding the opcode
-void CPU::AddressModeAbsolute()
+template <typename Bus, typename Flags, typename Trace>
+std::uint16_t BasicCPU<Bus, Flags, Trace>::AddressModeAbsolute()
 {
-    m_address = Read16(reg_pc);
+    std::uint16_t address = Read16(reg_pc);
     reg_pc += 2;
+    return address;
 }
 
 /// The address to the operand is the 2 bytes succeeding the opcode + value of
 /// register X
-void CPU::AddressModeAbsoluteX()
+template <typename Bus, typename Flags, typename Trace>
+std::uint16_t BasicCPU<Bus, Flags, Trace>::AddressModeAbsoluteX()
 {
-    m_address = Read16(reg_pc) + reg_x;
+    std::uint16_t address = Read16(reg_pc) + reg_x;
     reg_pc += 2;
+    return address;
 }
 
 /// The address to the operand is the 2 bytes succeeding the opcode + value of
 /// register Y
-void CPU::AddressModeAbsoluteY()
+template <typename Bus, typename Flags, typename Trace>
+std::uint16_t BasicCPU<Bus, Flags, Trace>::AddressModeAbsoluteY()
 {
-    m_address = Read16(reg_pc) + reg_y;
+    std::uint16_t address = Read16(reg_pc) + reg_y;
     reg_pc += 2;
+    return address;
 }
 
 /// The address to the operand is the byte succeeding the opcode extended to
 /// 16bits
-void CPU::AddressModeZeropage()
+template <typename Bus, typename Flags, typename Trace>
+std::uint16_t BasicCPU<Bus, Flags, Trace>::AddressModeZeropage()
 {
-    m_address = Read(reg_pc++);
+    return Read(reg_pc++);
 }
 
 ///-Indexed
 /// The address to the operand is the byte succeeding the opcode + register X
 /// If the address gets larger than 0x100(255) the address will wrap and gets
 /// back to 0
-void CPU::AddressModeZeropageX()
+template <typename Bus, typename Flags, typename Trace>
+std::uint16_t BasicCPU<Bus, Flags, Trace>::AddressModeZeropageX()
 {
     std::uint8_t addr = ((Read(reg_pc++) + reg_x) % 0x100);
-    m_address = addr;
+    return addr;
 }
 
 /// Y-Indexed
 /// The address to the operand is the byte succeeding the opcode + register Y
 /// If the address gets larger than 0x100(255) the address will wrap and gets
 /// back to 0
-void CPU::AddressModeZeropageY()
+template <typename Bus, typename Flags, typename Trace>
+std::uint16_t BasicCPU<Bus, Flags, Trace>::AddressModeZeropageY()
 {
     std::uint8_t addr = ((Read(reg_pc++) + reg_y) % 0x100);
-    m_address = addr;
+    return addr;
 }
 
 /// The two bytes that follow the opcode is an address which contains the
@@ -262,25 +355,28 @@ void CPU::AddressModeZeropageY()
 /// address + 1". Due to an error in the original design, if the target address
 /// is located on a page-boundary, the last byte of the address will be on
 /// 0xYY00
-void CPU::AddressModeIndirect()
+template <typename Bus, typename Flags, typename Trace>
+std::uint16_t BasicCPU<Bus, Flags, Trace>::AddressModeIndirect()
 {
     std::uint16_t indirection = Read16(reg_pc);
     std::uint8_t low = Read(indirection);
     std::uint8_t high = Read((0xFF00 & indirection) | ((indirection + 1) % 0x100));
-    m_address = low | (high << 8);
+    return low | (high << 8);
 }
 
-void CPU::AddressModeIndirectX()
+template <typename Bus, typename Flags, typename Trace>
+std::uint16_t BasicCPU<Bus, Flags, Trace>::AddressModeIndirectX()
 {
     // This address is used to index the
     std::uint8_t base = (Read(reg_pc++) + reg_x);
     std::uint8_t low = Read(base);
     // Wrap if the address gets to 255
     std::uint8_t high = Read(base + 1);
-    m_address = low | (high << 8);
+    return low | (high << 8);
 }
 
-void CPU::AddressModeIndirectY()
+template <typename Bus, typename Flags, typename Trace>
+std::uint16_t BasicCPU<Bus, Flags, Trace>::AddressModeIndirectY()
 {
     // This address is used to index the
     std::uint8_t base = (Read(reg_pc++));
@@ -288,544 +384,976 @@ void CPU::AddressModeIndirectY()
     // Wrap if the address gets to 255
     std::uint8_t high = Read(base + 1);
     // Add the contents of Y to get the final address
-    m_address = (low | (high << 8)) + reg_y;
+    return (low | (high << 8)) + reg_y;
+}
+
+template <typename Bus, typename Flags, typename Trace>
+template <AddressMode mode>
+std::uint16_t BasicCPU<Bus, Flags, Trace>::FetchAddress()
+{
+    if constexpr (mode == AddressMode::Immediate)
+        return AddressModeImmediate();
+    else if constexpr (mode == AddressMode::Absolute)
+        return AddressModeAbsolute();
+    else if constexpr (mode == AddressMode::AbsoluteX)
+        return AddressModeAbsoluteX();
+    else if constexpr (mode == AddressMode::AbsoluteY)
+        return AddressModeAbsoluteY();
+    else if constexpr (mode == AddressMode::Zeropage)
+        return AddressModeZeropage();
+    else if constexpr (mode == AddressMode::ZeropageX)
+        return AddressModeZeropageX();
+    else if constexpr (mode == AddressMode::ZeropageY)
+        return AddressModeZeropageY();
+    else if constexpr (mode == AddressMode::Indirect)
+        return AddressModeIndirect();
+    else if constexpr (mode == AddressMode::IndirectX)
+        return AddressModeIndirectX();
+    else if constexpr (mode == AddressMode::IndirectY)
+        return AddressModeIndirectY();
+    else if constexpr (mode == AddressMode::Accumulator)
+        return AddressModeAccumulator();
+    else
+        return AddressModeImplied();
+}
+
+template <typename Bus, typename Flags, typename Trace>
+template <AddressMode mode>
+void BasicCPU<Bus, Flags, Trace>::AddPagePenalty(std::uint16_t address)
+{
+    // The index was added to the low byte of the base address, if that wrapped
+    // around the low byte is now smaller than the index
+    if constexpr (mode == AddressMode::AbsoluteX)
+        m_cycles += (address & 0xFF) < reg_x;
+    else if constexpr (mode == AddressMode::AbsoluteY || mode == AddressMode::IndirectY)
+        m_cycles += (address & 0xFF) < reg_y;
+}
+
+/// Same as the AddressMode functions above, but with the operand bytes taken
+/// from the decoded instruction
+template <typename Bus, typename Flags, typename Trace>
+template <AddressMode mode>
+std::uint16_t BasicCPU<Bus, Flags, Trace>::DecodedAddress(std::uint16_t operand)
+{
+    if constexpr (mode == AddressMode::Immediate) {
+        return reg_pc - 1;
+    }
+    else if constexpr (mode == AddressMode::Absolute || mode == AddressMode::Zeropage) {
+        return operand;
+    }
+    else if constexpr (mode == AddressMode::AbsoluteX) {
+        return operand + reg_x;
+    }
+    else if constexpr (mode == AddressMode::AbsoluteY) {
+        return operand + reg_y;
+    }
+    else if constexpr (mode == AddressMode::ZeropageX) {
+        return (operand + reg_x) % 0x100;
+    }
+    else if constexpr (mode == AddressMode::ZeropageY) {
+        return (operand + reg_y) % 0x100;
+    }
+    else if constexpr (mode == AddressMode::Indirect) {
+        std::uint8_t low = Read(operand);
+        std::uint8_t high = Read((0xFF00 & operand) | ((operand + 1) % 0x100));
+        return low | (high << 8);
+    }
+    else if constexpr (mode == AddressMode::IndirectX) {
+        std::uint8_t base = operand + reg_x;
+        std::uint8_t low = Read(base);
+        std::uint8_t high = Read(base + 1);
+        return low | (high << 8);
+    }
+    else if constexpr (mode == AddressMode::IndirectY) {
+        std::uint8_t low = Read(operand);
+        std::uint8_t high = Read(operand + 1);
+        return (low | (high << 8)) + reg_y;
+    }
+    else {
+        // Implied and accumulator
+        return 0;
+    }
 }
 
-void CPU::AddressModeImplied()
+template <typename Bus, typename Flags, typename Trace>
+std::uint16_t BasicCPU<Bus, Flags, Trace>::AddressModeImplied()
 {
     // Simply means the instruction doesn't need an operand
+    return 0;
 }
 
-void CPU::AddressModeAccumulator()
+template <typename Bus, typename Flags, typename Trace>
+std::uint16_t BasicCPU<Bus, Flags, Trace>::AddressModeAccumulator()
 {
     // The operand is the contents of the accumulator(regA)
+    return 0;
 }
 
-void CPU::StackPush(std::uint8_t value)
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::StackPush(std::uint8_t value)
 {
-    Write(0x0100 | reg_sp--, value);
+    WriteMemory(0x0100 | reg_sp--, value);
 }
 
-std::uint8_t CPU::StackPop()
+template <typename Bus, typename Flags, typename Trace>
+std::uint8_t BasicCPU<Bus, Flags, Trace>::StackPop()
 {
     return Read(0x0100 | ++reg_sp);
 }
 
-void CPU::SetNMI()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::SetNMI()
 {
     m_nmi = true;
+    BreakRunLoop();
 }
 
-void CPU::SetIRQ()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::SetIRQ()
 {
     m_irq = true;
+    BreakRunLoop();
+}
+
+template <typename Bus, typename Flags, typename Trace>
+Scheduler::EventId BasicCPU<Bus, Flags, Trace>::ScheduleNMI(std::uint64_t cycle)
+{
+    return ScheduleEvent(cycle, [this](std::uint64_t) { SetNMI(); });
+}
+
+template <typename Bus, typename Flags, typename Trace>
+Scheduler::EventId BasicCPU<Bus, Flags, Trace>::ScheduleIRQ(std::uint64_t cycle)
+{
+    return ScheduleEvent(cycle, [this](std::uint64_t) { SetIRQ(); });
+}
+
+template <typename Bus, typename Flags, typename Trace>
+Scheduler::EventId BasicCPU<Bus, Flags, Trace>::ScheduleEvent(std::uint64_t cycle,
+                                                        Scheduler::Callback callback)
+{
+    // Might be called from within a run loop, e.g. by a device
+    m_deadline = std::min(m_deadline, cycle);
+    return m_scheduler.Schedule(cycle, std::move(callback));
 }
 
-void CPU::Step()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::Step()
 {
+    m_scheduler.RunDue(m_cycles);
+
     // Interrupt handling
     if (m_nmi)
         InvokeNMI();
-    else if (m_irq && !reg_status.I)
+    else if (m_irq && !reg_status.I())
         InvokeIRQ();
 
     // Fetch
     std::uint8_t opcode = Read(reg_pc++);
+    TraceFetch(reg_pc - 1, opcode);
+
+    // Decode and execute
+    s_handlers[opcode](*this);
+    m_instruction_count++;
+}
+
+template <typename Bus, typename Flags, typename Trace>
+typename BasicCPU<Bus, Flags, Trace>::DecodedInstruction& BasicCPU<Bus, Flags, Trace>::Decode(std::uint16_t addr)
+{
+    DecodedInstruction& decoded = m_decoded[addr];
+    std::uint8_t opcode = Read(addr);
+    const InstructionInfo& info = GetInstructionInfo(opcode);
+
+    decoded.handler = s_decoded_handlers[opcode];
+    decoded.dispatch = opcode;
+    decoded.opcode = opcode;
+    decoded.length = GetInstructionLength(info.mode);
+    decoded.cycles = info.cycles;
+    decoded.span = decoded.length;
+    decoded.fusion = Fusion::None;
+    decoded.valid = true;
+    if (decoded.length == 2)
+        decoded.operand = Read(addr + 1);
+    else if (decoded.length == 3)
+        decoded.operand = Read16(addr + 1);
+    else
+        decoded.operand = 0;
+
+    Fusion fusion = m_fusion && !Trace::ENABLED ? MatchFusion(addr) : Fusion::None;
+    if (fusion != Fusion::None) {
+        const FusionInfo& fusion_info = GetFusionInfo(fusion);
+        decoded.handler = s_fused_handlers[static_cast<unsigned int>(fusion)];
+        decoded.dispatch = FUSED_DISPATCH;
+        decoded.fusion = fusion;
+        for (unsigned int i = 1; i < fusion_info.count; i++) {
+            std::uint16_t next = addr + decoded.span;
+            unsigned int length =
+                GetInstructionLength(GetInstructionInfo(fusion_info.opcodes[i]).mode);
+            if (length == 2)
+                decoded.fused_operands[i - 1] = Read(next + 1);
+            else if (length == 3)
+                decoded.fused_operands[i - 1] = Read16(next + 1);
+            else
+                decoded.fused_operands[i - 1] = 0;
+            decoded.span += length;
+        }
+    }
+
+    for (unsigned int i = 0; i < decoded.span; i++)
+        m_code_pages[static_cast<std::uint16_t>(addr + i) >> 8] = true;
+
+    return decoded;
+}
+
+template <typename Bus, typename Flags, typename Trace>
+Fusion BasicCPU<Bus, Flags, Trace>::MatchFusion(std::uint16_t addr)
+{
+    // Only opcodes that go on to the next instruction start a sequence, so
+    // this never reads anything that wouldn't be executed anyway
+    std::uint8_t opcodes[3];
+    unsigned int known = 0;
+    std::uint16_t next = addr;
+
+    for (unsigned int index = 0; index < FUSION_COUNT; index++) {
+        Fusion fusion = static_cast<Fusion>(index);
+        const FusionInfo& info = GetFusionInfo(fusion);
+        bool match = true;
+        for (unsigned int i = 0; i < info.count && match; i++) {
+            if (i == known) {
+                opcodes[i] = Read(next);
+                next += GetInstructionLength(GetInstructionInfo(opcodes[i]).mode);
+                known++;
+            }
+            match = opcodes[i] == info.opcodes[i];
+        }
+        if (match)
+            return fusion;
+    }
+    return Fusion::None;
+}
 
-    // Decode
-    Instruction& instr = m_instruction_table[opcode];
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::InvalidateDecoded(std::uint16_t addr)
+{
+    if (m_decoded.empty())
+        return;
+    // Only the instructions starting less than MAX_DECODED_SPAN bytes before
+    // 'addr' can contain it
+    for (unsigned int i = 0; i < MAX_DECODED_SPAN; i++) {
+        DecodedInstruction& decoded = m_decoded[static_cast<std::uint16_t>(addr - i)];
+        if (decoded.valid && decoded.span > i)
+            decoded.valid = false;
+    }
+}
+
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::SetFusion(bool enabled)
+{
+    m_fusion = enabled;
+    for (auto& it : m_decoded)
+        it.valid = false;
+}
 
-    // Execute
-    (this->*instr.fetch_address)();  // Fetch the address (if necessary)
-    (this->*instr.op)();             // Execute the instruction
+// Jumps to a label instead of calling through a function pointer. Every
+// instruction gets its own copy of the dispatch, which the branch predictor
+// handles a lot better than the single indirect call in the portable loop.
+#if defined(__GNUC__) && !defined(LLVMES_NO_COMPUTED_GOTO)
+#define LLVMES_COMPUTED_GOTO
+#endif
+
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::RunDecoded()
+{
+    if (m_decoded.empty())
+        m_decoded.resize(0x10000);
+
+    m_should_run = true;
+    m_run_end = UINT64_MAX;
+    DecodedInstruction* decoded;
+
+#ifdef LLVMES_COMPUTED_GOTO
+    void* labels[FUSED_DISPATCH + 1];
+    for (auto& it : labels)
+        it = &&illegal_op;
+    labels[FUSED_DISPATCH] = &&fused;
+
+#define LLVMES_DECODED_LABEL(opcode, name, mode, op, cycles, page_penalty) \
+    labels[opcode] = &&op_##opcode;
+    LLVMES_INSTRUCTION_LIST(LLVMES_DECODED_LABEL)
+#undef LLVMES_DECODED_LABEL
+
+    // Interrupts, Halt() and illegal opcodes all clear the deadline, so a
+    // single compare is enough on the fast path
+#define LLVMES_DISPATCH()                 \
+    if (m_cycles >= m_deadline)           \
+        goto service;                     \
+    decoded = &m_decoded[reg_pc];         \
+    if (!decoded->valid)                  \
+        decoded = &Decode(reg_pc);        \
+    TraceFetch(reg_pc, decoded->opcode);  \
+    m_instruction_count++;                \
+    goto* labels[decoded->dispatch]
+
+service:
+    if (!ServiceRunLoop())
+        return;
+    LLVMES_DISPATCH();
+
+#define LLVMES_DECODED_OP(opcode, name, mode, op, cycles, page_penalty)              \
+    op_##opcode:                                                                     \
+    ExecuteDecoded<AddressMode::mode, &BasicCPU::OP_##op, cycles, page_penalty>(     \
+        *this, decoded->operand);                                                    \
+    LLVMES_DISPATCH();
+    LLVMES_INSTRUCTION_LIST(LLVMES_DECODED_OP)
+#undef LLVMES_DECODED_OP
+
+illegal_op:
+    ExecuteDecoded<AddressMode::Implied, &BasicCPU::IllegalOP, 0, false>(*this, 0);
+    LLVMES_DISPATCH();
+
+fused:
+    decoded->handler(*this, decoded->operand);
+    LLVMES_DISPATCH();
+#undef LLVMES_DISPATCH
+#else
+    while (ServiceRunLoop()) {
+        while (m_cycles < m_deadline) {
+            decoded = &m_decoded[reg_pc];
+            if (!decoded->valid)
+                decoded = &Decode(reg_pc);
+            TraceFetch(reg_pc, decoded->opcode);
+            m_instruction_count++;
+            decoded->handler(*this, decoded->operand);
+        }
+    }
+#endif
 }
 
-void CPU::Dump()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::Dump()
 {
     std::cout << "Register X: " << (unsigned int)reg_x << "\n"
               << "Register Y: " << (unsigned int)reg_y << "\n"
               << "Register A: " << (unsigned int)reg_a << "\n"
               << "Register SP: " << (unsigned int)reg_sp << "\n"
               << "Register PC: " << std::hex << reg_pc << "\n"
-              << "Flags: " << std::bitset<8>(reg_status) << std::dec << "\n\n";
+              << "Flags: " << std::bitset<8>(GetStatus()) << std::dec << "\n\n";
 }
 
-void CPU::Reset()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::Reset()
 {
     reg_pc = Read16(RESET_VECTOR);
-    reg_status = 0x34;
+    SetStatus(0x34);
     reg_x = 0;
     reg_y = 0;
     reg_a = 0;
     reg_sp = 0xFD;
-    m_address = 0;
     m_nmi = false;
     m_irq = false;
     m_illegal_opcode = false;
+    m_instruction_count = 0;
+    m_cycles = 0;
+    m_deadline = 0;
+    m_scheduler.Clear();
+    m_fusion_counts.fill(0);
+    // Memory has most likely been reloaded
+    m_code_pages.fill(false);
+    for (auto& it : m_decoded)
+        it.valid = false;
+}
+
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::TakeSnapshot()
+{
+    m_snapshot = {reg_x, reg_y, reg_a, reg_sp, reg_pc, GetStatus(),
+                  m_instruction_count, m_cycles, m_irq, m_nmi, m_illegal_opcode};
+    if constexpr (std::is_base_of<Memory, Bus>::value)
+        Bus::TakeSnapshot();
+}
+
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::RestoreSnapshot()
+{
+    reg_x = m_snapshot.reg_x;
+    reg_y = m_snapshot.reg_y;
+    reg_a = m_snapshot.reg_a;
+    reg_sp = m_snapshot.reg_sp;
+    reg_pc = m_snapshot.reg_pc;
+    m_instruction_count = m_snapshot.instruction_count;
+    m_cycles = m_snapshot.cycles;
+    m_irq = m_snapshot.irq;
+    m_nmi = m_snapshot.nmi;
+    m_illegal_opcode = m_snapshot.illegal_opcode;
+    SetStatus(m_snapshot.status);
+
+    if constexpr (std::is_base_of<Memory, Bus>::value) {
+        for (std::uint8_t page : Bus::RestoreSnapshot()) {
+            // Instructions starting on the page before can reach into this one
+            std::uint8_t previous = page - 1;
+            if (!m_code_pages[page] && !m_code_pages[previous])
+                continue;
+            for (unsigned int i = 0; i < Memory::PAGE_SIZE; i++)
+                InvalidateDecoded(page * Memory::PAGE_SIZE + i);
+        }
+    }
+
+    // The cycle counter went back, the deadline has to be worked out again
+    BreakRunLoop();
 }
 
-void CPU::Halt()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::Halt()
 {
     m_should_run = false;
+    BreakRunLoop();
 }
 
-void CPU::Run()
+template <typename Bus, typename Flags, typename Trace>
+bool BasicCPU<Bus, Flags, Trace>::ServiceRunLoop()
+{
+    m_scheduler.RunDue(m_cycles);
+
+    if (m_illegal_opcode || !m_should_run || m_cycles >= m_run_end)
+        return false;
+
+    if (m_nmi)
+        InvokeNMI();
+    else if (m_irq && !reg_status.I())
+        InvokeIRQ();
+
+    // A masked IRQ breaks the loop again once the I flag gets cleared
+    m_deadline = std::min(m_run_end, m_scheduler.NextTimestamp());
+    return true;
+}
+
+template <typename Bus, typename Flags, typename Trace>
+template <bool check_pc>
+void BasicCPU<Bus, Flags, Trace>::RunLoop(std::uint16_t stop_pc)
 {
     m_should_run = true;
-    while (!m_illegal_opcode && m_should_run)
-        Step();
+    while (ServiceRunLoop()) {
+        while (m_cycles < m_deadline) {
+            if constexpr (check_pc) {
+                if (reg_pc == stop_pc)
+                    return;
+            }
+            std::uint8_t opcode = Read(reg_pc++);
+            TraceFetch(reg_pc - 1, opcode);
+            s_handlers[opcode](*this);
+            m_instruction_count++;
+        }
+    }
+}
+
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::Run()
+{
+    m_run_end = UINT64_MAX;
+    RunLoop<false>(0);
+}
+
+template <typename Bus, typename Flags, typename Trace>
+std::uint64_t BasicCPU<Bus, Flags, Trace>::RunFor(std::uint64_t cycles)
+{
+    std::uint64_t start = m_cycles;
+    m_run_end = start + cycles;
+    RunLoop<false>(0);
+    return m_cycles - start;
 }
 
-void CPU::IllegalOP()
+template <typename Bus, typename Flags, typename Trace>
+bool BasicCPU<Bus, Flags, Trace>::RunUntil(std::uint16_t pc)
+{
+    m_run_end = UINT64_MAX;
+    RunLoop<true>(pc);
+    return reg_pc == pc;
+}
+
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::IllegalOP(std::uint16_t address)
 {
     m_illegal_opcode = true;
+    BreakRunLoop();
 }
 
-// A + M + C -> A, C
-void CPU::OP_ADC()
-{
-    std::uint8_t operand = Read(m_address);
-    std::uint32_t result = reg_a + operand + reg_status.C;
-    bool overflow = !((reg_a ^ operand) & 0x80) && ((reg_a ^ result) & 0x80);
-    reg_status.Z = (result & 0xFF) == 0;
-    reg_status.C = result > 0xFF;
-    reg_status.V = overflow;
-    reg_status.N = result & 0x80;
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::AddWithCarry(std::uint8_t operand, bool carry)
+{
+    std::uint32_t result = reg_a + operand + carry;
+    SetV(reg_a, operand, result);
+    SetNZ(result & 0xFF);
+    SetC(result > 0xFF);
     reg_a = result & 0xFF;
 }
 
-void CPU::OP_BRK()
+// A + M + C -> A, C
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_ADC(std::uint16_t address)
+{
+    AddWithCarry(Read(address), GetC());
+}
+
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_BRK(std::uint16_t address)
 {
     StackPush((reg_pc + 1) >> 8);
     StackPush((reg_pc + 1) & 0xFF);
-    StackPush(reg_status | FLAG_B | FLAG_UNUSED);
-    reg_status.I = 1;
+    StackPush(GetStatus() | FLAG_B | FLAG_UNUSED);
+    reg_status.I() = 1;
     reg_pc = Read16(IRQ_VECTOR);
 }
 
-void CPU::OP_INC()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_INC(std::uint16_t address)
 {
-    std::uint8_t operand = Read(m_address);
+    std::uint8_t operand = Read(address);
     operand++;
-    Write(m_address, operand);
-    reg_status.Z = operand == 0;
-    reg_status.N = operand & 0x80;
+    WriteMemory(address, operand);
+    SetNZ(operand);
 }
 
-void CPU::OP_DEC()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_DEC(std::uint16_t address)
 {
-    std::uint8_t operand = Read(m_address);
+    std::uint8_t operand = Read(address);
     operand--;
-    Write(m_address, operand);
-    reg_status.Z = operand == 0;
-    reg_status.N = operand & 0x80;
+    WriteMemory(address, operand);
+    SetNZ(operand);
 }
 
-void CPU::OP_INX()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_INX(std::uint16_t address)
 {
     reg_x++;
-    reg_status.Z = reg_x == 0;
-    reg_status.N = reg_x & 0x80;
+    SetNZ(reg_x);
 }
 
-void CPU::OP_INY()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_INY(std::uint16_t address)
 {
     reg_y++;
-    reg_status.Z = reg_y == 0;
-    reg_status.N = reg_y & 0x80;
+    SetNZ(reg_y);
 }
 
-void CPU::OP_DEY()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_DEY(std::uint16_t address)
 {
     reg_y--;
-    reg_status.Z = reg_y == 0;
-    reg_status.N = reg_y & 0x80;
+    SetNZ(reg_y);
 }
 
-void CPU::OP_DEX()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_DEX(std::uint16_t address)
 {
     reg_x--;
-    reg_status.Z = reg_x == 0;
-    reg_status.N = reg_x & 0x80;
+    SetNZ(reg_x);
 }
 
-void CPU::OP_NOP()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_NOP(std::uint16_t address)
 {
     // No operation
 }
 
-void CPU::OP_LDY()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_LDY(std::uint16_t address)
 {
     // Load index Y with memory
-    std::uint8_t operand = Read(m_address);
+    std::uint8_t operand = Read(address);
     reg_y = operand;
-    reg_status.Z = operand == 0;
-    reg_status.N = operand & 0x80;
+    SetNZ(operand);
 }
 
-void CPU::OP_LDA()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_LDA(std::uint16_t address)
 {
     // Load Accumulator
-    std::uint8_t operand = Read(m_address);
+    std::uint8_t operand = Read(address);
     reg_a = operand;
-    reg_status.Z = operand == 0;
-    reg_status.N = operand & 0x80;
+    SetNZ(operand);
 }
 
-void CPU::OP_LDX()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_LDX(std::uint16_t address)
 {
     // Load Accumulator
-    std::uint8_t operand = Read(m_address);
+    std::uint8_t operand = Read(address);
     reg_x = operand;
-    reg_status.Z = operand == 0;
-    reg_status.N = operand & 0x80;
+    SetNZ(operand);
 }
 
-void CPU::OP_JMP()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_JMP(std::uint16_t address)
 {
-    reg_pc = m_address;
+    reg_pc = address;
 }
 
-void CPU::OP_JSR()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_JSR(std::uint16_t address)
 {
     std::uint16_t returnAddress =
         reg_pc - 1;  // TODO: Should be just regPC since we increment in step()?
     StackPush(returnAddress >> 8);  // Push PC high
     StackPush(returnAddress);       // Push PC low
-    reg_pc = m_address;
+    reg_pc = address;
 }
 
-void CPU::OP_BNE()
+/// Relative jump by the signed byte at 'address'
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::Branch(bool condition, std::uint16_t address)
 {
-    std::int8_t operand = Read(m_address);
-    if (!reg_status.Z)
-        reg_pc += operand;
+    std::int8_t offset = Read(address);
+    if (condition)
+        TakeBranch(offset);
 }
 
-void CPU::OP_BEQ()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::TakeBranch(std::int8_t offset)
 {
-    std::int8_t operand = Read(m_address);
-    if (reg_status.Z)
-        reg_pc += operand;
+    std::uint16_t target = reg_pc + offset;
+    // One cycle for taking the branch, another one if it goes to another page
+    m_cycles += ((target ^ reg_pc) & 0xFF00) ? 2 : 1;
+    reg_pc = target;
 }
 
-void CPU::OP_BMI()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_BNE(std::uint16_t address)
 {
-    std::int8_t operand = Read(m_address);
-    if (reg_status.N)
-        reg_pc += operand;
+    Branch(!GetZ(), address);
 }
 
-void CPU::OP_BCC()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_BEQ(std::uint16_t address)
 {
-    std::int8_t operand = Read(m_address);
-    if (!reg_status.C)
-        reg_pc += operand;
+    Branch(GetZ(), address);
 }
 
-void CPU::OP_BCS()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_BMI(std::uint16_t address)
 {
-    std::int8_t operand = Read(m_address);
-    if (reg_status.C)
-        reg_pc += operand;
+    Branch(GetN(), address);
 }
 
-void CPU::OP_BPL()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_BCC(std::uint16_t address)
 {
-    std::int8_t operand = Read(m_address);
-    if (!reg_status.N)
-        reg_pc += operand;
+    Branch(!GetC(), address);
 }
 
-void CPU::OP_BVC()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_BCS(std::uint16_t address)
 {
-    std::int8_t operand = Read(m_address);
-    if (!reg_status.V)
-        reg_pc += operand;
+    Branch(GetC(), address);
 }
 
-void CPU::OP_BVS()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_BPL(std::uint16_t address)
 {
-    std::int8_t operand = Read(m_address);
-    if (reg_status.V)
-        reg_pc += operand;
+    Branch(!GetN(), address);
 }
 
-void CPU::OP_SEI()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_BVC(std::uint16_t address)
+{
+    Branch(!GetV(), address);
+}
+
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_BVS(std::uint16_t address)
+{
+    Branch(GetV(), address);
+}
+
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_SEI(std::uint16_t address)
 {
     reg_status = reg_status | FLAG_I;
 }
-void CPU::OP_CLI()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_CLI(std::uint16_t address)
 {
     reg_status = reg_status & ~FLAG_I;
+    if (m_irq)
+        BreakRunLoop();
 }
 
-void CPU::OP_CLC()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_CLC(std::uint16_t address)
 {
-    reg_status = reg_status & ~FLAG_C;
+    SetC(false);
 }
 
-void CPU::OP_CLD()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_CLD(std::uint16_t address)
 {
     reg_status = reg_status & ~FLAG_D;
 }
 
-void CPU::OP_CLV()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_CLV(std::uint16_t address)
 {
-    reg_status = reg_status & ~FLAG_V;
+    SetV(false);
 }
 
-void CPU::OP_BIT()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_BIT(std::uint16_t address)
 {
-    std::uint8_t operand = Read(m_address);
-    reg_status.N = operand & 0x80;
-    reg_status.V = operand & 0x40;
-    reg_status.Z = (operand & reg_a) == 0;
+    std::uint8_t operand = Read(address);
+    SetNZ(operand, operand & reg_a);
+    SetV(operand & 0x40);
 }
 
-void CPU::OP_EOR()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_EOR(std::uint16_t address)
 {
-    std::uint8_t operand = Read(m_address);
+    std::uint8_t operand = Read(address);
     reg_a ^= operand;
-    reg_status.Z = reg_a == 0;
-    reg_status.N = reg_a & 0x80;
+    SetNZ(reg_a);
 }
 
-void CPU::OP_AND()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_AND(std::uint16_t address)
 {
-    std::uint8_t operand = Read(m_address);
+    std::uint8_t operand = Read(address);
     reg_a &= operand;
-    reg_status.Z = reg_a == 0;
-    reg_status.N = reg_a & 0x80;
+    SetNZ(reg_a);
 }
 
-void CPU::OP_ASL()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_ASL(std::uint16_t address)
 {
-    std::uint8_t operand = Read(m_address);
-    reg_status.C = operand & 0x80;
+    std::uint8_t operand = Read(address);
+    SetC(operand & 0x80);
     operand <<= 1;
-    Write(m_address, operand);
-    reg_status.Z = operand == 0;
-    reg_status.N = operand & 0x80;
+    WriteMemory(address, operand);
+    SetNZ(operand);
 }
-void CPU::OP_ASL_ACC()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_ASL_ACC(std::uint16_t address)
 {
-    reg_status.C = reg_a & 0x80;
+    SetC(reg_a & 0x80);
     reg_a <<= 1;
-    reg_status.Z = reg_a == 0;
-    reg_status.N = reg_a & 0x80;
+    SetNZ(reg_a);
 }
 
-void CPU::OP_LSR()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_LSR(std::uint16_t address)
 {
-    std::uint8_t operand = Read(m_address);
-    reg_status.C = operand & 1;
+    std::uint8_t operand = Read(address);
+    SetC(operand & 1);
     operand >>= 1;
-    Write(m_address, operand);
-    reg_status.Z = operand == 0;
-    reg_status.N = 0;
+    WriteMemory(address, operand);
+    // Bit 7 is always cleared, so N is as well
+    SetNZ(operand);
 }
 
-void CPU::OP_LSR_ACC()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_LSR_ACC(std::uint16_t address)
 {
-    reg_status.C = reg_a & 1;
+    SetC(reg_a & 1);
     reg_a >>= 1;
-    reg_status.Z = reg_a == 0;
-    reg_status.N = 0;
+    SetNZ(reg_a);
 }
 
-void CPU::OP_ORA()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_ORA(std::uint16_t address)
 {
-    std::uint8_t operand = Read(m_address);
+    std::uint8_t operand = Read(address);
     reg_a |= operand;
-    reg_status.Z = reg_a == 0;
-    reg_status.N = reg_a & 0x80;
+    SetNZ(reg_a);
 }
 
-void CPU::OP_STY()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_STY(std::uint16_t address)
 {
-    Write(m_address, reg_y);
+    WriteMemory(address, reg_y);
 }
 
-void CPU::OP_STA()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_STA(std::uint16_t address)
 {
-    Write(m_address, reg_a);
+    WriteMemory(address, reg_a);
 }
 
-void CPU::OP_STX()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_STX(std::uint16_t address)
 {
-    Write(m_address, reg_x);
+    WriteMemory(address, reg_x);
 }
 
-void CPU::OP_PHA()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_PHA(std::uint16_t address)
 {
     StackPush(reg_a);
 }
 
-void CPU::OP_PHP()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_PHP(std::uint16_t address)
 {
-    StackPush(reg_status | FLAG_B | FLAG_UNUSED);
+    StackPush(GetStatus() | FLAG_B | FLAG_UNUSED);
 }
 
-void CPU::OP_PLA()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_PLA(std::uint16_t address)
 {
     reg_a = StackPop();
-    reg_status.Z = reg_a == 0;
-    reg_status.N = reg_a & 0x80;
+    SetNZ(reg_a);
 }
 
-void CPU::OP_PLP()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_PLP(std::uint16_t address)
 {
-    reg_status = StackPop();
+    SetStatus(StackPop());
 }
 
-void CPU::OP_ROL()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_ROL(std::uint16_t address)
 {
-    std::uint32_t operand = Read(m_address);
+    std::uint32_t operand = Read(address);
     operand <<= 1;
-    operand = reg_status.C ? operand | 1 : operand & ~1;
-    reg_status.C = operand & 0x0100;
-    reg_status.Z = (operand & 0xFF) == 0;
-    reg_status.N = (operand & 0xFF) & 0x80;
-    Write(m_address, operand & 0xFF);
+    operand = GetC() ? operand | 1 : operand & ~1;
+    SetC(operand & 0x0100);
+    SetNZ(operand & 0xFF);
+    WriteMemory(address, operand & 0xFF);
 }
 
-void CPU::OP_ROL_ACC()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_ROL_ACC(std::uint16_t address)
 {
     std::uint32_t operand = reg_a;
     operand <<= 1;
-    operand = reg_status.C ? operand | 1 : operand & ~1;
-    reg_status.C = operand & 0x0100;
-    reg_status.Z = (operand & 0xFF) == 0;
-    reg_status.N = (operand & 0xFF) & 0x80;
+    operand = GetC() ? operand | 1 : operand & ~1;
+    SetC(operand & 0x0100);
+    SetNZ(operand & 0xFF);
     reg_a = operand & 0xFF;
 }
-void CPU::OP_ROR_ACC()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_ROR_ACC(std::uint16_t address)
 {
     std::uint32_t operand = reg_a;
-    operand = reg_status.C ? operand | 0x0100 : operand & ~0x0100;
-    reg_status.C = operand & 1;
+    operand = GetC() ? operand | 0x0100 : operand & ~0x0100;
+    SetC(operand & 1);
     operand >>= 1;
-    reg_status.Z = (operand & 0xFF) == 0;
-    reg_status.N = (operand & 0xFF) & 0x80;
+    SetNZ(operand & 0xFF);
     reg_a = operand & 0xFF;
 }
 
-void CPU::OP_ROR()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_ROR(std::uint16_t address)
 {
-    std::uint32_t operand = Read(m_address);
-    operand = reg_status.C ? operand | 0x0100 : operand & ~0x0100;
-    reg_status.C = operand & 1;
+    std::uint32_t operand = Read(address);
+    operand = GetC() ? operand | 0x0100 : operand & ~0x0100;
+    SetC(operand & 1);
     operand >>= 1;
-    reg_status.Z = (operand & 0xFF) == 0;
-    reg_status.N = (operand & 0xFF) & 0x80;
-    Write(m_address, operand & 0xFF);
+    SetNZ(operand & 0xFF);
+    WriteMemory(address, operand & 0xFF);
 }
 
-void CPU::OP_RTI()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_RTI(std::uint16_t address)
 {
-    reg_status = StackPop();
+    SetStatus(StackPop());
     reg_pc = StackPop() | (StackPop() << 8);
 }
 
-void CPU::OP_RTS()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_RTS(std::uint16_t address)
 {
     reg_pc = (StackPop() | (StackPop() << 8)) + 1;
 }
 
 // A - M - C -> A
-void CPU::OP_SBC()
-{
-    std::uint8_t operand = Read(m_address);
-    std::uint32_t result = reg_a - operand - !reg_status.C;
-    bool overflow = ((reg_a ^ result) & 0x80) && ((reg_a ^ operand) & 0x80);
-    reg_status.Z = (result & 0xFF) == 0;
-    reg_status.C = result < 0x0100;
-    reg_status.V = overflow;
-    reg_status.N = result & 0x80;
-    reg_a = result & 0xFF;
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_SBC(std::uint16_t address)
+{
+    // Same as A + ~M + C
+    AddWithCarry(~Read(address), GetC());
 }
 
-void CPU::OP_SEC()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_SEC(std::uint16_t address)
 {
-    reg_status.C = 1;
+    SetC(true);
 }
 
-void CPU::OP_SED()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_SED(std::uint16_t address)
 {
-    reg_status.D = 1;
+    reg_status.D() = 1;
 }
 
-void CPU::OP_TAX()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_TAX(std::uint16_t address)
 {
     reg_x = reg_a;
-    reg_status.Z = reg_x == 0;
-    reg_status.N = reg_x & 0x80;
+    SetNZ(reg_x);
 }
 
-void CPU::OP_TSX()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_TSX(std::uint16_t address)
 {
     reg_x = reg_sp;
-    reg_status.Z = reg_x == 0;
-    reg_status.N = reg_x & 0x80;
+    SetNZ(reg_x);
 }
 
-void CPU::OP_TYA()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_TYA(std::uint16_t address)
 {
     reg_a = reg_y;
-    reg_status.Z = reg_a == 0;
-    reg_status.N = reg_a & 0x80;
+    SetNZ(reg_a);
 }
 
-void CPU::OP_TXS()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_TXS(std::uint16_t address)
 {
     reg_sp = reg_x;
 }
 
-void CPU::OP_TXA()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_TXA(std::uint16_t address)
 {
     reg_a = reg_x;
-    reg_status.Z = reg_a == 0;
-    reg_status.N = reg_a & 0x80;
+    SetNZ(reg_a);
 }
 
-void CPU::OP_TAY()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_TAY(std::uint16_t address)
 {
     reg_y = reg_a;
-    reg_status.Z = reg_y == 0;
-    reg_status.N = reg_y & 0x80;
+    SetNZ(reg_y);
+}
+
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::Compare(std::uint8_t reg, std::uint8_t operand)
+{
+    std::uint32_t result = reg - operand;
+    SetNZ(result & 0xFF);
+    SetC(result < 0x0100);
 }
 
 // A - M
-void CPU::OP_CMP()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_CMP(std::uint16_t address)
 {
-    std::uint8_t operand = Read(m_address);
-    std::uint32_t result = reg_a - operand;
-    reg_status.Z = reg_a == operand;
-    reg_status.N = result & 0x80;
-    reg_status.C = result < 0x0100;
+    Compare(reg_a, Read(address));
 }
 // X - M
-void CPU::OP_CPX()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_CPX(std::uint16_t address)
 {
-    std::uint8_t operand = Read(m_address);
-    std::uint32_t result = reg_x - operand;
-    reg_status.Z = reg_x == operand;
-    reg_status.N = result & 0x80;
-    reg_status.C = result < 0x0100;
+    Compare(reg_x, Read(address));
 }
 
 // Y - M
-void CPU::OP_CPY()
+template <typename Bus, typename Flags, typename Trace>
+void BasicCPU<Bus, Flags, Trace>::OP_CPY(std::uint16_t address)
 {
-    std::uint8_t operand = Read(m_address);
-    std::uint32_t result = reg_y - operand;
-    reg_status.Z = reg_y == operand;
-    reg_status.N = result & 0x80;
-    reg_status.C = result < 0x0100;
+    Compare(reg_y, Read(address));
 }
 
-DisassemblyMap CPU::Disassemble(std::uint16_t start, std::uint16_t stop)
+template <typename Bus, typename Flags, typename Trace>
+DisassemblyMap BasicCPU<Bus, Flags, Trace>::Disassemble(std::uint16_t start,
+                                                        std::uint16_t stop)
 {
     // Contains the final map
     std::map<std::uint16_t, std::string> map;
@@ -845,61 +1373,58 @@ DisassemblyMap CPU::Disassemble(std::uint16_t start, std::uint16_t stop)
 
         std::uint8_t opcode = Read(pc++);
 
-        instr_string += m_instruction_table[opcode].name + " ";
-
-        if (m_instruction_table[opcode].fetch_address == &CPU::AddressModeImplied) {
-            instr_string += " [IMP]";
-        }
-        else if (m_instruction_table[opcode].fetch_address ==
-                 &CPU::AddressModeImmediate) {
-            operand = Read(pc++);
-            instr_string += "#" + ToHexString<std::uint8_t>(operand) + " [IMM]";
-        }
-        else if (m_instruction_table[opcode].fetch_address == &CPU::AddressModeZeropage) {
-            operand = Read(pc++);
-            instr_string += ToHexString<std::uint8_t>(operand) + " [ZP]";
-        }
-        else if (m_instruction_table[opcode].fetch_address ==
-                 &CPU::AddressModeZeropageX) {
-            operand = Read(pc++);
-            instr_string += ToHexString<std::uint8_t>(operand) + ", X [ZPX]";
-        }
-        else if (m_instruction_table[opcode].fetch_address ==
-                 &CPU::AddressModeZeropageY) {
-            operand = Read(pc++);
-            instr_string += ToHexString<std::uint8_t>(operand) + ", Y [ZPY]";
-        }
-        else if (m_instruction_table[opcode].fetch_address ==
-                 &CPU::AddressModeIndirectX) {
-            operand = Read(pc++);
-            instr_string += "(" + ToHexString<std::uint8_t>(operand) + ", X) [IZX]";
-        }
-        else if (m_instruction_table[opcode].fetch_address ==
-                 &CPU::AddressModeIndirectY) {
-            operand = Read(pc++);
-            instr_string += "(" + ToHexString<std::uint8_t>(operand) + "), Y [IZY]";
-        }
-        else if (m_instruction_table[opcode].fetch_address == &CPU::AddressModeAbsolute) {
-            operand = Read16(pc);
-            pc += 2;
-            instr_string += ToHexString<std::uint16_t>(operand) + " [ABS]";
-        }
-        else if (m_instruction_table[opcode].fetch_address ==
-                 &CPU::AddressModeAbsoluteX) {
-            operand = Read16(pc);
-            pc += 2;
-            instr_string += ToHexString<std::uint16_t>(operand) + ", X [ABX]";
-        }
-        else if (m_instruction_table[opcode].fetch_address ==
-                 &CPU::AddressModeAbsoluteY) {
-            operand = Read16(pc);
-            pc += 2;
-            instr_string += ToHexString<std::uint16_t>(operand) + ", Y [ABY]";
-        }
-        else if (m_instruction_table[opcode].fetch_address == &CPU::AddressModeIndirect) {
-            operand = Read16(pc);
-            pc += 2;
-            instr_string += "(" + ToHexString<std::uint16_t>(operand) + ") [IND]";
+        const InstructionInfo& info = GetInstructionInfo(opcode);
+        instr_string += std::string(info.name) + " ";
+
+        switch (info.mode) {
+            case AddressMode::Implied:
+            case AddressMode::Accumulator:
+                instr_string += " [IMP]";
+                break;
+            case AddressMode::Immediate:
+                operand = Read(pc++);
+                instr_string += "#" + ToHexString<std::uint8_t>(operand) + " [IMM]";
+                break;
+            case AddressMode::Zeropage:
+                operand = Read(pc++);
+                instr_string += ToHexString<std::uint8_t>(operand) + " [ZP]";
+                break;
+            case AddressMode::ZeropageX:
+                operand = Read(pc++);
+                instr_string += ToHexString<std::uint8_t>(operand) + ", X [ZPX]";
+                break;
+            case AddressMode::ZeropageY:
+                operand = Read(pc++);
+                instr_string += ToHexString<std::uint8_t>(operand) + ", Y [ZPY]";
+                break;
+            case AddressMode::IndirectX:
+                operand = Read(pc++);
+                instr_string += "(" + ToHexString<std::uint8_t>(operand) + ", X) [IZX]";
+                break;
+            case AddressMode::IndirectY:
+                operand = Read(pc++);
+                instr_string += "(" + ToHexString<std::uint8_t>(operand) + "), Y [IZY]";
+                break;
+            case AddressMode::Absolute:
+                operand = Read16(pc);
+                pc += 2;
+                instr_string += ToHexString<std::uint16_t>(operand) + " [ABS]";
+                break;
+            case AddressMode::AbsoluteX:
+                operand = Read16(pc);
+                pc += 2;
+                instr_string += ToHexString<std::uint16_t>(operand) + ", X [ABX]";
+                break;
+            case AddressMode::AbsoluteY:
+                operand = Read16(pc);
+                pc += 2;
+                instr_string += ToHexString<std::uint16_t>(operand) + ", Y [ABY]";
+                break;
+            case AddressMode::Indirect:
+                operand = Read16(pc);
+                pc += 2;
+                instr_string += "(" + ToHexString<std::uint16_t>(operand) + ") [IND]";
+                break;
         }
 
         map[instr_addr] = instr_string;
@@ -908,4 +1433,12 @@ DisassemblyMap CPU::Disassemble(std::uint16_t start, std::uint16_t stop)
     return map;
 }
 
+template class BasicCPU<CallbackBus>;
+template class BasicCPU<FlatRAMBus>;
+template class BasicCPU<MMIOBus>;
+template class BasicCPU<Memory>;
+template class BasicCPU<Memory, LazyFlags>;
+template class BasicCPU<Memory, EagerFlags, RecordTrace>;
+template class BasicCPU<Memory, EagerFlags, ProfileTrace>;
+
 }  // namespace llvmes
@@ -8,30 +8,97 @@
 #include <string>
 #include <vector>
 
+#include "llvmes/interpreter/bus.h"
+#include "llvmes/interpreter/flags.h"
 #include "llvmes/interpreter/instruction.h"
+#include "llvmes/interpreter/profiler.h"
 #include "llvmes/interpreter/status_register.h"
+#include "llvmes/interpreter/trace.h"
 #include "llvmes/common.h"
+#include "llvmes/memory.h"
+#include "llvmes/scheduler.h"
 
 namespace llvmes {
 
 using DisassemblyMap = std::map<std::uint16_t, std::string>;
-typedef std::function<std::uint8_t(std::uint16_t)> BusRead;
-typedef std::function<void(std::uint16_t, std::uint8_t)> BusWrite;
 
-class CPU {
+/// The bus policy decides how memory is accessed (see bus.h). It's inherited, so
+/// the members of the bus are reachable directly on the CPU, e.g. 'cpu.Read'.
+/// The flags policy decides when N, Z, C and V are computed (see flags.h).
+/// The trace policy gets a TraceRecord for every instruction (see trace.h).
+template <typename Bus, typename Flags = EagerFlags, typename Trace = NoTrace>
+class BasicCPU : public Bus {
    public:
-    CPU();
+    using Bus::Read;
+    using Bus::Write;
+
+    BasicCPU();
     void Step();
     void Run();
+    /// Runs for at least 'cycles' cycles, the last instruction may go past the
+    /// budget. Returns the number of cycles actually run, which is less if the
+    /// CPU got halted.
+    std::uint64_t RunFor(std::uint64_t cycles);
+    /// Runs until reg_pc is 'pc'. Returns false if the CPU got halted before.
+    bool RunUntil(std::uint16_t pc);
+    /// Same as Run(), but every instruction is decoded only once into a
+    /// DecodedInstruction and executed from there. Writes through the CPU drop
+    /// the decoded instructions they overlap, so self-modifying code still works.
+    void RunDecoded();
+    /// Drops any decoded instruction covering 'addr'. Only needed when memory
+    /// holding code is modified behind the CPU's back, e.g. through GetRAM().
+    void InvalidateDecoded(std::uint16_t addr);
+    /// Lets RunDecoded() execute the sequences in LLVMES_FUSION_LIST with a
+    /// single handler. On by default, turning it off drops the decoded
+    /// instructions.
+    void SetFusion(bool enabled);
+    /// Number of times a fused sequence was entered since the last Reset()
+    std::uint64_t GetFusionCount(Fusion fusion) const
+    {
+        return m_fusion_counts[static_cast<unsigned int>(fusion)];
+    }
     void Halt();
     void Reset();
+    /// Remembers the registers, counters and pending interrupts, replacing the
+    /// previous snapshot. With a Memory bus the memory is included as well,
+    /// copy-on-write (see Memory::TakeSnapshot()), other buses have to save
+    /// their memory themselves. Scheduled events aren't part of the snapshot.
+    void TakeSnapshot();
+    /// Goes back to the last snapshot, which can be done any number of times.
+    /// Decoded instructions on the restored pages are dropped.
+    void RestoreSnapshot();
     void Dump();
     void SetNMI();
     void SetIRQ();
+    /// IRQ is level triggered, it stays asserted until the device clears it
+    void ClearIRQ() { m_irq = false; }
+    /// Raise the interrupt once the cycle counter reaches 'cycle'
+    Scheduler::EventId ScheduleNMI(std::uint64_t cycle);
+    Scheduler::EventId ScheduleIRQ(std::uint64_t cycle);
+    /// Calls 'callback' before the first instruction starting at or after
+    /// 'cycle'. Pending events are dropped by Reset().
+    Scheduler::EventId ScheduleEvent(std::uint64_t cycle, Scheduler::Callback callback);
+    bool CancelEvent(Scheduler::EventId id) { return m_scheduler.Cancel(id); }
     DisassemblyMap Disassemble(std::uint16_t start, std::uint16_t stop);
-
-    BusRead Read;
-    BusWrite Write;
+    /// The status register with all flags up to date. Use this rather than
+    /// reg_status, which is missing N, Z, C and V with LazyFlags.
+    StatusRegister GetStatus() const { return m_flags.Materialize(reg_status); }
+    void SetStatus(StatusRegister status)
+    {
+        reg_status = status;
+        m_flags.Load(status);
+        // A pending IRQ might not be masked anymore
+        if (m_irq)
+            BreakRunLoop();
+    }
+    /// Number of instructions executed since the last Reset()
+    std::uint64_t GetInstructionCount() const { return m_instruction_count; }
+    /// Number of cycles executed since the last Reset()
+    std::uint64_t GetCycles() const { return m_cycles; }
+    /// The trace policy, e.g. to attach a TraceRecorder to RecordTrace or a
+    /// Profiler to ProfileTrace. While tracing, RunDecoded() doesn't fuse
+    /// instructions, so that every one of them gets its own record.
+    Trace& GetTrace() { return m_trace; }
 
     std::uint8_t reg_x;
     std::uint8_t reg_y;
@@ -54,20 +121,241 @@ class CPU {
     // Address at this location points to the first instruction
     constexpr static unsigned int RESET_VECTOR = 0xFFFC;
     constexpr static unsigned int IRQ_VECTOR = 0xFFFE;
+    // Cycles it takes to enter an interrupt handler
+    constexpr static unsigned int INTERRUPT_CYCLES = 7;
 
    private:
-    std::vector<Instruction> m_instruction_table;
+    // Every opcode has a single handler with its addressing mode fused into it.
+    // The address is passed as an argument, so it can stay in a register.
+    typedef void (*Handler)(BasicCPU&);
+    typedef void (BasicCPU::*OperationFn)(std::uint16_t);
+    typedef std::array<Handler, 0x100> HandlerTable;
+
+    template <AddressMode mode, OperationFn op, unsigned int cycles, bool page_penalty>
+    static void Execute(BasicCPU& cpu)
+    {
+        cpu.m_cycles += cycles;
+        std::uint16_t address = cpu.FetchAddress<mode>();
+        if constexpr (page_penalty)
+            cpu.AddPagePenalty<mode>(address);
+        cpu.TraceExecute(address);
+        (cpu.*op)(address);
+    }
+
+    /// Expands LLVMES_INSTRUCTION_LIST into 'Execute' instances
+    constexpr static HandlerTable MakeHandlerTable();
+    // Shared by all CPUs of the same bus, names etc. are in GetInstructionInfo()
+    static const HandlerTable s_handlers;
+
+    // Handlers used by RunDecoded(), the operand bytes are already extracted
+    typedef void (*DecodedHandler)(BasicCPU&, std::uint16_t operand);
+    typedef std::array<DecodedHandler, 0x100> DecodedHandlerTable;
+
+    template <AddressMode mode, OperationFn op, unsigned int cycles, bool page_penalty>
+    static void ExecuteDecoded(BasicCPU& cpu, std::uint16_t operand)
+    {
+        std::uint16_t address = cpu.StartDecoded<mode, cycles, page_penalty>(operand);
+        (cpu.*op)(address);
+    }
+
+    /// Everything ExecuteDecoded() does before the operation, returns the address
+    template <AddressMode mode, unsigned int cycles, bool page_penalty>
+    std::uint16_t StartDecoded(std::uint16_t operand)
+    {
+        m_cycles += cycles;
+        reg_pc += GetInstructionLength(mode);
+        std::uint16_t address = DecodedAddress<mode>(operand);
+        if constexpr (page_penalty)
+            AddPagePenalty<mode>(address);
+        TraceExecute(address);
+        return address;
+    }
+
+    constexpr static DecodedHandlerTable MakeDecodedHandlerTable();
+    static const DecodedHandlerTable s_decoded_handlers;
+
+    // Handlers for the sequences in LLVMES_FUSION_LIST. They run the
+    // instructions one after the other, but skip the flags an instruction sets
+    // if the next one overwrites them. Between two instructions they give up
+    // if the run loop needs to do anything (see ContinueFused()), so fusion
+    // never changes when events and interrupts happen.
+    typedef std::array<DecodedHandler, FUSION_COUNT> FusedHandlerTable;
+
+    /// INX, INY, DEX or DEY followed by BNE
+    template <Fusion fusion, std::uint8_t BasicCPU::*reg, std::uint8_t delta>
+    static void FusedStepBranch(BasicCPU& cpu, std::uint16_t operand);
+    /// INC or DEC of a zeropage address followed by BNE
+    template <Fusion fusion, std::uint8_t delta>
+    static void FusedMemoryStepBranch(BasicCPU& cpu, std::uint16_t operand);
+    /// CLC followed by ADC or SEC followed by SBC
+    template <Fusion fusion, bool subtract, AddressMode mode, unsigned int cycles>
+    static void FusedCarryArithmetic(BasicCPU& cpu, std::uint16_t operand);
+    /// LDA followed by STA, both indexed
+    template <Fusion fusion, AddressMode load_mode, AddressMode store_mode>
+    static void FusedLoadStore(BasicCPU& cpu, std::uint16_t operand);
+    /// CMP with an immediate followed by BEQ or BNE
+    template <Fusion fusion, bool equal>
+    static void FusedCompareBranch(BasicCPU& cpu, std::uint16_t operand);
+    /// INX or INY, a compare of the same register and any branch
+    template <Fusion fusion, std::uint8_t BasicCPU::*reg, AddressMode compare_mode,
+              unsigned int compare_cycles, OperationFn branch>
+    static void FusedStepCompareBranch(BasicCPU& cpu, std::uint16_t operand);
+
+    constexpr static FusedHandlerTable MakeFusedHandlerTable();
+    static const FusedHandlerTable s_fused_handlers;
+
+    /// An instruction decoded at a certain address
+    struct DecodedInstruction {
+        DecodedHandler handler;
+        // The byte or word following the opcode
+        std::uint16_t operand;
+        // Operands of the instructions after this one, if it's fused with them
+        std::uint16_t fused_operands[2];
+        // Label RunDecoded() jumps to, the opcode or FUSED_DISPATCH
+        std::uint16_t dispatch;
+        std::uint8_t opcode;
+        std::uint8_t length;
+        std::uint8_t cycles;
+        // Bytes covered, the same as 'length' unless the instruction is fused
+        std::uint8_t span;
+        Fusion fusion;
+        bool valid;
+    };
+
+    constexpr static unsigned int FUSED_DISPATCH = 0x100;
+    // Two instructions of three bytes
+    constexpr static unsigned int MAX_DECODED_SPAN = 6;
+
+    // Indexed by address, allocated by the first RunDecoded()
+    std::vector<DecodedInstruction> m_decoded;
+    // Pages containing at least one decoded instruction. Writes to other pages
+    // don't have to look at m_decoded.
+    std::array<bool, 0x100> m_code_pages;
+    bool m_fusion;
+    std::array<std::uint64_t, FUSION_COUNT> m_fusion_counts;
+    std::uint64_t m_instruction_count;
+
+    std::uint64_t m_cycles;
+    // The run loops execute instructions as long as m_cycles is below this. It
+    // is the timestamp of the next scheduled event, or 0 when anything else
+    // needs attention (interrupts, Halt() etc.), so that's the only thing
+    // checked between two instructions.
+    std::uint64_t m_deadline;
+    // Where the current run ends, m_deadline is reset to this
+    std::uint64_t m_run_end;
+    Scheduler m_scheduler;
+
+    Flags m_flags;
     bool m_irq, m_nmi;
+
+    Trace m_trace;
+    // PC and opcode of the instruction being executed, filled in before its
+    // handler runs, which adds the rest
+    TraceRecord m_trace_record;
+
+    struct Snapshot {
+        std::uint8_t reg_x, reg_y, reg_a, reg_sp;
+        std::uint16_t reg_pc;
+        StatusRegister status;
+        std::uint64_t instruction_count;
+        std::uint64_t cycles;
+        bool irq, nmi, illegal_opcode;
+    };
+    Snapshot m_snapshot;
     // Will be set to true whenever an illegal op-code gets fetched
     bool m_illegal_opcode;
     // 
     bool m_should_run;
-    // Contains the address associated with an instruction
-    std::uint16_t m_address;
 
    private:
     /// Does two consecutively reads at a certain address
     std::uint16_t Read16(std::uint16_t addr);
+    /// Called by the run loops once they know what's going to be executed
+    void TraceFetch(std::uint16_t pc, std::uint8_t opcode)
+    {
+        if constexpr (Trace::ENABLED) {
+            m_trace_record.pc = pc;
+            m_trace_record.opcode = opcode;
+        }
+    }
+    /// Called by the handlers when the effective address is known, before
+    /// any register is modified
+    void TraceExecute(std::uint16_t address)
+    {
+        if constexpr (Trace::ENABLED) {
+            m_trace_record.address = address;
+            m_trace_record.reg_a = reg_a;
+            m_trace_record.reg_x = reg_x;
+            m_trace_record.reg_y = reg_y;
+            m_trace_record.reg_sp = reg_sp;
+            m_trace_record.status = GetStatus();
+            m_trace.Record(m_trace_record);
+        }
+    }
+
+    /// All writes done by instructions go through here, keeps m_decoded valid
+    void WriteMemory(std::uint16_t addr, std::uint8_t data)
+    {
+        Write(addr, data);
+        if (m_code_pages[addr >> 8])
+            InvalidateDecoded(addr);
+    }
+
+    void SetNZ(std::uint8_t value) { m_flags.SetNZ(reg_status, value); }
+    void SetNZ(std::uint8_t n_value, std::uint8_t z_value)
+    {
+        m_flags.SetNZ(reg_status, n_value, z_value);
+    }
+    void SetC(bool value) { m_flags.SetC(reg_status, value); }
+    void SetV(bool value) { m_flags.SetV(reg_status, value); }
+    void SetV(std::uint8_t a, std::uint8_t operand, std::uint8_t result)
+    {
+        m_flags.SetV(reg_status, a, operand, result);
+    }
+    bool GetN() const { return m_flags.GetN(reg_status); }
+    bool GetZ() const { return m_flags.GetZ(reg_status); }
+    bool GetC() const { return m_flags.GetC(reg_status); }
+    bool GetV() const { return m_flags.GetV(reg_status); }
+
+    /// Leave the inner run loop before the next instruction
+    void BreakRunLoop() { m_deadline = 0; }
+    /// Called by the run loops when the deadline is hit. Runs the due events,
+    /// handles pending interrupts and returns false if the loop should stop.
+    bool ServiceRunLoop();
+    /// Runs instructions until ServiceRunLoop() gives up or reg_pc is 'stop_pc'
+    template <bool check_pc>
+    void RunLoop(std::uint16_t stop_pc);
+
+    template <AddressMode mode>
+    std::uint16_t FetchAddress();
+    /// Indexing that crosses a page costs a cycle for some instructions
+    template <AddressMode mode>
+    void AddPagePenalty(std::uint16_t address);
+    void Branch(bool condition, std::uint16_t address);
+    /// Moves reg_pc by a branch offset and adds the cycles for it
+    void TakeBranch(std::int8_t offset);
+    /// A + operand + carry -> A, SBC passes ~M as the operand
+    void AddWithCarry(std::uint8_t operand, bool carry);
+    /// Sets the flags for CMP, CPX and CPY
+    void Compare(std::uint8_t reg, std::uint8_t operand);
+
+    DecodedInstruction& Decode(std::uint16_t addr);
+    /// The sequence in LLVMES_FUSION_LIST starting at 'addr', if any
+    Fusion MatchFusion(std::uint16_t addr);
+    /// Called by the fused handlers before the next instruction of the
+    /// sequence starting at 'start'. Returns false if the run loop needs to
+    /// look at anything first (see m_deadline), or if the sequence has been
+    /// overwritten, in which case the rest of it runs on its own.
+    bool ContinueFused(std::uint16_t start)
+    {
+        if (m_cycles >= m_deadline || !m_decoded[start].valid)
+            return false;
+        m_instruction_count++;
+        return true;
+    }
+    /// Effective address of a decoded instruction, reg_pc is already past it
+    template <AddressMode mode>
+    std::uint16_t DecodedAddress(std::uint16_t operand);
 
     void StackPush(std::uint8_t value);
     std::uint8_t StackPop();
@@ -75,80 +363,92 @@ class CPU {
     void InvokeIRQ();
     void InvokeNMI();
 
-    void AddressModeImmediate();
-    void AddressModeAbsolute();
-    void AddressModeAbsoluteX();
-    void AddressModeAbsoluteY();
-    void AddressModeZeropage();
-    void AddressModeZeropageX();
-    void AddressModeZeropageY();
-    void AddressModeIndirect();
-    void AddressModeIndirectX();
-    void AddressModeIndirectY();
-    void AddressModeImplied();
-    void AddressModeAccumulator();
-
-    void OP_BIT();
-    void OP_AND();
-    void OP_EOR();
-    void OP_ORA();
-    void OP_ASL();
-    void OP_ASL_ACC();
-    void OP_LSR();
-    void OP_LSR_ACC();
-    void OP_ADC();
-    void OP_JSR();
-    void OP_JMP();
-    void OP_BNE();
-    void OP_BEQ();
-    void OP_BMI();
-    void OP_BCC();
-    void OP_BCS();
-    void OP_BPL();
-    void OP_BVC();
-    void OP_BVS();
-    void OP_BRK();
-    void OP_LDY();
-    void OP_LDA();
-    void OP_LDX();
-    void OP_INX();
-    void OP_INC();
-    void OP_DEC();
-    void OP_INY();
-    void OP_DEY();
-    void OP_DEX();
-    void OP_NOP();
-    void OP_SEI();
-    void OP_CLI();
-    void OP_CLC();
-    void OP_CLD();
-    void OP_CLV();
-    void OP_PHA();
-    void OP_PHP();
-    void OP_PLA();
-    void OP_PLP();
-    void OP_ROL();
-    void OP_ROR();
-    void OP_ROL_ACC();
-    void OP_ROR_ACC();
-    void OP_RTI();
-    void OP_RTS();
-    void OP_SBC();
-    void OP_SEC();
-    void OP_SED();
-    void OP_STA();
-    void OP_STX();
-    void OP_STY();
-    void OP_TAX();
-    void OP_TAY();
-    void OP_TSX();
-    void OP_TYA();
-    void OP_TXS();
-    void OP_TXA();
-    void OP_CMP();
-    void OP_CPX();
-    void OP_CPY();
-    void IllegalOP();
+    std::uint16_t AddressModeImmediate();
+    std::uint16_t AddressModeAbsolute();
+    std::uint16_t AddressModeAbsoluteX();
+    std::uint16_t AddressModeAbsoluteY();
+    std::uint16_t AddressModeZeropage();
+    std::uint16_t AddressModeZeropageX();
+    std::uint16_t AddressModeZeropageY();
+    std::uint16_t AddressModeIndirect();
+    std::uint16_t AddressModeIndirectX();
+    std::uint16_t AddressModeIndirectY();
+    std::uint16_t AddressModeImplied();
+    std::uint16_t AddressModeAccumulator();
+
+    void OP_BIT(std::uint16_t address);
+    void OP_AND(std::uint16_t address);
+    void OP_EOR(std::uint16_t address);
+    void OP_ORA(std::uint16_t address);
+    void OP_ASL(std::uint16_t address);
+    void OP_ASL_ACC(std::uint16_t address);
+    void OP_LSR(std::uint16_t address);
+    void OP_LSR_ACC(std::uint16_t address);
+    void OP_ADC(std::uint16_t address);
+    void OP_JSR(std::uint16_t address);
+    void OP_JMP(std::uint16_t address);
+    void OP_BNE(std::uint16_t address);
+    void OP_BEQ(std::uint16_t address);
+    void OP_BMI(std::uint16_t address);
+    void OP_BCC(std::uint16_t address);
+    void OP_BCS(std::uint16_t address);
+    void OP_BPL(std::uint16_t address);
+    void OP_BVC(std::uint16_t address);
+    void OP_BVS(std::uint16_t address);
+    void OP_BRK(std::uint16_t address);
+    void OP_LDY(std::uint16_t address);
+    void OP_LDA(std::uint16_t address);
+    void OP_LDX(std::uint16_t address);
+    void OP_INX(std::uint16_t address);
+    void OP_INC(std::uint16_t address);
+    void OP_DEC(std::uint16_t address);
+    void OP_INY(std::uint16_t address);
+    void OP_DEY(std::uint16_t address);
+    void OP_DEX(std::uint16_t address);
+    void OP_NOP(std::uint16_t address);
+    void OP_SEI(std::uint16_t address);
+    void OP_CLI(std::uint16_t address);
+    void OP_CLC(std::uint16_t address);
+    void OP_CLD(std::uint16_t address);
+    void OP_CLV(std::uint16_t address);
+    void OP_PHA(std::uint16_t address);
+    void OP_PHP(std::uint16_t address);
+    void OP_PLA(std::uint16_t address);
+    void OP_PLP(std::uint16_t address);
+    void OP_ROL(std::uint16_t address);
+    void OP_ROR(std::uint16_t address);
+    void OP_ROL_ACC(std::uint16_t address);
+    void OP_ROR_ACC(std::uint16_t address);
+    void OP_RTI(std::uint16_t address);
+    void OP_RTS(std::uint16_t address);
+    void OP_SBC(std::uint16_t address);
+    void OP_SEC(std::uint16_t address);
+    void OP_SED(std::uint16_t address);
+    void OP_STA(std::uint16_t address);
+    void OP_STX(std::uint16_t address);
+    void OP_STY(std::uint16_t address);
+    void OP_TAX(std::uint16_t address);
+    void OP_TAY(std::uint16_t address);
+    void OP_TSX(std::uint16_t address);
+    void OP_TYA(std::uint16_t address);
+    void OP_TXS(std::uint16_t address);
+    void OP_TXA(std::uint16_t address);
+    void OP_CMP(std::uint16_t address);
+    void OP_CPX(std::uint16_t address);
+    void OP_CPY(std::uint16_t address);
+    void IllegalOP(std::uint16_t address);
 };
 
+// Instantiated in cpu.cpp
+extern template class BasicCPU<CallbackBus>;
+extern template class BasicCPU<FlatRAMBus>;
+extern template class BasicCPU<MMIOBus>;
+extern template class BasicCPU<Memory>;
+extern template class BasicCPU<Memory, LazyFlags>;
+extern template class BasicCPU<Memory, EagerFlags, RecordTrace>;
+extern template class BasicCPU<Memory, EagerFlags, ProfileTrace>;
+
+/// The callback driven CPU, keeps the original 'cpu.Read = ...' interface
+using CPU = BasicCPU<CallbackBus>;
+
 }  // namespace llvmes
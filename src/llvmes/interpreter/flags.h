@@ -0,0 +1,116 @@
+#pragma once
+#include <cstdint>
+
+#include "llvmes/interpreter/status_register.h"
+
+namespace llvmes {
+
+// The CPU is parameterized on how it keeps N, Z, C and V, see BasicCPU. The
+// instructions report what they computed through the Set functions, and the
+// flags are read back with the Get functions. 'status' is the status register
+// of the CPU, which also holds the I, D and B flags.
+//
+// The overflow flag is given as the operands and result of an addition, so
+// that a subtraction A - M has to pass ~M as 'operand'.
+
+/// Every flag is written to the status register right away
+struct EagerFlags {
+    void SetNZ(StatusRegister& status, std::uint8_t value)
+    {
+        status.N() = value & 0x80;
+        status.Z() = value == 0;
+    }
+    /// N from bit 7 of 'n_value', Z is set if 'z_value' is zero
+    void SetNZ(StatusRegister& status, std::uint8_t n_value, std::uint8_t z_value)
+    {
+        status.N() = n_value & 0x80;
+        status.Z() = z_value == 0;
+    }
+    void SetC(StatusRegister& status, bool c) { status.C() = c; }
+    void SetV(StatusRegister& status, bool v) { status.V() = v; }
+    void SetV(StatusRegister& status, std::uint8_t a, std::uint8_t operand,
+              std::uint8_t result)
+    {
+        status.V() = ~(a ^ operand) & (a ^ result) & 0x80;
+    }
+
+    bool GetN(const StatusRegister& status) const { return status.N(); }
+    bool GetZ(const StatusRegister& status) const { return status.Z(); }
+    bool GetC(const StatusRegister& status) const { return status.C(); }
+    bool GetV(const StatusRegister& status) const { return status.V(); }
+
+    /// Returns the complete status register
+    StatusRegister Materialize(const StatusRegister& status) const { return status; }
+    /// Takes over the flags of a status register that was written as a whole
+    void Load(const StatusRegister&) {}
+};
+
+/// Only the values the flags are based on are saved, the flags themselves are
+/// computed when an instruction asks for them (branches, PHP, interrupts...).
+/// The N, Z, C and V bits of the status register aren't kept up to date,
+/// BasicCPU::GetStatus() gives the complete register.
+struct LazyFlags {
+    // N is bit 7 of 'n_value', Z is set if 'z_value' is zero
+    std::uint8_t n_value = 0;
+    std::uint8_t z_value = 1;
+    // V is the overflow of 'v_a' + 'v_operand' = 'v_result'
+    std::uint8_t v_a = 0;
+    std::uint8_t v_operand = 0;
+    std::uint8_t v_result = 0;
+    // Used by too many instructions to be worth deferring
+    bool c = false;
+
+    void SetNZ(StatusRegister&, std::uint8_t value)
+    {
+        n_value = value;
+        z_value = value;
+    }
+    void SetNZ(StatusRegister&, std::uint8_t n, std::uint8_t z)
+    {
+        n_value = n;
+        z_value = z;
+    }
+    void SetC(StatusRegister&, bool value) { c = value; }
+    void SetV(StatusRegister&, bool value)
+    {
+        // 0 + 0 = 0x80 is an overflow
+        v_a = 0;
+        v_operand = 0;
+        v_result = value ? 0x80 : 0;
+    }
+    void SetV(StatusRegister&, std::uint8_t a, std::uint8_t operand, std::uint8_t result)
+    {
+        v_a = a;
+        v_operand = operand;
+        v_result = result;
+    }
+
+    bool GetN(const StatusRegister&) const { return n_value & 0x80; }
+    bool GetZ(const StatusRegister&) const { return z_value == 0; }
+    bool GetC(const StatusRegister&) const { return c; }
+    bool GetV(const StatusRegister&) const
+    {
+        return ~(v_a ^ v_operand) & (v_a ^ v_result) & 0x80;
+    }
+
+    StatusRegister Materialize(const StatusRegister& status) const
+    {
+        StatusRegister result = status;
+        result.N() = GetN(status);
+        result.Z() = GetZ(status);
+        result.C() = GetC(status);
+        result.V() = GetV(status);
+        return result;
+    }
+    void Load(const StatusRegister& status)
+    {
+        n_value = status.N() ? 0x80 : 0;
+        z_value = !status.Z();
+        c = status.C();
+        v_a = 0;
+        v_operand = 0;
+        v_result = status.V() ? 0x80 : 0;
+    }
+};
+
+}  // namespace llvmes
@@ -0,0 +1,37 @@
+#include "llvmes/interpreter/instruction.h"
+
+#include <array>
+
+namespace llvmes {
+
+static std::array<InstructionInfo, 0x100> MakeInstructionInfoTable()
+{
+    std::array<InstructionInfo, 0x100> table;
+    table.fill({"Illegal OP", AddressMode::Implied, 0, false, false});
+
+#define LLVMES_INSTRUCTION_INFO(opcode, name, mode, op, cycles, page_penalty) \
+    table[opcode] = {#name, AddressMode::mode, cycles, page_penalty, true};
+    LLVMES_INSTRUCTION_LIST(LLVMES_INSTRUCTION_INFO)
+#undef LLVMES_INSTRUCTION_INFO
+
+    return table;
+}
+
+const InstructionInfo& GetInstructionInfo(std::uint8_t opcode)
+{
+    static const std::array<InstructionInfo, 0x100> table = MakeInstructionInfoTable();
+    return table[opcode];
+}
+
+const FusionInfo& GetFusionInfo(Fusion fusion)
+{
+    static const FusionInfo table[FUSION_COUNT] = {
+#define LLVMES_FUSION_INFO(name, count, first, second, third) \
+    {#name, count, {first, second, third}},
+        LLVMES_FUSION_LIST(LLVMES_FUSION_INFO)
+#undef LLVMES_FUSION_INFO
+    };
+    return table[static_cast<unsigned int>(fusion)];
+}
+
+}  // namespace llvmes
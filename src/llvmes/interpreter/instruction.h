@@ -1,16 +1,259 @@
 #pragma once
-#include <string>
+#include <cstdint>
 
 namespace llvmes {
-class CPU;
-// Pointer to a function which will execute an instruction
-typedef void (CPU::*Operation_FnPtr)();
-// Pointer to a function which will fetch an address used in an instruction
-typedef void (CPU::*AddressMode_FnPtr)();
-
-struct Instruction {
-    Operation_FnPtr fetch_address;
-    AddressMode_FnPtr op;
-    std::string name;
+
+enum class AddressMode : std::uint8_t {
+    Implied,
+    Accumulator,
+    Immediate,
+    Zeropage,
+    ZeropageX,
+    ZeropageY,
+    Absolute,
+    AbsoluteX,
+    AbsoluteY,
+    Indirect,
+    IndirectX,
+    IndirectY,
+};
+
+/// Everything about an opcode that the CPU doesn't need to execute it. Only used
+/// by the disassembler and the tools, so it's kept apart from the handler table.
+struct InstructionInfo {
+    const char* name;
+    AddressMode mode;
+    // Base cycle count, without the page crossing and branch penalties
+    std::uint8_t cycles;
+    // Takes one cycle more if indexing crosses a page
+    bool page_penalty;
+    bool legal;
+};
+
+/// Returns the info for any of the 256 opcodes, illegal ones included
+const InstructionInfo& GetInstructionInfo(std::uint8_t opcode);
+
+/// Size in bytes of an instruction, opcode included
+constexpr unsigned int GetInstructionLength(AddressMode mode)
+{
+    switch (mode) {
+        case AddressMode::Implied:
+        case AddressMode::Accumulator:
+            return 1;
+        case AddressMode::Absolute:
+        case AddressMode::AbsoluteX:
+        case AddressMode::AbsoluteY:
+        case AddressMode::Indirect:
+            return 3;
+        default:
+            return 2;
+    }
+}
+
+// All legal opcodes as X(opcode, mnemonic, address mode, operation, cycles,
+// page penalty). The CPU expands it into its handler tables and
+// instruction.cpp into the info table, which keeps them in sync. 'operation'
+// names the OP_ function, which only differs from the mnemonic for the
+// accumulator versions of the shifts.
+// clang-format off
+#define LLVMES_INSTRUCTION_LIST(X) \
+    X(0x00, BRK, Implied, BRK, 7, 0) \
+    X(0x01, ORA, IndirectX, ORA, 6, 0) \
+    X(0x05, ORA, Zeropage, ORA, 3, 0) \
+    X(0x06, ASL, Zeropage, ASL, 5, 0) \
+    X(0x08, PHP, Implied, PHP, 3, 0) \
+    X(0x09, ORA, Immediate, ORA, 2, 0) \
+    X(0x0A, ASL, Accumulator, ASL_ACC, 2, 0) \
+    X(0x0D, ORA, Absolute, ORA, 4, 0) \
+    X(0x0E, ASL, Absolute, ASL, 6, 0) \
+    X(0x10, BPL, Immediate, BPL, 2, 0) \
+    X(0x11, ORA, IndirectY, ORA, 5, 1) \
+    X(0x15, ORA, ZeropageX, ORA, 4, 0) \
+    X(0x16, ASL, ZeropageX, ASL, 6, 0) \
+    X(0x18, CLC, Implied, CLC, 2, 0) \
+    X(0x19, ORA, AbsoluteY, ORA, 4, 1) \
+    X(0x1D, ORA, AbsoluteX, ORA, 4, 1) \
+    X(0x1E, ASL, AbsoluteX, ASL, 7, 0) \
+    X(0x20, JSR, Absolute, JSR, 6, 0) \
+    X(0x21, AND, IndirectX, AND, 6, 0) \
+    X(0x24, BIT, Zeropage, BIT, 3, 0) \
+    X(0x25, AND, Zeropage, AND, 3, 0) \
+    X(0x26, ROL, Zeropage, ROL, 5, 0) \
+    X(0x28, PLP, Implied, PLP, 4, 0) \
+    X(0x29, AND, Immediate, AND, 2, 0) \
+    X(0x2A, ROL, Accumulator, ROL_ACC, 2, 0) \
+    X(0x2C, BIT, Absolute, BIT, 4, 0) \
+    X(0x2D, AND, Absolute, AND, 4, 0) \
+    X(0x2E, ROL, Absolute, ROL, 6, 0) \
+    X(0x30, BMI, Immediate, BMI, 2, 0) \
+    X(0x31, AND, IndirectY, AND, 5, 1) \
+    X(0x35, AND, ZeropageX, AND, 4, 0) \
+    X(0x36, ROL, ZeropageX, ROL, 6, 0) \
+    X(0x38, SEC, Implied, SEC, 2, 0) \
+    X(0x39, AND, AbsoluteY, AND, 4, 1) \
+    X(0x3D, AND, AbsoluteX, AND, 4, 1) \
+    X(0x3E, ROL, AbsoluteX, ROL, 7, 0) \
+    X(0x40, RTI, Implied, RTI, 6, 0) \
+    X(0x41, EOR, IndirectX, EOR, 6, 0) \
+    X(0x45, EOR, Zeropage, EOR, 3, 0) \
+    X(0x46, LSR, Zeropage, LSR, 5, 0) \
+    X(0x48, PHA, Implied, PHA, 3, 0) \
+    X(0x49, EOR, Immediate, EOR, 2, 0) \
+    X(0x4A, LSR, Accumulator, LSR_ACC, 2, 0) \
+    X(0x4C, JMP, Absolute, JMP, 3, 0) \
+    X(0x4D, EOR, Absolute, EOR, 4, 0) \
+    X(0x4E, LSR, Absolute, LSR, 6, 0) \
+    X(0x50, BVC, Immediate, BVC, 2, 0) \
+    X(0x51, EOR, IndirectY, EOR, 5, 1) \
+    X(0x55, EOR, ZeropageX, EOR, 4, 0) \
+    X(0x56, LSR, ZeropageX, LSR, 6, 0) \
+    X(0x58, CLI, Implied, CLI, 2, 0) \
+    X(0x59, EOR, AbsoluteY, EOR, 4, 1) \
+    X(0x5D, EOR, AbsoluteX, EOR, 4, 1) \
+    X(0x5E, LSR, AbsoluteX, LSR, 7, 0) \
+    X(0x60, RTS, Implied, RTS, 6, 0) \
+    X(0x61, ADC, IndirectX, ADC, 6, 0) \
+    X(0x65, ADC, Zeropage, ADC, 3, 0) \
+    X(0x66, ROR, Zeropage, ROR, 5, 0) \
+    X(0x68, PLA, Implied, PLA, 4, 0) \
+    X(0x69, ADC, Immediate, ADC, 2, 0) \
+    X(0x6A, ROR, Accumulator, ROR_ACC, 2, 0) \
+    X(0x6C, JMP, Indirect, JMP, 5, 0) \
+    X(0x6D, ADC, Absolute, ADC, 4, 0) \
+    X(0x6E, ROR, Absolute, ROR, 6, 0) \
+    X(0x70, BVS, Immediate, BVS, 2, 0) \
+    X(0x71, ADC, IndirectY, ADC, 5, 1) \
+    X(0x75, ADC, ZeropageX, ADC, 4, 0) \
+    X(0x76, ROR, ZeropageX, ROR, 6, 0) \
+    X(0x78, SEI, Implied, SEI, 2, 0) \
+    X(0x79, ADC, AbsoluteY, ADC, 4, 1) \
+    X(0x7D, ADC, AbsoluteX, ADC, 4, 1) \
+    X(0x7E, ROR, AbsoluteX, ROR, 7, 0) \
+    X(0x81, STA, IndirectX, STA, 6, 0) \
+    X(0x84, STY, Zeropage, STY, 3, 0) \
+    X(0x85, STA, Zeropage, STA, 3, 0) \
+    X(0x86, STX, Zeropage, STX, 3, 0) \
+    X(0x88, DEY, Implied, DEY, 2, 0) \
+    X(0x8A, TXA, Implied, TXA, 2, 0) \
+    X(0x8C, STY, Absolute, STY, 4, 0) \
+    X(0x8D, STA, Absolute, STA, 4, 0) \
+    X(0x8E, STX, Absolute, STX, 4, 0) \
+    X(0x90, BCC, Immediate, BCC, 2, 0) \
+    X(0x91, STA, IndirectY, STA, 6, 0) \
+    X(0x94, STY, ZeropageX, STY, 4, 0) \
+    X(0x95, STA, ZeropageX, STA, 4, 0) \
+    X(0x96, STX, ZeropageY, STX, 4, 0) \
+    X(0x98, TYA, Implied, TYA, 2, 0) \
+    X(0x99, STA, AbsoluteY, STA, 5, 0) \
+    X(0x9A, TXS, Implied, TXS, 2, 0) \
+    X(0x9D, STA, AbsoluteX, STA, 5, 0) \
+    X(0xA0, LDY, Immediate, LDY, 2, 0) \
+    X(0xA1, LDA, IndirectX, LDA, 6, 0) \
+    X(0xA2, LDX, Immediate, LDX, 2, 0) \
+    X(0xA4, LDY, Zeropage, LDY, 3, 0) \
+    X(0xA5, LDA, Zeropage, LDA, 3, 0) \
+    X(0xA6, LDX, Zeropage, LDX, 3, 0) \
+    X(0xA8, TAY, Implied, TAY, 2, 0) \
+    X(0xA9, LDA, Immediate, LDA, 2, 0) \
+    X(0xAA, TAX, Implied, TAX, 2, 0) \
+    X(0xAC, LDY, Absolute, LDY, 4, 0) \
+    X(0xAD, LDA, Absolute, LDA, 4, 0) \
+    X(0xAE, LDX, Absolute, LDX, 4, 0) \
+    X(0xB0, BCS, Immediate, BCS, 2, 0) \
+    X(0xB1, LDA, IndirectY, LDA, 5, 1) \
+    X(0xB4, LDY, ZeropageX, LDY, 4, 0) \
+    X(0xB5, LDA, ZeropageX, LDA, 4, 0) \
+    X(0xB6, LDX, ZeropageY, LDX, 4, 0) \
+    X(0xB8, CLV, Implied, CLV, 2, 0) \
+    X(0xB9, LDA, AbsoluteY, LDA, 4, 1) \
+    X(0xBA, TSX, Implied, TSX, 2, 0) \
+    X(0xBC, LDY, AbsoluteX, LDY, 4, 1) \
+    X(0xBD, LDA, AbsoluteX, LDA, 4, 1) \
+    X(0xBE, LDX, AbsoluteY, LDX, 4, 1) \
+    X(0xC0, CPY, Immediate, CPY, 2, 0) \
+    X(0xC1, CMP, IndirectX, CMP, 6, 0) \
+    X(0xC4, CPY, Zeropage, CPY, 3, 0) \
+    X(0xC5, CMP, Zeropage, CMP, 3, 0) \
+    X(0xC6, DEC, Zeropage, DEC, 5, 0) \
+    X(0xC8, INY, Implied, INY, 2, 0) \
+    X(0xC9, CMP, Immediate, CMP, 2, 0) \
+    X(0xCA, DEX, Implied, DEX, 2, 0) \
+    X(0xCC, CPY, Absolute, CPY, 4, 0) \
+    X(0xCD, CMP, Absolute, CMP, 4, 0) \
+    X(0xCE, DEC, Absolute, DEC, 6, 0) \
+    X(0xD0, BNE, Immediate, BNE, 2, 0) \
+    X(0xD1, CMP, IndirectY, CMP, 5, 1) \
+    X(0xD5, CMP, ZeropageX, CMP, 4, 0) \
+    X(0xD6, DEC, ZeropageX, DEC, 6, 0) \
+    X(0xD8, CLD, Implied, CLD, 2, 0) \
+    X(0xD9, CMP, AbsoluteY, CMP, 4, 1) \
+    X(0xDD, CMP, AbsoluteX, CMP, 4, 1) \
+    X(0xDE, DEC, AbsoluteX, DEC, 7, 0) \
+    X(0xE0, CPX, Immediate, CPX, 2, 0) \
+    X(0xE1, SBC, IndirectX, SBC, 6, 0) \
+    X(0xE4, CPX, Zeropage, CPX, 3, 0) \
+    X(0xE5, SBC, Zeropage, SBC, 3, 0) \
+    X(0xE6, INC, Zeropage, INC, 5, 0) \
+    X(0xE8, INX, Implied, INX, 2, 0) \
+    X(0xE9, SBC, Immediate, SBC, 2, 0) \
+    X(0xEA, NOP, Implied, NOP, 2, 0) \
+    X(0xEC, CPX, Absolute, CPX, 4, 0) \
+    X(0xED, SBC, Absolute, SBC, 4, 0) \
+    X(0xEE, INC, Absolute, INC, 6, 0) \
+    X(0xF0, BEQ, Immediate, BEQ, 2, 0) \
+    X(0xF1, SBC, IndirectY, SBC, 5, 1) \
+    X(0xF5, SBC, ZeropageX, SBC, 4, 0) \
+    X(0xF6, INC, ZeropageX, INC, 6, 0) \
+    X(0xF8, SED, Implied, SED, 2, 0) \
+    X(0xF9, SBC, AbsoluteY, SBC, 4, 1) \
+    X(0xFD, SBC, AbsoluteX, SBC, 4, 1) \
+    X(0xFE, INC, AbsoluteX, INC, 7, 0)
+// clang-format on
+
+// Instruction sequences that BasicCPU::RunDecoded() executes with a single
+// handler, as X(name, number of instructions, opcodes). The third opcode is
+// only looked at for sequences of three.
+// clang-format off
+#define LLVMES_FUSION_LIST(X) \
+    X(DEX_BNE, 2, 0xCA, 0xD0, 0) \
+    X(DEY_BNE, 2, 0x88, 0xD0, 0) \
+    X(INX_BNE, 2, 0xE8, 0xD0, 0) \
+    X(INY_BNE, 2, 0xC8, 0xD0, 0) \
+    X(INC_ZP_BNE, 2, 0xE6, 0xD0, 0) \
+    X(DEC_ZP_BNE, 2, 0xC6, 0xD0, 0) \
+    X(CLC_ADC_IMM, 2, 0x18, 0x69, 0) \
+    X(CLC_ADC_ZP, 2, 0x18, 0x65, 0) \
+    X(CLC_ADC_ABS, 2, 0x18, 0x6D, 0) \
+    X(SEC_SBC_IMM, 2, 0x38, 0xE9, 0) \
+    X(SEC_SBC_ZP, 2, 0x38, 0xE5, 0) \
+    X(SEC_SBC_ABS, 2, 0x38, 0xED, 0) \
+    X(LDA_ABSX_STA_ABSY, 2, 0xBD, 0x99, 0) \
+    X(LDA_ABSY_STA_ABSX, 2, 0xB9, 0x9D, 0) \
+    X(LDA_ABSX_STA_ABSX, 2, 0xBD, 0x9D, 0) \
+    X(LDA_ABSY_STA_ABSY, 2, 0xB9, 0x99, 0) \
+    X(CMP_IMM_BEQ, 2, 0xC9, 0xF0, 0) \
+    X(CMP_IMM_BNE, 2, 0xC9, 0xD0, 0) \
+    X(INX_CPX_IMM_BNE, 3, 0xE8, 0xE0, 0xD0) \
+    X(INY_CPY_IMM_BNE, 3, 0xC8, 0xC0, 0xD0) \
+    X(INX_CPX_ZP_BPL, 3, 0xE8, 0xE4, 0x10)
+// clang-format on
+
+enum class Fusion : std::uint8_t {
+#define LLVMES_FUSION_ENUM(name, count, first, second, third) name,
+    LLVMES_FUSION_LIST(LLVMES_FUSION_ENUM)
+#undef LLVMES_FUSION_ENUM
+    None
 };
+
+constexpr unsigned int FUSION_COUNT = static_cast<unsigned int>(Fusion::None);
+
+struct FusionInfo {
+    const char* name;
+    // Number of instructions in the sequence, 2 or 3
+    unsigned int count;
+    std::uint8_t opcodes[3];
+};
+
+const FusionInfo& GetFusionInfo(Fusion fusion);
+
 }  // namespace llvmes
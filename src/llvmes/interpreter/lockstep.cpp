@@ -0,0 +1,1029 @@
+#include "llvmes/interpreter/lockstep.h"
+
+#include <algorithm>
+
+namespace llvmes {
+
+// Most loops below run over every lane and blend the result into the masked
+// ones, rather than skipping the others, so they can be vectorized. The memory
+// of the lanes is interleaved, the byte at 'addr' of all lanes is at
+// addr * LANES. An access where all lanes use the same address, which is the
+// usual case, is a single vector load or store. Only accesses that diverge are
+// done lane by lane.
+
+template <unsigned int LANES>
+LockstepCPU<LANES>::LockstepCPU()
+    : reg_x(),
+      reg_y(),
+      reg_a(),
+      reg_sp(),
+      reg_pc(),
+      reg_status(),
+      m_memory(LANES * 0x10000),
+      m_device_pages(),
+      m_n(),
+      m_z(),
+      m_c(),
+      m_v(),
+      m_running(),
+      m_illegal(),
+      m_pending_cycles(),
+      m_pending_instructions(),
+      m_cycles(),
+      m_instruction_count(),
+      m_cycle_limit(UINT64_MAX),
+      m_steps(0),
+      m_pc(0),
+      m_leader(0)
+{
+}
+
+template <unsigned int LANES>
+constexpr typename LockstepCPU<LANES>::HandlerTable LockstepCPU<LANES>::MakeHandlerTable()
+{
+    HandlerTable table{};
+    for (auto& it : table)
+        it = &Execute<AddressMode::Implied, &LockstepCPU::IllegalOP, 0, false>;
+
+#define LLVMES_LOCKSTEP_HANDLER(opcode, name, mode, op, cycles, page_penalty) \
+    table[opcode] =                                                           \
+        &Execute<AddressMode::mode, &LockstepCPU::OP_##op, cycles, page_penalty>;
+    LLVMES_INSTRUCTION_LIST(LLVMES_LOCKSTEP_HANDLER)
+#undef LLVMES_LOCKSTEP_HANDLER
+
+    return table;
+}
+
+template <unsigned int LANES>
+const typename LockstepCPU<LANES>::HandlerTable LockstepCPU<LANES>::s_handlers =
+    LockstepCPU<LANES>::MakeHandlerTable();
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::MapDevice(std::uint8_t first_page, unsigned int count,
+                                   LaneRead read, LaneWrite write)
+{
+    for (unsigned int i = 0; i < count; i++)
+        m_device_pages[first_page + i] = true;
+    m_device_read = std::move(read);
+    m_device_write = std::move(write);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::LoadRAM(unsigned int lane, std::uint16_t addr,
+                                 const std::uint8_t* data, std::size_t size)
+{
+    for (std::size_t i = 0; i < size && addr + i < 0x10000; i++)
+        RAM(lane, addr + i) = data[i];
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::SaveRAM(unsigned int lane, std::uint8_t* out) const
+{
+    for (std::size_t addr = 0; addr < 0x10000; addr++)
+        out[addr] = m_memory[addr * LANES + lane];
+}
+
+template <unsigned int LANES>
+std::uint8_t LockstepCPU<LANES>::Read(unsigned int lane, std::uint16_t addr)
+{
+    if (m_device_pages[addr >> 8] && m_device_read)
+        return m_device_read(lane, addr);
+    return m_memory[addr * LANES + lane];
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::Write(unsigned int lane, std::uint16_t addr, std::uint8_t data)
+{
+    if (m_device_pages[addr >> 8]) {
+        if (m_device_write)
+            m_device_write(lane, addr, data);
+        return;
+    }
+    m_memory[addr * LANES + lane] = data;
+}
+
+template <unsigned int LANES>
+typename LockstepCPU<LANES>::LaneBytes LockstepCPU<LANES>::Load(const LaneMask& mask,
+                                                                const LaneWords& address)
+{
+    LaneBytes values{};
+    std::uint32_t first = UniformAddress(mask, address);
+    if (first != NOT_UNIFORM) {
+        const std::uint8_t* data = &m_memory[first * LANES];
+        for (unsigned int i = 0; i < LANES; i++)
+            values[i] = data[i] & mask[i];
+        return values;
+    }
+
+    for (unsigned int i = 0; i < LANES; i++) {
+        if (mask[i])
+            values[i] = Read(i, address[i]);
+    }
+    return values;
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::Store(const LaneMask& mask, const LaneWords& address,
+                               const LaneBytes& values)
+{
+    std::uint32_t first = UniformAddress(mask, address);
+    if (first != NOT_UNIFORM) {
+        std::uint8_t* data = &m_memory[first * LANES];
+        for (unsigned int i = 0; i < LANES; i++)
+            data[i] = Blend(mask[i], values[i], data[i]);
+        return;
+    }
+
+    for (unsigned int i = 0; i < LANES; i++) {
+        if (mask[i])
+            Write(i, address[i], values[i]);
+    }
+}
+
+template <unsigned int LANES>
+std::uint32_t LockstepCPU<LANES>::UniformAddress(const LaneMask& mask,
+                                                 const LaneWords& address) const
+{
+    // The leader is always masked, the others have to match it
+    std::uint16_t first = address[m_leader];
+
+    // Bool reductions don't get vectorized
+    std::uint16_t diverged = 0;
+    for (unsigned int i = 0; i < LANES; i++)
+        diverged |= (address[i] ^ first) & Widen<std::uint16_t>(mask[i]);
+
+    if (diverged || m_device_pages[first >> 8])
+        return NOT_UNIFORM;
+    return first;
+}
+
+template <unsigned int LANES>
+typename LockstepCPU<LANES>::LaneWords LockstepCPU<LANES>::Load16(
+    const LaneMask& mask, const LaneWords& address)
+{
+    LaneWords high_address;
+    for (unsigned int i = 0; i < LANES; i++)
+        high_address[i] = address[i] + 1;
+
+    LaneBytes low = Load(mask, address);
+    LaneBytes high = Load(mask, high_address);
+    LaneWords result;
+    for (unsigned int i = 0; i < LANES; i++)
+        result[i] = low[i] | (high[i] << 8);
+    return result;
+}
+
+template <unsigned int LANES>
+template <typename T>
+void LockstepCPU<LANES>::Assign(std::array<T, LANES>& reg, const LaneMask& mask,
+                                const std::array<T, LANES>& values)
+{
+    for (unsigned int i = 0; i < LANES; i++)
+        reg[i] = Blend(mask[i], values[i], reg[i]);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::SetNZ(const LaneMask& mask, const LaneBytes& values)
+{
+    for (unsigned int i = 0; i < LANES; i++) {
+        m_n[i] = Blend(mask[i], values[i], m_n[i]);
+        m_z[i] = Blend(mask[i], values[i], m_z[i]);
+    }
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::StackPush(const LaneMask& mask, const LaneBytes& values)
+{
+    LaneWords address;
+    for (unsigned int i = 0; i < LANES; i++) {
+        address[i] = 0x0100 | reg_sp[i];
+        reg_sp[i] -= mask[i] & 1;
+    }
+    Store(mask, address, values);
+}
+
+template <unsigned int LANES>
+typename LockstepCPU<LANES>::LaneBytes LockstepCPU<LANES>::StackPop(const LaneMask& mask)
+{
+    LaneWords address;
+    for (unsigned int i = 0; i < LANES; i++) {
+        reg_sp[i] += mask[i] & 1;
+        address[i] = 0x0100 | reg_sp[i];
+    }
+    return Load(mask, address);
+}
+
+template <unsigned int LANES>
+typename LockstepCPU<LANES>::LaneBytes LockstepCPU<LANES>::GetStatusBytes() const
+{
+    LaneBytes status;
+    for (unsigned int i = 0; i < LANES; i++) {
+        status[i] = (reg_status[i] & 0x3C) | (m_n[i] & 0x80) | ((m_v[i] & 0x80) >> 1) |
+                    (m_z[i] ? 0 : 0x02) | m_c[i];
+    }
+    return status;
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::SetStatusBytes(const LaneMask& mask, const LaneBytes& status)
+{
+    LaneBytes n, v, z, c;
+    for (unsigned int i = 0; i < LANES; i++) {
+        n[i] = status[i];
+        v[i] = status[i] << 1;
+        z[i] = ~status[i] & 0x02;
+        c[i] = status[i] & 1;
+    }
+    Assign(reg_status, mask, status);
+    Assign(m_n, mask, n);
+    Assign(m_v, mask, v);
+    Assign(m_z, mask, z);
+    Assign(m_c, mask, c);
+}
+
+template <unsigned int LANES>
+StatusRegister LockstepCPU<LANES>::GetStatus(unsigned int lane) const
+{
+    return GetStatusBytes()[lane];
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::Reset()
+{
+    LaneMask all;
+    all.fill(0xFF);
+    LaneWords vector;
+    vector.fill(RESET_VECTOR);
+    reg_pc = Load16(all, vector);
+
+    LaneBytes status;
+    status.fill(0x34);
+    SetStatusBytes(all, status);
+    reg_x.fill(0);
+    reg_y.fill(0);
+    reg_a.fill(0);
+    reg_sp.fill(0xFD);
+    m_running = all;
+    m_illegal.fill(0);
+    m_pending_cycles.fill(0);
+    m_pending_instructions.fill(0);
+    m_cycles.fill(0);
+    m_instruction_count.fill(0);
+    m_steps = 0;
+}
+
+template <unsigned int LANES>
+bool LockstepCPU<LANES>::Step()
+{
+    // The lanes with the lowest PC go first, so the others wait at the point
+    // they're ahead at until the rest catches up
+    std::uint32_t lowest = 0x10000;
+    for (unsigned int i = 0; i < LANES; i++)
+        lowest = std::min<std::uint32_t>(lowest, m_running[i] ? reg_pc[i] : 0x10000);
+    if (lowest == 0x10000)
+        return false;
+
+    std::uint16_t pc = lowest;
+    unsigned int leader = 0;
+    while (!m_running[leader] || reg_pc[leader] != pc)
+        leader++;
+    std::uint8_t opcode = Read(leader, pc);
+
+    LaneMask mask;
+    if (m_device_pages[pc >> 8]) {
+        for (unsigned int i = 0; i < LANES; i++) {
+            bool active = m_running[i] && reg_pc[i] == pc && Read(i, pc) == opcode;
+            mask[i] = active ? 0xFF : 0;
+        }
+    }
+    else {
+        // The code might differ between the lanes, e.g. if it modifies itself
+        const std::uint8_t* code = &m_memory[pc * LANES];
+        for (unsigned int i = 0; i < LANES; i++) {
+            bool active = (reg_pc[i] == pc) & (code[i] == opcode);
+            mask[i] = active ? m_running[i] : 0;
+        }
+    }
+    for (unsigned int i = 0; i < LANES; i++) {
+        reg_pc[i] += mask[i] & 1;
+        m_pending_instructions[i] += mask[i] & 1;
+    }
+
+    m_pc = pc + 1;
+    m_leader = leader;
+    s_handlers[opcode](*this, mask);
+    if (++m_steps % COUNTER_FLUSH == 0)
+        FlushCounters();
+    return true;
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::FlushCounters()
+{
+    for (unsigned int i = 0; i < LANES; i++) {
+        m_cycles[i] += m_pending_cycles[i];
+        m_instruction_count[i] += m_pending_instructions[i];
+        m_pending_cycles[i] = 0;
+        m_pending_instructions[i] = 0;
+        if (m_cycles[i] >= m_cycle_limit)
+            m_running[i] = 0;
+    }
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::Run()
+{
+    while (Step())
+        ;
+    FlushCounters();
+}
+
+template <unsigned int LANES>
+typename LockstepCPU<LANES>::LaneBytes LockstepCPU<LANES>::FetchOperand(
+    const LaneMask& mask, unsigned int offset)
+{
+    // All masked lanes are at the same PC, so this is always uniform
+    std::uint16_t addr = m_pc + offset;
+    if (m_device_pages[addr >> 8]) {
+        LaneWords address;
+        address.fill(addr);
+        return Load(mask, address);
+    }
+
+    LaneBytes values;
+    const std::uint8_t* data = &m_memory[addr * LANES];
+    for (unsigned int i = 0; i < LANES; i++)
+        values[i] = data[i] & mask[i];
+    return values;
+}
+
+template <unsigned int LANES>
+typename LockstepCPU<LANES>::LaneWords LockstepCPU<LANES>::FetchOperand16(
+    const LaneMask& mask)
+{
+    LaneBytes low = FetchOperand(mask, 0);
+    LaneBytes high = FetchOperand(mask, 1);
+    LaneWords result;
+    for (unsigned int i = 0; i < LANES; i++)
+        result[i] = low[i] | (high[i] << 8);
+    return result;
+}
+
+template <unsigned int LANES>
+template <AddressMode mode>
+typename LockstepCPU<LANES>::LaneWords LockstepCPU<LANES>::FetchAddress(
+    const LaneMask& mask)
+{
+    constexpr unsigned int length = GetInstructionLength(mode) - 1;
+    LaneWords address{};
+
+    // Same as the AddressMode functions of BasicCPU, see cpu.cpp
+    if constexpr (mode == AddressMode::Immediate) {
+        address = reg_pc;
+    }
+    else if constexpr (mode == AddressMode::Zeropage || mode == AddressMode::ZeropageX ||
+                       mode == AddressMode::ZeropageY) {
+        LaneBytes operand = FetchOperand(mask);
+        for (unsigned int i = 0; i < LANES; i++) {
+            if constexpr (mode == AddressMode::ZeropageX)
+                address[i] = static_cast<std::uint8_t>(operand[i] + reg_x[i]);
+            else if constexpr (mode == AddressMode::ZeropageY)
+                address[i] = static_cast<std::uint8_t>(operand[i] + reg_y[i]);
+            else
+                address[i] = operand[i];
+        }
+    }
+    else if constexpr (mode == AddressMode::Absolute || mode == AddressMode::AbsoluteX ||
+                       mode == AddressMode::AbsoluteY) {
+        address = FetchOperand16(mask);
+        for (unsigned int i = 0; i < LANES; i++) {
+            if constexpr (mode == AddressMode::AbsoluteX)
+                address[i] += reg_x[i];
+            else if constexpr (mode == AddressMode::AbsoluteY)
+                address[i] += reg_y[i];
+        }
+    }
+    else if constexpr (mode == AddressMode::Indirect) {
+        LaneWords indirection = FetchOperand16(mask);
+        // The high byte doesn't cross the page
+        LaneWords high_address;
+        for (unsigned int i = 0; i < LANES; i++)
+            high_address[i] = (indirection[i] & 0xFF00) | ((indirection[i] + 1) & 0xFF);
+        LaneBytes low = Load(mask, indirection);
+        LaneBytes high = Load(mask, high_address);
+        for (unsigned int i = 0; i < LANES; i++)
+            address[i] = low[i] | (high[i] << 8);
+    }
+    else if constexpr (mode == AddressMode::IndirectX || mode == AddressMode::IndirectY) {
+        LaneBytes operand = FetchOperand(mask);
+        LaneWords base;
+        for (unsigned int i = 0; i < LANES; i++) {
+            if constexpr (mode == AddressMode::IndirectX)
+                base[i] = static_cast<std::uint8_t>(operand[i] + reg_x[i]);
+            else
+                base[i] = operand[i];
+        }
+        address = Load16(mask, base);
+        if constexpr (mode == AddressMode::IndirectY) {
+            for (unsigned int i = 0; i < LANES; i++)
+                address[i] += reg_y[i];
+        }
+    }
+
+    if constexpr (length > 0) {
+        for (unsigned int i = 0; i < LANES; i++)
+            reg_pc[i] += mask[i] & length;
+    }
+    return address;
+}
+
+template <unsigned int LANES>
+template <AddressMode mode>
+void LockstepCPU<LANES>::AddPagePenalty(const LaneMask& mask, const LaneWords& address)
+{
+    for (unsigned int i = 0; i < LANES; i++) {
+        if constexpr (mode == AddressMode::AbsoluteX)
+            m_pending_cycles[i] += (mask[i] & 1) & ((address[i] & 0xFF) < reg_x[i]);
+        else if constexpr (mode == AddressMode::AbsoluteY ||
+                           mode == AddressMode::IndirectY)
+            m_pending_cycles[i] += (mask[i] & 1) & ((address[i] & 0xFF) < reg_y[i]);
+    }
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::Branch(const LaneMask& mask, const LaneWords& address,
+                                const LaneBytes& flag, std::uint8_t bits, bool expected)
+{
+    LaneBytes offset = Load(mask, address);
+    for (unsigned int i = 0; i < LANES; i++) {
+        std::uint8_t set = (flag[i] & bits) ? 0xFF : 0;
+        std::uint8_t taken = mask[i] & (expected ? set : ~set);
+        std::uint16_t target = reg_pc[i] + static_cast<std::int8_t>(offset[i]);
+        std::uint16_t penalty = ((target ^ reg_pc[i]) & 0xFF00) ? 2 : 1;
+        m_pending_cycles[i] += Widen<std::uint16_t>(taken) & penalty;
+        reg_pc[i] = Blend(taken, target, reg_pc[i]);
+    }
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::LoadRegister(LaneBytes& reg, const LaneMask& mask,
+                                      const LaneWords& address)
+{
+    LaneBytes operand = Load(mask, address);
+    Assign(reg, mask, operand);
+    SetNZ(mask, operand);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::Transfer(LaneBytes& to, const LaneBytes& from,
+                                  const LaneMask& mask, bool set_nz)
+{
+    Assign(to, mask, from);
+    if (set_nz)
+        SetNZ(mask, to);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::Increment(LaneBytes& reg, const LaneMask& mask,
+                                   std::uint8_t delta)
+{
+    for (unsigned int i = 0; i < LANES; i++)
+        reg[i] += mask[i] & delta;
+    SetNZ(mask, reg);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::Compare(const LaneBytes& reg, const LaneMask& mask,
+                                 const LaneWords& address)
+{
+    LaneBytes operand = Load(mask, address);
+    LaneBytes result, carry;
+    for (unsigned int i = 0; i < LANES; i++) {
+        // Bit 8 is set if the subtraction borrowed
+        std::uint16_t difference = reg[i] - operand[i];
+        result[i] = difference;
+        carry[i] = (difference >> 8) + 1;
+    }
+    SetNZ(mask, result);
+    SetC(mask, carry);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::SetStatusBits(const LaneMask& mask, std::uint8_t bits,
+                                       bool value)
+{
+    for (unsigned int i = 0; i < LANES; i++) {
+        std::uint8_t status = value ? (reg_status[i] | bits) : (reg_status[i] & ~bits);
+        reg_status[i] = Blend(mask[i], status, reg_status[i]);
+    }
+}
+
+template <unsigned int LANES>
+template <bool left, bool rotate>
+void LockstepCPU<LANES>::Shift(LaneBytes& values, LaneBytes& carry)
+{
+    for (unsigned int i = 0; i < LANES; i++) {
+        // Done in 16 bits, x86 has no vector shifts for bytes
+        std::uint16_t in = rotate ? m_c[i] : 0;
+        if constexpr (left) {
+            std::uint16_t wide = (values[i] << 1) | in;
+            carry[i] = wide >> 8;
+            values[i] = wide;
+        }
+        else {
+            std::uint16_t wide = values[i] | (in << 8);
+            carry[i] = wide & 1;
+            values[i] = wide >> 1;
+        }
+    }
+}
+
+template <unsigned int LANES>
+template <bool left, bool rotate>
+void LockstepCPU<LANES>::ShiftMemory(const LaneMask& mask, const LaneWords& address)
+{
+    LaneBytes operand = Load(mask, address);
+    LaneBytes carry;
+    Shift<left, rotate>(operand, carry);
+    SetC(mask, carry);
+    Store(mask, address, operand);
+    SetNZ(mask, operand);
+}
+
+template <unsigned int LANES>
+template <bool left, bool rotate>
+void LockstepCPU<LANES>::ShiftAccumulator(const LaneMask& mask)
+{
+    LaneBytes result = reg_a;
+    LaneBytes carry;
+    Shift<left, rotate>(result, carry);
+    SetC(mask, carry);
+    Assign(reg_a, mask, result);
+    SetNZ(mask, result);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_BIT(const LaneMask& mask, const LaneWords& address)
+{
+    LaneBytes operand = Load(mask, address);
+    LaneBytes n, z, v;
+    for (unsigned int i = 0; i < LANES; i++) {
+        n[i] = operand[i];
+        z[i] = operand[i] & reg_a[i];
+        v[i] = operand[i] << 1;
+    }
+    Assign(m_n, mask, n);
+    Assign(m_z, mask, z);
+    SetV(mask, v);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_AND(const LaneMask& mask, const LaneWords& address)
+{
+    LaneBytes operand = Load(mask, address);
+    for (unsigned int i = 0; i < LANES; i++)
+        reg_a[i] &= operand[i] | ~mask[i];
+    SetNZ(mask, reg_a);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_EOR(const LaneMask& mask, const LaneWords& address)
+{
+    // Unmasked lanes read 0, which leaves A as it is
+    LaneBytes operand = Load(mask, address);
+    for (unsigned int i = 0; i < LANES; i++)
+        reg_a[i] ^= operand[i];
+    SetNZ(mask, reg_a);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_ORA(const LaneMask& mask, const LaneWords& address)
+{
+    LaneBytes operand = Load(mask, address);
+    for (unsigned int i = 0; i < LANES; i++)
+        reg_a[i] |= operand[i];
+    SetNZ(mask, reg_a);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_ASL(const LaneMask& mask, const LaneWords& address)
+{
+    ShiftMemory<true, false>(mask, address);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_ASL_ACC(const LaneMask& mask, const LaneWords& address)
+{
+    ShiftAccumulator<true, false>(mask);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_LSR(const LaneMask& mask, const LaneWords& address)
+{
+    ShiftMemory<false, false>(mask, address);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_LSR_ACC(const LaneMask& mask, const LaneWords& address)
+{
+    ShiftAccumulator<false, false>(mask);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_ROL(const LaneMask& mask, const LaneWords& address)
+{
+    ShiftMemory<true, true>(mask, address);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_ROL_ACC(const LaneMask& mask, const LaneWords& address)
+{
+    ShiftAccumulator<true, true>(mask);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_ROR(const LaneMask& mask, const LaneWords& address)
+{
+    ShiftMemory<false, true>(mask, address);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_ROR_ACC(const LaneMask& mask, const LaneWords& address)
+{
+    ShiftAccumulator<false, true>(mask);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_ADC(const LaneMask& mask, const LaneWords& address)
+{
+    LaneBytes operand = Load(mask, address);
+    LaneBytes result, carry, overflow;
+    for (unsigned int i = 0; i < LANES; i++) {
+        std::uint16_t sum = reg_a[i] + operand[i] + m_c[i];
+        result[i] = sum;
+        carry[i] = sum >> 8;
+        overflow[i] = ~(reg_a[i] ^ operand[i]) & (reg_a[i] ^ result[i]);
+    }
+    SetV(mask, overflow);
+    SetNZ(mask, result);
+    SetC(mask, carry);
+    Assign(reg_a, mask, result);
+}
+
+// A - M - C -> A
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_SBC(const LaneMask& mask, const LaneWords& address)
+{
+    LaneBytes operand = Load(mask, address);
+    LaneBytes result, carry, overflow;
+    for (unsigned int i = 0; i < LANES; i++) {
+        // Same as A + ~M + C
+        std::uint8_t inverted = ~operand[i];
+        std::uint16_t sum = reg_a[i] + inverted + m_c[i];
+        result[i] = sum;
+        carry[i] = sum >> 8;
+        overflow[i] = ~(reg_a[i] ^ inverted) & (reg_a[i] ^ result[i]);
+    }
+    SetV(mask, overflow);
+    SetNZ(mask, result);
+    SetC(mask, carry);
+    Assign(reg_a, mask, result);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_JSR(const LaneMask& mask, const LaneWords& address)
+{
+    LaneBytes high, low;
+    for (unsigned int i = 0; i < LANES; i++) {
+        std::uint16_t return_address = reg_pc[i] - 1;
+        high[i] = return_address >> 8;
+        low[i] = return_address & 0xFF;
+    }
+    StackPush(mask, high);
+    StackPush(mask, low);
+    Assign(reg_pc, mask, address);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_JMP(const LaneMask& mask, const LaneWords& address)
+{
+    Assign(reg_pc, mask, address);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_RTI(const LaneMask& mask, const LaneWords& address)
+{
+    SetStatusBytes(mask, StackPop(mask));
+    LaneBytes low = StackPop(mask);
+    LaneBytes high = StackPop(mask);
+    LaneWords target;
+    for (unsigned int i = 0; i < LANES; i++)
+        target[i] = low[i] | (high[i] << 8);
+    Assign(reg_pc, mask, target);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_RTS(const LaneMask& mask, const LaneWords& address)
+{
+    LaneBytes low = StackPop(mask);
+    LaneBytes high = StackPop(mask);
+    LaneWords target;
+    for (unsigned int i = 0; i < LANES; i++)
+        target[i] = (low[i] | (high[i] << 8)) + 1;
+    Assign(reg_pc, mask, target);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_BRK(const LaneMask& mask, const LaneWords& address)
+{
+    LaneBytes high, low, status = GetStatusBytes();
+    for (unsigned int i = 0; i < LANES; i++) {
+        high[i] = (reg_pc[i] + 1) >> 8;
+        low[i] = (reg_pc[i] + 1) & 0xFF;
+        status[i] |= FLAG_B | FLAG_UNUSED;
+    }
+    StackPush(mask, high);
+    StackPush(mask, low);
+    StackPush(mask, status);
+    SetStatusBits(mask, FLAG_I, true);
+
+    LaneWords vector;
+    vector.fill(IRQ_VECTOR);
+    Assign(reg_pc, mask, Load16(mask, vector));
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_BNE(const LaneMask& mask, const LaneWords& address)
+{
+    Branch(mask, address, m_z, 0xFF, true);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_BEQ(const LaneMask& mask, const LaneWords& address)
+{
+    Branch(mask, address, m_z, 0xFF, false);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_BMI(const LaneMask& mask, const LaneWords& address)
+{
+    Branch(mask, address, m_n, 0x80, true);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_BPL(const LaneMask& mask, const LaneWords& address)
+{
+    Branch(mask, address, m_n, 0x80, false);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_BCC(const LaneMask& mask, const LaneWords& address)
+{
+    Branch(mask, address, m_c, 0x01, false);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_BCS(const LaneMask& mask, const LaneWords& address)
+{
+    Branch(mask, address, m_c, 0x01, true);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_BVC(const LaneMask& mask, const LaneWords& address)
+{
+    Branch(mask, address, m_v, 0x80, false);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_BVS(const LaneMask& mask, const LaneWords& address)
+{
+    Branch(mask, address, m_v, 0x80, true);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_LDA(const LaneMask& mask, const LaneWords& address)
+{
+    LoadRegister(reg_a, mask, address);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_LDX(const LaneMask& mask, const LaneWords& address)
+{
+    LoadRegister(reg_x, mask, address);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_LDY(const LaneMask& mask, const LaneWords& address)
+{
+    LoadRegister(reg_y, mask, address);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_STA(const LaneMask& mask, const LaneWords& address)
+{
+    Store(mask, address, reg_a);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_STX(const LaneMask& mask, const LaneWords& address)
+{
+    Store(mask, address, reg_x);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_STY(const LaneMask& mask, const LaneWords& address)
+{
+    Store(mask, address, reg_y);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_INC(const LaneMask& mask, const LaneWords& address)
+{
+    LaneBytes operand = Load(mask, address);
+    for (unsigned int i = 0; i < LANES; i++)
+        operand[i]++;
+    Store(mask, address, operand);
+    SetNZ(mask, operand);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_DEC(const LaneMask& mask, const LaneWords& address)
+{
+    LaneBytes operand = Load(mask, address);
+    for (unsigned int i = 0; i < LANES; i++)
+        operand[i]--;
+    Store(mask, address, operand);
+    SetNZ(mask, operand);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_INX(const LaneMask& mask, const LaneWords& address)
+{
+    Increment(reg_x, mask, 1);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_INY(const LaneMask& mask, const LaneWords& address)
+{
+    Increment(reg_y, mask, 1);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_DEX(const LaneMask& mask, const LaneWords& address)
+{
+    Increment(reg_x, mask, 0xFF);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_DEY(const LaneMask& mask, const LaneWords& address)
+{
+    Increment(reg_y, mask, 0xFF);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_TAX(const LaneMask& mask, const LaneWords& address)
+{
+    Transfer(reg_x, reg_a, mask, true);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_TAY(const LaneMask& mask, const LaneWords& address)
+{
+    Transfer(reg_y, reg_a, mask, true);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_TSX(const LaneMask& mask, const LaneWords& address)
+{
+    Transfer(reg_x, reg_sp, mask, true);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_TXA(const LaneMask& mask, const LaneWords& address)
+{
+    Transfer(reg_a, reg_x, mask, true);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_TXS(const LaneMask& mask, const LaneWords& address)
+{
+    Transfer(reg_sp, reg_x, mask, false);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_TYA(const LaneMask& mask, const LaneWords& address)
+{
+    Transfer(reg_a, reg_y, mask, true);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_CMP(const LaneMask& mask, const LaneWords& address)
+{
+    Compare(reg_a, mask, address);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_CPX(const LaneMask& mask, const LaneWords& address)
+{
+    Compare(reg_x, mask, address);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_CPY(const LaneMask& mask, const LaneWords& address)
+{
+    Compare(reg_y, mask, address);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_PHA(const LaneMask& mask, const LaneWords& address)
+{
+    StackPush(mask, reg_a);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_PHP(const LaneMask& mask, const LaneWords& address)
+{
+    LaneBytes status = GetStatusBytes();
+    for (unsigned int i = 0; i < LANES; i++)
+        status[i] |= FLAG_B | FLAG_UNUSED;
+    StackPush(mask, status);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_PLA(const LaneMask& mask, const LaneWords& address)
+{
+    LaneBytes values = StackPop(mask);
+    Assign(reg_a, mask, values);
+    SetNZ(mask, values);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_PLP(const LaneMask& mask, const LaneWords& address)
+{
+    SetStatusBytes(mask, StackPop(mask));
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_SEC(const LaneMask& mask, const LaneWords& address)
+{
+    LaneBytes one;
+    one.fill(1);
+    SetC(mask, one);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_SED(const LaneMask& mask, const LaneWords& address)
+{
+    SetStatusBits(mask, FLAG_D, true);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_SEI(const LaneMask& mask, const LaneWords& address)
+{
+    SetStatusBits(mask, FLAG_I, true);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_CLC(const LaneMask& mask, const LaneWords& address)
+{
+    SetC(mask, LaneBytes{});
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_CLD(const LaneMask& mask, const LaneWords& address)
+{
+    SetStatusBits(mask, FLAG_D, false);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_CLI(const LaneMask& mask, const LaneWords& address)
+{
+    SetStatusBits(mask, FLAG_I, false);
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_CLV(const LaneMask& mask, const LaneWords& address)
+{
+    SetV(mask, LaneBytes{});
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::OP_NOP(const LaneMask& mask, const LaneWords& address)
+{
+    // No operation
+}
+
+template <unsigned int LANES>
+void LockstepCPU<LANES>::IllegalOP(const LaneMask& mask, const LaneWords& address)
+{
+    for (unsigned int i = 0; i < LANES; i++) {
+        m_illegal[i] |= mask[i];
+        m_running[i] &= ~mask[i];
+    }
+}
+
+template class LockstepCPU<8>;
+template class LockstepCPU<16>;
+template class LockstepCPU<32>;
+
+}  // namespace llvmes
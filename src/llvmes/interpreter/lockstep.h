@@ -0,0 +1,292 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "llvmes/interpreter/instruction.h"
+#include "llvmes/interpreter/status_register.h"
+
+// Inlines everything a handler calls into it. GCC and Clang only, MSVC has no
+// equivalent and just inlines what it decides to.
+#if defined(__GNUC__)
+#define LLVMES_FLATTEN __attribute__((flatten))
+#else
+#define LLVMES_FLATTEN
+#endif
+
+namespace llvmes {
+
+/// Runs LANES instances of the same program in lock-step. The registers and
+/// flags of all instances are stored as arrays (structure of arrays) and
+/// every handler works on all lanes at once, so the register and flag updates
+/// compile to vector code. Each lane has its own 64KB of memory.
+///
+/// Each step picks the running lanes with the lowest PC that fetch the same
+/// opcode there and executes that opcode for them, the other lanes are masked
+/// out. Lanes that diverged in a loop or a branch are picked up again once they
+/// meet at the same PC.
+///
+/// The semantics are the same as BasicCPU's (cpu.cpp is the reference), but
+/// there are no interrupts. Decimal mode is ignored, like in BasicCPU.
+template <unsigned int LANES>
+class LockstepCPU {
+   public:
+    // One byte per lane, a lane takes part in an operation if its mask is 0xFF
+    typedef std::array<std::uint8_t, LANES> LaneBytes;
+    typedef std::array<std::uint16_t, LANES> LaneWords;
+    typedef LaneBytes LaneMask;
+
+    typedef std::function<std::uint8_t(unsigned int lane, std::uint16_t addr)> LaneRead;
+    typedef std::function<void(unsigned int lane, std::uint16_t addr, std::uint8_t data)>
+        LaneWrite;
+
+    LockstepCPU();
+
+    /// Executes one instruction for a group of lanes. Returns false if no lane
+    /// is running anymore.
+    bool Step();
+    /// Runs until every lane has halted
+    void Run();
+    /// Resets every lane, the reset vector is read from each lane's memory
+    void Reset();
+    void Halt(unsigned int lane) { m_running[lane] = 0; }
+
+    /// Accesses to the pages are forwarded to the device, with the lane that
+    /// made them. If 'read' is empty, reads go to the lane's memory.
+    void MapDevice(std::uint8_t first_page, unsigned int count, LaneRead read,
+                   LaneWrite write);
+    /// Lanes stop once they've run for this many cycles, 0 means no limit. It's
+    /// only checked every COUNTER_FLUSH steps, so lanes can go a bit further.
+    void SetCycleLimit(std::uint64_t cycles)
+    {
+        m_cycle_limit = cycles ? cycles : UINT64_MAX;
+    }
+
+    /// The memory of the lanes is interleaved, so it can only be accessed byte
+    /// by byte
+    std::uint8_t& RAM(unsigned int lane, std::uint16_t addr)
+    {
+        return m_memory[addr * LANES + lane];
+    }
+    void LoadRAM(unsigned int lane, std::uint16_t addr, const std::uint8_t* data,
+                 std::size_t size);
+    /// Copies the 64KB of a lane to 'out'
+    void SaveRAM(unsigned int lane, std::uint8_t* out) const;
+    StatusRegister GetStatus(unsigned int lane) const;
+    bool IsRunning(unsigned int lane) const { return m_running[lane]; }
+    bool HitIllegalOpcode(unsigned int lane) const { return m_illegal[lane]; }
+    std::uint64_t GetInstructionCount(unsigned int lane) const
+    {
+        return m_instruction_count[lane] + m_pending_instructions[lane];
+    }
+    std::uint64_t GetCycles(unsigned int lane) const
+    {
+        return m_cycles[lane] + m_pending_cycles[lane];
+    }
+    /// Number of Step() calls, i.e. instructions executed by at least one lane
+    std::uint64_t GetStepCount() const { return m_steps; }
+
+    constexpr static unsigned int LANE_COUNT = LANES;
+
+    LaneBytes reg_x;
+    LaneBytes reg_y;
+    LaneBytes reg_a;
+    LaneBytes reg_sp;
+    LaneWords reg_pc;
+    // I, D, B and the unused bit, N, Z, C and V are kept in their own arrays
+    LaneBytes reg_status;
+
+   private:
+    constexpr static unsigned int FLAG_I = (1 << 2);
+    constexpr static unsigned int FLAG_D = (1 << 3);
+    constexpr static unsigned int FLAG_B = (1 << 4);
+    constexpr static unsigned int FLAG_UNUSED = (1 << 5);
+    constexpr static unsigned int RESET_VECTOR = 0xFFFC;
+    constexpr static unsigned int IRQ_VECTOR = 0xFFFE;
+
+    typedef void (*Handler)(LockstepCPU&, const LaneMask&);
+    typedef void (LockstepCPU::*OperationFn)(const LaneMask&, const LaneWords&);
+    typedef std::array<Handler, 0x100> HandlerTable;
+
+    template <AddressMode mode, OperationFn op, unsigned int cycles, bool page_penalty>
+    LLVMES_FLATTEN static void Execute(LockstepCPU& cpu, const LaneMask& mask)
+    {
+        for (unsigned int i = 0; i < LANES; i++)
+            cpu.m_pending_cycles[i] += mask[i] & cycles;
+        LaneWords address = cpu.FetchAddress<mode>(mask);
+        if constexpr (page_penalty)
+            cpu.AddPagePenalty<mode>(mask, address);
+        (cpu.*op)(mask, address);
+    }
+
+    constexpr static HandlerTable MakeHandlerTable();
+    /// Adds the pending counters to the totals and checks the cycle limit
+    void FlushCounters();
+    static const HandlerTable s_handlers;
+
+    // Memory accesses of the masked lanes, the other lanes read as 0
+    std::uint8_t Read(unsigned int lane, std::uint16_t addr);
+    void Write(unsigned int lane, std::uint16_t addr, std::uint8_t data);
+    LaneBytes Load(const LaneMask& mask, const LaneWords& address);
+    void Store(const LaneMask& mask, const LaneWords& address, const LaneBytes& values);
+    LaneWords Load16(const LaneMask& mask, const LaneWords& address);
+    constexpr static std::uint32_t NOT_UNIFORM = 0x10000;
+    /// The address if all masked lanes access the same one and it's not a
+    /// device, NOT_UNIFORM otherwise
+    std::uint32_t UniformAddress(const LaneMask& mask, const LaneWords& address) const;
+
+    /// Extends a mask byte to all bits of T
+    template <typename T>
+    static T Widen(std::uint8_t mask)
+    {
+        return static_cast<T>(-static_cast<T>(mask & 1));
+    }
+    /// 'value' if the mask is set, 'old' otherwise. Done with bit operations,
+    /// a conditional keeps GCC from vectorizing the loop.
+    template <typename T>
+    static T Blend(std::uint8_t mask, T value, T old)
+    {
+        T wide = Widen<T>(mask);
+        return (value & wide) | (old & ~wide);
+    }
+    /// reg = values in the masked lanes
+    template <typename T>
+    static void Assign(std::array<T, LANES>& reg, const LaneMask& mask,
+                       const std::array<T, LANES>& values);
+    void SetNZ(const LaneMask& mask, const LaneBytes& values);
+    void SetC(const LaneMask& mask, const LaneBytes& carry) { Assign(m_c, mask, carry); }
+    void SetV(const LaneMask& mask, const LaneBytes& overflow)
+    {
+        Assign(m_v, mask, overflow);
+    }
+
+    void StackPush(const LaneMask& mask, const LaneBytes& values);
+    LaneBytes StackPop(const LaneMask& mask);
+    LaneBytes GetStatusBytes() const;
+    void SetStatusBytes(const LaneMask& mask, const LaneBytes& status);
+
+    /// The operand bytes following the opcode
+    LaneBytes FetchOperand(const LaneMask& mask, unsigned int offset = 0);
+    LaneWords FetchOperand16(const LaneMask& mask);
+    template <AddressMode mode>
+    LaneWords FetchAddress(const LaneMask& mask);
+    template <AddressMode mode>
+    void AddPagePenalty(const LaneMask& mask, const LaneWords& address);
+
+    // Helpers shared by the operations that only differ in the registers or
+    // flags they use
+    /// Taken in the lanes where 'flag & bits' being non-zero equals 'expected'
+    void Branch(const LaneMask& mask, const LaneWords& address, const LaneBytes& flag,
+                std::uint8_t bits, bool expected);
+    void LoadRegister(LaneBytes& reg, const LaneMask& mask, const LaneWords& address);
+    void Transfer(LaneBytes& to, const LaneBytes& from, const LaneMask& mask,
+                  bool set_nz);
+    void Increment(LaneBytes& reg, const LaneMask& mask, std::uint8_t delta);
+    void Compare(const LaneBytes& reg, const LaneMask& mask, const LaneWords& address);
+    void SetStatusBits(const LaneMask& mask, std::uint8_t bits, bool value);
+    /// Shifts and rotates, 'left' selects the direction
+    template <bool left, bool rotate>
+    void Shift(LaneBytes& values, LaneBytes& carry);
+    template <bool left, bool rotate>
+    void ShiftMemory(const LaneMask& mask, const LaneWords& address);
+    template <bool left, bool rotate>
+    void ShiftAccumulator(const LaneMask& mask);
+
+    void OP_BIT(const LaneMask& mask, const LaneWords& address);
+    void OP_AND(const LaneMask& mask, const LaneWords& address);
+    void OP_EOR(const LaneMask& mask, const LaneWords& address);
+    void OP_ORA(const LaneMask& mask, const LaneWords& address);
+    void OP_ASL(const LaneMask& mask, const LaneWords& address);
+    void OP_ASL_ACC(const LaneMask& mask, const LaneWords& address);
+    void OP_LSR(const LaneMask& mask, const LaneWords& address);
+    void OP_LSR_ACC(const LaneMask& mask, const LaneWords& address);
+    void OP_ROL(const LaneMask& mask, const LaneWords& address);
+    void OP_ROL_ACC(const LaneMask& mask, const LaneWords& address);
+    void OP_ROR(const LaneMask& mask, const LaneWords& address);
+    void OP_ROR_ACC(const LaneMask& mask, const LaneWords& address);
+    void OP_ADC(const LaneMask& mask, const LaneWords& address);
+    void OP_SBC(const LaneMask& mask, const LaneWords& address);
+    void OP_JSR(const LaneMask& mask, const LaneWords& address);
+    void OP_JMP(const LaneMask& mask, const LaneWords& address);
+    void OP_RTI(const LaneMask& mask, const LaneWords& address);
+    void OP_RTS(const LaneMask& mask, const LaneWords& address);
+    void OP_BRK(const LaneMask& mask, const LaneWords& address);
+    void OP_BNE(const LaneMask& mask, const LaneWords& address);
+    void OP_BEQ(const LaneMask& mask, const LaneWords& address);
+    void OP_BMI(const LaneMask& mask, const LaneWords& address);
+    void OP_BPL(const LaneMask& mask, const LaneWords& address);
+    void OP_BCC(const LaneMask& mask, const LaneWords& address);
+    void OP_BCS(const LaneMask& mask, const LaneWords& address);
+    void OP_BVC(const LaneMask& mask, const LaneWords& address);
+    void OP_BVS(const LaneMask& mask, const LaneWords& address);
+    void OP_LDA(const LaneMask& mask, const LaneWords& address);
+    void OP_LDX(const LaneMask& mask, const LaneWords& address);
+    void OP_LDY(const LaneMask& mask, const LaneWords& address);
+    void OP_STA(const LaneMask& mask, const LaneWords& address);
+    void OP_STX(const LaneMask& mask, const LaneWords& address);
+    void OP_STY(const LaneMask& mask, const LaneWords& address);
+    void OP_INC(const LaneMask& mask, const LaneWords& address);
+    void OP_DEC(const LaneMask& mask, const LaneWords& address);
+    void OP_INX(const LaneMask& mask, const LaneWords& address);
+    void OP_INY(const LaneMask& mask, const LaneWords& address);
+    void OP_DEX(const LaneMask& mask, const LaneWords& address);
+    void OP_DEY(const LaneMask& mask, const LaneWords& address);
+    void OP_TAX(const LaneMask& mask, const LaneWords& address);
+    void OP_TAY(const LaneMask& mask, const LaneWords& address);
+    void OP_TSX(const LaneMask& mask, const LaneWords& address);
+    void OP_TXA(const LaneMask& mask, const LaneWords& address);
+    void OP_TXS(const LaneMask& mask, const LaneWords& address);
+    void OP_TYA(const LaneMask& mask, const LaneWords& address);
+    void OP_CMP(const LaneMask& mask, const LaneWords& address);
+    void OP_CPX(const LaneMask& mask, const LaneWords& address);
+    void OP_CPY(const LaneMask& mask, const LaneWords& address);
+    void OP_PHA(const LaneMask& mask, const LaneWords& address);
+    void OP_PHP(const LaneMask& mask, const LaneWords& address);
+    void OP_PLA(const LaneMask& mask, const LaneWords& address);
+    void OP_PLP(const LaneMask& mask, const LaneWords& address);
+    void OP_SEC(const LaneMask& mask, const LaneWords& address);
+    void OP_SED(const LaneMask& mask, const LaneWords& address);
+    void OP_SEI(const LaneMask& mask, const LaneWords& address);
+    void OP_CLC(const LaneMask& mask, const LaneWords& address);
+    void OP_CLD(const LaneMask& mask, const LaneWords& address);
+    void OP_CLI(const LaneMask& mask, const LaneWords& address);
+    void OP_CLV(const LaneMask& mask, const LaneWords& address);
+    void OP_NOP(const LaneMask& mask, const LaneWords& address);
+    void IllegalOP(const LaneMask& mask, const LaneWords& address);
+
+    // Byte 'addr' of lane i is at addr * LANES + i
+    std::vector<std::uint8_t> m_memory;
+    std::array<bool, 0x100> m_device_pages;
+    LaneRead m_device_read;
+    LaneWrite m_device_write;
+
+    // Flags kept in the form the operations produce them, so that updating
+    // them needs no byte shifts: N and V are bit 7, Z is set when the byte is
+    // zero and C is 0 or 1
+    LaneBytes m_n, m_z, m_c, m_v;
+    // 0xFF while the lane runs, cleared by Halt() and illegal opcodes
+    LaneMask m_running;
+    LaneBytes m_illegal;
+    // The handlers count into 16 bit lanes, which are a lot cheaper to update
+    // than 64 bit ones, and get added to the totals every COUNTER_FLUSH steps.
+    // An instruction takes less than 16 cycles.
+    constexpr static unsigned int COUNTER_FLUSH = 0x1000;
+    std::array<std::uint16_t, LANES> m_pending_cycles;
+    std::array<std::uint16_t, LANES> m_pending_instructions;
+    std::array<std::uint64_t, LANES> m_cycles;
+    std::array<std::uint64_t, LANES> m_instruction_count;
+    std::uint64_t m_cycle_limit;
+    std::uint64_t m_steps;
+    // Address after the opcode of the current step, the masked lanes share it
+    std::uint16_t m_pc;
+    // A lane that takes part in the current step
+    unsigned int m_leader;
+};
+
+extern template class LockstepCPU<8>;
+extern template class LockstepCPU<16>;
+extern template class LockstepCPU<32>;
+
+}  // namespace llvmes
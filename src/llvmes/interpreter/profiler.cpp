@@ -0,0 +1,186 @@
+#include "llvmes/interpreter/profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include "llvmes/common.h"
+#include "llvmes/interpreter/instruction.h"
+
+namespace llvmes {
+
+Profiler::Profiler()
+    : m_pc_counts(0x10000),
+      m_opcodes(0x10000),
+      m_taken(0x10000),
+      m_not_taken(0x10000),
+      m_targets(0x10000),
+      m_opcode_counts(),
+      m_instructions(0),
+      m_branch_pending(false),
+      m_branch_pc(0),
+      m_current_frame(0)
+{
+    m_frames.push_back({0, 0, 0, {}});
+}
+
+void Profiler::EnterSubroutine(std::uint16_t address)
+{
+    auto it = m_frames[m_current_frame].children.find(address);
+    if (it != m_frames[m_current_frame].children.end()) {
+        m_current_frame = it->second;
+        return;
+    }
+
+    std::uint32_t frame = m_frames.size();
+    m_frames.push_back({address, m_current_frame, 0, {}});
+    m_frames[m_current_frame].children[address] = frame;
+    m_current_frame = frame;
+}
+
+void Profiler::LeaveSubroutine()
+{
+    // Programs that return to an address they pushed themselves have more RTS
+    // than JSR, they stay at the top
+    if (m_current_frame != 0)
+        m_current_frame = m_frames[m_current_frame].parent;
+}
+
+static const char* GetAddressModeName(AddressMode mode)
+{
+    // Same abbreviations as the disassembler
+    switch (mode) {
+        case AddressMode::Implied:
+            return "IMP";
+        case AddressMode::Accumulator:
+            return "ACC";
+        case AddressMode::Immediate:
+            return "IMM";
+        case AddressMode::Zeropage:
+            return "ZP";
+        case AddressMode::ZeropageX:
+            return "ZPX";
+        case AddressMode::ZeropageY:
+            return "ZPY";
+        case AddressMode::Absolute:
+            return "ABS";
+        case AddressMode::AbsoluteX:
+            return "ABX";
+        case AddressMode::AbsoluteY:
+            return "ABY";
+        case AddressMode::Indirect:
+            return "IND";
+        case AddressMode::IndirectX:
+            return "IZX";
+        case AddressMode::IndirectY:
+            return "IZY";
+    }
+    return "";
+}
+
+// Indices of the non-zero entries of 'counts', most first
+template <typename Container>
+static std::vector<unsigned int> SortByCount(const Container& counts, unsigned int top)
+{
+    std::vector<unsigned int> indices;
+    for (unsigned int i = 0; i < counts.size(); i++) {
+        if (counts[i])
+            indices.push_back(i);
+    }
+    std::stable_sort(
+        indices.begin(), indices.end(),
+        [&counts](unsigned int a, unsigned int b) { return counts[a] > counts[b]; });
+    if (indices.size() > top)
+        indices.resize(top);
+    return indices;
+}
+
+void Profiler::WriteReport(std::ostream& out, const Disassembler& disassemble,
+                           unsigned int top) const
+{
+    auto percent = [this](std::uint64_t count) {
+        std::stringstream stream;
+        stream << std::fixed << std::setprecision(2) << std::setw(6)
+               << (m_instructions ? 100.0 * count / m_instructions : 0.0) << "%";
+        return stream.str();
+    };
+
+    out << "Instructions: " << m_instructions << "\n";
+
+    out << "\nHot addresses:\n";
+    for (unsigned int pc : SortByCount(m_pc_counts, top)) {
+        out << "  " << ToHexString<std::uint16_t>(pc) << "  " << percent(m_pc_counts[pc])
+            << std::setw(12) << m_pc_counts[pc] << "  " << disassemble(pc) << "\n";
+    }
+
+    out << "\nOpcodes:\n";
+    for (unsigned int opcode : SortByCount(m_opcode_counts, 0x100)) {
+        const InstructionInfo& info = GetInstructionInfo(opcode);
+        out << "  " << ToHexString<std::uint8_t>(opcode) << " " << info.name << " "
+            << std::left << std::setw(3) << GetAddressModeName(info.mode) << std::right
+            << "  " << percent(m_opcode_counts[opcode]) << std::setw(12)
+            << m_opcode_counts[opcode] << "\n";
+    }
+
+    // IndirectY is the last addressing mode
+    std::array<std::uint64_t, static_cast<unsigned int>(AddressMode::IndirectY) + 1>
+        modes{};
+    for (unsigned int opcode = 0; opcode < 0x100; opcode++)
+        modes[static_cast<unsigned int>(GetInstructionInfo(opcode).mode)] +=
+            m_opcode_counts[opcode];
+    out << "\nAddressing modes:\n";
+    for (unsigned int mode : SortByCount(modes, modes.size())) {
+        out << "  " << std::left << std::setw(3)
+            << GetAddressModeName(static_cast<AddressMode>(mode)) << std::right << "  "
+            << percent(modes[mode]) << std::setw(12) << modes[mode] << "\n";
+    }
+
+    std::vector<std::uint64_t> branches(0x10000);
+    std::uint64_t taken = 0, not_taken = 0;
+    for (unsigned int pc = 0; pc < 0x10000; pc++) {
+        if ((m_opcodes[pc] & 0x1F) != 0x10)
+            continue;
+        branches[pc] = m_taken[pc] + m_not_taken[pc];
+        taken += m_taken[pc];
+        not_taken += m_not_taken[pc];
+    }
+    out << "\nBranches: " << taken << " taken, " << not_taken << " not taken\n";
+    for (unsigned int pc : SortByCount(branches, top)) {
+        out << "  " << ToHexString<std::uint16_t>(pc) << "  "
+            << GetInstructionInfo(m_opcodes[pc]).name << std::setw(12) << m_taken[pc]
+            << " taken" << std::setw(12) << m_not_taken[pc] << " not taken\n";
+    }
+
+    // A loop is a branch or a jump backwards, its body everything in between
+    std::vector<std::uint64_t> loops(0x10000);
+    for (unsigned int pc = 0; pc < 0x10000; pc++) {
+        if (m_taken[pc] && m_targets[pc] <= pc)
+            loops[pc] = m_taken[pc];
+    }
+    out << "\nLoops:\n";
+    for (unsigned int pc : SortByCount(loops, top)) {
+        std::uint64_t body = 0;
+        for (unsigned int i = m_targets[pc]; i <= pc; i++)
+            body += m_pc_counts[i];
+        out << "  " << ToHexString<std::uint16_t>(m_targets[pc]) << "-"
+            << ToHexString<std::uint16_t>(pc) << "  " << percent(body) << std::setw(12)
+            << loops[pc] << " iterations\n";
+    }
+}
+
+void Profiler::WriteCollapsedStacks(std::ostream& out) const
+{
+    // Walked depth first, every frame comes with its call stack
+    std::vector<std::pair<std::uint32_t, std::string>> pending = {{0, "root"}};
+    while (!pending.empty()) {
+        auto [frame, stack] = std::move(pending.back());
+        pending.pop_back();
+
+        if (m_frames[frame].instructions)
+            out << stack << " " << m_frames[frame].instructions << "\n";
+        for (const auto& child : m_frames[frame].children)
+            pending.push_back({child.second, stack + ";" + ToHexString(child.first)});
+    }
+}
+
+}  // namespace llvmes
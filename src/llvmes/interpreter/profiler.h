@@ -0,0 +1,129 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "llvmes/interpreter/trace.h"
+
+namespace llvmes {
+
+/// Finds out where a program spends its time from the instructions it
+/// executes, which it gets through ProfileTrace. Everything is counted in
+/// instructions: executions of every address, of every opcode, how often each
+/// branch was taken, and a call tree following JSR and RTS.
+class Profiler {
+   public:
+    /// Turns an address into a line of disassembly for the report
+    typedef std::function<std::string(std::uint16_t pc)> Disassembler;
+
+    Profiler();
+
+    void Add(const TraceRecord& record)
+    {
+        // Whether a branch was taken shows from where the next instruction is
+        if (m_branch_pending)
+            ResolveBranch(record.pc);
+
+        m_pc_counts[record.pc]++;
+        m_opcodes[record.pc] = record.opcode;
+        m_opcode_counts[record.opcode]++;
+        m_frames[m_current_frame].instructions++;
+        m_instructions++;
+
+        if ((record.opcode & 0x1F) == 0x10) {
+            m_branch_pending = true;
+            m_branch_pc = record.pc;
+        }
+        else if (record.opcode == JMP_ABSOLUTE || record.opcode == JMP_INDIRECT) {
+            m_taken[record.pc]++;
+            m_targets[record.pc] = record.address;
+        }
+        else if (record.opcode == JSR) {
+            EnterSubroutine(record.address);
+        }
+        else if (record.opcode == RTS) {
+            LeaveSubroutine();
+        }
+    }
+
+    std::uint64_t GetInstructionCount() const { return m_instructions; }
+    std::uint64_t GetCount(std::uint16_t pc) const { return m_pc_counts[pc]; }
+    std::uint64_t GetOpcodeCount(std::uint8_t opcode) const
+    {
+        return m_opcode_counts[opcode];
+    }
+
+    /// Writes the 'top' most executed addresses with their disassembly, the
+    /// opcode and addressing mode histograms, the branches and the loops,
+    /// found as branches and jumps going backwards.
+    void WriteReport(std::ostream& out, const Disassembler& disassemble,
+                     unsigned int top = 20) const;
+    /// Writes the call tree in the collapsed stack format of flamegraph.pl,
+    /// one "root;$8010;$8123 <instructions>" line per call stack. Subroutines
+    /// are named after their address.
+    void WriteCollapsedStacks(std::ostream& out) const;
+
+   private:
+    constexpr static std::uint8_t JSR = 0x20;
+    constexpr static std::uint8_t RTS = 0x60;
+    constexpr static std::uint8_t JMP_ABSOLUTE = 0x4C;
+    constexpr static std::uint8_t JMP_INDIRECT = 0x6C;
+
+    void ResolveBranch(std::uint16_t pc)
+    {
+        m_branch_pending = false;
+        // Relative branches are two bytes
+        if (pc == static_cast<std::uint16_t>(m_branch_pc + 2)) {
+            m_not_taken[m_branch_pc]++;
+        }
+        else {
+            m_taken[m_branch_pc]++;
+            m_targets[m_branch_pc] = pc;
+        }
+    }
+    void EnterSubroutine(std::uint16_t address);
+    void LeaveSubroutine();
+
+    struct Frame {
+        std::uint16_t address;
+        std::uint32_t parent;
+        // Executed in this subroutine, without the ones it called
+        std::uint64_t instructions;
+        std::map<std::uint16_t, std::uint32_t> children;
+    };
+
+    // Indexed by address
+    std::vector<std::uint64_t> m_pc_counts;
+    std::vector<std::uint8_t> m_opcodes;
+    std::vector<std::uint64_t> m_taken;
+    std::vector<std::uint64_t> m_not_taken;
+    std::vector<std::uint16_t> m_targets;
+
+    std::array<std::uint64_t, 0x100> m_opcode_counts;
+    std::uint64_t m_instructions;
+
+    bool m_branch_pending;
+    std::uint16_t m_branch_pc;
+
+    // The call tree, the first frame is where the program started
+    std::vector<Frame> m_frames;
+    std::uint32_t m_current_frame;
+};
+
+/// Tracing policy of BasicCPU that feeds 'profiler', if it's set
+struct ProfileTrace {
+    constexpr static bool ENABLED = true;
+    void Record(const TraceRecord& record)
+    {
+        if (profiler)
+            profiler->Add(record);
+    }
+
+    Profiler* profiler = nullptr;
+};
+
+}  // namespace llvmes
@@ -1,80 +1,63 @@
+#pragma once
+#include <cstdint>
+
 namespace llvmes {
+
+/// The processor status in a single byte. The flags are accessed like bools
+/// through their accessors, e.g. 'reg_status.C() = 1', and the whole register
+/// converts to and from an integer.
 class StatusRegister {
+    // Refers to a single flag of the register, only lives as long as the
+    // expression it's used in
     template <unsigned int N>
     class Bit {
-        unsigned int &data;
+        std::uint8_t& data;
 
        public:
-        constexpr Bit(unsigned int &data) : data(data) {}
+        constexpr Bit(std::uint8_t& data) : data(data) {}
 
-        unsigned int &operator=(bool value)
+        Bit& operator=(bool value)
         {
-            if (value)
-                return data |= (1 << N);
-            return data &= ~(1 << N);
+            data = value ? (data | (1 << N)) : (data & ~(1 << N));
+            return *this;
         }
 
         constexpr operator bool() const { return data & (1 << N); }
     };
 
    public:
-    unsigned int data;
-    Bit<0> C;
-    Bit<1> Z;
-    Bit<2> I;
-    Bit<3> D;
-    Bit<4> B;
-    Bit<5> Unused;
-    Bit<6> V;
-    Bit<7> N;
-
-    constexpr StatusRegister()
-        : data(0),
-          C(data),
-          Z(data),
-          I(data),
-          D(data),
-          B(data),
-          Unused(data),
-          V(data),
-          N(data)
-    {
-    }
-
-    constexpr StatusRegister(const StatusRegister &other)
-        : data(other.data),
-          C(data),
-          Z(data),
-          I(data),
-          D(data),
-          B(data),
-          Unused(data),
-          V(data),
-          N(data)
-    {
-    }
-
-    constexpr StatusRegister(unsigned int value)
-        : data(value),
-          C(data),
-          Z(data),
-          I(data),
-          D(data),
-          B(data),
-          Unused(data),
-          V(data),
-          N(data)
-    {
-    }
+    std::uint8_t data;
+
+    constexpr StatusRegister() : data(0) {}
+    constexpr StatusRegister(unsigned int value) : data(value) {}
+
+    Bit<0> C() { return data; }
+    Bit<1> Z() { return data; }
+    Bit<2> I() { return data; }
+    Bit<3> D() { return data; }
+    Bit<4> B() { return data; }
+    Bit<5> Unused() { return data; }
+    Bit<6> V() { return data; }
+    Bit<7> N() { return data; }
+
+    constexpr bool C() const { return data & (1 << 0); }
+    constexpr bool Z() const { return data & (1 << 1); }
+    constexpr bool I() const { return data & (1 << 2); }
+    constexpr bool D() const { return data & (1 << 3); }
+    constexpr bool B() const { return data & (1 << 4); }
+    constexpr bool Unused() const { return data & (1 << 5); }
+    constexpr bool V() const { return data & (1 << 6); }
+    constexpr bool N() const { return data & (1 << 7); }
 
     constexpr operator unsigned int() const { return data; }
 
-    unsigned int &operator=(unsigned int newValue) { return data = newValue; }
-
-    StatusRegister &operator=(StatusRegister &other)
+    StatusRegister& operator=(unsigned int value)
     {
-        data = other.data;
+        data = value;
         return *this;
     }
 };
+
+static_assert(sizeof(StatusRegister) == 1, "StatusRegister should be a single byte");
+
 }  // namespace llvmes
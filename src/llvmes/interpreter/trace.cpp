@@ -0,0 +1,246 @@
+#include "llvmes/interpreter/trace.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+#include "llvmes/interpreter/instruction.h"
+
+namespace llvmes {
+
+// Length of every opcode, the encoder looks it up for every record
+static constexpr std::array<std::uint8_t, 0x100> MakeLengthTable()
+{
+    std::array<std::uint8_t, 0x100> table{};
+    for (auto& it : table)
+        it = 1;
+#define LLVMES_INSTRUCTION_LENGTH(opcode, name, mode, op, cycles, page_penalty) \
+    table[opcode] = GetInstructionLength(AddressMode::mode);
+    LLVMES_INSTRUCTION_LIST(LLVMES_INSTRUCTION_LENGTH)
+#undef LLVMES_INSTRUCTION_LENGTH
+    return table;
+}
+
+static constexpr std::array<std::uint8_t, 0x100> s_lengths = MakeLengthTable();
+
+static std::uint8_t* WriteVarint(std::int16_t value, std::uint8_t* out)
+{
+    // Zigzag, so small negative differences stay small as well
+    std::uint16_t zigzag = (static_cast<std::uint16_t>(value) << 1) ^ (value >> 15);
+    while (zigzag >= 0x80) {
+        *out++ = static_cast<std::uint8_t>(zigzag | 0x80);
+        zigzag >>= 7;
+    }
+    *out++ = static_cast<std::uint8_t>(zigzag);
+    return out;
+}
+
+// Returns the number of bytes used, 0 if 'data' ends too early
+static std::size_t ReadVarint(const std::uint8_t* data, std::size_t size,
+                              std::int16_t& value)
+{
+    std::uint16_t zigzag = 0;
+    for (std::size_t i = 0; i < size && i < 3; i++) {
+        zigzag |= static_cast<std::uint16_t>(data[i] & 0x7F) << (7 * i);
+        if (!(data[i] & 0x80)) {
+            value = static_cast<std::int16_t>((zigzag >> 1) ^ -(zigzag & 1));
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+TraceEncoder::TraceEncoder() : m_previous(), m_opcodes(0x10000) {}
+
+std::uint16_t TraceEncoder::NextPC() const
+{
+    return m_previous.pc + s_lengths[m_previous.opcode];
+}
+
+std::uint8_t* TraceEncoder::Encode(const TraceRecord& record, std::uint8_t* out)
+{
+    std::uint8_t* start = out++;
+    std::uint8_t changed = 0;
+
+    std::uint16_t next_pc = NextPC();
+    if (record.pc != next_pc) {
+        changed |= PC_CHANGED;
+        out = WriteVarint(static_cast<std::int16_t>(record.pc - next_pc), out);
+    }
+    if (record.address != m_previous.address) {
+        changed |= ADDRESS_CHANGED;
+        out = WriteVarint(static_cast<std::int16_t>(record.address - m_previous.address),
+                          out);
+    }
+
+    auto write_byte = [&](std::uint8_t value, std::uint8_t previous, std::uint8_t flag) {
+        if (value != previous) {
+            changed |= flag;
+            *out++ = value;
+        }
+    };
+    write_byte(record.opcode, m_opcodes[record.pc], OPCODE_CHANGED);
+    write_byte(record.reg_a, m_previous.reg_a, A_CHANGED);
+    write_byte(record.reg_x, m_previous.reg_x, X_CHANGED);
+    write_byte(record.reg_y, m_previous.reg_y, Y_CHANGED);
+    write_byte(record.reg_sp, m_previous.reg_sp, SP_CHANGED);
+    write_byte(record.status, m_previous.status, STATUS_CHANGED);
+
+    *start = changed;
+    m_opcodes[record.pc] = record.opcode;
+    m_previous = record;
+    return out;
+}
+
+std::size_t TraceEncoder::Decode(const std::uint8_t* data, std::size_t size,
+                                 TraceRecord& record)
+{
+    if (size == 0)
+        return 0;
+    std::uint8_t changed = data[0];
+    std::size_t position = 1;
+    record = m_previous;
+
+    record.pc = NextPC();
+    if (changed & PC_CHANGED) {
+        std::int16_t delta;
+        std::size_t length = ReadVarint(data + position, size - position, delta);
+        if (!length)
+            return 0;
+        record.pc += delta;
+        position += length;
+    }
+    if (changed & ADDRESS_CHANGED) {
+        std::int16_t delta;
+        std::size_t length = ReadVarint(data + position, size - position, delta);
+        if (!length)
+            return 0;
+        record.address += delta;
+        position += length;
+    }
+
+    record.opcode = m_opcodes[record.pc];
+    std::uint8_t* fields[] = {&record.opcode, &record.reg_a,  &record.reg_x,
+                              &record.reg_y,  &record.reg_sp, &record.status};
+    for (unsigned int i = 0; i < 6; i++) {
+        if (!(changed & (OPCODE_CHANGED << i)))
+            continue;
+        if (position == size)
+            return 0;
+        *fields[i] = data[position++];
+    }
+
+    m_opcodes[record.pc] = record.opcode;
+    m_previous = record;
+    return position;
+}
+
+TraceRecorder::TraceRecorder(const std::string& path)
+    : m_ring(RING_SIZE),
+      m_cached_tail(0),
+      m_head(0),
+      m_tail(0),
+      m_stop(false),
+      m_bytes_written(0),
+      m_file(path, std::ios::out | std::ios::binary)
+{
+    if (m_file.fail())
+        throw std::runtime_error("Can't create the trace file '" + path + "'");
+    m_file.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    m_file.put(TRACE_VERSION);
+    m_bytes_written = sizeof(TRACE_MAGIC) + 1;
+    m_writer = std::thread(&TraceRecorder::WriterMain, this);
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake_writer.notify_one();
+    m_writer.join();
+}
+
+void TraceRecorder::WaitForSpace(std::uint64_t head)
+{
+    m_cached_tail = m_tail.load(std::memory_order_acquire);
+    if (head - m_cached_tail < RING_SIZE)
+        return;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_wake_writer.notify_one();
+    m_space_available.wait(lock, [this, head] {
+        m_cached_tail = m_tail.load(std::memory_order_acquire);
+        return head - m_cached_tail < RING_SIZE;
+    });
+}
+
+void TraceRecorder::WriterMain()
+{
+    // Records are handed back to Push() in chunks, it shouldn't have to wait
+    // for a whole ring buffer to be encoded
+    constexpr std::uint64_t CHUNK = RING_SIZE / 16;
+    TraceEncoder encoder;
+    std::vector<std::uint8_t> buffer(CHUNK * TraceEncoder::MAX_RECORD_SIZE);
+
+    while (true) {
+        std::uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        std::uint64_t head = m_head.load(std::memory_order_acquire);
+
+        if (tail == head) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            // Everything pushed before m_stop got set is visible after reading it
+            if (m_stop && m_head.load(std::memory_order_acquire) == tail)
+                break;
+            // Polls now and then, Push() only wakes it up when it has to wait
+            m_wake_writer.wait_for(lock, std::chrono::milliseconds(1));
+            continue;
+        }
+
+        head = std::min(head, tail + CHUNK);
+        std::uint8_t* end = buffer.data();
+        for (; tail != head; tail++)
+            end = encoder.Encode(m_ring[tail & (RING_SIZE - 1)], end);
+        m_tail.store(tail, std::memory_order_release);
+        {
+            // Push() can't miss the notification between checking m_tail and
+            // going to sleep
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        m_space_available.notify_one();
+
+        std::size_t size = end - buffer.data();
+        m_file.write(reinterpret_cast<const char*>(buffer.data()), size);
+        m_bytes_written += size;
+    }
+    m_file.flush();
+}
+
+TraceReader::TraceReader(const std::string& path) : m_position(0)
+{
+    std::ifstream in{path, std::ios::binary};
+    if (in.fail())
+        throw std::runtime_error("Can't open the trace file '" + path + "'");
+    m_data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+    if (m_data.size() < sizeof(TRACE_MAGIC) + 1 ||
+        std::memcmp(m_data.data(), TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0)
+        throw std::runtime_error("'" + path + "' isn't a trace file");
+    if (m_data[sizeof(TRACE_MAGIC)] != TRACE_VERSION)
+        throw std::runtime_error("'" + path + "' has an unsupported trace version");
+    m_position = sizeof(TRACE_MAGIC) + 1;
+}
+
+bool TraceReader::Next(TraceRecord& record)
+{
+    std::size_t length =
+        m_encoder.Decode(m_data.data() + m_position, m_data.size() - m_position, record);
+    m_position += length;
+    return length != 0;
+}
+
+}  // namespace llvmes
@@ -0,0 +1,160 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace llvmes {
+
+/// One executed instruction, the registers are the ones it started with
+struct TraceRecord {
+    std::uint16_t pc;
+    // Effective address worked out by the addressing mode, meaningless for
+    // implied and accumulator instructions
+    std::uint16_t address;
+    std::uint8_t opcode;
+    std::uint8_t reg_a;
+    std::uint8_t reg_x;
+    std::uint8_t reg_y;
+    std::uint8_t reg_sp;
+    std::uint8_t status;
+};
+
+// Trace files start with TRACE_MAGIC and the format version. Every record is
+// then stored relative to the one before it (see TraceEncoder), so a record
+// where only A changed and the PC advanced past the previous instruction takes
+// two bytes.
+constexpr char TRACE_MAGIC[8] = {'L', 'L', 'V', 'M', 'E', 'S', 'T', 'R'};
+constexpr std::uint8_t TRACE_VERSION = 1;
+
+/// The delta encoding, shared by the recorder and the reader. A record starts
+/// with a byte telling which fields differ from what's expected, followed by
+/// the fields that do:
+///   PC       the PC following the previous instruction, otherwise the
+///            difference as a zigzag varint
+///   address  the previous address, otherwise the difference as a zigzag varint
+///   opcode   the opcode last seen at the same PC, otherwise the new one
+///   A to P   the previous value, otherwise the new one
+class TraceEncoder {
+   public:
+    // The flags, two varints of up to three bytes and six bytes
+    constexpr static std::size_t MAX_RECORD_SIZE = 13;
+
+    TraceEncoder();
+    /// Writes up to MAX_RECORD_SIZE bytes to 'out', returns the end of them
+    std::uint8_t* Encode(const TraceRecord& record, std::uint8_t* out);
+    /// Returns the number of bytes used, 0 if 'data' ends in the middle of the
+    /// record
+    std::size_t Decode(const std::uint8_t* data, std::size_t size, TraceRecord& record);
+
+   private:
+    constexpr static std::uint8_t PC_CHANGED = 1 << 0;
+    constexpr static std::uint8_t ADDRESS_CHANGED = 1 << 1;
+    constexpr static std::uint8_t OPCODE_CHANGED = 1 << 2;
+    constexpr static std::uint8_t A_CHANGED = 1 << 3;
+    constexpr static std::uint8_t X_CHANGED = 1 << 4;
+    constexpr static std::uint8_t Y_CHANGED = 1 << 5;
+    constexpr static std::uint8_t SP_CHANGED = 1 << 6;
+    constexpr static std::uint8_t STATUS_CHANGED = 1 << 7;
+
+    std::uint16_t NextPC() const;
+
+    TraceRecord m_previous;
+    std::vector<std::uint8_t> m_opcodes;
+};
+
+/// Writes the records it's given to a trace file. Push() only copies the record
+/// into a ring buffer, a background thread encodes and writes them. The ring
+/// buffer has a single producer, the CPU thread, and a single consumer, so
+/// it's synchronized with two counters and no locks. If the writer falls
+/// behind, Push() blocks until it catches up rather than dropping records,
+/// that's the only time a lock is taken.
+class TraceRecorder {
+   public:
+    constexpr static std::size_t RING_SIZE = 1 << 16;
+
+    /// Throws std::runtime_error if the file can't be created
+    explicit TraceRecorder(const std::string& path);
+    /// Writes whatever is still in the ring buffer and closes the file
+    ~TraceRecorder();
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    void Push(const TraceRecord& record)
+    {
+        std::uint64_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_cached_tail >= RING_SIZE)
+            WaitForSpace(head);
+        m_ring[head & (RING_SIZE - 1)] = record;
+        m_head.store(head + 1, std::memory_order_release);
+    }
+
+    std::uint64_t GetRecordCount() const { return m_head.load(); }
+    /// Size of the file written so far
+    std::uint64_t GetBytesWritten() const { return m_bytes_written.load(); }
+
+   private:
+    void WaitForSpace(std::uint64_t head);
+    void WriterMain();
+
+    std::vector<TraceRecord> m_ring;
+    // Only touched by Push(), the last m_tail it has seen
+    std::uint64_t m_cached_tail;
+    // Written by Push() and by the writer respectively, on separate cache lines
+    // so the two threads don't keep taking the line from each other
+    alignas(64) std::atomic<std::uint64_t> m_head;
+    alignas(64) std::atomic<std::uint64_t> m_tail;
+    std::atomic<bool> m_stop;
+    std::atomic<std::uint64_t> m_bytes_written;
+
+    // Wakes up the writer when the ring buffer is full or the recorder is
+    // destroyed, and Push() once there's space again
+    std::mutex m_mutex;
+    std::condition_variable m_wake_writer;
+    std::condition_variable m_space_available;
+
+    std::ofstream m_file;
+    std::thread m_writer;
+};
+
+/// Reads back the records of a trace file
+class TraceReader {
+   public:
+    /// Throws std::runtime_error if the file can't be opened or isn't a trace
+    explicit TraceReader(const std::string& path);
+    /// Returns false at the end of the trace
+    bool Next(TraceRecord& record);
+
+   private:
+    std::vector<std::uint8_t> m_data;
+    std::size_t m_position;
+    TraceEncoder m_encoder;
+};
+
+// The tracing policy of BasicCPU. Disabled tracing is a separate
+// instantiation, so the hooks in the run loops don't even leave a branch
+// behind.
+
+/// Doesn't record anything
+struct NoTrace {
+    constexpr static bool ENABLED = false;
+    void Record(const TraceRecord&) {}
+};
+
+/// Hands every instruction to 'recorder', if it's set
+struct RecordTrace {
+    constexpr static bool ENABLED = true;
+    void Record(const TraceRecord& record)
+    {
+        if (recorder)
+            recorder->Push(record);
+    }
+
+    TraceRecorder* recorder = nullptr;
+};
+
+}  // namespace llvmes
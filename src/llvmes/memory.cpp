@@ -0,0 +1,155 @@
+#include "llvmes/memory.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace llvmes {
+
+Memory::Memory() : m_ram(PAGE_COUNT * PAGE_SIZE), m_has_snapshot(false)
+{
+    m_page_device.fill(NO_DEVICE);
+    m_cow_pages.fill(nullptr);
+    m_saved.fill(false);
+    MapRAM(0x00, PAGE_COUNT);
+}
+
+void Memory::MapRAM(std::uint8_t first_page, unsigned int count, std::uint8_t* host)
+{
+    assert(first_page + count <= PAGE_COUNT);
+    DropSnapshotPages(first_page, count);
+    std::uint8_t* base = host ? host : &m_ram[first_page * PAGE_SIZE];
+    for (unsigned int i = 0; i < count; i++) {
+        m_read_pages[first_page + i] = base + i * PAGE_SIZE;
+        m_write_pages[first_page + i] = base + i * PAGE_SIZE;
+        m_page_device[first_page + i] = NO_DEVICE;
+    }
+}
+
+void Memory::MapROM(std::uint8_t first_page, unsigned int count, std::uint8_t* host)
+{
+    MapRAM(first_page, count, host);
+    for (unsigned int i = 0; i < count; i++)
+        m_write_pages[first_page + i] = nullptr;
+}
+
+void Memory::MapDevice(std::uint8_t first_page, unsigned int count, DeviceRead read,
+                       DeviceWrite write)
+{
+    assert(first_page + count <= PAGE_COUNT);
+    assert(m_devices.size() < NO_DEVICE);
+    DropSnapshotPages(first_page, count);
+
+    bool direct_read = !read;
+    m_devices.push_back({std::move(read), std::move(write)});
+    std::uint8_t device = m_devices.size() - 1;
+
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int page = first_page + i;
+        // Direct reads keep whatever memory the page was mapped to before
+        if (!direct_read)
+            m_read_pages[page] = nullptr;
+        else if (!m_read_pages[page])
+            m_read_pages[page] = &m_ram[page * PAGE_SIZE];
+        m_write_pages[page] = nullptr;
+        m_page_device[page] = device;
+    }
+}
+
+std::uint8_t Memory::ReadDevice(std::uint16_t addr) const
+{
+    std::uint8_t device = m_page_device[addr >> 8];
+    if (device == NO_DEVICE || !m_devices[device].read)
+        return 0;
+    return m_devices[device].read(addr);
+}
+
+void Memory::WriteDevice(std::uint16_t addr, std::uint8_t data)
+{
+    // First write to a page since the snapshot
+    if (m_cow_pages[addr >> 8]) {
+        SavePage(addr >> 8);
+        m_write_pages[addr >> 8][addr & 0xFF] = data;
+        return;
+    }
+
+    // Writes to ROM end up here as well and are dropped
+    std::uint8_t device = m_page_device[addr >> 8];
+    if (device == NO_DEVICE || !m_devices[device].write)
+        return;
+    m_devices[device].write(addr, data);
+}
+
+void Memory::TakeSnapshot()
+{
+    if (m_snapshot.empty())
+        m_snapshot.resize(PAGE_COUNT * PAGE_SIZE);
+
+    // Pages saved for the previous snapshot are protected again below
+    for (std::uint8_t page : m_saved_list)
+        m_saved[page] = false;
+    m_saved_list.clear();
+    m_device_pages.clear();
+
+    for (unsigned int page = 0; page < PAGE_COUNT; page++) {
+        if (m_cow_pages[page]) {
+            m_write_pages[page] = nullptr;
+            continue;
+        }
+        if (m_write_pages[page]) {
+            m_cow_pages[page] = m_write_pages[page];
+            m_write_pages[page] = nullptr;
+        }
+        else if (IsDevicePage(page) && m_read_pages[page]) {
+            std::memcpy(&m_snapshot[page * PAGE_SIZE], m_read_pages[page], PAGE_SIZE);
+            m_device_pages.push_back(page);
+        }
+    }
+    m_has_snapshot = true;
+}
+
+const std::vector<std::uint8_t>& Memory::RestoreSnapshot()
+{
+    assert(m_has_snapshot);
+    m_restored.clear();
+
+    for (std::uint8_t page : m_saved_list) {
+        std::memcpy(m_cow_pages[page], &m_snapshot[page * PAGE_SIZE], PAGE_SIZE);
+        m_write_pages[page] = nullptr;
+        m_saved[page] = false;
+        m_restored.push_back(page);
+    }
+    m_saved_list.clear();
+
+    for (std::uint8_t page : m_device_pages) {
+        if (m_read_pages[page])
+            std::memcpy(m_read_pages[page], &m_snapshot[page * PAGE_SIZE], PAGE_SIZE);
+        m_restored.push_back(page);
+    }
+    return m_restored;
+}
+
+void Memory::SavePage(std::uint8_t page)
+{
+    std::memcpy(&m_snapshot[page * PAGE_SIZE], m_cow_pages[page], PAGE_SIZE);
+    m_write_pages[page] = m_cow_pages[page];
+    m_saved[page] = true;
+    m_saved_list.push_back(page);
+}
+
+void Memory::DropSnapshotPages(std::uint8_t first_page, unsigned int count)
+{
+    for (unsigned int page = first_page; page < first_page + count; page++) {
+        if (m_saved[page]) {
+            m_saved[page] = false;
+            m_saved_list.erase(
+                std::find(m_saved_list.begin(), m_saved_list.end(), page));
+        }
+        m_device_pages.erase(
+            std::remove(m_device_pages.begin(), m_device_pages.end(), page),
+            m_device_pages.end());
+        m_cow_pages[page] = nullptr;
+    }
+}
+
+}  // namespace llvmes
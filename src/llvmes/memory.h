@@ -0,0 +1,122 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace llvmes {
+
+typedef std::function<std::uint8_t(std::uint16_t)> DeviceRead;
+typedef std::function<void(std::uint16_t, std::uint8_t)> DeviceWrite;
+
+/// The 64KB address space split into 256 pages of 256 bytes. Every page is
+/// either a direct host pointer (RAM or ROM) or belongs to a device. Plain
+/// memory is resolved with a single table lookup, only device pages dispatch to
+/// a callback. Memory satisfies the bus policy of the CPU (see bus.h), so it
+/// can be used directly as BasicCPU<Memory>.
+class Memory {
+   public:
+    constexpr static unsigned int PAGE_SIZE = 0x100;
+    constexpr static unsigned int PAGE_COUNT = 0x100;
+
+    /// All pages start out as RAM backed by the internal storage
+    Memory();
+    // The page table points into the internal storage
+    Memory(const Memory&) = delete;
+    Memory& operator=(const Memory&) = delete;
+    Memory(Memory&&) = default;
+    Memory& operator=(Memory&&) = default;
+
+    std::uint8_t Read(std::uint16_t addr) const
+    {
+        const std::uint8_t* page = m_read_pages[addr >> 8];
+        if (page)
+            return page[addr & 0xFF];
+        return ReadDevice(addr);
+    }
+
+    void Write(std::uint16_t addr, std::uint8_t data)
+    {
+        std::uint8_t* page = m_write_pages[addr >> 8];
+        if (page)
+            page[addr & 0xFF] = data;
+        else
+            WriteDevice(addr, data);
+    }
+
+    /// Maps 'count' pages as RAM. 'host' is the memory backing 'first_page', if
+    /// it's null the internal storage is used.
+    void MapRAM(std::uint8_t first_page, unsigned int count, std::uint8_t* host = nullptr);
+    /// Same as RAM, but writes to the pages are ignored
+    void MapROM(std::uint8_t first_page, unsigned int count, std::uint8_t* host = nullptr);
+    /// Accesses to the pages are forwarded to the device. If 'read' is empty,
+    /// reads keep going to the memory the pages were mapped to before.
+    void MapDevice(std::uint8_t first_page, unsigned int count, DeviceRead read,
+                   DeviceWrite write);
+
+    /// Internal storage, indexed by the full 16 bit address
+    std::uint8_t* GetRAM() { return m_ram.data(); }
+    const std::uint8_t* GetRAM() const { return m_ram.data(); }
+    /// Host pointer of a page, nullptr if the page can't be read directly
+    std::uint8_t* GetPage(std::uint8_t page) { return m_read_pages[page]; }
+    bool IsDevicePage(std::uint8_t page) const { return m_page_device[page] != NO_DEVICE; }
+    bool IsWritable(std::uint8_t page) const
+    {
+        return m_write_pages[page] != nullptr || m_cow_pages[page] != nullptr;
+    }
+    /// The page table used by Write(). A page without a pointer has to be
+    /// written through Write(), code that writes to memory directly (the JIT)
+    /// checks it. The table stays at the same address.
+    std::uint8_t* const* GetWritePages() const { return m_write_pages.data(); }
+
+    /// Remembers the contents of all pages, replacing the previous snapshot.
+    /// Nothing is copied yet: the RAM pages are write protected, and the first
+    /// write to one saves the page before it's modified. Device pages that are
+    /// read directly are saved right away, as their devices usually write to
+    /// them behind the memory's back.
+    void TakeSnapshot();
+    /// Brings back the contents of the last snapshot. Only the pages written
+    /// since the snapshot (or the last restore) are copied, and the snapshot
+    /// stays, so this can be repeated. Returns the restored pages.
+    const std::vector<std::uint8_t>& RestoreSnapshot();
+    bool HasSnapshot() const { return m_has_snapshot; }
+    /// Number of pages saved since the snapshot or the last restore
+    unsigned int GetSnapshotDirtyPages() const { return m_saved_list.size(); }
+
+   private:
+    constexpr static std::uint8_t NO_DEVICE = 0xFF;
+
+    struct Device {
+        DeviceRead read;
+        DeviceWrite write;
+    };
+
+    std::uint8_t ReadDevice(std::uint16_t addr) const;
+    void WriteDevice(std::uint16_t addr, std::uint8_t data);
+    /// Saves the page for the snapshot
+    void SavePage(std::uint8_t page);
+    /// Ends copy-on-write for pages that get mapped to something else
+    void DropSnapshotPages(std::uint8_t first_page, unsigned int count);
+
+    std::vector<std::uint8_t> m_ram;
+    std::array<std::uint8_t*, PAGE_COUNT> m_read_pages;
+    std::array<std::uint8_t*, PAGE_COUNT> m_write_pages;
+    // Index into m_devices or NO_DEVICE
+    std::array<std::uint8_t, PAGE_COUNT> m_page_device;
+    std::vector<Device> m_devices;
+
+    // Write pointers of the pages protected for the snapshot, which are null in
+    // m_write_pages until the page is saved
+    std::array<std::uint8_t*, PAGE_COUNT> m_cow_pages;
+    // Contents of the saved pages, indexed by the full 16 bit address
+    std::vector<std::uint8_t> m_snapshot;
+    std::array<bool, PAGE_COUNT> m_saved;
+    std::vector<std::uint8_t> m_saved_list;
+    // Device pages saved by TakeSnapshot(), restored every time
+    std::vector<std::uint8_t> m_device_pages;
+    // Returned by RestoreSnapshot()
+    std::vector<std::uint8_t> m_restored;
+    bool m_has_snapshot;
+};
+
+}  // namespace llvmes
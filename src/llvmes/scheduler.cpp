@@ -0,0 +1,44 @@
+#include "llvmes/scheduler.h"
+
+#include <algorithm>
+
+namespace llvmes {
+
+Scheduler::EventId Scheduler::Schedule(std::uint64_t timestamp, Callback callback)
+{
+    EventId id = m_next_id++;
+    m_events.push_back({timestamp, id, std::move(callback)});
+    std::push_heap(m_events.begin(), m_events.end(), Later);
+    return id;
+}
+
+bool Scheduler::Cancel(EventId id)
+{
+    // There are only a handful of events at a time, so no index by id
+    auto it = std::find_if(m_events.begin(), m_events.end(),
+                           [id](const Event& event) { return event.id == id; });
+    if (it == m_events.end())
+        return false;
+
+    m_events.erase(it);
+    std::make_heap(m_events.begin(), m_events.end(), Later);
+    return true;
+}
+
+void Scheduler::RunDue(std::uint64_t now)
+{
+    while (!m_events.empty() && m_events.front().timestamp <= now) {
+        std::pop_heap(m_events.begin(), m_events.end(), Later);
+        Event event = std::move(m_events.back());
+        m_events.pop_back();
+        // The callback may schedule or cancel events itself
+        event.callback(event.timestamp);
+    }
+}
+
+void Scheduler::Clear()
+{
+    m_events.clear();
+}
+
+}  // namespace llvmes
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace llvmes {
+
+/// Pending events ordered by the cycle they're due at. Devices schedule
+/// interrupts, timers etc. here instead of being polled after every
+/// instruction, the executing code only has to compare its cycle counter
+/// against NextTimestamp(). Doesn't depend on the CPU, so the interpreter and
+/// the compiled code can share it.
+class Scheduler {
+   public:
+    typedef std::uint64_t EventId;
+    /// Gets the timestamp the event was scheduled for, which can be earlier than
+    /// the current cycle. Periodic events reschedule themselves relative to it.
+    typedef std::function<void(std::uint64_t timestamp)> Callback;
+
+    constexpr static std::uint64_t NEVER = UINT64_MAX;
+
+    /// Events with the same timestamp run in the order they were scheduled
+    EventId Schedule(std::uint64_t timestamp, Callback callback);
+    /// Returns false if the event already ran or was cancelled
+    bool Cancel(EventId id);
+    /// Runs every event that is due at 'now', including the ones scheduled by
+    /// the callbacks while doing so
+    void RunDue(std::uint64_t now);
+    void Clear();
+
+    std::uint64_t NextTimestamp() const
+    {
+        return m_events.empty() ? NEVER : m_events.front().timestamp;
+    }
+    bool Empty() const { return m_events.empty(); }
+
+   private:
+    struct Event {
+        std::uint64_t timestamp;
+        EventId id;
+        Callback callback;
+    };
+
+    // Ordering for std::push_heap etc., puts the earliest event at the front
+    static bool Later(const Event& a, const Event& b)
+    {
+        if (a.timestamp != b.timestamp)
+            return a.timestamp > b.timestamp;
+        return a.id > b.id;
+    }
+
+    std::vector<Event> m_events;
+    EventId m_next_id = 0;
+};
+
+}  // namespace llvmes
@@ -0,0 +1,118 @@
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "cxxopts.hpp"
+#include "llvmes/batch/batch.h"
+
+using namespace llvmes;
+using namespace std::chrono;
+
+static std::vector<std::uint8_t> readFile(const std::string& path)
+{
+    std::ifstream in{path, std::ios::binary};
+    if (in.fail())
+        throw std::runtime_error("The file " + path + " doesn't exist");
+    return std::vector<std::uint8_t>{std::istreambuf_iterator<char>(in),
+                                     std::istreambuf_iterator<char>()};
+}
+
+int main(int argc, char** argv)
+try {
+    cxxopts::Options options("Batch", "Run many bin files in parallel using the interpreter");
+
+    options.add_options()("f,positional", "Files",
+                          cxxopts::value<std::vector<std::string>>())(
+        "h,help", "Print usage")("j,threads", "Number of worker threads (default: all cores)",
+                                 cxxopts::value<unsigned int>())(
+        "r,repeat", "Run every file this many times", cxxopts::value<unsigned int>())(
+        "i,input", "File copied to the input address of every job",
+        cxxopts::value<std::string>())(
+        "c,cycles", "Stop jobs after this many cycles", cxxopts::value<std::uint64_t>())(
+        "d,decoded", "Run pre-decoded instructions (RunDecoded)", cxxopts::value<bool>())(
+        "s,lockstep", "Run jobs with the same program in lock-step (LockstepCPU)",
+        cxxopts::value<bool>())(
+        "o,output", "Print the console output of every job", cxxopts::value<bool>())(
+        "q,quiet", "Only print the summary", cxxopts::value<bool>());
+
+    options.parse_positional({"positional"});
+    auto result = options.parse(argc, argv);
+
+    if (result.count("help") || !result.count("positional")) {
+        std::cout << options.help() << std::endl;
+        exit(0);
+    }
+
+    BatchSettings settings;
+    if (result.count("threads"))
+        settings.threads = result["threads"].as<unsigned int>();
+    if (result.count("decoded"))
+        settings.decoded = true;
+    if (result.count("lockstep"))
+        settings.lockstep = true;
+
+    unsigned int repeat = result.count("repeat") ? result["repeat"].as<unsigned int>() : 1;
+
+    std::vector<std::uint8_t> input;
+    if (result.count("input"))
+        input = readFile(result["input"].as<std::string>());
+
+    std::vector<BatchJob> jobs;
+    for (auto& path : result["positional"].as<std::vector<std::string>>()) {
+        BatchJob job;
+        job.name = path;
+        job.program = readFile(path);
+        job.input = input;
+        if (result.count("cycles"))
+            job.cycle_limit = result["cycles"].as<std::uint64_t>();
+        for (unsigned int i = 0; i < repeat; i++)
+            jobs.push_back(job);
+    }
+    // End - parsing command line
+
+    auto start = high_resolution_clock::now();
+    std::vector<BatchResult> results = RunBatch(jobs, settings);
+    auto stop = high_resolution_clock::now();
+    double wall_seconds = duration_cast<duration<double>>(stop - start).count();
+
+    std::uint64_t instructions = 0;
+    double job_seconds = 0;
+    unsigned int failed = 0;
+    for (auto& r : results) {
+        instructions += r.instructions;
+        job_seconds += r.seconds;
+        if (!r.exited)
+            failed++;
+
+        if (result.count("quiet"))
+            continue;
+        std::cout << r.name << ": ";
+        if (r.exited)
+            std::cout << "exit " << (unsigned)r.exit_code;
+        else
+            std::cout << (r.timed_out ? "timeout" : "illegal opcode");
+        std::cout << ", hash " << std::hex << std::setw(16) << std::setfill('0')
+                  << r.memory_hash << std::dec << std::setfill(' ') << ", "
+                  << r.instructions << " instructions, " << r.cycles << " cycles, "
+                  << r.seconds * 1e3 << "ms" << std::endl;
+        if (result.count("output"))
+            std::cout << r.output;
+    }
+
+    std::cout << "Jobs: " << results.size() << " (" << failed << " didn't exit)"
+              << std::endl;
+    std::cout << "Wall time: " << wall_seconds * 1e3 << "ms" << std::endl;
+    std::cout << "Instructions: " << instructions << std::endl;
+    std::cout << "Jobs/s: " << results.size() / wall_seconds << std::endl;
+    std::cout << "Aggregate MIPS: " << instructions / wall_seconds / 1e6 << std::endl;
+    // How much of the summed up job time was overlapped
+    std::cout << "Parallel speedup: " << job_seconds / wall_seconds << std::endl;
+
+    return failed ? 1 : 0;
+}
+catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+}
@@ -0,0 +1,378 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "cxxopts.hpp"
+#include "llvmes/dynarec/compiler.h"
+#include "llvmes/dynarec/parser.h"
+#include "llvmes/hash.h"
+#include "llvmes/interpreter/cpu.h"
+#include "llvmes/time.h"
+
+using namespace llvmes;
+using namespace llvmes::dynarec;
+using namespace std::chrono;
+
+struct Settings {
+    JITTIR::OptimizationLevel level = JITTIR::OptimizationLevel::None;
+    bool ignore_stack = false;
+    bool quiet = false;
+    // Enough for every program in the corpus that exits
+    std::uint64_t cycles = 4000000000;
+    // Seconds the JIT gets to exit, it has no cycle limit
+    unsigned int timeout = 60;
+};
+
+// The state of an engine every time the program writes to a console port or
+// exits, which both engines agree on
+struct Checkpoint {
+    std::uint16_t address;
+    std::uint8_t reg_a;
+    std::uint8_t reg_x;
+    std::uint8_t reg_y;
+    std::uint8_t reg_sp;
+    std::uint8_t status;
+    std::uint64_t memory_hash;
+
+    bool operator==(const Checkpoint& other) const
+    {
+        return address == other.address && reg_a == other.reg_a &&
+               reg_x == other.reg_x && reg_y == other.reg_y &&
+               reg_sp == other.reg_sp && status == other.status &&
+               memory_hash == other.memory_hash;
+    }
+    bool operator!=(const Checkpoint& other) const { return !(*this == other); }
+};
+
+// Where an engine was at a checkpoint, or where it ended up if it never got
+// there
+struct Context {
+    std::vector<std::uint8_t> memory;
+    std::uint16_t pc = 0;
+    std::uint64_t instructions = 0;
+};
+
+static bool isCheckpoint(std::uint16_t addr)
+{
+    return (addr >= 0x2008 && addr <= 0x200C) || addr == 0x200F;
+}
+
+static MemoryHasher createHasher(const Settings& settings)
+{
+    MemoryHasher hasher;
+    // Tells a difference in what was pushed apart from one in the rest of the state
+    if (settings.ignore_stack)
+        hasher.IgnorePage(0x01);
+    return hasher;
+}
+
+// Runs the program on the interpreter and returns its checkpoints. If 'stop' is
+// set, the run ends at that checkpoint and 'context' is filled in.
+static std::vector<Checkpoint> runInterpreter(const std::vector<std::uint8_t>& program,
+                                              const Settings& settings,
+                                              std::size_t stop = SIZE_MAX,
+                                              Context* context = nullptr)
+{
+    std::vector<Checkpoint> checkpoints;
+    MemoryHasher hasher = createHasher(settings);
+
+    auto cpu = std::make_unique<BasicCPU<Memory>>();
+    std::copy(program.begin(), program.end(), &cpu->GetRAM()[0x8000]);
+
+    BasicCPU<Memory>* cpu_ptr = cpu.get();
+    cpu->MapDevice(0x20, 1, nullptr, [&](std::uint16_t addr, std::uint8_t data) {
+        BasicCPU<Memory>& cpu = *cpu_ptr;
+        if (!isCheckpoint(addr)) {
+            cpu.GetRAM()[addr] = data;
+            return;
+        }
+
+        std::uint8_t sp = settings.ignore_stack ? 0 : cpu.reg_sp;
+        std::uint8_t status = cpu.GetStatus();
+        checkpoints.push_back({addr, cpu.reg_a, cpu.reg_x, cpu.reg_y, sp, status,
+                               hasher.Update(cpu.GetRAM())});
+        if (addr == 0x200F || checkpoints.size() - 1 == stop)
+            cpu.Halt();
+    });
+
+    cpu->Reset();
+    cpu->RunFor(settings.cycles);
+
+    if (context) {
+        context->memory.assign(cpu->GetRAM(), cpu->GetRAM() + 0x10000);
+        context->pc = cpu->reg_pc;
+        context->instructions = cpu->GetInstructionCount();
+    }
+    return checkpoints;
+}
+
+// Runs the program on the JIT and compares it with the interpreter's
+// checkpoints as it goes. Returns the index of the first one that differs, or
+// SIZE_MAX, and fills in 'context' and 'divergence' for it.
+static std::size_t runJIT(const std::vector<std::uint8_t>& program,
+                          const std::string& name, const Settings& settings,
+                          const std::vector<Checkpoint>& expected,
+                          std::size_t& checkpoint_count, Checkpoint& divergence,
+                          Context& context)
+{
+    std::size_t first_difference = SIZE_MAX;
+    checkpoint_count = 0;
+    MemoryHasher hasher = createHasher(settings);
+
+    Parser parser(std::vector<std::uint8_t>(program), 0x8000);
+    ParseResult parse_result = parser.Parse();
+    Compiler compiler(parse_result, name);
+    compiler.GetConsole().SetOutput(nullptr);
+
+    compiler.SetCheckpointCallback([&](const CheckpointState& state) {
+        std::uint8_t sp = settings.ignore_stack ? 0 : state.reg_sp;
+        std::vector<std::uint8_t>& memory = compiler.GetMemory();
+        Checkpoint checkpoint = {state.address, state.reg_a, state.reg_x, state.reg_y,
+                                 sp, state.status, hasher.Update(memory.data())};
+
+        std::size_t index = checkpoint_count++;
+        if (first_difference != SIZE_MAX)
+            return;
+        if (index >= expected.size() || checkpoint != expected[index]) {
+            first_difference = index;
+            divergence = checkpoint;
+            context.memory = memory;
+        }
+    });
+
+    auto main = compiler.Compile(settings.level);
+    main();
+
+    // Ran out of checkpoints before the interpreter did
+    if (first_difference == SIZE_MAX && checkpoint_count < expected.size()) {
+        first_difference = checkpoint_count;
+        context.memory = compiler.GetMemory();
+    }
+    return first_difference;
+}
+
+static void printCheckpoint(const std::string& engine, const Checkpoint& checkpoint,
+                            const Settings& settings)
+{
+    std::cout << "  " << engine << "  " << ToHexString(checkpoint.address)
+              << "  A:" << ToHexString(checkpoint.reg_a)
+              << " X:" << ToHexString(checkpoint.reg_x)
+              << " Y:" << ToHexString(checkpoint.reg_y);
+    if (!settings.ignore_stack)
+        std::cout << " SP:" << ToHexString(checkpoint.reg_sp);
+    std::cout << " P:" << ToHexString(checkpoint.status) << "  memory " << std::hex
+              << std::setw(16) << std::setfill('0') << checkpoint.memory_hash << std::dec
+              << std::setfill(' ') << std::endl;
+}
+
+// Prints the bytes that differ, at most 'max_lines' of them
+static void printMemoryDifference(const std::vector<std::uint8_t>& expected,
+                                  const std::vector<std::uint8_t>& actual,
+                                  const Settings& settings, unsigned int max_lines = 16)
+{
+    MemoryHasher hasher = createHasher(settings);
+    unsigned int differences = 0;
+    for (unsigned int addr = 0; addr < expected.size(); addr++) {
+        if (hasher.IsIgnored(addr >> 8) || expected[addr] == actual[addr])
+            continue;
+        if (differences++ < max_lines)
+            std::cout << "    " << ToHexString<std::uint16_t>(addr) << "  "
+                      << ToHexString(expected[addr]) << " / " << ToHexString(actual[addr])
+                      << std::endl;
+    }
+    std::cout << "  " << differences << " bytes differ (interpreter / jit)" << std::endl;
+}
+
+// A JIT run on a thread of its own, so a program that doesn't exit on the JIT
+// can be given up on. The thread shares nothing but this with the caller.
+struct JITRun {
+    std::vector<std::uint8_t> program;
+    std::string name;
+    Settings settings;
+    std::vector<Checkpoint> expected;
+
+    std::size_t index = SIZE_MAX;
+    std::size_t checkpoint_count = 0;
+    Checkpoint divergence;
+    Context context;
+    std::exception_ptr error;
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool done = false;
+};
+
+// Set once a JIT run was given up on, its thread is still running
+static bool abandoned_jit_run = false;
+
+enum class Outcome { Matched, Failed, Skipped };
+
+// Whether both engines went through the same checkpoints
+static Outcome compare(const std::string& path, const Settings& settings)
+{
+    std::ifstream in{path, std::ios::binary};
+    if (in.fail())
+        throw std::runtime_error("The file doesn't exist: " + path);
+    auto program = std::vector<std::uint8_t>{std::istreambuf_iterator<char>(in),
+                                             std::istreambuf_iterator<char>()};
+
+    std::vector<Checkpoint> expected = runInterpreter(program, settings);
+    // Without an exit there's no end to compare, and nothing would stop the JIT
+    if (expected.empty() || expected.back().address != 0x200F) {
+        std::cout << "skip " << path << ": the interpreter didn't exit within "
+                  << settings.cycles << " cycles" << std::endl;
+        return Outcome::Skipped;
+    }
+
+    auto run = std::make_shared<JITRun>();
+    run->program = program;
+    run->name = path;
+    run->settings = settings;
+    run->expected = expected;
+    std::thread([run] {
+        try {
+            run->index = runJIT(run->program, run->name, run->settings, run->expected,
+                                run->checkpoint_count, run->divergence, run->context);
+        }
+        catch (...) {
+            run->error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(run->mutex);
+        run->done = true;
+        run->finished.notify_one();
+    }).detach();
+
+    {
+        std::unique_lock<std::mutex> lock(run->mutex);
+        if (!run->finished.wait_for(lock, seconds(settings.timeout),
+                                    [&run] { return run->done; })) {
+            abandoned_jit_run = true;
+            std::cout << "FAIL " << path << ": the jit didn't exit within "
+                      << settings.timeout << "s" << std::endl;
+            return Outcome::Failed;
+        }
+    }
+    if (run->error)
+        std::rethrow_exception(run->error);
+    std::size_t index = run->index;
+    std::size_t jit_count = run->checkpoint_count;
+
+    if (index == SIZE_MAX) {
+        if (!settings.quiet)
+            std::cout << "ok " << path << " (" << expected.size() << " checkpoints)"
+                      << std::endl;
+        return Outcome::Matched;
+    }
+
+    std::cout << "FAIL " << path << ": checkpoint " << index << " differs, "
+              << expected.size() << " on the interpreter, " << jit_count << " on the jit"
+              << std::endl;
+
+    // Runs the interpreter again up to the checkpoint for the memory
+    Context context;
+    runInterpreter(program, settings, index, &context);
+    if (index < expected.size()) {
+        printCheckpoint("interpreter", expected[index], settings);
+        std::cout << "  at PC " << ToHexString(context.pc) << " after "
+                  << context.instructions << " instructions" << std::endl;
+    }
+    else {
+        std::cout << "  interpreter  no checkpoint, stopped at PC "
+                  << ToHexString(context.pc) << std::endl;
+    }
+    if (index < jit_count)
+        printCheckpoint("jit        ", run->divergence, settings);
+    else
+        std::cout << "  jit          no checkpoint, exited" << std::endl;
+
+    printMemoryDifference(context.memory, run->context.memory, settings);
+    return Outcome::Failed;
+}
+
+int main(int argc, char** argv)
+try {
+    cxxopts::Options options(
+        "Co-simulation",
+        "Run bin files on both the interpreter and the JIT and compare the registers "
+        "and a hash of the memory at every console write and the exit");
+
+    options.add_options()("f,positional", "Files",
+                          cxxopts::value<std::vector<std::string>>())(
+        "h,help", "Print usage")("O,optimize", "Optimize the JIT, same as --opt-level 2",
+                                 cxxopts::value<bool>())(
+        "opt-level", "IR passes of the JIT: 0, fast, 1, 2 or 3",
+        cxxopts::value<std::string>())(
+        "k,ignore-stack", "Leave SP and the stack page out of the comparison",
+        cxxopts::value<bool>())(
+        "c,cycles",
+        "Cycles the interpreter gets to exit, programs that don't are skipped "
+        "(default 4000000000)",
+        cxxopts::value<std::uint64_t>())(
+        "t,timeout", "Seconds the JIT gets to exit (default 60)",
+        cxxopts::value<unsigned int>())(
+        "q,quiet", "Only print the differences and the summary", cxxopts::value<bool>());
+
+    options.parse_positional({"positional"});
+    auto result = options.parse(argc, argv);
+
+    if (result.count("help") || !result.count("positional")) {
+        std::cout << options.help() << std::endl;
+        exit(0);
+    }
+
+    Settings settings;
+    if (result.count("optimize"))
+        settings.level = JITTIR::OptimizationLevel::O2;
+    if (result.count("opt-level"))
+        settings.level = ParseOptimizationLevel(result["opt-level"].as<std::string>());
+    if (result.count("ignore-stack"))
+        settings.ignore_stack = true;
+    if (result.count("quiet"))
+        settings.quiet = true;
+    if (result.count("cycles"))
+        settings.cycles = result["cycles"].as<std::uint64_t>();
+    if (result.count("timeout"))
+        settings.timeout = result["timeout"].as<unsigned int>();
+
+    auto files = result["positional"].as<std::vector<std::string>>();
+    unsigned int matched = 0;
+    unsigned int skipped = 0;
+    ClockType start = high_resolution_clock::now();
+    for (const auto& file : files) {
+        try {
+            Outcome outcome = compare(file, settings);
+            if (outcome == Outcome::Matched)
+                matched++;
+            else if (outcome == Outcome::Skipped)
+                skipped++;
+        }
+        catch (std::exception& e) {
+            std::cout << "FAIL " << file << ": " << e.what() << std::endl;
+        }
+    }
+    ClockType stop = high_resolution_clock::now();
+
+    std::cout << "Matched: " << matched << " / " << files.size() - skipped << ", "
+              << skipped << " skipped in "
+              << GetDuration<ClockType>(TimeFormat::Milli, start, stop)
+              << GetTimeFormatAbbreviation(TimeFormat::Milli) << std::endl;
+    int exit_code = matched + skipped == files.size() ? 0 : 1;
+    // The threads of the runs that were given up on can't be stopped
+    if (abandoned_jit_run) {
+        std::cout.flush();
+        std::_Exit(exit_code);
+    }
+    return exit_code;
+}
+catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+}
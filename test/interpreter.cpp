@@ -1,53 +1,159 @@
 #include <chrono>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <type_traits>
 
 #include "cxxopts.hpp"
+#include "llvmes/console.h"
 #include "llvmes/interpreter/cpu.h"
 #include "llvmes/time.h"
 
 using namespace llvmes;
 using namespace std::chrono;
 
-std::vector<std::uint8_t> memory(0xFFFF);
-
-std::shared_ptr<CPU> cpu;
-
-std::uint8_t readMemory(std::uint16_t adr)
-{
-    return memory[adr];
-}
-
-void writeMemory(std::uint16_t addr, std::uint8_t data)
+struct Settings {
+    bool verbose = false;
+    bool save = false;
+    bool decoded = false;
+    bool fusion = true;
+    bool quiet = false;
+    TimeFormat time_format = TimeFormat::Micro;
+    std::string save_path;
+    std::string trace_path;
+    std::string profile_path;
+};
+
+// Plain RAM is resolved through the page table, only the page holding
+// 0x2008-0x200F goes through writeDevice
+template <typename CPUType>
+void writeDevice(CPUType& cpu, Console& console, std::uint16_t addr, std::uint8_t data)
 {
     // Write to '0x2008' and 'A' will be written to stdout as char
     if (addr == 0x2008) {
-        std::cout << cpu->reg_a;
+        console.PutChar(cpu.reg_a);
     }
     // Write A to stdout
     else if (addr == 0x2009) {
-        std::cout << ToHexString(cpu->reg_a) << std::endl;
+        console.PutHex(cpu.reg_a);
     }
     // Write X to stdout
     else if (addr == 0x200A) {
-        std::cout << ToHexString(cpu->reg_x) << std::endl;
+        console.PutHex(cpu.reg_x);
     }
     // Write Y to stdout
     else if (addr == 0x200B) {
-        std::cout << ToHexString(cpu->reg_y) << std::endl;
+        console.PutHex(cpu.reg_y);
     }
     // Write status to stdout
     else if (addr == 0x200C) {
-        std::cout << ToHexString((uint8_t)cpu->reg_status) << std::endl;
+        console.PutHex(cpu.GetStatus());
     }
     // Exit program with exit code from reg A
     else if (addr == 0x200F) {
-        cpu->Halt();
-        // std::cout << "exit: " << (unsigned)cpu->reg_a << std::endl;
+        cpu.Halt();
+        console.Flush();
     }
     else {
-        memory[addr] = data;
+        cpu.GetRAM()[addr] = data;
+    }
+}
+
+template <typename CPUType>
+void execute(const std::string& input, const std::vector<char>& program,
+             const Settings& settings)
+{
+    // Start of Total time is defined as this point, when the actual virtual CPU
+    // is created
+
+    ClockType start = high_resolution_clock::now();
+    ClockType exec_start, stop;
+
+    auto cpu = std::make_shared<CPUType>();
+
+    std::copy(program.begin(), program.end(), &cpu->GetRAM()[0x8000]);
+
+    // Without a stream the program's output is only kept in memory
+    Console console(settings.quiet ? nullptr : &std::cout);
+    CPUType* cpu_ptr = cpu.get();
+    cpu->MapDevice(0x20, 1, nullptr,
+                   [cpu_ptr, &console](std::uint16_t addr, std::uint8_t data) {
+                       writeDevice(*cpu_ptr, console, addr, data);
+                   });
+    cpu->Reset();
+    cpu->SetFusion(settings.fusion);
+
+    std::unique_ptr<TraceRecorder> recorder;
+    std::unique_ptr<Profiler> profiler;
+    auto& trace = cpu->GetTrace();
+    if constexpr (std::is_same_v<std::decay_t<decltype(trace)>, RecordTrace>) {
+        recorder = std::make_unique<TraceRecorder>(settings.trace_path);
+        trace.recorder = recorder.get();
+    }
+    if constexpr (std::is_same_v<std::decay_t<decltype(trace)>, ProfileTrace>) {
+        profiler = std::make_unique<Profiler>();
+        trace.profiler = profiler.get();
+    }
+
+    exec_start = high_resolution_clock::now();
+    if (settings.decoded)
+        cpu->RunDecoded();
+    else
+        cpu->Run();
+    // Programs that run off the end don't halt through 0x200F
+    console.Flush();
+    stop = high_resolution_clock::now();
+
+    if (recorder) {
+        std::uint64_t records = recorder->GetRecordCount();
+        // Waits for the rest of the trace to be written
+        recorder.reset();
+        if (settings.verbose)
+            std::cout << "Trace records: " << records << std::endl;
+    }
+
+    if (profiler) {
+        std::ofstream report(settings.profile_path);
+        profiler->WriteReport(report, [&cpu](std::uint16_t pc) {
+            return cpu->Disassemble(pc, pc)[pc];
+        });
+        std::ofstream stacks(settings.profile_path + ".folded");
+        profiler->WriteCollapsedStacks(stacks);
+    }
+
+    if (settings.verbose) {
+        TimeFormat time_format = settings.time_format;
+        std::cout << "Execution time: "
+                  << GetDuration<ClockType>(time_format, exec_start, stop)
+                  << GetTimeFormatAbbreviation(time_format) << std::endl;
+        std::cout << "Total time: "
+                  << GetDuration<ClockType>(time_format, start, stop)
+                  << GetTimeFormatAbbreviation(time_format) << std::endl;
+        double seconds = duration_cast<duration<double>>(stop - exec_start).count();
+        std::cout << "Instructions: " << cpu->GetInstructionCount() << std::endl;
+        std::cout << "Cycles: " << cpu->GetCycles() << std::endl;
+        std::cout << "MIPS: " << cpu->GetInstructionCount() / seconds / 1e6 << std::endl;
+        if (settings.decoded && settings.fusion) {
+            std::cout << "Fused sequences:" << std::endl;
+            for (unsigned int i = 0; i < FUSION_COUNT; i++) {
+                Fusion fusion = static_cast<Fusion>(i);
+                if (cpu->GetFusionCount(fusion))
+                    std::cout << "  " << GetFusionInfo(fusion).name << ": "
+                              << cpu->GetFusionCount(fusion) << std::endl;
+            }
+        }
+    }
+
+    if (settings.save) {
+        std::string out = settings.save_path;
+        std::stringstream ss;
+        ss << input << ".mem";
+        if (out.empty())
+            out = ss.str();
+        auto fstream = std::fstream(out, std::ios::out | std::ios::binary);
+        fstream.write((char*)cpu->GetRAM(), Memory::PAGE_COUNT * Memory::PAGE_SIZE);
+        fstream.close();
     }
 }
 
@@ -61,7 +167,18 @@ try {
         "v,verbose", "Enable verbose output", cxxopts::value<bool>())(
         "h,help", "Print usage")("t,time", "Set time format (ms/us/s)",
                                  cxxopts::value<std::string>())(
-        "s,save", "Save memory to disk", cxxopts::value<std::string>());
+        "s,save", "Save memory to disk", cxxopts::value<std::string>())(
+        "d,decoded", "Run pre-decoded instructions (RunDecoded)", cxxopts::value<bool>())(
+        "l,lazy", "Compute the flags lazily (LazyFlags)", cxxopts::value<bool>())(
+        "n,no-fusion", "Don't fuse instruction sequences in decoded mode",
+        cxxopts::value<bool>())(
+        "r,record", "Record a trace of every instruction to a file (see the trace tool)",
+        cxxopts::value<std::string>())(
+        "p,profile",
+        "Write a profile to a file, and the call stacks for flamegraph.pl to <file>.folded",
+        cxxopts::value<std::string>())(
+        "q,quiet", "Keep the program's output in memory instead of printing it",
+        cxxopts::value<bool>());
 
     options.parse_positional({"positional"});
     auto result = options.parse(argc, argv);
@@ -71,23 +188,33 @@ try {
         exit(0);
     }
 
-    bool verbose = false;
-    bool save = false;
-    TimeFormat time_format = TimeFormat::Micro;
+    Settings settings;
 
     if (result.count("verbose"))
-        verbose = true;
-    if (result.count("save"))
-        save = true;
+        settings.verbose = true;
+    if (result.count("save")) {
+        settings.save = true;
+        settings.save_path = result["save"].as<std::string>();
+    }
+    if (result.count("decoded"))
+        settings.decoded = true;
+    if (result.count("no-fusion"))
+        settings.fusion = false;
+    if (result.count("quiet"))
+        settings.quiet = true;
+    if (result.count("record"))
+        settings.trace_path = result["record"].as<std::string>();
+    if (result.count("profile"))
+        settings.profile_path = result["profile"].as<std::string>();
 
     if (result.count("time")) {
         auto t_format = result["time"].as<std::string>();
         if (t_format == "ms")
-            time_format = TimeFormat::Milli;
+            settings.time_format = TimeFormat::Milli;
         else if (t_format == "us")
-            time_format = TimeFormat::Micro;
+            settings.time_format = TimeFormat::Micro;
         else if (t_format == "s")
-            time_format = TimeFormat::Seconds;
+            settings.time_format = TimeFormat::Seconds;
     }
 
     auto input = result["positional"].as<std::string>();
@@ -101,43 +228,14 @@ try {
     auto program = std::vector<char>{std::istreambuf_iterator<char>(in),
                                      std::istreambuf_iterator<char>()};
 
-    // Start of Total time is defined as this point, when the actual virtual CPU
-    // is created
-
-    ClockType start = high_resolution_clock::now();
-    ClockType exec_start, stop;
-
-    cpu = std::make_shared<CPU>();
-
-    std::copy(program.begin(), program.end(), &memory[0x8000]);
-
-    cpu->Read = readMemory;
-    cpu->Write = writeMemory;
-    cpu->Reset();
-
-    exec_start = high_resolution_clock::now();
-    cpu->Run();
-    stop = high_resolution_clock::now();
-
-    if (verbose) {
-        std::cout << "Execution time: "
-                  << GetDuration<ClockType>(time_format, exec_start, stop)
-                  << GetTimeFormatAbbreviation(time_format) << std::endl;
-        std::cout << "Total time: "
-                  << GetDuration<ClockType>(time_format, start, stop)
-                  << GetTimeFormatAbbreviation(time_format) << std::endl;
-    }
-
-    if (save) {
-        std::string out = result["save"].as<std::string>();
-        std::stringstream ss;
-        ss << input << ".mem";
-        if (out.empty())
-            out = ss.str();
-        auto fstream = std::fstream(out, std::ios::out | std::ios::binary);
-        fstream.write((char*)memory.data(), memory.size());
-        fstream.close();
-    }
+    if (!settings.profile_path.empty())
+        execute<BasicCPU<Memory, EagerFlags, ProfileTrace>>(input, program, settings);
+    else if (!settings.trace_path.empty())
+        execute<BasicCPU<Memory, EagerFlags, RecordTrace>>(input, program, settings);
+    else if (result.count("lazy"))
+        execute<BasicCPU<Memory, LazyFlags>>(input, program, settings);
+    else
+        execute<BasicCPU<Memory>>(input, program, settings);
 
     return 0;
 }
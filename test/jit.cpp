@@ -4,11 +4,22 @@
 #include "cxxopts.hpp"
 #include "llvmes/dynarec/compiler.h"
 #include "llvmes/dynarec/parser.h"
+#include "llvmes/dynarec/tiered.h"
 #include "llvmes/time.h"
 
 using namespace llvmes::dynarec;
 using namespace std::chrono;
 
+static void saveMemory(std::string out, const std::string& input, const uint8_t* data,
+                       size_t size)
+{
+    if (out.empty())
+        out = input + ".mem";
+    auto fstream = std::fstream(out, std::ios::out | std::ios::binary);
+    fstream.write((const char*)data, size);
+    fstream.close();
+}
+
 int main(int argc, char** argv)
 try {
     cxxopts::Options options("JIT Compiler", "Run a bin file using the jit compiler");
@@ -16,9 +27,27 @@ try {
     options.add_options()("f,positional", "File", cxxopts::value<std::string>())(
         "v,verbose", "Enable verbose output", cxxopts::value<bool>())(
         "i,ir", "Write IR to file", cxxopts::value<bool>())(
-        "O,optimize", "Optimize", cxxopts::value<bool>())("h,help", "Print usage")(
+        "O,optimize", "Optimize, same as --opt-level 2", cxxopts::value<bool>())(
+        "opt-level", "IR passes: 0, fast (registers out of memory), 1, 2 or 3",
+        cxxopts::value<std::string>())(
+        "codegen-level", "Optimization level of the code generator: 0 to 3 (default 2)",
+        cxxopts::value<std::string>())(
+        "T,tiered", "Start on the interpreter and switch to compiled code once hot",
+        cxxopts::value<bool>())(
+        "hot", "Instructions interpreted before compiling in tiered mode",
+        cxxopts::value<uint64_t>())("h,help", "Print usage")(
         "t,time", "Set time format (ms/us/s)", cxxopts::value<std::string>())(
-        "s,save", "Save memory to disk", cxxopts::value<std::string>());
+        "s,save", "Save memory to disk", cxxopts::value<std::string>())(
+        "q,quiet", "Keep the program's output in memory instead of printing it",
+        cxxopts::value<bool>())(
+        "C,cache", "Keep compiled programs in this directory and reuse them",
+        cxxopts::value<std::string>())(
+        "cache-size", "Size limit of the cache in MB (default 64)",
+        cxxopts::value<uint64_t>())(
+        "L,lazy", "Compile subroutines when they're first called",
+        cxxopts::value<bool>())(
+        "keep-flags", "Store every flag, also the ones nothing reads",
+        cxxopts::value<bool>());
 
     options.parse_positional({"positional"});
     auto result = options.parse(argc, argv);
@@ -29,8 +58,10 @@ try {
     }
 
     TimeFormat time_format = TimeFormat::Micro;
-    bool verbose, optimize, save, write_ir;
-    verbose = optimize = save = write_ir = false;
+    bool verbose, save, write_ir;
+    verbose = save = write_ir = false;
+    JITTIR::OptimizationLevel level = JITTIR::OptimizationLevel::None;
+    llvm::CodeGenOpt::Level codegen_level = llvm::CodeGenOpt::Default;
 
     if (result.count("time")) {
         auto t_format = result["time"].as<std::string>();
@@ -48,7 +79,13 @@ try {
         verbose = true;
 
     if (result.count("optimize"))
-        optimize = true;
+        level = JITTIR::OptimizationLevel::O2;
+
+    if (result.count("opt-level"))
+        level = ParseOptimizationLevel(result["opt-level"].as<std::string>());
+
+    if (result.count("codegen-level"))
+        codegen_level = ParseCodeGenOptLevel(result["codegen-level"].as<std::string>());
 
     if (result.count("save"))
         save = true;
@@ -66,6 +103,35 @@ try {
 
     // Same as interpreter, this chunk above doesn't count
 
+    if (result.count("tiered")) {
+        ClockType start = high_resolution_clock::now();
+        TieredEngine engine(in_file, input);
+        if (result.count("optimize") || result.count("opt-level"))
+            engine.SetOptimizationLevel(level);
+        if (result.count("hot"))
+            engine.SetHotThreshold(result["hot"].as<uint64_t>());
+        if (result.count("quiet"))
+            engine.SetOutput(nullptr);
+        int exit_code = engine.Run();
+        ClockType stop = high_resolution_clock::now();
+
+        if (verbose) {
+            std::cout << "Total time: "
+                      << GetDuration<ClockType>(time_format, start, stop)
+                      << GetTimeFormatAbbreviation(time_format) << std::endl;
+            std::cout << "Interpreted instructions: "
+                      << engine.GetInterpretedInstructions() << std::endl;
+            std::cout << "Background compile time: " << engine.GetCompileMilliseconds()
+                      << "ms" << std::endl;
+            std::cout << "Ran natively: " << (engine.RanNatively() ? "yes" : "no")
+                      << std::endl;
+        }
+        if (save)
+            saveMemory(result["save"].as<std::string>(), input, engine.GetMemory(),
+                       0x10000);
+        return exit_code;
+    }
+
     ClockType start = high_resolution_clock::now();
     ClockType stop, exec_start, parse_start, parse_stop, compile_start, compile_stop;
 
@@ -86,12 +152,29 @@ try {
         return 1;
     }
 
+    std::unique_ptr<ObjectCache> cache;
+    if (result.count("cache")) {
+        uint64_t max_size = ObjectCache::DEFAULT_MAX_SIZE;
+        if (result.count("cache-size"))
+            max_size = result["cache-size"].as<uint64_t>() * 1024 * 1024;
+        cache =
+            std::make_unique<ObjectCache>(result["cache"].as<std::string>(), max_size);
+    }
+
     auto c = std::make_unique<Compiler>(parse_result, input);
+    if (cache)
+        c->SetObjectCache(cache.get());
+    if (result.count("lazy"))
+        c->SetLazy(true);
+    if (result.count("keep-flags"))
+        c->SetFlagElimination(false);
     if (write_ir)
         c->SetDumpDir(".");
+    if (result.count("quiet"))
+        c->GetConsole().SetOutput(nullptr);
 
     compile_start = high_resolution_clock::now();
-    auto main = c->Compile(optimize);
+    auto main = c->Compile(level, codegen_level);
     compile_stop = high_resolution_clock::now();
 
     exec_start = high_resolution_clock::now();
@@ -110,18 +193,24 @@ try {
                   << GetTimeFormatAbbreviation(time_format) << std::endl;
         std::cout << "Total time: " << GetDuration<ClockType>(time_format, start, stop)
                   << GetTimeFormatAbbreviation(time_format) << std::endl;
+        if (cache)
+            std::cout << "Object cache: " << (c->IsCacheHit() ? "hit" : "miss")
+                      << std::endl;
+        if (result.count("lazy"))
+            std::cout << "Subroutines compiled: " << c->GetCompiledSubroutineCount()
+                      << " of " << c->GetSubroutineCount() << std::endl;
+        std::cout << "Targets compiled at runtime: " << c->GetRuntimeTargetCount()
+                  << std::endl;
+        std::cout << "Writes to compiled code: " << c->GetCodeModificationCount()
+                  << std::endl;
+        std::cout << "Dead flag stores removed: " << c->GetDeadFlagStoreCount() << " of "
+                  << c->GetFlagStoreCount() << std::endl;
     }
 
     if (save) {
-        std::string out = result["save"].as<std::string>();
-        std::stringstream ss;
-        ss << input << ".mem";
-        if (out.empty())
-            out = ss.str();
-        auto ram_ref = c->GetMemory();
-        auto fstream = std::fstream(out, std::ios::out | std::ios::binary);
-        fstream.write((char*)ram_ref.data(), ram_ref.size());
-        fstream.close();
+        auto& ram_ref = c->GetMemory();
+        saveMemory(result["save"].as<std::string>(), input, ram_ref.data(),
+                   ram_ref.size());
     }
 
     return exit_code;
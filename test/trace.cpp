@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <cctype>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include "cxxopts.hpp"
+#include "llvmes/common.h"
+#include "llvmes/interpreter/instruction.h"
+#include "llvmes/interpreter/trace.h"
+
+using namespace llvmes;
+
+struct Range {
+    std::uint16_t first = 0x0000;
+    std::uint16_t last = 0xFFFF;
+
+    bool Contains(std::uint16_t value) const { return value >= first && value <= last; }
+};
+
+// Takes "first,last" in hex, like memview
+static Range parseRange(const std::vector<std::string>& values)
+{
+    if (values.size() != 2)
+        throw std::runtime_error("Range takes two values!");
+    Range range;
+    range.first = std::stoi(values[0], 0, 16);
+    range.last = std::stoi(values[1], 0, 16);
+    return range;
+}
+
+static void printRecord(std::uint64_t index, const TraceRecord& record)
+{
+    const InstructionInfo& info = GetInstructionInfo(record.opcode);
+    std::cout << std::setw(10) << index << "  " << ToHexString(record.pc) << "  "
+              << ToHexString(record.opcode) << " " << std::left << std::setw(3)
+              << info.name << std::right;
+
+    bool has_address =
+        info.mode != AddressMode::Implied && info.mode != AddressMode::Accumulator;
+    if (has_address)
+        std::cout << "  " << ToHexString(record.address);
+    else
+        std::cout << "       ";
+
+    std::cout << "  A:" << ToHexString(record.reg_a) << " X:" << ToHexString(record.reg_x)
+              << " Y:" << ToHexString(record.reg_y) << " SP:" << ToHexString(record.reg_sp)
+              << " P:" << ToHexString(record.status) << std::endl;
+}
+
+int main(int argc, char** argv)
+try {
+    cxxopts::Options options("Trace", "Print and filter a trace recorded by the interpreter");
+
+    options.add_options()("f,positional", "File", cxxopts::value<std::string>())(
+        "h,help", "Print usage")(
+        "p,pc", "Only instructions within a PC range, e.g. -p 8000,80FF",
+        cxxopts::value<std::vector<std::string>>())(
+        "a,address", "Only instructions whose address is within a range",
+        cxxopts::value<std::vector<std::string>>())(
+        "m,mnemonic", "Only instructions with these mnemonics, e.g. -m STA,STX",
+        cxxopts::value<std::vector<std::string>>())(
+        "s,skip", "Skip this many matching records", cxxopts::value<std::uint64_t>())(
+        "c,count", "Print at most this many records", cxxopts::value<std::uint64_t>())(
+        "t,stats", "Print how often every instruction was executed instead",
+        cxxopts::value<bool>());
+
+    options.parse_positional({"positional"});
+    auto result = options.parse(argc, argv);
+
+    if (result.count("help") || !result.count("positional")) {
+        std::cout << options.help() << std::endl;
+        exit(0);
+    }
+
+    Range pc_range, address_range;
+    if (result.count("pc"))
+        pc_range = parseRange(result["pc"].as<std::vector<std::string>>());
+    bool filter_address = result.count("address");
+    if (filter_address)
+        address_range = parseRange(result["address"].as<std::vector<std::string>>());
+    std::vector<std::string> mnemonics;
+    if (result.count("mnemonic"))
+        mnemonics = result["mnemonic"].as<std::vector<std::string>>();
+    for (auto& mnemonic : mnemonics)
+        std::transform(mnemonic.begin(), mnemonic.end(), mnemonic.begin(), ::toupper);
+    std::uint64_t skip = result.count("skip") ? result["skip"].as<std::uint64_t>() : 0;
+    std::uint64_t count =
+        result.count("count") ? result["count"].as<std::uint64_t>() : UINT64_MAX;
+    bool stats = result.count("stats");
+
+    auto matches = [&](const TraceRecord& record) {
+        if (!pc_range.Contains(record.pc))
+            return false;
+        const InstructionInfo& info = GetInstructionInfo(record.opcode);
+        if (filter_address &&
+            (info.mode == AddressMode::Implied || info.mode == AddressMode::Accumulator ||
+             !address_range.Contains(record.address)))
+            return false;
+        if (mnemonics.empty())
+            return true;
+        for (const auto& mnemonic : mnemonics) {
+            if (mnemonic == info.name)
+                return true;
+        }
+        return false;
+    };
+
+    TraceReader reader(result["positional"].as<std::string>());
+    TraceRecord record;
+    std::uint64_t index = 0, matched = 0, printed = 0;
+    std::map<std::string, std::uint64_t> executed;
+
+    for (; reader.Next(record) && printed < count; index++) {
+        if (!matches(record) || matched++ < skip)
+            continue;
+        if (stats)
+            executed[GetInstructionInfo(record.opcode).name]++;
+        else
+            printRecord(index, record);
+        printed++;
+    }
+
+    if (stats) {
+        for (const auto& it : executed)
+            std::cout << it.first << ": " << it.second << std::endl;
+        std::cout << "Total: " << printed << std::endl;
+    }
+
+    return 0;
+}
+catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+}